@@ -265,7 +265,7 @@ public:
   std::string m_id;                     // Node Type|ID of this node.
   std::string m_addrNode, m_addrWebSock;
   NetworkServer *m_pServer, *m_pWebSockServer;
-  ObjectPool<implBigworldChildNode, SW2_BIGWORLD_MAX_CHILD_NODE> m_poolChild;
+  LazyObjectPool<implBigworldChildNode, SW2_BIGWORLD_MAX_CHILD_NODE> m_poolChild; // Construct node on connect.
   ObjectPool<implBigworldParentNode, SW2_BIGWORLD_MAX_DEPEX_NODE> m_poolDepex;
 
   explicit implBigworldNode(BigworldCallback *pCallback) : m_pCallback(pCallback), m_pServer(0), m_pWebSockServer(0)
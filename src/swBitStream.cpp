@@ -9,6 +9,8 @@
 //
 
 #include <limits.h>
+#include <math.h>
+#include <string.h>
 
 #include <algorithm>
 
@@ -20,13 +22,63 @@ namespace sw2 {
 namespace impl {
 
 const int DEF_BITS = CHAR_BIT * sizeof(int);
+const int DEF_BITS64 = CHAR_BIT * sizeof(uint64);
+const int MAX_VARINT_BYTES = 10;        // Max bytes of a 64-bit varint.
 const int MAX_STRING_BITS = 20;
+const int MAX_WORD_BITS = 56;           // Max bits of a word read/write, leave room for bit offset.
+const float QUAT_RANGE = 0.70710678f;   // Range of smallest three components, 1/sqrt(2).
 
 //
-// Internal use.
+// Internal use. The stream is little endian in bits, bit n is stored at bit
+// (n % 8) of byte (n / 8), so a word is loaded and stored as little endian
+// integer and accessed with shifts.
 //
 
-static const uchar c_bitMask[] = {0, 1, 3, 7, 0xf, 0x1f, 0x3f, 0x7f, 0xff};
+inline uint64 getBitMask(int bitCount)
+{
+  return ((uint64)1 << bitCount) - 1;
+}
+
+inline uint64 loadWord(uchar const* p, int n)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (8 == n) {                         // Unaligned fast path.
+    uint64 v;
+    ::memcpy(&v, p, 8);
+    return v;
+  }
+#endif
+  uint64 v = 0;
+  for (int i = 0; i < n; i++) {
+    v |= (uint64)p[i] << (CHAR_BIT * i);
+  }
+  return v;
+}
+
+inline void storeWord(uchar* p, uint64 v, int n)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (8 == n) {                         // Unaligned fast path.
+    ::memcpy(p, &v, 8);
+    return;
+  }
+#endif
+  for (int i = 0; i < n; i++) {
+    p[i] = (uchar)(v >> (CHAR_BIT * i));
+  }
+}
+
+//
+// Replace bits [bitPtr, bitPtr + bitCount) of p with v, at most 8 bytes of p
+// are accessed and avail bytes are accessible.
+//
+
+inline void mergeWord(uchar* p, int avail, int bitPtr, uint64 v, int bitCount)
+{
+  int n = std::min(avail, 8);
+  uint64 m = getBitMask(bitCount) << bitPtr;
+  storeWord(p, (loadWord(p, n) & ~m) | ((v << bitPtr) & m), n);
+}
 
 } // namespace impl
 
@@ -58,7 +110,12 @@ BitStream::BitStream(char* buff, int szBuff) :
   m_bitPtr(0),
   m_bytePtr(0),
   m_bitCount(DEF_BITS),
-  m_bGood(true)
+  m_bitCount64(DEF_BITS64),
+  m_bVarint(false),
+  m_varintMax((uint64)-1),
+  m_quant(0, 0, 0),
+  m_bGood(true),
+  m_bAlignBlob(false)
 {
 }
 
@@ -69,7 +126,12 @@ BitStream::BitStream(std::string &s) :
   m_bitPtr(0),
   m_bytePtr(0),
   m_bitCount(DEF_BITS),
-  m_bGood(true)
+  m_bitCount64(DEF_BITS64),
+  m_bVarint(false),
+  m_varintMax((uint64)-1),
+  m_quant(0, 0, 0),
+  m_bGood(true),
+  m_bAlignBlob(false)
 {
 }
 
@@ -80,12 +142,83 @@ BitStream::BitStream(std::string &s) :
 BitStream& BitStream::operator<<(setBitCount const& bc)
 {
   m_bitCount = std::min(bc.bitCount, DEF_BITS);
+  m_bitCount64 = std::min(bc.bitCount, DEF_BITS64);
   return *this;
 }
 
 BitStream& BitStream::operator>>(setBitCount const& bc)
 {
   m_bitCount = std::min(bc.bitCount, DEF_BITS);
+  m_bitCount64 = std::min(bc.bitCount, DEF_BITS64);
+  return *this;
+}
+
+void BitStream::resetBitCount()
+{
+  m_bitCount = DEF_BITS;
+  m_bitCount64 = DEF_BITS64;
+  m_bVarint = false;
+  m_varintMax = (uint64)-1;
+  m_quant.bitCount = 0;
+}
+
+//
+// Varint manipulator.
+//
+
+BitStream& BitStream::operator<<(setVarint const&)
+{
+  m_bVarint = true;
+  return *this;
+}
+
+BitStream& BitStream::operator>>(setVarint const& vi)
+{
+  m_bVarint = true;
+  m_varintMax = vi.maxValue;
+  return *this;
+}
+
+//
+// Quantize manipulator.
+//
+
+BitStream& BitStream::operator<<(setQuantize const& q)
+{
+  m_quant = q;
+  m_quant.bitCount = std::min(q.bitCount, DEF_BITS);
+  return *this;
+}
+
+BitStream& BitStream::operator>>(setQuantize const& q)
+{
+  m_quant = q;
+  m_quant.bitCount = std::min(q.bitCount, DEF_BITS);
+  return *this;
+}
+
+//
+// Align manipulator.
+//
+
+BitStream& BitStream::operator<<(alignByte const&)
+{
+  if (0 != m_bitPtr) {
+    writeBits(0, CHAR_BIT - m_bitPtr);
+  } else {
+    m_bGood = true;
+  }
+  return *this;
+}
+
+BitStream& BitStream::operator>>(alignByte const&)
+{
+  if (0 != m_bitPtr) {
+    uint64 v;
+    readBits(v, CHAR_BIT - m_bitPtr);
+  } else {
+    m_bGood = true;
+  }
   return *this;
 }
 
@@ -107,59 +240,157 @@ void BitStream::setPtr(int bytePtr, int bitPtr)
 
 BitStream& BitStream::operator<<(bool b)
 {
-  uchar sign = b ? 1 : 0;
-  write(&sign, 1);
+  writeBits(b ? 1 : 0, 1);
 
-  m_bitCount = DEF_BITS;
+  resetBitCount();
 
   return *this;
 }
 
 BitStream& BitStream::operator<<(int i)
 {
-  uchar sign = 0 >= i ? 1 : 0;
+  if (m_bVarint) {
+    writeVarint(encodeZigzag(i));
+    resetBitCount();
+    return *this;
+  }
+
+  uint sign = 0 >= i ? 1 : 0;
   uint ui = 0 <= i ? i : -i;
 
   int by = m_bytePtr, bi = m_bitPtr;
 
   m_bitCount -= 1;
   if (operator<<(ui)) {
-    write(&sign, 1);
+    writeBits(sign, 1);
   }
 
   if (fail()) {
     setPtr(by, bi);
   }
 
-  m_bitCount = DEF_BITS;
+  resetBitCount();
 
   return *this;
 }
 
 BitStream& BitStream::operator<<(uint u)
 {
-  uchar b[4];
-  b[0] = (uchar)(u & 0xff);
-  b[1] = (uchar)((u >> 8) & 0xff);
-  b[2] = (uchar)((u >> 16) & 0xff);
-  b[3] = (uchar)((u >> 24) & 0xff);
+  if (m_bVarint) {
+    writeVarint(u);
+  } else {
+    writeBits(u, m_bitCount);
+  }
 
-  write(b, m_bitCount);
+  resetBitCount();
 
-  m_bitCount = DEF_BITS;
+  return *this;
+}
+
+BitStream& BitStream::operator<<(int64 i)
+{
+  if (m_bVarint) {
+    writeVarint(encodeZigzag(i));
+    resetBitCount();
+    return *this;
+  }
+
+  uint sign = 0 >= i ? 1 : 0;
+  uint64 ui = 0 <= i ? (uint64)i : 0 - (uint64)i;
+
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  m_bitCount64 -= 1;
+  if (operator<<(ui)) {
+    writeBits(sign, 1);
+  }
+
+  if (fail()) {
+    setPtr(by, bi);
+  }
+
+  resetBitCount();
+
+  return *this;
+}
+
+BitStream& BitStream::operator<<(uint64 u)
+{
+  if (m_bVarint) {
+    writeVarint(u);
+  } else if (prepareWrite(m_bitCount64)) {
+    int lo = std::min(m_bitCount64, DEF_BITS);
+    writeBits(u & 0xffffffff, lo);
+    writeBits(u >> DEF_BITS, m_bitCount64 - lo);
+  }
+
+  resetBitCount();
 
   return *this;
 }
 
 BitStream& BitStream::operator<<(float f)
 {
-  return operator<<(*(uint*)((void*)&f));
+  if (0 >= m_quant.bitCount) {
+    return operator<<(*(uint*)((void*)&f));
+  }
+
+  writeFloat(f, &m_quant);
+
+  resetBitCount();
+
+  return *this;
+}
+
+BitStream& BitStream::operator<<(double d)
+{
+  uint64 u;
+  ::memcpy(&u, &d, sizeof(u));
+  return operator<<(u);
+}
+
+BitStream& BitStream::operator<<(FloatPoint const& pt)
+{
+  setQuantize const* q = 0 < m_quant.bitCount ? &m_quant : 0;
+
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  if (writeFloat(pt.x, q)) {
+    writeFloat(pt.y, q);
+  }
+
+  if (fail()) {
+    setPtr(by, bi);
+  }
+
+  resetBitCount();
+
+  return *this;
+}
+
+BitStream& BitStream::operator<<(FloatPoint3 const& pt)
+{
+  setQuantize const* q = 0 < m_quant.bitCount ? &m_quant : 0;
+
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  if (writeFloat(pt.x, q) && writeFloat(pt.y, q)) {
+    writeFloat(pt.z, q);
+  }
+
+  if (fail()) {
+    setPtr(by, bi);
+  }
+
+  resetBitCount();
+
+  return *this;
 }
 
 BitStream& BitStream::operator<<(std::string const& s)
 {
   uint x;
-  if (MAX_STRING_BITS <= m_bitCount) {
+  if (MAX_STRING_BITS <= m_bitCount || m_bVarint) {
     x = (1 << MAX_STRING_BITS) - 1;
   } else {
     x = (1 << m_bitCount) - 1;
@@ -170,14 +401,14 @@ BitStream& BitStream::operator<<(std::string const& s)
   int by = m_bytePtr, bi = m_bitPtr;
 
   if (operator<<(len)) {
-    write(s.data(), CHAR_BIT * len);
+    writeBlob(s.data(), len);
   }
 
   if (fail()) {
     setPtr(by, bi);
   }
 
-  m_bitCount = DEF_BITS;
+  resetBitCount();
 
   return *this;
 }
@@ -188,52 +419,56 @@ bool BitStream::write(void const* pStream, int bitCount)
     return m_bGood = true;
   }
 
-  if (m_sbuff) {
-    while (isOutOfRange(bitCount)) {
-      m_sbuff->resize(2 * (1 + m_sbuff->length()), 0);
-    }
-  } else {
-    if (isOutOfRange(bitCount)) {
-      return m_bGood = false;
-    }
+  if (!prepareWrite(bitCount)) {
+    return false;
   }
 
-  uchar* d = (uchar*)(m_sbuff ? m_sbuff->data() : m_buff) + m_bytePtr; // Destination buffer.
+  if (0 >= bitCount) {
+    return m_bGood = true;
+  }
+
+  uchar* d = getBuff() + m_bytePtr;     // Destination buffer.
   uchar const* s = (uchar const*)pStream; // Source buffer.
-  int sbitptr = 0;                      // Pointer of source buffer.
 
-  while (0 < bitCount) {
+  if (0 == m_bitPtr) {
 
     //
-    // Calculate BIT count to write.
+    // Byte aligned, copy whole bytes and merge the last partial byte.
     //
 
-    int nb = calcBitsCount(bitCount, sbitptr);
+    int n = bitCount / CHAR_BIT;
+    ::memcpy(d, s, n);
+    m_bytePtr += n;
+    if (0 < (bitCount %= CHAR_BIT)) {
+      mergeWord(d + n, 1, 0, s[n], bitCount);
+      m_bitPtr = bitCount;
+    }
 
-    uchar n = *s;
+    return m_bGood = true;
+  }
 
-    //
-    // Write bits.
-    //
+  //
+  // Unaligned, write a word at a time.
+  //
+
+  int avail = getBuffSize() - m_bytePtr; // Accessible bytes of destination.
+
+  while (0 < bitCount) {
 
-    uchar mb = c_bitMask[nb];
-    *d &= ~(mb << m_bitPtr);
-    *d |= (((n >> sbitptr) & mb) << m_bitPtr);
+    int nb = std::min(bitCount, MAX_WORD_BITS);
+    uint64 v = loadWord(s, std::min((bitCount + CHAR_BIT - 1) / CHAR_BIT, 8));
+    mergeWord(d, avail, m_bitPtr, v, nb);
 
     //
-    // Update pointers.
+    // Update pointers, nb is a multiple of 8 except the last word.
     //
 
-    if (CHAR_BIT <= (m_bitPtr += nb)) {
-      d += 1;
-      m_bytePtr += 1;
-      m_bitPtr &= (CHAR_BIT - 1);
-    }
-
-    if (CHAR_BIT <= (sbitptr += nb)) {
-      s += 1;
-      sbitptr &= (CHAR_BIT - 1);
-    }
+    int bits = m_bitPtr + nb;
+    d += bits / CHAR_BIT;
+    avail -= bits / CHAR_BIT;
+    m_bytePtr += bits / CHAR_BIT;
+    m_bitPtr = bits % CHAR_BIT;
+    s += nb / CHAR_BIT;
 
     bitCount -= nb;
   }
@@ -241,32 +476,57 @@ bool BitStream::write(void const* pStream, int bitCount)
   return m_bGood = true;
 }
 
+bool BitStream::writeBits(uint64 v, int bitCount)
+{
+  if (!prepareWrite(bitCount)) {
+    return false;
+  }
+
+  if (0 < bitCount) {
+    mergeWord(getBuff() + m_bytePtr, getBuffSize() - m_bytePtr, m_bitPtr, v, bitCount);
+    int bits = m_bitPtr + bitCount;
+    m_bytePtr += bits / CHAR_BIT;
+    m_bitPtr = bits % CHAR_BIT;
+  }
+
+  return m_bGood = true;
+}
+
 //
 // Read.
 //
 
 BitStream& BitStream::operator>>(bool& b)
 {
-  uchar sign = 0;
-  if (read(&sign, 1)) {
+  uint64 sign;
+  if (readBits(sign, 1)) {
     b = 1 == sign;
   }
 
-  m_bitCount = DEF_BITS;
+  resetBitCount();
 
   return *this;
 }
 
 BitStream& BitStream::operator>>(int& i)
 {
-  uchar sign = 0;
+  if (m_bVarint) {
+    uint64 v;
+    if (readVarint(v, 0xffffffff)) {
+      i = (int)decodeZigzag(v);
+    }
+    resetBitCount();
+    return *this;
+  }
+
+  uint64 sign = 0;
   uint ui = 0;
 
   int by = m_bytePtr, bi = m_bitPtr;
 
   m_bitCount -= 1;
   if (operator>>(ui)) {
-    read(&sign, 1);
+    readBits(sign, 1);
   }
 
   if (fail()) {
@@ -275,28 +535,83 @@ BitStream& BitStream::operator>>(int& i)
     i = sign ? -(int)ui : ui;
   }
 
-  m_bitCount = DEF_BITS;
+  resetBitCount();
 
   return *this;
 }
 
 BitStream& BitStream::operator>>(uint& u)
 {
-  uchar b[4] = {0};
-  if (read(b, m_bitCount)) {
-    u = (((int)b[0] & 0xff) |
-        (((int)b[1] & 0xff) << 8) |
-        (((int)b[2] & 0xff) << 16) |
-        (((int)b[3] & 0xff) << 24));
+  uint64 v;
+  if (m_bVarint ? readVarint(v, 0xffffffff) : readBits(v, m_bitCount)) {
+    u = (uint)v;
   }
 
-  m_bitCount = DEF_BITS;
+  resetBitCount();
+
+  return *this;
+}
+
+BitStream& BitStream::operator>>(int64& i)
+{
+  if (m_bVarint) {
+    uint64 v;
+    if (readVarint(v, (uint64)-1)) {
+      i = decodeZigzag(v);
+    }
+    resetBitCount();
+    return *this;
+  }
+
+  uint64 sign = 0;
+  uint64 ui = 0;
+
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  m_bitCount64 -= 1;
+  if (operator>>(ui)) {
+    readBits(sign, 1);
+  }
+
+  if (fail()) {
+    setPtr(by, bi);
+  } else {
+    i = sign ? (int64)(0 - ui) : (int64)ui;
+  }
+
+  resetBitCount();
+
+  return *this;
+}
+
+BitStream& BitStream::operator>>(uint64& u)
+{
+  if (m_bVarint) {
+    readVarint(u, (uint64)-1);
+  } else if (isOutOfRange(m_bitCount64)) {
+    SW2_TRACE_ERROR("Read out of range.");
+    m_bGood = false;
+  } else {
+    int lo = std::min(m_bitCount64, DEF_BITS);
+    uint64 vlo, vhi;
+    readBits(vlo, lo);
+    readBits(vhi, m_bitCount64 - lo);
+    u = vlo | (vhi << DEF_BITS);
+  }
+
+  resetBitCount();
 
   return *this;
 }
 
 BitStream& BitStream::operator>>(float& f)
 {
+  if (0 < m_quant.bitCount) {
+    readFloat(f, &m_quant);
+    resetBitCount();
+    return *this;
+  }
+
   uint u = 0;
   if (operator>>(u)) {
     f = *(float*)((void*)&u);
@@ -305,6 +620,42 @@ BitStream& BitStream::operator>>(float& f)
   return *this;
 }
 
+BitStream& BitStream::operator>>(FloatPoint& pt)
+{
+  setQuantize const* q = 0 < m_quant.bitCount ? &m_quant : 0;
+
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  FloatPoint p;
+  if (readFloat(p.x, q) && readFloat(p.y, q)) {
+    pt = p;
+  } else {
+    setPtr(by, bi);
+  }
+
+  resetBitCount();
+
+  return *this;
+}
+
+BitStream& BitStream::operator>>(FloatPoint3& pt)
+{
+  setQuantize const* q = 0 < m_quant.bitCount ? &m_quant : 0;
+
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  FloatPoint3 p;
+  if (readFloat(p.x, q) && readFloat(p.y, q) && readFloat(p.z, q)) {
+    pt = p;
+  } else {
+    setPtr(by, bi);
+  }
+
+  resetBitCount();
+
+  return *this;
+}
+
 BitStream& BitStream::operator>>(std::string& s)
 {
   s.clear();
@@ -313,21 +664,27 @@ BitStream& BitStream::operator>>(std::string& s)
 
   int by = m_bytePtr, bi = m_bitPtr;    // Save pointers.
   if (operator>>(len)) {
-    char buf[512];
-    while (0 != len) {
-      uint l = std::min(len, (uint)sizeof(buf));
-      read(buf, CHAR_BIT * l);
-      if (fail()) {
-        setPtr(by, bi);
-        m_bitCount = DEF_BITS;
-        return *this;
-      }
-      s.append(buf, l);
-      len -= l;
+    if (m_bAlignBlob) {
+      operator>>(alignByte());
+    }
+    if (fail()) {
+      ;
+    } else if (isOutOfRangeBytes(len)) { // Length from stream, check before multiply.
+      SW2_TRACE_ERROR("Read out of range.");
+      m_bGood = false;
+    } else if (0 == m_bitPtr) {         // Aligned, copy from stream buffer directly.
+      s.assign((char const*)getBuff() + m_bytePtr, len);
+      m_bytePtr += len;
+    } else {
+      s.resize(len);
+      read(&s[0], CHAR_BIT * len);
+    }
+    if (fail()) {
+      setPtr(by, bi);
     }
   }
 
-  m_bitCount = DEF_BITS;
+  resetBitCount();
 
   return *this;
 }
@@ -343,49 +700,308 @@ bool BitStream::read(void* pStream, int bitCount)
     return m_bGood = false;
   }
 
-  uchar const* s = (uchar const*)(m_sbuff ? m_sbuff->data() : m_buff) + m_bytePtr; // Source buffer.
+  if (0 >= bitCount) {
+    return m_bGood = true;
+  }
+
+  uchar const* s = getBuff() + m_bytePtr; // Source buffer.
   uchar* d = (uchar*)pStream;           // Destination buffer.
-  int dbitptr = 0;                      // Pointer of destination buffer.
 
-  while (0 < bitCount) {
+  if (0 == m_bitPtr) {
 
     //
-    // Calculate BIT count to read.
+    // Byte aligned, copy whole bytes and merge the last partial byte.
     //
 
-    int nb = calcBitsCount(bitCount, dbitptr);
+    int n = bitCount / CHAR_BIT;
+    ::memcpy(d, s, n);
+    m_bytePtr += n;
+    if (0 < (bitCount %= CHAR_BIT)) {
+      mergeWord(d + n, 1, 0, s[n], bitCount);
+      m_bitPtr = bitCount;
+    }
 
-    uchar n = *s;
+    return m_bGood = true;
+  }
 
-    //
-    // Read bits.
-    //
+  //
+  // Unaligned, read a word at a time.
+  //
+
+  int avail = getBuffSize() - m_bytePtr; // Accessible bytes of source.
 
-    uchar mb = c_bitMask[nb];
-    *d &= ~(mb << dbitptr);
-    *d |= ((n >> m_bitPtr) & mb) << dbitptr;
+  while (0 < bitCount) {
+
+    int nb = std::min(bitCount, MAX_WORD_BITS);
+    uint64 v = loadWord(s, std::min(avail, 8)) >> m_bitPtr;
+    mergeWord(d, (bitCount + CHAR_BIT - 1) / CHAR_BIT, 0, v, nb);
 
     //
-    // Update pointers.
+    // Update pointers, nb is a multiple of 8 except the last word.
     //
 
-    if (CHAR_BIT <= (m_bitPtr += nb)) {
-      s += 1;
-      m_bytePtr += 1;
-      m_bitPtr &= (CHAR_BIT - 1);
+    int bits = m_bitPtr + nb;
+    s += bits / CHAR_BIT;
+    avail -= bits / CHAR_BIT;
+    m_bytePtr += bits / CHAR_BIT;
+    m_bitPtr = bits % CHAR_BIT;
+    d += nb / CHAR_BIT;
+
+    bitCount -= nb;
+  }
+
+  return m_bGood = true;
+}
+
+bool BitStream::readBits(uint64& v, int bitCount)
+{
+  if (isOutOfRange(bitCount)) {
+    SW2_TRACE_ERROR("Read out of range.");
+    return m_bGood = false;
+  }
+
+  v = 0;
+  if (0 < bitCount) {
+    uchar const* s = getBuff() + m_bytePtr;
+    v = (loadWord(s, std::min(getBuffSize() - m_bytePtr, 8)) >> m_bitPtr) & getBitMask(bitCount);
+    int bits = m_bitPtr + bitCount;
+    m_bytePtr += bits / CHAR_BIT;
+    m_bitPtr = bits % CHAR_BIT;
+  }
+
+  return m_bGood = true;
+}
+
+BitStream& BitStream::operator>>(double& d)
+{
+  uint64 u = 0;
+  if (operator>>(u)) {
+    ::memcpy(&d, &u, sizeof(d));
+  }
+
+  return *this;
+}
+
+//
+// Float, full 32 bits or quantized in a range.
+//
+
+bool BitStream::writeFloat(float f, setQuantize const* q)
+{
+  if (0 == q) {
+    uint u;
+    ::memcpy(&u, &f, sizeof(u));
+    return writeBits(u, DEF_BITS);
+  }
+
+  double maxq = (double)(((uint64)1 << q->bitCount) - 1);
+  double t = (f - q->minVal) / ((double)q->maxVal - q->minVal);
+  if (!(0 < t)) {                       // Clamp, NaN is min.
+    t = 0;
+  } else if (1 < t) {
+    t = 1;
+  }
+
+  return writeBits((uint64)(t * maxq + 0.5), q->bitCount);
+}
+
+bool BitStream::readFloat(float& f, setQuantize const* q)
+{
+  uint64 v;
+  if (0 == q) {
+    if (readBits(v, DEF_BITS)) {
+      uint u = (uint)v;
+      ::memcpy(&f, &u, sizeof(f));
     }
+    return m_bGood;
+  }
+
+  if (readBits(v, q->bitCount)) {
+    double maxq = (double)(((uint64)1 << q->bitCount) - 1);
+    f = (float)(q->minVal + ((double)q->maxVal - q->minVal) * v / maxq);
+  }
+
+  return m_bGood;
+}
+
+//
+// Quaternion, smallest three. Write index of the largest component, and the
+// other three in range [-1/sqrt(2), 1/sqrt(2)]. Flip sign of all components if
+// the largest is negative, q and -q are the same rotation.
+//
 
-    if (CHAR_BIT <= (dbitptr += nb)) {
-      d += 1;
-      dbitptr &= (CHAR_BIT - 1);
+bool BitStream::writeQuaternion(float const q[4], int bitCount)
+{
+  bitCount = std::max(1, std::min(bitCount, DEF_BITS));
+
+  if (!prepareWrite(2 + 3 * bitCount)) {
+    return false;
+  }
+
+  int largest = 0;
+  for (int i = 1; i < 4; i++) {
+    if (::fabs(q[i]) > ::fabs(q[largest])) {
+      largest = i;
     }
+  }
 
-    bitCount -= nb;
+  float sign = 0 > q[largest] ? -1.0f : 1.0f;
+  setQuantize range(-QUAT_RANGE, QUAT_RANGE, bitCount);
+
+  writeBits(largest, 2);
+  for (int i = 0; i < 4; i++) {
+    if (largest != i) {
+      writeFloat(sign * q[i], &range);
+    }
   }
 
+  return m_bGood;
+}
+
+bool BitStream::readQuaternion(float q[4], int bitCount)
+{
+  bitCount = std::max(1, std::min(bitCount, DEF_BITS));
+
+  if (isOutOfRange(2 + 3 * bitCount)) {
+    SW2_TRACE_ERROR("Read out of range.");
+    return m_bGood = false;
+  }
+
+  uint64 largest;
+  readBits(largest, 2);
+
+  setQuantize range(-QUAT_RANGE, QUAT_RANGE, bitCount);
+  float sum = 0;
+  for (int i = 0; i < 4; i++) {
+    if ((int)largest != i) {
+      readFloat(q[i], &range);
+      sum += q[i] * q[i];
+    }
+  }
+
+  q[largest] = ::sqrt(std::max(0.0f, 1.0f - sum));
+
   return m_bGood = true;
 }
 
+//
+// Varint, 7 bits a byte from low to high, high bit of a byte is set if more
+// bytes follow.
+//
+
+bool BitStream::writeVarint(uint64 v)
+{
+  uint64 lo = 0, hi = 0;                // Encoded bytes, at most 10.
+  int n = 0;
+  do {
+    uint64 b = (v & 0x7f) | (0x7f < v ? 0x80 : 0);
+    if (7 > n) {
+      lo |= b << (CHAR_BIT * n);
+    } else {
+      hi |= b << (CHAR_BIT * (n - 7));
+    }
+    v >>= 7;
+    n += 1;
+  } while (0 != v);
+
+  if (!prepareWrite(CHAR_BIT * n)) {
+    return false;
+  }
+
+  writeBits(lo, CHAR_BIT * std::min(n, 7));
+  return writeBits(hi, CHAR_BIT * std::max(n - 7, 0));
+}
+
+bool BitStream::readVarint(uint64& v, uint64 maxValue)
+{
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  maxValue = std::min(maxValue, m_varintMax);
+
+  uint64 x = 0;
+  for (int n = 0; MAX_VARINT_BYTES > n; n++) {
+    uint64 b;
+    if (!readBits(b, CHAR_BIT)) {
+      break;
+    }
+    x |= (b & 0x7f) << (7 * n);
+    if (0 == (b & 0x80)) {
+      if (maxValue < x) {
+        break;
+      }
+      v = x;
+      return m_bGood = true;
+    }
+  }
+
+  SW2_TRACE_ERROR("Bad varint.");
+  setPtr(by, bi);
+  return m_bGood = false;
+}
+
+//
+// Blob.
+//
+
+bool BitStream::writeBlob(void const* pBlob, int len)
+{
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  if (m_bAlignBlob && !operator<<(alignByte())) {
+    return false;
+  }
+
+  if (!write(pBlob, CHAR_BIT * len)) {
+    setPtr(by, bi);
+    return false;
+  }
+
+  return true;
+}
+
+bool BitStream::readBlob(void* pBlob, int len)
+{
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  if (m_bAlignBlob && !operator>>(alignByte())) {
+    return false;
+  }
+
+  if (0 > len || isOutOfRangeBytes(len)) {
+    SW2_TRACE_ERROR("Read out of range.");
+    setPtr(by, bi);
+    return m_bGood = false;
+  }
+
+  if (!read(pBlob, CHAR_BIT * len)) {
+    setPtr(by, bi);
+    return false;
+  }
+
+  return true;
+}
+
+char const* BitStream::readView(int len)
+{
+  int by = m_bytePtr, bi = m_bitPtr;
+
+  if (m_bAlignBlob && !operator>>(alignByte())) {
+    return 0;
+  }
+
+  if (0 != m_bitPtr || 0 > len || isOutOfRangeBytes(len)) {
+    setPtr(by, bi);
+    m_bGood = false;
+    return 0;
+  }
+
+  char const* p = (char const*)getBuff() + m_bytePtr;
+  m_bytePtr += len;
+  m_bGood = true;
+
+  return p;
+}
+
 //
 // Private.
 //
@@ -399,20 +1015,26 @@ bool BitStream::isOutOfRange(int bitCount) const
   }
 }
 
-int BitStream::calcBitsCount(int bitCount, int bitPtr) const
+bool BitStream::isOutOfRangeBytes(uint len) const
 {
-  int nb;
-  if (CHAR_BIT < m_bitPtr + bitCount) {
-    nb = CHAR_BIT - m_bitPtr;
-  } else {
-    nb = bitCount;
-  }
+  int avail = (CHAR_BIT * (getBuffSize() - m_bytePtr) - m_bitPtr) / CHAR_BIT; // Whole bytes left.
+  return len > (uint)std::max(avail, 0);
+}
 
-  if (CHAR_BIT < nb + bitPtr) {
-    nb = CHAR_BIT - bitPtr;
+bool BitStream::prepareWrite(int bitCount)
+{
+  if (m_sbuff) {
+    if (isOutOfRange(bitCount)) {       // Grow once to fit.
+      int need = m_bytePtr + (m_bitPtr + bitCount + CHAR_BIT - 1) / CHAR_BIT;
+      m_sbuff->resize(std::max(need, 2 * (1 + (int)m_sbuff->length())), 0);
+    }
+  } else {
+    if (isOutOfRange(bitCount)) {
+      return m_bGood = false;
+    }
   }
 
-  return nb;
+  return true;
 }
 
 } // namespace sw2
@@ -36,6 +36,8 @@
 /// bs << 2006;                         // Write an integer with default bit count.
 /// bs << setBitCount(5) << 15;         // Write a 5-bits integer.
 /// bs << 3.1415f;                      // Write a floating number.
+/// bs << setVarint() << 300;           // Write a varint, 2 bytes.
+/// bs << setQuantize(-1000, 1000, 16) << pos; // Write a 16-bit per axis point.
 ///
 /// //
 /// // The order of read must correspond to the write order, including the bit
@@ -46,6 +48,20 @@
 /// bs >> iVal1;                        // Read an integer with default bit count.
 /// bs >> setBitCount(5) >> iVal2;      // Read a 5-bits integer.
 /// bs >> fVal;                         // Read a floating number.
+/// bs >> setVarint() >> iVal3;         // Read a varint.
+/// bs >> setVarint(255) >> sVal;       // Read a string of max 255 characters.
+/// bs >> setQuantize(-1000, 1000, 16) >> pos; // Read a quantized point.
+///
+/// //
+/// // Large payloads are copied at memcpy speed when byte aligned, use
+/// // alignByte or setAlignBlob to align them.
+/// //
+///
+/// bs << alignByte();                  // Pad zero bits to next byte.
+/// bs.writeBlob(data, len);            // Write len bytes.
+///
+/// bs >> alignByte();                  // Skip to next byte.
+/// char const* p = bs.readView(len);   // Zero copy read len bytes.
 ///
 /// \endcode
 ///
@@ -56,6 +72,7 @@
 #pragma once
 
 #include "swinc.h"
+#include "swGeometry.h"
 
 namespace sw2 {
 
@@ -88,6 +105,45 @@ struct setBitCount
   }
 };
 
+///
+/// \brief Read/write next integer as varint, small numbers use less bits.
+///        Signed integers are zigzag encoded, apply to length of string too.
+/// \note maxValue limits the next read, a bigger (zigzag encoded) value or
+///       length of string fails the read before allocation.
+///
+
+struct setVarint
+{
+  uint64 maxValue;
+
+  explicit setVarint(uint64 maxValue_ = (uint64)-1) : maxValue(maxValue_)
+  {
+  }
+};
+
+///
+/// \brief Read/write next float or point as a quantized number in a range.
+///        Value out of range is clamped, precision is (max-min)/(2^bits-1).
+///
+
+struct setQuantize
+{
+  float minVal, maxVal;
+  int bitCount;
+
+  setQuantize(float minv, float maxv, int bc) : minVal(minv), maxVal(maxv), bitCount(bc)
+  {
+  }
+};
+
+///
+/// \brief Align to next byte, write zero bits as padding or skip on read.
+///
+
+struct alignByte
+{
+};
+
 ///
 /// \brief Calculate the max bit need to store a number.
 /// \param [in] n A number.
@@ -194,6 +250,39 @@ public:
 
   bool isOutOfRange(int bitCount) const;
 
+  ///
+  /// \brief Check is current pointer byte aligned.
+  /// \return Return true if byte aligned else return false.
+  ///
+
+  bool isByteAligned() const
+  {
+    return 0 == m_bitPtr;
+  }
+
+  ///
+  /// \brief Set blob alignment.
+  /// \param [in] bAlign Align blobs or not, default is false.
+  /// \note When enabled, string data and blobs are aligned to next byte before
+  ///       read/write, so they are copied by a single memcpy. This changes
+  ///       stream format, both reader and writer must use the same setting.
+  ///
+
+  void setAlignBlob(bool bAlign)
+  {
+    m_bAlignBlob = bAlign;
+  }
+
+  ///
+  /// \brief Check is blob alignment enabled.
+  /// \return Return true if blob alignment is enabled else return false.
+  ///
+
+  bool isAlignBlob() const
+  {
+    return m_bAlignBlob;
+  }
+
   ///
   /// \brief Set how many bits of next write.
   ///
@@ -206,6 +295,42 @@ public:
 
   BitStream& operator>>(setBitCount const& bc);
 
+  ///
+  /// \brief Set next write is varint.
+  ///
+
+  BitStream& operator<<(setVarint const& vi);
+
+  ///
+  /// \brief Set next read is varint.
+  ///
+
+  BitStream& operator>>(setVarint const& vi);
+
+  ///
+  /// \brief Set next write is quantized.
+  ///
+
+  BitStream& operator<<(setQuantize const& q);
+
+  ///
+  /// \brief Set next read is quantized.
+  ///
+
+  BitStream& operator>>(setQuantize const& q);
+
+  ///
+  /// \brief Write zero bits to align to next byte.
+  ///
+
+  BitStream& operator<<(alignByte const& ab);
+
+  ///
+  /// \brief Skip bits to align to next byte.
+  ///
+
+  BitStream& operator>>(alignByte const& ab);
+
   ///
   /// \brief Write a boolean value.
   /// \param [in] b True or false.
@@ -229,6 +354,22 @@ public:
 
   BitStream& operator<<(uint u);
 
+  ///
+  /// \brief Write a signed 64-bit integer.
+  /// \param [in] i A signed 64-bit integer.
+  /// \note Default bit count is 64, sign bit is same as int.
+  ///
+
+  BitStream& operator<<(int64 i);
+
+  ///
+  /// \brief Write a unsigned 64-bit integer.
+  /// \param [in] u A unsigned 64-bit integer.
+  /// \note Default bit count is 64.
+  ///
+
+  BitStream& operator<<(uint64 u);
+
   ///
   /// \brief Write a floating point number.
   /// \param [in] f A floating point number.
@@ -236,6 +377,29 @@ public:
 
   BitStream& operator<<(float f);
 
+  ///
+  /// \brief Write a double precision floating point number.
+  /// \param [in] d A double precision floating point number.
+  ///
+
+  BitStream& operator<<(double d);
+
+  ///
+  /// \brief Write a 2D point.
+  /// \param [in] pt A 2D point.
+  /// \note Each axis is a float, or quantized if setQuantize is set.
+  ///
+
+  BitStream& operator<<(FloatPoint const& pt);
+
+  ///
+  /// \brief Write a 3D point.
+  /// \param [in] pt A 3D point.
+  /// \note Each axis is a float, or quantized if setQuantize is set.
+  ///
+
+  BitStream& operator<<(FloatPoint3 const& pt);
+
   ///
   /// \brief Write a string.
   /// \param [in] s A string.
@@ -253,6 +417,29 @@ public:
 
   bool write(void const* pStream, int bitCount);
 
+  ///
+  /// \brief Write a blob.
+  /// \param [in] pBlob The blob.
+  /// \param [in] len Size of blob in bytes.
+  /// \return Return true if success else return false.
+  /// \note The blob is written by a single memcpy if byte aligned, see
+  ///       setAlignBlob. If write is out of buffer boundary then the BitStream
+  ///       keeps no change.
+  ///
+
+  bool writeBlob(void const* pBlob, int len);
+
+  ///
+  /// \brief Write a rotation quaternion with smallest three encoding.
+  /// \param [in] q A normalized quaternion, x, y, z, w.
+  /// \param [in] bitCount Bit count of each of the smallest three components.
+  /// \return Return true if success else return false.
+  /// \note Index of the largest component is written in 2 bits, the largest
+  ///       component is restored by the other three on read.
+  ///
+
+  bool writeQuaternion(float const q[4], int bitCount = 10);
+
   ///
   /// \brief Read a boolean value.
   /// \param [out] b True or false
@@ -274,6 +461,20 @@ public:
 
   BitStream& operator>>(uint& u);
 
+  ///
+  /// \brief Read a signed 64-bit integer.
+  /// \param [out] i A signed 64-bit integer.
+  ///
+
+  BitStream& operator>>(int64& i);
+
+  ///
+  /// \brief Read a unsigned 64-bit integer.
+  /// \param [out] u A unsigned 64-bit integer.
+  ///
+
+  BitStream& operator>>(uint64& u);
+
   ///
   /// \brief Read a floating number.
   /// \param [out] f A floating number.
@@ -281,6 +482,27 @@ public:
 
   BitStream& operator>>(float& f);
 
+  ///
+  /// \brief Read a double precision floating point number.
+  /// \param [out] d A double precision floating point number.
+  ///
+
+  BitStream& operator>>(double& d);
+
+  ///
+  /// \brief Read a 2D point.
+  /// \param [out] pt A 2D point.
+  ///
+
+  BitStream& operator>>(FloatPoint& pt);
+
+  ///
+  /// \brief Read a 3D point.
+  /// \param [out] pt A 3D point.
+  ///
+
+  BitStream& operator>>(FloatPoint3& pt);
+
   ///
   /// \brief Read a string.
   /// \param [out] s A string.
@@ -298,9 +520,68 @@ public:
 
   bool read(void* pStream, int bitCount);
 
+  ///
+  /// \brief Read a blob.
+  /// \param [out] pBlob Read blob to this buffer.
+  /// \param [in] len Size of blob in bytes.
+  /// \return Return true if success else return false.
+  /// \note The blob is read by a single memcpy if byte aligned, see setAlignBlob.
+  ///
+
+  bool readBlob(void* pBlob, int len);
+
+  ///
+  /// \brief Read a blob without copy.
+  /// \param [in] len Size of blob in bytes.
+  /// \return Return pointer to the blob in stream buffer if success else return
+  ///         0. The pointer keeps valid until the stream buffer is changed.
+  /// \note The blob must be byte aligned, see alignByte and setAlignBlob.
+  ///
+
+  char const* readView(int len);
+
+  ///
+  /// \brief Read a rotation quaternion with smallest three encoding.
+  /// \param [out] q A normalized quaternion, x, y, z, w.
+  /// \param [in] bitCount Bit count of each of the smallest three components,
+  ///        must correspond to the write.
+  /// \return Return true if success else return false.
+  ///
+
+  bool readQuaternion(float q[4], int bitCount = 10);
+
 private:
 
-  int calcBitsCount(int bitCount, int bitPtr) const;
+  uchar* getBuff() const
+  {
+    return (uchar*)(m_sbuff ? m_sbuff->data() : m_buff);
+  }
+
+  int getBuffSize() const
+  {
+    return m_sbuff ? (int)m_sbuff->length() : m_szBuff;
+  }
+
+  void resetBitCount();
+
+  static uint64 encodeZigzag(int64 i)
+  {
+    return ((uint64)i << 1) ^ (uint64)(i >> 63);
+  }
+
+  static int64 decodeZigzag(uint64 u)
+  {
+    return (int64)(u >> 1) ^ -(int64)(u & 1);
+  }
+
+  bool isOutOfRangeBytes(uint len) const;
+  bool prepareWrite(int bitCount);
+  bool writeVarint(uint64 v);
+  bool readVarint(uint64& v, uint64 maxValue);
+  bool writeBits(uint64 v, int bitCount);
+  bool readBits(uint64& v, int bitCount);
+  bool writeFloat(float f, setQuantize const* q);
+  bool readFloat(float& f, setQuantize const* q);
 
 private:
 
@@ -312,8 +593,13 @@ private:
   int m_bytePtr;                        // Current byte pointer.
 
   int m_bitCount;                       // Bit count for next read/write,
+  int m_bitCount64;                     // Bit count for next 64-bit read/write.
+  bool m_bVarint;                       // Next integer read/write is varint.
+  uint64 m_varintMax;                   // Max value of next varint read.
+  setQuantize m_quant;                  // Quantize of next float/point, valid if bitCount > 0.
 
   bool m_bGood;                         // State.
+  bool m_bAlignBlob;                    // Align blobs to byte.
 };
 
 } // namespace sw2
@@ -17,9 +17,10 @@
 
 #pragma once
 
-#include <list>
+#include <string.h>
 
 #include "swBitStream.h"
+#include "swThreadPool.h"
 #include "swUtil.h"
 
 namespace sw2 {
@@ -35,6 +36,10 @@ class BitStreamPacket
 public:
   typedef BitStreamPacket* (*StaticCreatePacket)();
 
+  BitStreamPacket() : pNextCache(0)
+  {
+  }
+
   virtual ~BitStreamPacket()
   {
   }
@@ -63,6 +68,262 @@ public:
   ///
 
   virtual bool write(BitStream &bs) const=0;
+
+  ///
+  /// \brief Get number of fields for delta encoding.
+  /// \return Return number of fields, 0 if delta encoding is not supported.
+  /// \note See BitStreamPacketBaseline.
+  ///
+
+  virtual int getFieldCount() const
+  {
+    return 0;
+  }
+
+  ///
+  /// \brief Read a field from bit stream.
+  /// \param [in] bs Bit stream.
+  /// \param [in] index Index of field, 0..getFieldCount()-1.
+  /// \return Return true if read data success else return false.
+  ///
+
+  virtual bool readField(BitStream &, int)
+  {
+    return false;
+  }
+
+  ///
+  /// \brief Write a field to bit stream.
+  /// \param [out] bs Bit stream.
+  /// \param [in] index Index of field, 0..getFieldCount()-1.
+  /// \return Return true if write data success else return false.
+  ///
+
+  virtual bool writeField(BitStream &, int) const
+  {
+    return false;
+  }
+
+  BitStreamPacket *pNextCache;          ///< Internal use, next free packet in cache.
+};
+
+//
+// \brief Field descriptors of a packet schema, see BitStreamSchema.
+// \note MAX_BITS is max encoded bits of the field.
+//
+
+//
+// \brief Unsigned integer field in range [0, MAXV], bit count is BITCOUNT<MAXV>.
+// \note Read fails if value is out of range.
+//
+
+template<class T, typename V, V T::*M, unsigned int MAXV>
+struct BitStreamUIntField
+{
+  enum { COUNT = 1, MAX_BITS = BITCOUNT<MAXV>::value };
+
+  static bool read(BitStream &bs, T &p)
+  {
+    unsigned int v;
+    if (!(bs >> setBitCount(MAX_BITS) >> v) || MAXV < v) {
+      return false;
+    }
+    p.*M = (V)v;
+    return true;
+  }
+
+  static bool write(BitStream &bs, const T &p)
+  {
+    assert(MAXV >= (unsigned int)(p.*M));
+    return bs << setBitCount(MAX_BITS) << (unsigned int)(p.*M);
+  }
+};
+
+//
+// \brief Signed integer field of BITS bits, including the sign bit.
+//
+
+template<class T, int T::*M, int BITS>
+struct BitStreamIntField
+{
+  enum { COUNT = 1, MAX_BITS = BITS };
+
+  static bool read(BitStream &bs, T &p)
+  {
+    return bs >> setBitCount(BITS) >> p.*M;
+  }
+
+  static bool write(BitStream &bs, const T &p)
+  {
+    return bs << setBitCount(BITS) << p.*M;
+  }
+};
+
+//
+// \brief Boolean field.
+//
+
+template<class T, bool T::*M>
+struct BitStreamBoolField
+{
+  enum { COUNT = 1, MAX_BITS = 1 };
+
+  static bool read(BitStream &bs, T &p)
+  {
+    return bs >> p.*M;
+  }
+
+  static bool write(BitStream &bs, const T &p)
+  {
+    return bs << p.*M;
+  }
+};
+
+//
+// \brief Float field, 32 bits.
+//
+
+template<class T, float T::*M>
+struct BitStreamFloatField
+{
+  enum { COUNT = 1, MAX_BITS = 32 };
+
+  static bool read(BitStream &bs, T &p)
+  {
+    return bs >> p.*M;
+  }
+
+  static bool write(BitStream &bs, const T &p)
+  {
+    return bs << p.*M;
+  }
+};
+
+//
+// \brief String field of max MAXLEN bytes, length bit count is BITCOUNT<MAXLEN>.
+// \note Read fails if string is too long.
+//
+
+template<class T, std::string T::*M, unsigned int MAXLEN>
+struct BitStreamStringField
+{
+  enum { COUNT = 1, MAX_BITS = BITCOUNT<MAXLEN>::value + 8 * MAXLEN };
+
+  static bool read(BitStream &bs, T &p)
+  {
+    return (bs >> setBitCount(BITCOUNT<MAXLEN>::value) >> p.*M) && MAXLEN >= (p.*M).length();
+  }
+
+  static bool write(BitStream &bs, const T &p)
+  {
+    assert(MAXLEN >= (p.*M).length());
+    return bs << setBitCount(BITCOUNT<MAXLEN>::value) << p.*M;
+  }
+};
+
+//
+// \brief Unused field of BitStreamSchema.
+//
+
+struct BitStreamNoField
+{
+  enum { COUNT = 0, MAX_BITS = 0 };
+
+  template<class T>
+  static bool read(BitStream &, T &)
+  {
+    return true;
+  }
+
+  template<class T>
+  static bool write(BitStream &, const T &)
+  {
+    return true;
+  }
+};
+
+//
+// \brief Compile time packet schema, read/write a list of fields in order.
+// \note MAX_BITS is max encoded bits of the packet, use it to presize buffers.
+// \note Declare schema in a packet with SW2_DECLARE_BITSTREAM_SCHEMA, it
+//       implements read/write and delta encoding fields of the packet.
+//
+// \code
+// struct evMove : public BitStreamPacket
+// {
+//   SW2_DECLARE_BITSTREAM_PACKET(EID_MOVE, evMove)
+//   uint id;
+//   bool bRun;
+//   typedef BitStreamSchema<
+//     BitStreamUIntField<evMove, uint, &evMove::id, MAX_PLAYER - 1>,
+//     BitStreamBoolField<evMove, &evMove::bRun> > Schema;
+//   SW2_DECLARE_BITSTREAM_SCHEMA(Schema)
+// };
+// \endcode
+//
+
+template<class F0, class F1 = BitStreamNoField, class F2 = BitStreamNoField, class F3 = BitStreamNoField,
+         class F4 = BitStreamNoField, class F5 = BitStreamNoField, class F6 = BitStreamNoField, class F7 = BitStreamNoField>
+struct BitStreamSchema
+{
+  enum {
+    COUNT = F0::COUNT + F1::COUNT + F2::COUNT + F3::COUNT + F4::COUNT + F5::COUNT + F6::COUNT + F7::COUNT,
+    MAX_BITS = F0::MAX_BITS + F1::MAX_BITS + F2::MAX_BITS + F3::MAX_BITS + F4::MAX_BITS + F5::MAX_BITS + F6::MAX_BITS + F7::MAX_BITS
+  };
+
+  template<class T>
+  static bool read(BitStream &bs, T &p)
+  {
+    return F0::read(bs, p) && F1::read(bs, p) && F2::read(bs, p) && F3::read(bs, p) &&
+           F4::read(bs, p) && F5::read(bs, p) && F6::read(bs, p) && F7::read(bs, p);
+  }
+
+  template<class T>
+  static bool write(BitStream &bs, const T &p)
+  {
+    return F0::write(bs, p) && F1::write(bs, p) && F2::write(bs, p) && F3::write(bs, p) &&
+           F4::write(bs, p) && F5::write(bs, p) && F6::write(bs, p) && F7::write(bs, p);
+  }
+
+  template<class T>
+  static bool readField(BitStream &bs, T &p, int index)
+  {
+    if (0 > index || COUNT <= index) {
+      return false;
+    }
+    switch (index)
+    {
+    case 0: return F0::read(bs, p);
+    case 1: return F1::read(bs, p);
+    case 2: return F2::read(bs, p);
+    case 3: return F3::read(bs, p);
+    case 4: return F4::read(bs, p);
+    case 5: return F5::read(bs, p);
+    case 6: return F6::read(bs, p);
+    case 7: return F7::read(bs, p);
+    }
+    return false;
+  }
+
+  template<class T>
+  static bool writeField(BitStream &bs, const T &p, int index)
+  {
+    if (0 > index || COUNT <= index) {
+      return false;
+    }
+    switch (index)
+    {
+    case 0: return F0::write(bs, p);
+    case 1: return F1::write(bs, p);
+    case 2: return F2::write(bs, p);
+    case 3: return F3::write(bs, p);
+    case 4: return F4::write(bs, p);
+    case 5: return F5::write(bs, p);
+    case 6: return F6::write(bs, p);
+    case 7: return F7::write(bs, p);
+    }
+    return false;
+  }
 };
 
 //
@@ -74,16 +335,108 @@ class BitStreamPacketHandler
 {
 public:
 
+  enum {
+    DEF_CACHE_SIZE = 64,                // Default max cached packets of a type.
+    MAGAZINE_SIZE = 16                  // Max cached packets of a type in a magazine.
+  };
+
+  //
+  // \brief Per thread packet cache, alloc and free packets without lock.
+  // \note A decoder thread owns a magazine and passes it to readPacket and
+  //       freePacket, the magazine exchanges half of it with shared cache of
+  //       the handler if it is empty or full. See setThreadSafe.
+  //
+
+  class Magazine
+  {
+  public:
+    explicit Magazine(BitStreamPacketHandler &h) : m_h(h), m_hit(0), m_miss(0)
+    {
+      for (int i = 0; i < MAX_ID; i++) {
+        m_pFree[i] = 0;
+        m_nFree[i] = 0;
+      }
+    }
+
+    ~Magazine()
+    {
+      m_h.lock();
+      for (int i = 0; i < MAX_ID; i++) {
+        m_h.exchange_i(*this, i, m_nFree[i]);
+      }
+      m_h.unlock();
+    }
+
+  private:
+    friend class BitStreamPacketHandler;
+
+    BitStreamPacketHandler &m_h;
+    BitStreamPacket *m_pFree[MAX_ID];   // Free lists.
+    int m_nFree[MAX_ID];
+    long m_hit, m_miss;                 // Add to handler when exchange.
+  };
+
   //
   // \brief Constructor.
   // \param [in] bitMagic Number bits of magic ID header of packet.
   // \param [in] magic The magic ID header of packet.
   //
 
-  explicit BitStreamPacketHandler(unsigned int bitsMagic = 0, unsigned int magic = 0) : m_bitsMagic(bitsMagic), m_magic(magic)
+  explicit BitStreamPacketHandler(unsigned int bitsMagic = 0, unsigned int magic = 0) : m_bitsMagic(bitsMagic), m_magic(magic), m_maxCache(DEF_CACHE_SIZE), m_pLock(0), m_hit(0), m_miss(0)
   {
   }
 
+  ~BitStreamPacketHandler()
+  {
+    setThreadSafe(false);
+  }
+
+  //
+  // \brief Set max cached packets of a type.
+  // \param [in] maxCache Max cached packets, a freed packet is deleted if
+  //        the cache is full.
+  //
+
+  void setCacheSize(int maxCache)
+  {
+    m_maxCache = maxCache;
+  }
+
+  //
+  // \brief Enable or disable thread safe.
+  // \param [in] bThreadSafe Lock shared cache if true, must be true if the
+  //        handler is used by multiple threads, set it before use.
+  //
+
+  void setThreadSafe(bool bThreadSafe)
+  {
+    if (bThreadSafe && 0 == m_pLock) {
+      m_pLock = ThreadLock::alloc();
+    } else if (!bThreadSafe && m_pLock) {
+      ThreadLock::free(m_pLock);
+      m_pLock = 0;
+    }
+  }
+
+  //
+  // \brief Get cache hit count, a packet is allocated from cache.
+  // \note Counts of a magazine are added when it exchanges with the handler.
+  //
+
+  long getCacheHit() const
+  {
+    return m_hit;
+  }
+
+  //
+  // \brief Get cache miss count, a packet is created.
+  //
+
+  long getCacheMiss() const
+  {
+    return m_miss;
+  }
+
   //
   // \brief Release handled packet.
   // \param [in] p A packet returned by readPacket.
@@ -92,12 +445,19 @@ public:
 
   bool freePacket(const BitStreamPacket *p)
   {
-    int id = p->getId();
-    if (0 <= id && MAX_ID > id) {
-      m_rt[id].freePacket((BitStreamPacket*)p);
-      return true;
-    }
-    return false;
+    return freePacket_i(p, 0);
+  }
+
+  //
+  // \brief Release handled packet to a magazine.
+  // \param [in] p A packet returned by readPacket.
+  // \param [in] mag Magazine of current thread.
+  // \return True if p is a valid packet else return false.
+  //
+
+  bool freePacket(const BitStreamPacket *p, Magazine &mag)
+  {
+    return freePacket_i(p, &mag);
   }
 
   //
@@ -114,32 +474,21 @@ public:
 
   bool readPacket(BitStream &bs, const BitStreamPacket **pp)
   {
-    if (0 < m_bitsMagic) {
-      if (bs.isOutOfRange(m_bitsMagic)) {
-        return false;
-      }
-      unsigned int magic;
-      if (!(bs >> sw2::setBitCount(m_bitsMagic) >> magic)) {
-        return false;
-      }
-      if (magic != m_magic) {
-        return false;
-      }
-    }
-    unsigned int id = (unsigned int)-1;
-    if (!bs.isOutOfRange(getIdBitCount()) && !(bs >> setBitCount(getIdBitCount()) >> id)) {
-      return false;
-    }
-    BitStreamPacket *p = allocPacket(id);
-    if (0 == p) {
-      return false;
-    }
-    if (!p->read(bs)) {
-      freePacket(p);
-      return false;
-    }
-    *pp = p;
-    return true;
+    return readPacket_i(bs, pp, 0);
+  }
+
+  //
+  // \brief Read and decode a packet from bit stream, allocate from a magazine.
+  // \param [in] bs A bit stream to read packet data from.
+  // \param [out] pp A pointer to obtain a decoded packet.
+  // \param [in] mag Magazine of current thread.
+  // \return True is a valid packet is decoded else return false.
+  // \note After the packet is handled, use freePacket with mag to release it.
+  //
+
+  bool readPacket(BitStream &bs, const BitStreamPacket **pp, Magazine &mag)
+  {
+    return readPacket_i(bs, pp, &mag);
   }
 
   //
@@ -185,13 +534,164 @@ public:
     return p.write(bs);
   }
 
+  //
+  // \brief Read and match packet header, magic ID and packet type ID.
+  // \param [in] bs A bit stream to read packet header from.
+  // \param [out] id Packet type ID.
+  // \return True if header is valid else return false.
+  // \note The ID is not checked, it may be not registered.
+  //
+
+  bool readHeader(BitStream &bs, unsigned int &id) const
+  {
+    if (0 < m_bitsMagic) {
+      if (bs.isOutOfRange(m_bitsMagic)) {
+        return false;
+      }
+      unsigned int magic;
+      if (!(bs >> sw2::setBitCount(m_bitsMagic) >> magic)) {
+        return false;
+      }
+      if (magic != m_magic) {
+        return false;
+      }
+    }
+    if (bs.isOutOfRange(getIdBitCount())) {
+      return false;
+    }
+    return bs >> setBitCount(getIdBitCount()) >> id;
+  }
+
 protected:
-  BitStreamPacket* allocPacket(int id)
+  bool readPacket_i(BitStream &bs, const BitStreamPacket **pp, Magazine *pMag)
+  {
+    unsigned int id;
+    if (!readHeader(bs, id)) {
+      return false;
+    }
+    BitStreamPacket *p = allocPacket(id, pMag);
+    if (0 == p) {
+      return false;
+    }
+    if (!p->read(bs)) {
+      freePacket_i(p, pMag);
+      return false;
+    }
+    *pp = p;
+    return true;
+  }
+
+
+  BitStreamPacket* allocPacket(int id, Magazine *pMag = 0)
   {
     if(0 > id || MAX_ID <= id) {
       return 0;
     }
-    return m_rt[id].allocPacket();
+
+    BitStreamPacket *p = 0;
+    if (pMag) {
+      if (0 == pMag->m_pFree[id]) {     // Empty, get half from shared cache.
+        lock();
+        exchange_i(*pMag, id, -MAGAZINE_SIZE / 2);
+        unlock();
+      }
+      if (0 != (p = pMag->m_pFree[id])) {
+        pMag->m_pFree[id] = p->pNextCache;
+        pMag->m_nFree[id] -= 1;
+        pMag->m_hit += 1;
+        return p;
+      }
+      pMag->m_miss += 1;
+    } else {
+      lock();
+      if (0 != (p = m_rt[id].pop())) {
+        m_hit += 1;
+      } else {
+        m_miss += 1;
+      }
+      unlock();
+      if (p) {
+        return p;
+      }
+    }
+
+    return m_rt[id].pf ? m_rt[id].pf() : 0;
+  }
+
+  bool freePacket_i(const BitStreamPacket *p, Magazine *pMag)
+  {
+    int id = p->getId();
+    if (0 > id || MAX_ID <= id) {
+      return false;
+    }
+
+    if (pMag) {
+      BitStreamPacket *p2 = (BitStreamPacket*)p;
+      p2->pNextCache = pMag->m_pFree[id];
+      pMag->m_pFree[id] = p2;
+      if (MAGAZINE_SIZE < ++pMag->m_nFree[id]) { // Full, put half to shared cache.
+        lock();
+        exchange_i(*pMag, id, MAGAZINE_SIZE / 2);
+        unlock();
+      }
+      return true;
+    }
+
+    lock();
+    bool bFull = m_maxCache <= m_rt[id].nFree;
+    if (!bFull) {
+      m_rt[id].push((BitStreamPacket*)p);
+    }
+    unlock();
+
+    if (bFull) {
+      delete p;
+    }
+
+    return true;
+  }
+
+  //
+  // Move n packets from magazine to shared cache, or -n packets from shared
+  // cache to magazine if n < 0. Add counts of magazine. Call in lock.
+  //
+
+  void exchange_i(Magazine &mag, int id, int n)
+  {
+    BitStreamPacketRuntime &rt = m_rt[id];
+    for (; 0 < n && mag.m_pFree[id]; n--) {
+      BitStreamPacket *p = mag.m_pFree[id];
+      mag.m_pFree[id] = p->pNextCache;
+      mag.m_nFree[id] -= 1;
+      if (m_maxCache <= rt.nFree) {
+        delete p;
+      } else {
+        rt.push(p);
+      }
+    }
+    for (; 0 > n && rt.pFree; n++) {
+      BitStreamPacket *p = rt.pop();
+      p->pNextCache = mag.m_pFree[id];
+      mag.m_pFree[id] = p;
+      mag.m_nFree[id] += 1;
+    }
+    m_hit += mag.m_hit;
+    m_miss += mag.m_miss;
+    mag.m_hit = mag.m_miss = 0;
+  }
+
+  void lock()
+  {
+    if (m_pLock) {
+      m_pLock->lock();
+    }
+  }
+
+  void unlock()
+  {
+    if (m_pLock) {
+      m_pLock->unlock();
+    }
   }
 
   int getIdBitCount() const
@@ -204,41 +704,422 @@ private:
   {
   public:
     BitStreamPacket::StaticCreatePacket pf;
-    std::list<BitStreamPacket*> cache;
+    BitStreamPacket *pFree;             // Intrusive free list.
+    int nFree;
 
-    BitStreamPacketRuntime() : pf(0)
+    BitStreamPacketRuntime() : pf(0), pFree(0), nFree(0)
     {
     }
 
     ~BitStreamPacketRuntime()
     {
-      std::list<BitStreamPacket*>::iterator it = cache.begin();
-      for (; cache.end() != it; it++) {
-        delete *it;
+      while (pFree) {
+        delete pop();
       }
     }
 
-    BitStreamPacket* allocPacket()
+    BitStreamPacket* pop()
     {
-      if (!cache.empty()) {
-        BitStreamPacket *p = cache.front();
-        cache.pop_front();
-        return p;
-      }
-      if (pf) {
-        BitStreamPacket *p = pf();
-        return p;
+      BitStreamPacket *p = pFree;
+      if (p) {
+        pFree = p->pNextCache;
+        nFree -= 1;
       }
-      return 0;
+      return p;
     }
 
-    void freePacket(BitStreamPacket *p)
+    void push(BitStreamPacket *p)
     {
-      cache.push_back(p);
+      p->pNextCache = pFree;
+      pFree = p;
+      nFree += 1;
     }
   };
   BitStreamPacketRuntime m_rt[MAX_ID];
   unsigned int m_bitsMagic, m_magic;
+  int m_maxCache;
+  ThreadLock *m_pLock;                  // Lock of shared cache if thread safe.
+  long m_hit, m_miss;
+};
+
+//
+// \brief Delta encode packets of a type against acked baselines.
+// \note Sender and receiver keep a ring of last N packets keyed by sequence,
+//       a packet is encoded against the newest baseline acked by receiver, as
+//       a changed field bitmask plus changed fields only. Full encode if there
+//       is no baseline or packet has no fields, see BitStreamPacket::getFieldCount.
+// \note Baselines are stored by write and read back, so sender and receiver
+//       have exactly same baselines, including quantized fields.
+// \note Sequence is not written, send it once in the snapshot header which
+//       has packets of many entities.
+//
+
+template<int N>
+class BitStreamPacketBaseline
+{
+public:
+
+  //
+  // \brief Constructor.
+  // \param [in] pf A function to allocate a new object of this type of packet.
+  //
+
+  explicit BitStreamPacketBaseline(BitStreamPacket::StaticCreatePacket pf) : m_pf(pf), m_bAcked(false), m_ackSeq(0)
+  {
+  }
+
+  ~BitStreamPacketBaseline()
+  {
+    for (int i = 0; i < N; i++) {
+      delete m_ring[i].p;
+    }
+  }
+
+  //
+  // \brief Receiver has got a packet, it is a baseline of later packets.
+  // \param [in] seq Sequence of the packet.
+  //
+
+  void ack(unsigned int seq)
+  {
+    if (0 == get(seq)) {
+      return;
+    }
+    if (!m_bAcked || 0 < (int)(seq - m_ackSeq)) {
+      m_bAcked = true;
+      m_ackSeq = seq;
+    }
+  }
+
+  //
+  // \brief Get a stored baseline.
+  // \param [in] seq Sequence of the baseline.
+  // \return Return the baseline if it is in the ring else return 0.
+  //
+
+  const BitStreamPacket* get(unsigned int seq) const
+  {
+    const Slot &s = m_ring[seq % N];
+    return s.bValid && seq == s.seq ? s.p : 0;
+  }
+
+  //
+  // \brief Encode a packet against newest acked baseline and store it.
+  // \param [in] bs A bit stream to write packet data to.
+  // \param [in] seq Sequence of the packet, increase by tick.
+  // \param [in] p A packet to encode.
+  // \return True if write is success else return false.
+  //
+
+  bool writePacket(BitStream &bs, unsigned int seq, const BitStreamPacket &p)
+  {
+    const BitStreamPacket *base = 0;
+    if (m_bAcked && 0 < p.getFieldCount() && (unsigned int)(N - 1) > seq - m_ackSeq - 1) { // 0 < dist < N.
+      base = get(m_ackSeq);
+    }
+
+    int by = bs.getBytePtr(), bi = bs.getBitPtr();
+    if (!(bs << (0 != base))) {
+      return false;
+    }
+    if (base && !(bs << setBitCount(BITCOUNT<N - 1>::value) << (seq - m_ackSeq))) {
+      return false;
+    }
+    if (!(base ? writeDelta(bs, p, *base) : p.write(bs))) {
+      bs.setPtr(by, bi);
+      return false;
+    }
+
+    return store(seq, p);
+  }
+
+  //
+  // \brief Decode a packet against the baseline and store it.
+  // \param [in] bs A bit stream to read packet data from.
+  // \param [in] seq Sequence of the packet, ack it to sender if success.
+  // \param [out] p A packet of this type to decode to.
+  // \return True if a valid packet is decoded else return false.
+  //
+
+  bool readPacket(BitStream &bs, unsigned int seq, BitStreamPacket &p)
+  {
+    bool bDelta = false;
+    if (!(bs >> bDelta)) {
+      return false;
+    }
+
+    if (!bDelta) {
+      return p.read(bs) && store(seq, p);
+    }
+
+    unsigned int dist;
+    if (!(bs >> setBitCount(BITCOUNT<N - 1>::value) >> dist)) {
+      return false;
+    }
+
+    const BitStreamPacket *base = get(seq - dist);
+    if (0 == base) {
+      SW2_TRACE_ERROR("BitStreamPacketBaseline baseline %u not found.", seq - dist);
+      return false;
+    }
+
+    return readDelta(bs, p, *base) && store(seq, p);
+  }
+
+private:
+  struct Slot
+  {
+    bool bValid;
+    unsigned int seq;
+    BitStreamPacket *p;
+
+    Slot() : bValid(false), seq(0), p(0)
+    {
+    }
+  };
+
+  bool store(unsigned int seq, const BitStreamPacket &p)
+  {
+    Slot &s = m_ring[seq % N];
+    s.bValid = false;
+    if (0 == s.p && 0 == (s.p = m_pf())) {
+      return false;
+    }
+
+    BitStream bs(m_scratch);
+    if (!p.write(bs)) {
+      return false;
+    }
+    bs.reset();
+    if (!s.p->read(bs)) {
+      return false;
+    }
+
+    s.bValid = true;
+    s.seq = seq;
+    return true;
+  }
+
+  //
+  // Compare encoded fields, so quantized fields are compared as is on wire.
+  //
+
+  bool isFieldChanged(const BitStreamPacket &p, const BitStreamPacket &base, int index)
+  {
+    BitStream bs(m_scratch), bs2(m_scratch2);
+    if (!p.writeField(bs, index) || !base.writeField(bs2, index)) {
+      return true;
+    }
+
+    if (bs.getBytePtr() != bs2.getBytePtr() || bs.getBitPtr() != bs2.getBitPtr()) {
+      return true;
+    }
+
+    int len = bs.getBytePtr();
+    if (0 != ::memcmp(m_scratch.data(), m_scratch2.data(), len)) {
+      return true;
+    }
+
+    if (0 == bs.getBitPtr()) {
+      return false;
+    }
+
+    unsigned char mask = (unsigned char)((1 << bs.getBitPtr()) - 1);
+    return 0 != ((m_scratch[len] ^ m_scratch2[len]) & mask);
+  }
+
+  bool writeDelta(BitStream &bs, const BitStreamPacket &p, const BitStreamPacket &base)
+  {
+    int n = p.getFieldCount();
+
+    for (int i = 0; i < n; i += 32) {
+      unsigned int mask = 0;
+      for (int j = i; j < n && i + 32 > j; j++) {
+        if (isFieldChanged(p, base, j)) {
+          mask |= 1u << (j - i);
+        }
+      }
+      if (!(bs << setBitCount(std::min(n - i, 32)) << mask)) {
+        return false;
+      }
+      for (int j = i; j < n && i + 32 > j; j++) {
+        if ((mask & (1u << (j - i))) && !p.writeField(bs, j)) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  bool readDelta(BitStream &bs, BitStreamPacket &p, const BitStreamPacket &base)
+  {
+    int n = p.getFieldCount();
+    if (base.getFieldCount() != n) {
+      return false;
+    }
+
+    for (int i = 0; i < n; i += 32) {
+      unsigned int mask;
+      if (!(bs >> setBitCount(std::min(n - i, 32)) >> mask)) {
+        return false;
+      }
+      for (int j = i; j < n && i + 32 > j; j++) {
+        if (mask & (1u << (j - i))) {
+          if (!p.readField(bs, j)) {
+            return false;
+          }
+        } else {
+          BitStream bs2(m_scratch);     // Unchanged, copy from baseline.
+          if (!base.writeField(bs2, j)) {
+            return false;
+          }
+          bs2.reset();
+          if (!p.readField(bs2, j)) {
+            return false;
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+  BitStreamPacket::StaticCreatePacket m_pf;
+  Slot m_ring[N];
+  bool m_bAcked;
+  unsigned int m_ackSeq;                // Newest acked sequence.
+  std::string m_scratch, m_scratch2;    // Reused encode buffers.
+};
+
+//
+// \brief Decode packets and dispatch to typed handlers by packet type ID.
+// \note Register a handler per packet type, dispatch decodes every packet of
+//       a bit stream into a local object of the registered type and calls its
+//       handler, no packet is allocated and a packet costs one indirect call.
+// \note Packets without a registered handler are decoded by the packet
+//       handler and passed to the default handler if it is set.
+//
+
+template<int MAX_ID, class T, class ArgT>
+class BitStreamPacketDispatcher
+{
+public:
+  typedef bool (T::*DefaultHandler)(ArgT, BitStreamPacket&);
+
+  //
+  // \brief Constructor.
+  // \param [in] h Packet handler, to read packet header and other packets.
+  // \param [in] obj Object to call handlers.
+  //
+
+  BitStreamPacketDispatcher(BitStreamPacketHandler<MAX_ID> &h, T &obj) : m_h(h), m_obj(obj), m_default(0)
+  {
+    for (int i = 0; i < MAX_ID; i++) {
+      m_fn[i] = 0;
+    }
+  }
+
+  //
+  // \brief Register a handler of a packet type.
+  // \return True if register is success else return false.
+  // \note Usage: registerHandler<MyPacket, &MyClass::onMyPacket>(), the
+  //       handler is bool onMyPacket(ArgT, MyPacket&), return false to stop
+  //       dispatching.
+  //
+
+  template<class PacketT, bool (T::*F)(ArgT, PacketT&)>
+  bool registerHandler()
+  {
+    int id = PacketT().getId();
+    if (0 > id || MAX_ID <= id) {
+      SW2_TRACE_ERROR("registerHandler [%d] invalid ID.", id);
+      return false;
+    }
+    m_fn[id] = &invoke<PacketT, F>;
+    return true;
+  }
+
+  //
+  // \brief Set handler of packets without a registered handler.
+  // \param [in] f Default handler, 0 to stop dispatching at such packets.
+  //
+
+  void setDefaultHandler(DefaultHandler f)
+  {
+    m_default = f;
+  }
+
+  //
+  // \brief Decode all packets of a bit stream and call their handlers.
+  // \param [in] bs A bit stream to read packets from.
+  // \param [in] arg Argument pass to handlers.
+  // \return Number of packets handled.
+  // \note Stop at end of stream, invalid packet, packet without handler or a
+  //       handler returns false. The bit stream stops at the invalid or not
+  //       handled packet.
+  //
+
+  int dispatch(BitStream &bs, ArgT arg)
+  {
+    int n = 0;
+    while (true) {
+      int bytePtr = bs.getBytePtr(), bitPtr = bs.getBitPtr();
+      unsigned int id;
+      if (!m_h.readHeader(bs, id)) {
+        bs.setPtr(bytePtr, bitPtr);
+        break;
+      }
+      int ret;
+      if (MAX_ID > id && 0 != m_fn[id]) {
+        ret = m_fn[id](m_obj, bs, arg);
+      } else {
+        ret = dispatchDefault(bs, arg, bytePtr, bitPtr);
+      }
+      if (0 > ret) {
+        bs.setPtr(bytePtr, bitPtr);
+        break;
+      }
+      n += 1;
+      if (0 == ret) {
+        break;
+      }
+    }
+    return n;
+  }
+
+private:
+  typedef int (*Invoker)(T&, BitStream&, ArgT);
+
+  template<class PacketT, bool (T::*F)(ArgT, PacketT&)>
+  static int invoke(T &obj, BitStream &bs, ArgT arg)
+  {
+    PacketT p;
+    if (!p.PacketT::read(bs)) {
+      return -1;
+    }
+    return (obj.*F)(arg, p) ? 1 : 0;
+  }
+
+  int dispatchDefault(BitStream &bs, ArgT arg, int bytePtr, int bitPtr)
+  {
+    if (0 == m_default) {
+      return -1;
+    }
+    bs.setPtr(bytePtr, bitPtr);
+    const BitStreamPacket *p;
+    if (!m_h.readPacket(bs, &p)) {
+      return -1;
+    }
+    bool ret = (m_obj.*m_default)(arg, const_cast<BitStreamPacket&>(*p));
+    m_h.freePacket(p);
+    return ret ? 1 : 0;
+  }
+
+  BitStreamPacketHandler<MAX_ID> &m_h;
+  T &m_obj;
+  DefaultHandler m_default;
+  Invoker m_fn[MAX_ID];
 };
 
 //
@@ -251,6 +1132,20 @@ public:\
   static BitStreamPacket* staticCreatePacket() { return new cls; }\
   virtual int getId() const { return id; }
 
+//
+// \brief Implement read/write and delta encoding fields by a schema.
+// \note Use after SW2_DECLARE_BITSTREAM_PACKET and fields, see BitStreamSchema.
+//
+
+#define SW2_DECLARE_BITSTREAM_SCHEMA(schema) \
+public:\
+  enum { MAX_BITS = schema::MAX_BITS };\
+  virtual bool read(BitStream &bs) { return schema::read(bs, *this); }\
+  virtual bool write(BitStream &bs) const { return schema::write(bs, *this); }\
+  virtual int getFieldCount() const { return schema::COUNT; }\
+  virtual bool readField(BitStream &bs, int index) { return schema::readField(bs, *this, index); }\
+  virtual bool writeField(BitStream &bs, int index) const { return schema::writeField(bs, *this, index); }
+
 //
 // \brief Register a bit stream packet type.
 // \note See BitStreamPacketHandler::registerPacket.
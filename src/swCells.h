@@ -93,6 +93,16 @@
 /// cells.search(pobj->getX() - 50.0f, pobj->getY() - 50.0f, pobj->getX() + 50.0f, pobj->getY() + 50.0f, 100, Filter());
 ///
 /// //
+/// // Many searches of a tick can run in parallel by ThreadPool, 4 tasks.
+/// //
+///
+/// CellsQueryBatch&lt;Cells&lt;MyObj*, float&gt; &gt; batch;
+/// batch.clear();
+/// int q = batch.addSearch(pobj->getX(), pobj->getY(), 125.0f, 100);
+/// batch.run(cells, 4);
+/// MyObj* const* found = batch.getResult(q); // batch.getCount(q) objects.
+///
+/// //
 /// // Remove the object from Cells if it is no longer need.
 /// //
 ///
@@ -106,16 +116,24 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+# include <emmintrin.h>
+# define SW2_CELLS_SSE2
+#endif
+
 #include "swGeometry.h"
 #include "swObjectPool.h"
+#include "swThreadPool.h"
+#include "swUtil.h"
 
 namespace sw2 {
 
 namespace impl {
 
-template<typename ObjT, typename ValueT> struct implCellsRectFunc
+template<typename ValueT> struct implCellsRectFunc
 {
   RECT_t<ValueT> rc;
 
@@ -123,13 +141,13 @@ template<typename ObjT, typename ValueT> struct implCellsRectFunc
   {
   }
 
-  bool operator()(ObjT const& obj) const
+  bool operator()(ValueT x, ValueT y) const
   {
-    return rc.ptInRect(POINT_t<ValueT>(obj.x, obj.y));
+    return rc.ptInRect(POINT_t<ValueT>(x, y));
   }
 };
 
-template<typename ObjT, typename ValueT> struct implCellsSphereFunc
+template<typename ValueT> struct implCellsSphereFunc
 {
   ValueT x, y, radiuss;
 
@@ -137,22 +155,142 @@ template<typename ObjT, typename ValueT> struct implCellsSphereFunc
   {
   }
 
-  bool operator()(ObjT const& obj) const
+  bool operator()(ValueT x_, ValueT y_) const
   {
-    ValueT a = x - obj.x;
-    ValueT b = y - obj.y;
+    ValueT a = x - x_;
+    ValueT b = y - y_;
     return a * a + b * b <= radiuss;
   }
 };
 
-template<typename ObjT, typename ValueT> struct implCellsItem
+template<typename ObjT> struct implCellsItem
 {
   ObjT obj;
-  int cellxy;                           // Index of cells.
   int id;                               // ID of cells[cellxy].
-  ValueT x, y;                          // Current coordinate.
 };
 
+//
+// Cell of an offset to origin, floor(d / size). Integer division is exact,
+// floating point multiplies by reciprocal of cell size and corrects the
+// rounding of the reciprocal.
+//
+
+template<typename ValueT> struct implCellsCalc
+{
+  static ValueT recip(ValueT)
+  {
+    return 0;                           // Not used.
+  }
+
+  static int getCell(ValueT d, ValueT size, ValueT)
+  {
+    int c = (int)(d / size);
+    c -= c * size > d;                  // Floor of negative.
+    return c;
+  }
+};
+
+template<typename ValueT> struct implCellsRecipCalc
+{
+  static ValueT recip(ValueT size)
+  {
+    return (ValueT)1 / size;
+  }
+
+  static int getCell(ValueT d, ValueT size, ValueT inv)
+  {
+    int c = (int)(d * inv);
+    c -= (ValueT)c * size > d;
+    c += (ValueT)(c + 1) * size <= d;
+    return c;
+  }
+};
+
+template<> struct implCellsCalc<float> : public implCellsRecipCalc<float>
+{
+};
+
+template<> struct implCellsCalc<double> : public implCellsRecipCalc<double>
+{
+};
+
+//
+// Compute cells of coordinates for Cells::moveBatch, -1 if out of boundary.
+//
+
+template<typename ValueT, typename CellsT>
+void implCellsCompute(CellsT const& c, ValueT const* xs, ValueT const* ys, int n, int* pcell)
+{
+  for (int i = 0; i < n; i++) {
+    int cx = implCellsCalc<ValueT>::getCell(xs[i] - c.refx, c.cellw, c.invcellw);
+    int cy = implCellsCalc<ValueT>::getCell(ys[i] - c.refy, c.cellh, c.invcellh);
+    int in = (0 <= cx) & (c.ncellx > cx) & (0 <= cy) & (c.ncelly > cy);
+    pcell[i] = in ? cx + c.ncellx * cy : -1;
+  }
+}
+
+template<typename ValueT> struct implCellsBatch
+{
+  enum { VECTORIZED = 0 };
+
+  template<typename CellsT>
+  static void compute(CellsT const& c, ValueT const* xs, ValueT const* ys, int n, int* pcell)
+  {
+    implCellsCompute(c, xs, ys, n, pcell);
+  }
+};
+
+#if defined(SW2_CELLS_SSE2)
+
+//
+// Float coordinates, 4 objects a time by SSE2, same result as above.
+//
+
+template<> struct implCellsBatch<float>
+{
+  enum { VECTORIZED = 1 };
+
+  static __m128i getCell(__m128 d, __m128 size, __m128 inv)
+  {
+    __m128i c = _mm_cvttps_epi32(_mm_mul_ps(d, inv));
+    __m128 cf = _mm_cvtepi32_ps(c);
+    c = _mm_add_epi32(c, _mm_castps_si128(_mm_cmpgt_ps(_mm_mul_ps(cf, size), d))); // Mask is -1.
+    cf = _mm_cvtepi32_ps(c);
+    c = _mm_sub_epi32(c, _mm_castps_si128(_mm_cmple_ps(_mm_mul_ps(_mm_add_ps(cf, _mm_set1_ps(1)), size), d)));
+    return c;
+  }
+
+  static __m128i mul(__m128i a, __m128i b)
+  {
+    __m128i e = _mm_mul_epu32(a, b);    // Low 32 bits of products of lane 0 and 2.
+    __m128i o = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(e, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(o, _MM_SHUFFLE(0, 0, 2, 0)));
+  }
+
+  template<typename CellsT>
+  static void compute(CellsT const& c, float const* xs, float const* ys, int n, int* pcell)
+  {
+    __m128 refx = _mm_set1_ps(c.refx), refy = _mm_set1_ps(c.refy);
+    __m128 cellw = _mm_set1_ps(c.cellw), cellh = _mm_set1_ps(c.cellh);
+    __m128 invw = _mm_set1_ps(c.invcellw), invh = _mm_set1_ps(c.invcellh);
+    __m128i ncellx = _mm_set1_epi32(c.ncellx), ncelly = _mm_set1_epi32(c.ncelly);
+    __m128i none = _mm_set1_epi32(-1);
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i cx = getCell(_mm_sub_ps(_mm_loadu_ps(xs + i), refx), cellw, invw);
+      __m128i cy = getCell(_mm_sub_ps(_mm_loadu_ps(ys + i), refy), cellh, invh);
+      __m128i in = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(cx, none), _mm_cmplt_epi32(cx, ncellx)), _mm_and_si128(_mm_cmpgt_epi32(cy, none), _mm_cmplt_epi32(cy, ncelly)));
+      __m128i cxy = _mm_add_epi32(cx, mul(ncellx, cy));
+      _mm_storeu_si128((__m128i*)(pcell + i), _mm_or_si128(_mm_and_si128(in, cxy), _mm_andnot_si128(in, none)));
+    }
+
+    implCellsCompute(c, xs + i, ys + i, n - i, pcell + i); // Rest.
+  }
+};
+
+#endif // SW2_CELLS_SSE2
+
 } // namespace impl
 
 ///
@@ -164,17 +302,25 @@ class Cells
 {
 public:
 
+  typedef ObjT ObjType;
+  typedef ValueT ValueType;
+  typedef impl::implCellsCalc<ValueT> CalcT;
+
   ValueT refx, refy;                    // Origin(left-top corner) coordinate.
   ValueT cellw, cellh;                  // Cell size(width/height).
+  ValueT invcellw, invcellh;            // Reciprocal of cell size, floating point only.
   int ncellx, ncelly;                   // Cell count.
   RECT_t<ValueT> rc;                    // Boundary.
 
-  typedef impl::implCellsItem<ObjT, ValueT> ItemT;
+  typedef impl::implCellsItem<ObjT> ItemT;
   typedef ObjectPool<int, INIT_CELL_POOL_SIZE, true> CellT;
 
   ObjectPool<ItemT, INIT_OBJ_POOL_SIZE, true> cobjs; // Manage all objects in the cells.
   std::vector<CellT> cells;             // All cells, each cell manages its' own objects list.
 
+  std::vector<ValueT> objx, objy;       // Coordinate of objects, index by object ID.
+  std::vector<int> objcell;             // Index of cells of objects, index by object ID.
+
   ///
   /// \brief Initialize cells.
   /// \param [in] refx X of reference origin point(left-top corner).
@@ -191,6 +337,8 @@ public:
     this->refy = refy;
     this->cellw = cellw;
     this->cellh = cellh;
+    invcellw = CalcT::recip(cellw);
+    invcellh = CalcT::recip(cellh);
     this->ncellx = ncellx;
     this->ncelly = ncelly;
     rc = RECT_t<ValueT>(refx, refy, refx + ncellx * cellw, refy + ncelly * cellh);
@@ -223,13 +371,19 @@ public:
     }
 
     int id = cobjs.alloc();
+    if ((int)objx.size() <= id) {       // Pool grows.
+      objx.resize(cobjs.capacity());
+      objy.resize(cobjs.capacity());
+      objcell.resize(cobjs.capacity());
+    }
+
     ItemT& i = cobjs[id];
     i.obj = obj;
-    i.cellxy = getCellxy(x, y);
-    i.id = cells[i.cellxy].alloc();
-    i.x = x;
-    i.y = y;
-    cells[i.cellxy][i.id] = id;
+    objcell[id] = getCellxy(x, y);
+    i.id = cells[objcell[id]].alloc();
+    objx[id] = x;
+    objy[id] = y;
+    cells[objcell[id]][i.id] = id;
 
     return id;
   }
@@ -246,8 +400,7 @@ public:
       return false;
     }
 
-    ItemT const& i = cobjs[id];
-    cells[i.cellxy].free(i.id);
+    cells[objcell[id]].free(cobjs[id].id);
 
     cobjs.free(id);
 
@@ -273,21 +426,65 @@ public:
     }
 
     int nextxy = getCellxy(newx, newy);
-
-    ItemT& i = cobjs[id];
-    if (i.cellxy != nextxy) {           // Move to next cell?
-      cells[i.cellxy].free(i.id);       // Remove from prev cell.
-      i.cellxy = nextxy;
-      i.id = cells[i.cellxy].alloc();   // Put to new cell.
-      cells[i.cellxy][i.id] = id;
+    if (objcell[id] != nextxy) {        // Move to next cell?
+      changeCell(id, nextxy);
     }
 
-    i.x = newx;                         // Update new location.
-    i.y = newy;
+    objx[id] = newx;                    // Update new location.
+    objy[id] = newy;
 
     return true;
   }
 
+  ///
+  /// \brief Move objects.
+  /// \param [in] ids IDs of objects.
+  /// \param [in] xs New X coordinates of objects.
+  /// \param [in] ys New Y coordinates of objects.
+  /// \param [in] n Number of objects.
+  /// \return Return number of objects moved. An object of invalid ID or moves
+  ///         out of boundary is not moved.
+  /// \note For float coordinates with SSE2, cells of new coordinates are
+  ///       computed first 4 objects a time, then only objects changed cell
+  ///       are removed and put to cells. Else it is same as move one by one.
+  ///
+
+  int moveBatch(int const* ids, ValueT const* xs, ValueT const* ys, int n)
+  {
+    int moved = 0;
+    if (!impl::implCellsBatch<ValueT>::VECTORIZED) {
+      for (int i = 0; i < n; i++) {
+        if (move(ids[i], xs[i], ys[i])) {
+          moved += 1;
+        }
+      }
+      return moved;
+    }
+
+    const int BATCH = 64;               // Cells of a batch stay in L1 cache.
+    int cell[BATCH];
+
+    for (int i = 0; i < n; i += BATCH) {
+      int m = BATCH < n - i ? BATCH : n - i;
+      impl::implCellsBatch<ValueT>::compute(*this, xs + i, ys + i, m, cell);
+
+      for (int j = 0; j < m; j++) {
+        int id = ids[i + j];
+        if (-1 == cell[j] || !cobjs.isUsed(id)) {
+          continue;
+        }
+        if (objcell[id] != cell[j]) {
+          changeCell(id, cell[j]);
+        }
+        objx[id] = xs[i + j];
+        objy[id] = ys[i + j];
+        moved += 1;
+      }
+    }
+
+    return moved;
+  }
+
   ///
   /// \brief Search objects in a specified circle.
   /// \param [in] x X coordinate of circle center.
@@ -305,7 +502,7 @@ public:
   template<typename FilterT>
   void search(ValueT x, ValueT y, ValueT radius, uint nMax, FilterT& filter) const
   {
-    impl::implCellsSphereFunc<ItemT,ValueT> sf(x, y, radius);
+    impl::implCellsSphereFunc<ValueT> sf(x, y, radius);
     search(x - radius, y - radius, x + radius, y + radius, nMax, filter, sf);
   }
 
@@ -327,15 +524,29 @@ public:
   template<typename FilterT>
   void search(ValueT x1, ValueT y1, ValueT x2, ValueT y2, uint nMax, FilterT& filter) const
   {
-    impl::implCellsRectFunc<ItemT,ValueT> rf(x1, y1, x2, y2);
+    impl::implCellsRectFunc<ValueT> rf(x1, y1, x2, y2);
     search(x1, y1, x2, y2, nMax, filter, rf);
   }
 
 private:
 
+  static int getCell(ValueT d, ValueT size, ValueT inv)
+  {
+    return CalcT::getCell(d, size, inv);
+  }
+
   int getCellxy(ValueT x, ValueT y) const
   {
-    return (int)((x - refx) / cellw) + ncellx * (int)(((y - refy) / cellh));
+    return getCell(x - refx, cellw, invcellw) + ncellx * getCell(y - refy, cellh, invcellh);
+  }
+
+  void changeCell(int id, int nextxy)
+  {
+    ItemT& i = cobjs[id];
+    cells[objcell[id]].free(i.id);      // Remove from prev cell.
+    objcell[id] = nextxy;
+    i.id = cells[nextxy].alloc();       // Put to new cell.
+    cells[nextxy][i.id] = id;
   }
 
   //
@@ -361,22 +572,22 @@ private:
       return;
     }
 
-    bd[LEFT] = (int)((x1 - refx) / cellw); // Find boundary cell.
+    bd[LEFT] = getCell(x1 - refx, cellw, invcellw); // Find boundary cell.
     if (0 > bd[LEFT]) {
       bd[LEFT] = 0;
     }
 
-    bd[TOP] = (int)((y1 - refy) / cellh);
+    bd[TOP] = getCell(y1 - refy, cellh, invcellh);
     if (0 > bd[TOP]) {
       bd[TOP] = 0;
     }
 
-    bd[RIGHT] = (int)((x2 - refx) / cellw);
+    bd[RIGHT] = getCell(x2 - refx, cellw, invcellw);
     if (ncellx <= bd[RIGHT]) {
       bd[RIGHT] = ncellx - 1;
     }
 
-    bd[BOTTOM] = (int)((y2 - refy) / cellh);
+    bd[BOTTOM] = getCell(y2 - refy, cellh, invcellh);
     if (ncelly <= bd[BOTTOM]) {
       bd[BOTTOM] = ncelly - 1;
     }
@@ -401,11 +612,11 @@ private:
       if (0 <= cc && ncellx * ncelly > cc) {
         const CellT &p = cells[cc];
         for (int i = p.first(); -1 != i && 0 < nMax; i = p.next(i)) {
-          ItemT const& obj = cobjs[p[i]];
-          if (!func(obj)) {
+          int id = p[i];
+          if (!func(objx[id], objy[id])) {
             continue;
           }
-          if (filter(obj.obj, obj.x, obj.y)) {
+          if (filter(cobjs[id].obj, objx[id], objy[id])) {
             nMax -= 1;
           }
         }
@@ -477,6 +688,253 @@ private:
   }
 };
 
+///
+/// \brief Batch of searches over a Cells, run in parallel by ThreadPool.
+/// \note Queries are added to the batch then run at once. Each query writes
+///       found objects to its own span of a result buffer, in the same order
+///       of Cells::search, so results do not depend on the number of threads.
+/// \note The Cells must not be changed while run, i.e. read only snapshot.
+///
+
+template<typename CellsT>
+class CellsQueryBatch
+{
+public:
+
+  typedef typename CellsT::ValueType ValueT;
+  typedef typename CellsT::ObjType ObjT;
+
+  CellsQueryBatch() : mCells(0), mNext(0)
+  {
+  }
+
+  ///
+  /// \brief Remove all queries.
+  /// \note Result buffer is kept, so next batch of the same size allocates
+  ///       nothing.
+  ///
+
+  void clear()
+  {
+    mQuery.clear();
+    mMax.clear();
+    mOffset.clear();
+    mCount.clear();
+  }
+
+  ///
+  /// \brief Add a search in a specified circle.
+  /// \param [in] x X coordinate of circle center.
+  /// \param [in] y Y coordinate of circle center.
+  /// \param [in] radius Radius of the circle.
+  /// \param [in] nMax Max number of objects to search, clamped to number of
+  ///            objects of the cells when run.
+  /// \return Return index of the query.
+  ///
+
+  int addSearch(ValueT x, ValueT y, ValueT radius, uint nMax)
+  {
+    Query q = {x, y, radius, 0, true};
+    return add(q, nMax);
+  }
+
+  ///
+  /// \brief Add a search in a specified rectangle.
+  /// \param [in] x1 X coordinate of left-top corner.
+  /// \param [in] y1 Y coordinate of left-top corner.
+  /// \param [in] x2 X coordinate of right-bottom corner.
+  /// \param [in] y2 Y coordinate of right-bottom corner.
+  /// \param [in] nMax Max number of objects to search, clamped to number of
+  ///            objects of the cells when run.
+  /// \return Return index of the query.
+  ///
+
+  int addSearch(ValueT x1, ValueT y1, ValueT x2, ValueT y2, uint nMax)
+  {
+    Query q = {x1, y1, x2, y2, false};
+    return add(q, nMax);
+  }
+
+  ///
+  /// \brief Run all queries.
+  /// \param [in] cells The cells to search.
+  /// \param [in] nThread Number of tasks to run in ThreadPool.
+  /// \note The calling thread runs queries too, and returns after all queries
+  ///       are done. If ThreadPool is not initialized or busy, queries are run
+  ///       by the calling thread.
+  ///
+
+  void run(CellsT const& cells, int nThread)
+  {
+    mCells = &cells;
+    mNext = 0;
+
+    //
+    // A query never finds more than all objects, so a huge nMax does not
+    // grow the result buffer.
+    //
+
+    size_t offset = 0;
+    uint nObj = (uint)cells.cobjs.size();
+    for (size_t i = 0; i < mQuery.size(); i++) {
+      mOffset[i] = offset;
+      mCount[i] = 0;
+      offset += (std::min)(mMax[i], nObj);
+    }
+
+    if (mResult.size() < offset) {
+      mResult.resize(offset);
+    }
+
+    if ((int)mTask.size() != nThread) {
+      mTask.resize(nThread);
+    }
+
+    for (size_t i = 0; i < mTask.size(); i++) {
+      mTask[i].mBatch = this;
+      mTask[i].runTask();
+    }
+
+    runQuery();
+
+    for (size_t i = 0; i < mTask.size(); i++) {
+      while (mTask[i].isRunning()) {
+        Util::sleep(0);                 // Yield to tasks of the last chunks.
+      }
+    }
+
+    mCells = 0;
+  }
+
+  ///
+  /// \brief Get number of queries.
+  /// \return Return number of queries.
+  ///
+
+  int size() const
+  {
+    return (int)mQuery.size();
+  }
+
+  ///
+  /// \brief Get number of objects found by a query.
+  /// \param [in] i Index of query.
+  /// \return Return number of objects found.
+  ///
+
+  int getCount(int i) const
+  {
+    return mCount[i];
+  }
+
+  ///
+  /// \brief Get objects found by a query.
+  /// \param [in] i Index of query.
+  /// \return Return first of getCount(i) objects found.
+  ///
+
+  ObjT const* getResult(int i) const
+  {
+    return mResult.empty() ? 0 : &mResult[0] + mOffset[i];
+  }
+
+private:
+
+  struct Query
+  {
+    ValueT x1, y1, x2, y2;              // Rectangle, or center (x1,y1) and radius x2 of circle.
+    bool bCircle;
+  };
+
+  //
+  // Filter writes objects to the span of a query.
+  //
+
+  struct Collector
+  {
+    ObjT* p;
+    int n;
+
+    bool operator()(ObjT const& obj, ValueT, ValueT)
+    {
+      p[n++] = obj;
+      return true;
+    }
+  };
+
+  class Task : public ThreadTask
+  {
+  public:
+
+    CellsQueryBatch* mBatch;
+
+    Task() : mBatch(0)
+    {
+    }
+
+    Task(Task const&) : ThreadTask(), mBatch(0) // Copy of vector resize, never running.
+    {
+    }
+
+    virtual void threadTask()
+    {
+      mBatch->runQuery();
+    }
+  };
+
+  enum { QUERY_CHUNK = 16 };            // Queries to take a time.
+
+  int add(Query const& q, uint nMax)
+  {
+    mQuery.push_back(q);
+    mMax.push_back(nMax);
+    mOffset.push_back(0);               // Span is decided when run.
+    mCount.push_back(0);
+    return (int)mQuery.size() - 1;
+  }
+
+  //
+  // Take chunks of queries until all are taken, shared by the calling thread
+  // and tasks.
+  //
+
+  void runQuery()
+  {
+    int n = (int)mQuery.size();
+    uint nObj = (uint)mCells->cobjs.size();
+    while (true) {
+      int i = QUERY_CHUNK * (int)(Util::atomicIncrement(&mNext) - 1);
+      if (n <= i) {
+        break;
+      }
+      int end = i + QUERY_CHUNK < n ? i + QUERY_CHUNK : n;
+      for (; i < end; i++) {
+        Query const& q = mQuery[i];
+        Collector c = {0, 0};
+        uint nMax = (std::min)(mMax[i], nObj); // Same span size of run.
+        if (0 < nMax) {
+          c.p = &mResult[0] + mOffset[i];
+          if (q.bCircle) {
+            mCells->search(q.x1, q.y1, q.x2, nMax, c);
+          } else {
+            mCells->search(q.x1, q.y1, q.x2, q.y2, nMax, c);
+          }
+        }
+        mCount[i] = c.n;
+      }
+    }
+  }
+
+  CellsT const* mCells;
+  std::vector<Query> mQuery;
+  std::vector<uint> mMax;               // Max objects of queries.
+  std::vector<size_t> mOffset;          // Span of queries in mResult.
+  std::vector<int> mCount;
+  std::vector<ObjT> mResult;
+  std::vector<Task> mTask;
+  long volatile mNext;                  // Next chunk of queries to run.
+};
+
 } // namespace sw2
 
 // end of swCells.h
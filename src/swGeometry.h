@@ -39,6 +39,25 @@ struct POINT_t
 typedef POINT_t<int> IntPoint;
 typedef POINT_t<float> FloatPoint;
 
+///
+/// \brief 3D point.
+///
+
+template<typename ValueT>
+struct POINT3_t
+{
+  POINT3_t(ValueT x_ = ValueT(), ValueT y_ = ValueT(), ValueT z_ = ValueT()) : x(x_), y(y_), z(z_)
+  {
+  }
+
+  ValueT x;                           ///< X coordinate of the point.
+  ValueT y;                           ///< Y coordinate of the point.
+  ValueT z;                           ///< Z coordinate of the point.
+};
+
+typedef POINT3_t<int> IntPoint3;
+typedef POINT3_t<float> FloatPoint3;
+
 ///
 /// \brief 2D rectangle.
 ///
@@ -8,12 +8,24 @@
 //  2005/08/02 Waync created.
 //
 
+#include <stdio.h>
 #include <time.h>
 
+#if defined(WIN32)
+# include <windows.h>
+# include <wincrypt.h>
+# if defined(_MSC_VER)
+#   pragma comment(lib, "advapi32")
+# endif
+#endif
+
 #include <algorithm>
+#include <map>
+#include <vector>
 
 #include "swNetwork.h"
 #include "swObjectPool.h"
+#include "swThreadPool.h"
 #include "swUtil.h"
 
 //
@@ -33,6 +45,28 @@
 //  MAX PACKET SIZE IS 1024 BYTES, MAX DATA SIZE IS:
 //    (00) Stream: 2(stream beg) + n(stream) + 2(stream end)
 //    (11) Keepalive: 2(header only)
+//    (11) Ping/pong: 2(header) + 4(timestamp)
+//    (11) Session control: 2(header) + 4 * n(values)
+//
+//  Both sides send version first after connected. A peer never sends version
+//  is an old one, it only accepts keep alive, stream begin and end, and a
+//  control packet with payload as the first packet. So ping, batch stream and
+//  session are used only after version of the peer is received.
+//
+//  A ping carries the sender's timestamp in microseconds, the receiver echoes
+//  it back in a pong immediately, the sender gets round trip time from it.
+//
+//  Session resumption: a client sends version after connected, a server with
+//  session enabled replies a session id and a random token. Both sides count streams received
+//  and ack the count periodically, sent streams are kept until acked. When the
+//  connection drops, the server keeps the session, the client reconnects and
+//  sends resume with the id, token and its count, the server replies resumed with
+//  its count, then both sides resend streams not received by the peer. Bye is
+//  sent before disconnect on purpose, the session is closed.
+//
+//  A batch stream starts with batch beg instead of stream beg, the stream is a
+//  list of small streams and each is prefixed with a 7-bits varint length:
+//    2(batch beg) + [len + n(stream)] + [len + n(stream)] + ... + 2(stream end)
 //
 
 namespace sw2 {
@@ -43,33 +77,335 @@ namespace impl {
 // Constants.
 //
 
-#define MAX_CLIENT 4096                 // Max client connection of a single server.
-#define TIMEOUT_KEEP_ALIVE 25           // Send a keep alive signal if there's no data sent after this interval, sec.
+#define INIT_CLIENT 64                  // Initial size of client connection pool of a single server.
+#define TIMEOUT_KEEP_ALIVE 25           // Max interval of keep alive ping, sec.
+#define MIN_KEEP_ALIVE 1                // Min interval of keep alive ping, sec.
 #define TIMEOUT_DEAD_CONNECTION 60      // Force disconnect if there's no data received after this interval, sec.
 #define MAX_PACKET_BUFFER_SIZE 1024     // Max buffer size, bytes.
 #define PACKET_HEADER_SIZE 2            // Size of packet header, bytes.
+#define MAX_BATCH_BUFFER_SIZE 4096      // Max buffered size of a batch stream, bytes.
+#define MAX_BATCH_STREAM_SIZE 512       // Max size of a stream can be batched, bytes.
+#define MAX_LEAN_FREE_BUFF 64           // Max shared free receive buffers kept in lean mode.
+#define INTERVAL_SAMPLE_QUEUE 1000      // Sample interval of send buffer bytes, millisecond.
+#define INTERVAL_ACK 100                // Min interval of stream ack, millisecond.
+#define INTERVAL_RESUME 1000            // Retry interval of resume connect, millisecond.
+#define TIMEOUT_PENDING 10              // Wait version or resume of a new connection, sec.
+#define MAX_SESSION_TIMEOUT 3600        // Max session timeout, sec.
+#define MAX_SESSION_UNACKED (1024 * 1024) // Default max bytes of unacked sent streams of a session.
+#define MAX_CTRL_PACKET_SIZE 18         // Max size of control packet, bytes.
+#define PENDING_CONNECTION ((uint_ptr)-2) // User data of a socket waiting version or resume.
+#define DETACHED_CONNECTION ((uint_ptr)-1) // User data of a socket not owned by a connection.
+
+#define NETWORK_PROTOCOL_VERSION 2      // Version of ping, batch stream and session, 0 if peer is an old one.
 
 #define MAKE_PACKET_HEADER(len, type, flag) ((len) | ((type) << 10) | ((flag) << 12))
 
 ushort const keepAlive = MAKE_PACKET_HEADER(0, 3, 0x0);
 ushort const streamBeg = MAKE_PACKET_HEADER(0, 0, 0xc);
 ushort const streamEnd = MAKE_PACKET_HEADER(0, 0, 0x8);
+ushort const batchBeg = MAKE_PACKET_HEADER(0, 0, 0xd);
+ushort const ping = MAKE_PACKET_HEADER(4, 3, 0x1);
+ushort const pong = MAKE_PACKET_HEADER(4, 3, 0x2);
+ushort const version = MAKE_PACKET_HEADER(4, 3, 0x0); // Protocol version(4).
+ushort const bye = MAKE_PACKET_HEADER(0, 3, 0x4);
+ushort const session = MAKE_PACKET_HEADER(16, 3, 0x5); // Session id(4) + token(8) + timeout(4).
+ushort const ack = MAKE_PACKET_HEADER(4, 3, 0x6); // Received streams(4).
+ushort const resume = MAKE_PACKET_HEADER(16, 3, 0x7); // Session id(4) + token(8) + received streams(4).
+ushort const resumed = MAKE_PACKET_HEADER(4, 3, 0x8); // Received streams(4).
+
+//
+// Control packet.
+//
+
+inline int makeCtrlPacket(uchar* p, ushort header, uint v0 = 0, uint v1 = 0, uint v2 = 0, uint v3 = 0)
+{
+  uint v[4] = {v0, v1, v2, v3};
+  p[0] = (uchar)header;
+  p[1] = (uchar)(header >> 8);
+  int len = header & 0x3ff;
+  for (int i = 0; i < len; i++) {
+    p[PACKET_HEADER_SIZE + i] = (uchar)(v[i / 4] >> (8 * (i % 4)));
+  }
+  return PACKET_HEADER_SIZE + len;
+}
+
+inline uint getCtrlValue(uchar const* p, int i)
+{
+  p += PACKET_HEADER_SIZE + 4 * i;
+  return (uint)p[0] | ((uint)p[1] << 8) | ((uint)p[2] << 16) | ((uint)p[3] << 24);
+}
+
+inline uint64 getCtrlToken(uchar const* p, int i)
+{
+  return (uint64)getCtrlValue(p, i) | ((uint64)getCtrlValue(p, i + 1) << 32);
+}
+
+//
+// Session token, from the random source of system, a guessed token must not
+// resume other's session.
+//
+
+bool genToken(uint64& token)
+{
+#if defined(WIN32)
+  HCRYPTPROV hProv;
+  if (!::CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) {
+    return false;
+  }
+  BOOL ret = ::CryptGenRandom(hProv, sizeof(token), (BYTE*)&token);
+  ::CryptReleaseContext(hProv, 0);
+  return FALSE != ret;
+#else
+  FILE* f = ::fopen("/dev/urandom", "rb");
+  if (0 == f) {
+    return false;
+  }
+  size_t n = ::fread(&token, sizeof(token), 1, f);
+  ::fclose(f);
+  return 1 == n;
+#endif
+}
+
+inline bool isSameToken(uint64 a, uint64 b)
+{
+  uint diff = 0;                        // Constant time, no early out.
+  for (int i = 0; i < 8; i++) {
+    diff |= (uint)((a ^ b) >> (8 * i)) & 0xff;
+  }
+  return 0 == diff;
+}
+
+//
+// Batch stream length prefix.
+//
+
+inline void appendBatchLen(std::string &s, uint len)
+{
+  while (0x80 <= len) {
+    s.push_back((char)((len & 0x7f) | 0x80));
+    len >>= 7;
+  }
+  s.push_back((char)len);
+}
+
+inline bool readBatchLen(uchar const*& p, uchar const* end, uint &len)
+{
+  len = 0;
+  for (int shift = 0; p < end && 28 >= shift; shift += 7) {
+    uchar c = *p++;
+    len |= (uint)(c & 0x7f) << shift;
+    if (0 == (c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
 
 //
 // Implementation.
 //
 
+class implNetworkBuffPool
+{
+public:
+
+  ~implNetworkBuffPool()
+  {
+    for (size_t i = 0; i < m_free.size(); i++) {
+      delete [] m_free[i];
+    }
+  }
+
+  uchar* alloc()
+  {
+    if (m_free.empty()) {
+      return new uchar[MAX_PACKET_BUFFER_SIZE];
+    }
+
+    uchar* p = m_free.back();
+    m_free.pop_back();
+
+    return p;
+  }
+
+  void free(uchar* p)
+  {
+    if (MAX_LEAN_FREE_BUFF > (int)m_free.size()) {
+      m_free.push_back(p);
+    } else {
+      delete [] p;
+    }
+  }
+
+  size_t getBytesMem() const
+  {
+    return m_free.size() * MAX_PACKET_BUFFER_SIZE;
+  }
+
+public:
+
+  std::vector<uchar*> m_free;           // Free receive buffers.
+};
+
+//
+// Pipeline message, received data to decode or stream to send.
+//
+
+struct implNetworkMsg
+{
+  implNetworkMsg* pNext;                // Next message.
+  void* pConn;                          // Owner connection.
+  int len;                              // Data length, -1 to disconnect, -2 to send a pong, -3 to update RTT, -4 to set peer version.
+  uint stamp;                           // Timestamp of pong, RTT, or peer version.
+
+  uchar* data()
+  {
+    return (uchar*)(this + 1);
+  }
+
+  static implNetworkMsg* alloc(void* pConn, int len, void const* pData)
+  {
+    implNetworkMsg* p = (implNetworkMsg*)::operator new(sizeof(implNetworkMsg) + (std::max)(0, len));
+    p->pNext = 0;
+    p->pConn = pConn;
+    p->len = len;
+    if (0 < len) {
+      ::memcpy(p->data(), pData, len);
+    }
+    return p;
+  }
+
+  static void free(implNetworkMsg* p)
+  {
+    ::operator delete(p);
+  }
+};
+
+//
+// Lock-free message queue, multiple producers and single consumer. Producers
+// push to a stack, the consumer takes the whole stack and reverses it, so no
+// ABA problem.
+//
+
+class implNetworkMsgQueue
+{
+public:
+
+  implNetworkMsgQueue() : m_pHead(0)
+  {
+  }
+
+  ~implNetworkMsgQueue()
+  {
+    clear();
+  }
+
+  bool empty() const
+  {
+    return 0 == m_pHead;                // Hint only, may change by producers.
+  }
+
+  void push(implNetworkMsg* p)
+  {
+    void* pHead = 0;
+    while (true) {
+      p->pNext = (implNetworkMsg*)pHead;
+      void* pPrev = Util::atomicCompareExchangePointer(&m_pHead, p, pHead);
+      if (pPrev == pHead) {
+        break;
+      }
+      pHead = pPrev;                    // Retry with current top.
+    }
+  }
+
+  implNetworkMsg* popAll()
+  {
+    implNetworkMsg* p = (implNetworkMsg*)Util::atomicExchangePointer(&m_pHead, 0);
+
+    //
+    // Reverse to push order.
+    //
+
+    implNetworkMsg* pHead = 0;
+    while (p) {
+      implNetworkMsg* pNext = p->pNext;
+      p->pNext = pHead;
+      pHead = p;
+      p = pNext;
+    }
+
+    return pHead;
+  }
+
+  void clear()
+  {
+    implNetworkMsg* p = popAll();
+    while (p) {
+      implNetworkMsg* pNext = p->pNext;
+      implNetworkMsg::free(p);
+      p = pNext;
+    }
+  }
+
+public:
+
+  void* volatile m_pHead;               // Top of message stack.
+};
+
+//
+// Histograms recorded by the strand of a connection in pipeline mode, merged
+// by reactor when the strand is not running.
+//
+
+struct implNetworkHistStrand
+{
+  NetworkHistogram msgSizeIn;
+  NetworkHistogram callbackTime;
+};
+
 class implNetworkBase
 {
 public:
 
+  implNetworkBase() : m_buffLen(0), m_buff(0), m_pBuffPool(0), m_bLean(false), m_batchWindow(-1), m_batchTime(0), m_bBatch(false), m_peerVersion(0), m_pHist(0), m_pHistStrand(0), m_unackedHead(0), m_bytesUnacked(0), m_maxUnacked(MAX_SESSION_UNACKED)
+  {
+    resetRtt();
+    resetSession();
+  }
+
   virtual ~implNetworkBase()
   {
+    releaseBuff();
+  }
+
+  uchar* allocBuff()
+  {
+    if (m_pBuffPool) {
+      return m_pBuffPool->alloc();
+    }
+
+    return new uchar[MAX_PACKET_BUFFER_SIZE];
+  }
+
+  void releaseBuff()
+  {
+    if (m_pBuffPool && m_buff) {
+      m_pBuffPool->free(m_buff);
+    } else {
+      delete [] m_buff;
+    }
+    m_buff = 0;
+    m_buffLen = 0;
+  }
+
+  size_t getBytesMemBuff() const
+  {
+    return m_ss.capacity() + m_batch.capacity() + (m_buff ? MAX_PACKET_BUFFER_SIZE : 0);
   }
 
   bool isBadHeader(ushort header) const
   {
-    if (keepAlive == header || streamBeg == header || streamEnd == header) {
+    if (streamBeg == header || streamEnd == header || batchBeg == header || 3 == ((header >> 10) & 0x3)) {
       return false;
     }
 
@@ -87,19 +423,36 @@ public:
   {
     do {
 
-      int l = std::min(MAX_PACKET_BUFFER_SIZE - m_buffLen, len);
+      uchar const* p;
+      int lenBuff;
+
+      if (0 == m_buffLen) {
+
+        //
+        // Nothing is buffered, process the stream directly.
+        //
+
+        p = (uchar const*)pStream;
+        lenBuff = len;
+        len = 0;
+
+      } else {
 
-      ::memcpy(m_buff + m_buffLen, pStream, l);
-      m_buffLen += l;
+        int l = std::min(MAX_PACKET_BUFFER_SIZE - m_buffLen, len);
 
-      pStream = (uchar*)pStream + l;
-      len -= l;
+        ::memcpy(m_buff + m_buffLen, pStream, l);
+        m_buffLen += l;
 
-      uchar* p = m_buff;
+        pStream = (uchar*)pStream + l;
+        len -= l;
+
+        p = m_buff;
+        lenBuff = m_buffLen;
+      }
 
       while (true) {
 
-        if (PACKET_HEADER_SIZE > m_buffLen) {
+        if (PACKET_HEADER_SIZE > lenBuff) {
           break;
         }
 
@@ -117,7 +470,12 @@ public:
         //
 
         int lenPacket = header & 0x3ff; // # bytes, len of data only not include header.
-        if (lenPacket + PACKET_HEADER_SIZE > m_buffLen) {
+        if (lenPacket + PACKET_HEADER_SIZE > MAX_PACKET_BUFFER_SIZE) {
+          SW2_TRACE_ERROR("Bad packet length.");
+          return false;                 // Never fits the receive buffer.
+        }
+
+        if (lenPacket + PACKET_HEADER_SIZE > lenBuff) {
           break;
         }
 
@@ -131,10 +489,20 @@ public:
           // Process keep-alive or stream packet header.
           //
 
-          if (streamBeg == header) {    // Stream start?
+          if (streamBeg == header || batchBeg == header) { // Stream start?
             m_ss = "";                  // Reset buffer.
+            m_bBatch = batchBeg == header;
           } else if (streamEnd == header) { // Stream end.
-            onStreamReady_i((int)m_ss.length(), m_ss.data());
+            if (!m_bBatch) {
+              notifyStreamReady_i((int)m_ss.length(), m_ss.data());
+            } else if (!handleBatchReady(t)) {
+              return false;
+            }
+            if (m_bLean) {              // Lean mode, release after the message completes.
+              std::string().swap(m_ss);
+            }
+          } else if (bye == header) {   // Session closed by peer.
+            m_bBye = true;
           } else if (keepAlive != header) {
             SW2_TRACE_ERROR("Invalid keep alive header.");
             return false;
@@ -154,6 +522,26 @@ public:
             IncRecvPack();
             break;
           case 3:                       // Keep-alive signal.
+            if (version == header) {
+              onVersion_i(getCtrlValue(p, 0));
+            } else if (ping == header) {
+              if (!sendPong_i(getCtrlValue(p, 0))) {
+                return false;
+              }
+            } else if (pong == header) {
+              onPong_i((uint)Util::getTickCountUs() - getCtrlValue(p, 0));
+            } else if (session == header) {
+              if (!onSession_i(getCtrlValue(p, 0), getCtrlToken(p, 1), getCtrlValue(p, 3))) {
+                return false;
+              }
+            } else if (ack == header) {
+              processAck(getCtrlValue(p, 0));
+            } else if (resumed == header) {
+              if (!onResumed_i(getCtrlValue(p, 0))) {
+                m_bBye = true;          // Can not resume, close the session.
+                return false;
+              }
+            }
             break;
           }
         }
@@ -167,21 +555,56 @@ public:
         }
 
         p += lenPacket + PACKET_HEADER_SIZE;
-        assert(m_buffLen >= lenPacket + PACKET_HEADER_SIZE);
-        m_buffLen -= lenPacket + PACKET_HEADER_SIZE;
+        assert(lenBuff >= lenPacket + PACKET_HEADER_SIZE);
+        lenBuff -= lenPacket + PACKET_HEADER_SIZE;
       }
 
-      if (m_buffLen) {
-        ::memcpy(m_buff, p, m_buffLen);
+      //
+      // Keep the incomplete packet, receive buffer is allocated on demand.
+      //
+
+      if (lenBuff) {
+        if (0 == m_buff) {
+          m_buff = allocBuff();
+        }
+        ::memmove(m_buff, p, lenBuff);
+        m_buffLen = lenBuff;
+      } else if (m_bLean) {
+        releaseBuff();                  // Lean mode, release or back to shared pool.
+      } else {
+        m_buffLen = 0;
       }
 
     } while (0 < len);
 
+    return true;
+  }
+
+  template<class T>
+  bool handleBatchReady(T* t)
+  {
     //
-    // Reset timeout timer.
+    // Unpack small streams of a batch stream.
     //
 
-    m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
+    uchar const* p = (uchar const*)m_ss.data();
+    uchar const* end = p + m_ss.length();
+
+    while (p < end) {
+
+      uint len;
+      if (!readBatchLen(p, end, len) || 0 == len || (uint)(end - p) < len) {
+        SW2_TRACE_ERROR("Bad batch stream.");
+        return false;
+      }
+
+      notifyStreamReady_i((int)len, p);
+      p += len;
+
+      if (CS_CONNECTED != t->getConnectionState()) {
+        break;
+      }
+    }
 
     return true;
   }
@@ -228,23 +651,121 @@ public:
       return false;
     }
 
+    return true;
+  }
+
+  template<class T>
+  bool send_i(T* t, int len, void const* pStream)
+  {
+    if (0 < len) {
+      m_pHist->msgSizeOut.add((uint)len);
+
+      //
+      // Keep the stream until acked in session mode, if the connection is
+      // suspended, send it after resumed.
+      //
+
+      if (m_bSession) {
+        if (m_maxUnacked < m_bytesUnacked + len) {
+          SW2_TRACE_ERROR("Too many unacked streams, drop the session.");
+          m_bBye = true;                // Caller disconnects.
+          return false;
+        }
+        m_unacked.push_back(std::string((char const*)pStream, len));
+        m_bytesUnacked += len;
+      }
+      m_streamSent += 1;
+      if (m_bSuspended) {
+        return true;
+      }
+    }
+
+    return sendStream_i(t, len, pStream);
+  }
+
+  template<class T>
+  bool sendStream_i(T* t, int len, void const* pStream)
+  {
+    //
+    // Send stream raw data.
+    //
+
+    if (0 > m_batchWindow || NETWORK_PROTOCOL_VERSION > m_peerVersion) { // Old peer can not read batch stream.
+      return send_i(t, (char*)pStream, len, 0, streamBeg, streamEnd);
+    }
+
+    if (0 >= len || CS_CONNECTED != t->getConnectionState()) {
+      return false;
+    }
+
     //
-    // Reset timeout timer.
+    // Batch mode, queue the stream and send later with other streams in a
+    // single batch stream.
     //
 
-    m_keepAliveTimeout.setTimeout(1000 * TIMEOUT_KEEP_ALIVE);
+    if (MAX_BATCH_STREAM_SIZE < len) {  // Too big, send it directly.
+      return flush_i(t) && send_i(t, (char*)pStream, len, 0, streamBeg, streamEnd);
+    }
+
+    if (MAX_BATCH_BUFFER_SIZE < (int)m_batch.length() + len + 4 && !flush_i(t)) {
+      return false;
+    }
+
+    if (m_batch.empty()) {
+      m_batchTime = Util::getTickCountUs();
+    }
+
+    appendBatchLen(m_batch, (uint)len);
+    m_batch.append((char const*)pStream, len);
 
     return true;
   }
 
   template<class T>
-  bool send_i(T* t, int len, void const* pStream)
+  bool flush_i(T* t)
+  {
+    if (m_batch.empty()) {
+      return true;
+    }
+
+    bool ret = send_i(t, m_batch.data(), (int)m_batch.length(), 0, batchBeg, streamEnd);
+    if (m_bLean) {
+      std::string().swap(m_batch);
+    } else {
+      m_batch.clear();
+    }
+
+    return ret;
+  }
+
+  template<class T>
+  bool flushBatch_(T* t)
   {
     //
-    // Send stream raw data.
+    // Send batched streams if batch window is expired.
     //
 
-    return send_i(t, (char*)pStream, len, 0, streamBeg, streamEnd);
+    if (m_batch.empty()) {
+      return true;
+    }
+
+    if (CS_CONNECTED != t->getConnectionState()) {
+      m_batch.clear();
+      return true;
+    }
+
+    if (0 < m_batchWindow && (uint64)m_batchWindow > Util::getTickCountUs() - m_batchTime) {
+      return true;
+    }
+
+    return flush_i(t);
+  }
+
+  void resetBatch(int batchWindow)
+  {
+    m_batchWindow = batchWindow;
+    m_batch.clear();
+    m_bBatch = false;
   }
 
   template<class T>
@@ -263,39 +784,245 @@ public:
     }
 
     //
-    // Check keep alive timeout timer, send immediately.
+    // Check keep alive timeout timer, send a ping immediately. Old peer
+    // does not know ping, send a keep alive signal instead.
     //
 
     if (m_keepAliveTimeout.isExpired()) {
-      if (!t->send(PACKET_HEADER_SIZE, (void*)&keepAlive)) {
+      uchar p[MAX_CTRL_PACKET_SIZE];
+      if (NETWORK_PROTOCOL_VERSION > m_peerVersion) {
+        if (!t->send(PACKET_HEADER_SIZE, (void*)&keepAlive)) {
+          return false;
+        }
+        m_keepAliveTimeout.setTimeout(1000 * TIMEOUT_KEEP_ALIVE);
+      } else {
+        if (!t->send(makeCtrlPacket(p, ping, (uint)Util::getTickCountUs()), p)) {
+          return false;
+        }
+        m_keepAliveTimeout.setTimeout(m_keepAliveInterval);
+      }
+    }
+
+    //
+    // Ack received streams in session mode.
+    //
+
+    if (m_bSession && m_streamRecv != m_streamAcked && m_ackTimeout.isExpired()) {
+      uchar p[MAX_CTRL_PACKET_SIZE];
+      if (!t->send(makeCtrlPacket(p, ack, m_streamRecv), p)) {
         return false;
       }
-      m_keepAliveTimeout.setTimeout(1000 * TIMEOUT_KEEP_ALIVE);
+      m_streamAcked = m_streamRecv;
+      m_ackTimeout.setTimeout(INTERVAL_ACK);
     }
 
     return true;
   }
 
   //
-  // Callback.
+  // Session.
   //
 
-  virtual void onStreamReady_i(int len, void const* pStream)=0;
-  virtual void IncRecvPack()=0;
-  virtual void IncSendPack()=0;
+  void resetSession()
+  {
+    m_bSession = m_bSuspended = m_bBye = false;
+    m_sessionId = 0;
+    m_token = 0;
+    m_sessionTimeout = 0;
+    m_streamSent = m_streamRecv = m_streamAcked = 0;
+    std::vector<std::string>().swap(m_unacked); // Empty vector holds no heap memory.
+    m_unackedHead = 0;
+    m_bytesUnacked = 0;
+  }
 
-public:
+  uint getStreamBase() const
+  {
+    return m_streamSent - (uint)(m_unacked.size() - m_unackedHead); // Seq of first unacked stream.
+  }
 
-  int m_buffLen;                        // Buffered receive data length.
-  uchar m_buff[MAX_PACKET_BUFFER_SIZE]; // Receive data buffer.
+  bool canResume(uint streamRecv) const
+  {
+    return 0 <= (int)(streamRecv - getStreamBase()) && 0 <= (int)(m_streamSent - streamRecv);
+  }
 
-  std::string m_ss;                     // Stream buffer.
+  void processAck(uint streamRecv)
+  {
+    uint base = getStreamBase();
+    while (m_unacked.size() > m_unackedHead && 0 < (int)(streamRecv - base)) {
+      m_bytesUnacked -= m_unacked[m_unackedHead].length();
+      std::string().swap(m_unacked[m_unackedHead]);
+      m_unackedHead += 1;
+      base += 1;
+    }
+
+    //
+    // Acked streams are released, compact the slots when most are acked.
+    //
+
+    if (m_unacked.size() == m_unackedHead) {
+      m_unacked.clear();
+      m_unackedHead = 0;
+    } else if (m_unacked.size() <= 2 * m_unackedHead) {
+      m_unacked.erase(m_unacked.begin(), m_unacked.begin() + m_unackedHead);
+      m_unackedHead = 0;
+    }
+  }
+
+  template<class T>
+  bool resend_i(T* t)
+  {
+    for (size_t i = m_unackedHead; i < m_unacked.size(); i++) {
+      if (!sendStream_i(t, (int)m_unacked[i].length(), m_unacked[i].data())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void suspend_i()
+  {
+    //
+    // Connection dropped, keep the session. Batched streams are kept in
+    // unacked streams and resent after resumed.
+    //
+
+    m_bSuspended = true;
+    m_batch.clear();
+    m_bBatch = false;
+    m_ss.clear();
+    m_sessionExpire.setTimeout(1000 * m_sessionTimeout);
+  }
+
+  size_t getBytesMemSession() const
+  {
+    size_t n = m_unacked.capacity() * sizeof(std::string);
+    for (size_t i = m_unackedHead; i < m_unacked.size(); i++) {
+      n += m_unacked[i].capacity();
+    }
+    return n;
+  }
+
+  //
+  // RTT.
+  //
+
+  void resetRtt()
+  {
+    m_rtt = m_rttJitter = 0;
+    m_keepAliveInterval = 1000 * MIN_KEEP_ALIVE; // Measure soon after connected.
+    m_keepAliveTimeout.setTimeout(m_keepAliveInterval);
+  }
+
+  void updateRtt(uint rtt)
+  {
+    //
+    // Smoothed RTT and jitter. Keep alive interval grows while RTT is stable,
+    // and shrinks to measure more often when RTT changes.
+    //
+
+    if (0 == m_rtt) {
+      m_rtt = (std::max)(1u, rtt);
+      m_rttJitter = rtt / 2;
+      return;
+    }
+
+    uint delta = m_rtt > rtt ? m_rtt - rtt : rtt - m_rtt;
+    bool bStable = delta <= 2 * m_rttJitter + 1000;
+
+    m_rttJitter = (3 * m_rttJitter + delta) / 4;
+    m_rtt = (std::max)(1u, (7 * m_rtt + rtt) / 8);
+
+    if (bStable) {
+      m_keepAliveInterval = (std::min)(2 * m_keepAliveInterval, 1000 * TIMEOUT_KEEP_ALIVE);
+    } else {
+      m_keepAliveInterval = (std::max)(m_keepAliveInterval / 2, 1000 * MIN_KEEP_ALIVE);
+    }
+  }
+
+  void setPeerVersion(uint ver)
+  {
+    m_peerVersion = ver;
+    m_keepAliveTimeout.setTimeout(m_keepAliveInterval); // Ping soon.
+  }
+
+  void getRttStats(NetworkClientStats &ns) const
+  {
+    ns.rtt = m_rtt;
+    ns.rttJitter = m_rttJitter;
+  }
+
+  void notifyStreamReady_i(int len, void const* pStream)
+  {
+    m_streamRecv += 1;
+
+    uint64 t = Util::getTickCountUs();
+    onStreamReady_i(len, pStream);
+    uint dt = (uint)(Util::getTickCountUs() - t);
+
+    if (m_pHistStrand) {                // Pipeline mode, owned by strand.
+      m_pHistStrand->msgSizeIn.add((uint)len);
+      m_pHistStrand->callbackTime.add(dt);
+    } else {
+      m_pHist->msgSizeIn.add((uint)len);
+      m_pHist->callbackTime.add(dt);
+    }
+  }
+
+  //
+  // Callback.
+  //
+
+  virtual void onStreamReady_i(int len, void const* pStream)=0;
+  virtual bool sendPong_i(uint stamp)=0;
+  virtual void onPong_i(uint rtt)=0;
+  virtual void onVersion_i(uint ver)=0;
+  virtual bool onSession_i(uint id, uint64 token, uint timeout)=0;
+  virtual bool onResumed_i(uint streamRecv)=0;
+  virtual void IncRecvPack()=0;
+  virtual void IncSendPack()=0;
+
+public:
+
+  int m_buffLen;                        // Buffered receive data length.
+  uchar* m_buff;                        // Receive data buffer, allocated on demand.
+  implNetworkBuffPool* m_pBuffPool;     // Shared receive buffer pool in lean mode, else 0.
+  bool m_bLean;                         // Memory lean mode.
+
+  std::string m_ss;                     // Stream buffer.
+
+  int m_batchWindow;                    // Batch window in microseconds, <0 if batch mode is disabled.
+  uint64 m_batchTime;                   // Time of first stream is batched.
+  std::string m_batch;                  // Batched streams to send.
+  bool m_bBatch;                        // Is receiving a batch stream.
 
   TimeoutTimer m_deadConnectionTimeout; // Since last receive data.
-  TimeoutTimer m_keepAliveTimeout;      // Since last send data.
+  TimeoutTimer m_keepAliveTimeout;      // Since last ping.
+  int m_keepAliveInterval;              // Adaptive keep alive interval, millisecond.
+  uint m_rtt;                           // Smoothed RTT, microsecond, 0 if not measured.
+  uint m_rttJitter;                     // RTT variation, microsecond.
+  uint m_peerVersion;                   // Protocol version of peer, 0 if not received.
 
   long m_packetSent;
   long m_packetRecv;
+
+  NetworkHistStats* m_pHist;            // Histograms of client or server.
+  implNetworkHistStrand* m_pHistStrand; // Histograms of strand in pipeline mode, else 0.
+
+  bool m_bSession;                      // Session resumption is enabled.
+  bool m_bSuspended;                    // Connection dropped, waiting resume.
+  bool m_bBye;                          // Session closed on purpose.
+  uint m_sessionId;                     // Session id, the connection id of server.
+  uint64 m_token;                       // Session token.
+  int m_sessionTimeout;                 // Session keeps after dropped, sec.
+  TimeoutTimer m_sessionExpire;         // Session expire time when suspended.
+  uint m_streamSent;                    // Streams sent, seq of next stream.
+  uint m_streamRecv;                    // Streams received.
+  uint m_streamAcked;                   // Streams received and acked to peer.
+  TimeoutTimer m_ackTimeout;
+  std::vector<std::string> m_unacked;   // Sent streams not acked by peer, from m_unackedHead.
+  size_t m_unackedHead;                 // Index of first unacked stream.
+  size_t m_bytesUnacked;                // Bytes of unacked streams.
+  size_t m_maxUnacked;                  // Max bytes of unacked streams, the session is dropped if exceeded.
 };
 
 class implNetworkClient : public implNetworkBase, public NetworkClient, public SocketClientCallback
@@ -307,6 +1034,9 @@ public:
     m_pClient = SocketClient::alloc(this);
     NetworkClient::userData = 0;
     m_packetSent = m_packetRecv = 0;
+    m_pHist = &m_hist;
+    m_hist.reset();
+    m_timeSample = Util::getTickCount();
   }
 
   virtual ~implNetworkClient()
@@ -333,22 +1063,50 @@ public:
 
   virtual void onSocketServerLeave(SocketClient*)
   {
+    if (m_bSuspended && !m_bBye) {
+      return;                           // Resume failed, retry later.
+    }
+
+    if (m_bSession && !m_bBye && 0 < m_sessionTimeout) {
+      suspend_i();                      // Dropped, try to resume the session.
+      m_resumeTimeout.setTimeout(0);
+      return;
+    }
+
+    resetSession();
     m_pInterface->onNetworkServerLeave(this);
   }
 
   virtual void onSocketServerReady(SocketClient*)
   {
     m_buffLen = 0;
+    resetBatch(m_batchWindow);
     m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
-    m_keepAliveTimeout.setTimeout(1000 * TIMEOUT_KEEP_ALIVE);
-    m_pInterface->onNetworkServerReady(this);
+    resetRtt();
     m_packetSent = m_packetRecv = 0;
+
+    if (m_bSuspended) {
+      uchar p[MAX_CTRL_PACKET_SIZE];
+      m_pClient->send(makeCtrlPacket(p, resume, m_sessionId, (uint)m_token, (uint)(m_token >> 32), m_streamRecv), p);
+      return;
+    }
+
+    resetSession();
+    m_peerVersion = 0;
+    uchar p[MAX_CTRL_PACKET_SIZE];
+    m_pClient->send(makeCtrlPacket(p, version, NETWORK_PROTOCOL_VERSION), p);
+
+    m_pInterface->onNetworkServerReady(this);
   }
 
   virtual void onSocketStreamReady(SocketClient*, int len, void const* pStream)
   {
+    m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
     if (!implNetworkBase::handleStreamReady(m_pClient, len, pStream)) {
-      disconnect();
+      m_bBye = true;                    // Bad stream, do not resume.
+      disconnect_i();
+    } else if (!implNetworkBase::flushBatch_(m_pClient)) { // Streams batched in callbacks go with this trigger.
+      disconnect_i();
     }
   }
 
@@ -358,16 +1116,48 @@ public:
 
   virtual bool connect(std::string const& svrAddr)
   {
+    if (m_bSuspended) {
+      return false;
+    }
+    resetSession();
+    m_addr = svrAddr;
     return m_pClient->connect(svrAddr);
   }
 
   virtual void disconnect()
   {
+    if (m_bSuspended) {                 // Give up resume.
+      m_bBye = true;
+      if (CS_DISCONNECTED == m_pClient->getConnectionState()) {
+        resetSession();
+        m_pInterface->onNetworkServerLeave(this);
+      } else {
+        m_pClient->disconnect();
+      }
+      return;
+    }
+
+    if (m_bSession && CS_CONNECTED == m_pClient->getConnectionState()) {
+      implNetworkBase::flush_i(m_pClient);
+      uchar p[MAX_CTRL_PACKET_SIZE];
+      m_pClient->send(makeCtrlPacket(p, bye), p);
+    }
+
+    m_bBye = true;
+    disconnect_i();
+  }
+
+  void disconnect_i()
+  {
+    implNetworkBase::flush_i(m_pClient);
     m_pClient->disconnect();
   }
 
   virtual int getConnectionState() const
   {
+    if (m_bSuspended) {
+      return CS_CONNECTED;              // Resuming.
+    }
     return m_pClient->getConnectionState();
   }
 
@@ -383,22 +1173,68 @@ public:
     *(SocketClientStats*)&ns = m_pClient->getNetStats();
     ns.packetsSent = m_packetSent;
     ns.packetsRecv = m_packetRecv;
+    ns.bytesMem += sizeof(*this) + getBytesMemBuff() + getBytesMemSession();
+    getRttStats(ns);
 
     return ns;
   }
 
   virtual bool send(int len, void const* pStream)
   {
-    return implNetworkBase::send_i(m_pClient, len, pStream);
+    if (!implNetworkBase::send_i(m_pClient, len, pStream)) {
+      if (m_bBye) {                     // Session dropped.
+        disconnect();
+      }
+      return false;
+    }
+    return true;
+  }
+
+  virtual bool send(int len, void const* pStream, int channel)
+  {
+    return send(len, pStream);          // Always reliable.
+  }
+
+  virtual void setBatchWindow(int usec)
+  {
+    implNetworkBase::flush_i(m_pClient);
+    m_batchWindow = usec;
   }
 
   virtual void trigger()
   {
+    uint64 t = Util::getTickCountUs();
+
+    if (!implNetworkBase::flushBatch_(m_pClient)) {
+      disconnect_i();
+    }
+
     m_pClient->trigger();
 
-    if (!implNetworkBase::trigger_(m_pClient)) {
-      disconnect();
+    if (m_bSuspended) {
+      triggerResume();
+    } else if (!implNetworkBase::trigger_(m_pClient)) {
+      disconnect_i();
     }
+
+    if (INTERVAL_SAMPLE_QUEUE <= Util::getTickCount() - m_timeSample) {
+      m_timeSample = Util::getTickCount();
+      if (CS_CONNECTED == getConnectionState()) {
+        m_hist.queueBytes.add((uint)m_pClient->getNetStats().bytesBuff);
+      }
+    }
+
+    m_hist.triggerTime.add((uint)(Util::getTickCountUs() - t));
+  }
+
+  virtual NetworkHistStats getHistStats() const
+  {
+    return m_hist;
+  }
+
+  virtual void resetHistStats()
+  {
+    m_hist.reset();
   }
 
   //
@@ -410,6 +1246,44 @@ public:
     m_pInterface->onNetworkStreamReady(this, len, pStream);
   }
 
+  virtual bool sendPong_i(uint stamp)
+  {
+    uchar p[MAX_CTRL_PACKET_SIZE];
+    return m_pClient->send(makeCtrlPacket(p, pong, stamp), p);
+  }
+
+  virtual void onPong_i(uint rtt)
+  {
+    updateRtt(rtt);
+  }
+
+  virtual void onVersion_i(uint ver)
+  {
+    setPeerVersion(ver);
+  }
+
+  virtual bool onSession_i(uint id, uint64 token, uint timeout)
+  {
+    m_bSession = true;
+    m_sessionId = id;
+    m_token = token;
+    m_sessionTimeout = (int)(std::min)(timeout, (uint)MAX_SESSION_TIMEOUT);
+    return true;
+  }
+
+  virtual bool onResumed_i(uint streamRecv)
+  {
+    if (!m_bSuspended || !canResume(streamRecv)) {
+      SW2_TRACE_ERROR("Resume session failed.");
+      return false;
+    }
+
+    processAck(streamRecv);
+    m_bSuspended = false;
+
+    return resend_i(m_pClient);
+  }
+
   void IncRecvPack()
   {
   }
@@ -418,24 +1292,174 @@ public:
   {
   }
 
+  void triggerResume()
+  {
+    int state = m_pClient->getConnectionState();
+
+    if (m_sessionExpire.isExpired() || m_bBye) {
+      if (CS_DISCONNECTED != state) {   // Wait disconnected.
+        m_bBye = true;
+        m_pClient->disconnect();
+      } else {
+        resetSession();
+        m_pInterface->onNetworkServerLeave(this);
+      }
+      return;
+    }
+
+    if (CS_DISCONNECTED == state && m_resumeTimeout.isExpired()) {
+      m_resumeTimeout.setTimeout(INTERVAL_RESUME);
+      m_pClient->connect(m_addr);
+    } else if (CS_CONNECTED == state && m_deadConnectionTimeout.isExpired()) {
+      m_pClient->disconnect();
+    }
+  }
+
 public:
 
   SocketClient* m_pClient;
   NetworkClientCallback* m_pInterface;
+
+  std::string m_addr;                   // Server address to resume.
+  TimeoutTimer m_resumeTimeout;         // Retry interval of resume connect.
+
+  NetworkHistStats m_hist;
+  uint m_timeSample;                    // Last sample time of send buffer bytes.
+};
+
+class implNetworkConnection;
+
+//
+// Decode task of a connection in pipeline mode, a task runs one at a time, so
+// received data of a connection is decoded and handled in order.
+//
+
+class implNetworkStrand : public ThreadTask
+{
+public:
+
+  implNetworkStrand() : m_pConn(0)
+  {
+  }
+
+  int getConnectionState() const;
+
+  virtual void threadTask();
+
+public:
+
+  implNetworkConnection* m_pConn;
 };
 
 class implNetworkConnection : public implNetworkBase, public NetworkConnection
 {
 public:
 
+  implNetworkConnection() : m_bPipeline(false), m_bClosing(0), m_bLeaving(false), m_pReply(0), m_bytesMemStrand(0)
+  {
+    m_strand.m_pConn = this;
+  }
+
   virtual ~implNetworkConnection()
   {
+    delete m_pHistStrand;
+  }
+
+  //
+  // Pipeline mode.
+  //
+
+  void runStrand()
+  {
+    //
+    // Run in worker thread, decode received data and notify streams.
+    //
+
+    implNetworkMsg* p = m_inbound.popAll();
+    while (p) {
+      implNetworkMsg* pNext = p->pNext;
+      if (!m_bClosing && !implNetworkBase::handleStreamReady(&m_strand, p->len, p->data())) {
+        disconnect();
+      }
+      implNetworkMsg::free(p);
+      p = pNext;
+    }
+
+    m_bytesMemStrand = (long)(m_ss.capacity() + (m_buff ? MAX_PACKET_BUFFER_SIZE : 0)); // Buffers owned by strand.
+  }
+
+  void schedule()
+  {
+    if (!m_inbound.empty()) {
+      m_strand.runTask();               // Retry next trigger if fail or running.
+    }
+  }
+
+  void leave()
+  {
+    //
+    // Socket is gone, the decode task may still run a callback of this
+    // connection. Release it later when the task is done, without blocking
+    // the reactor.
+    //
+
+    m_addr = m_pClient->getAddr();
+    m_pClient = 0;
+    m_bLeaving = true;
+    Util::atomicCompareExchange(&m_bClosing, 1, 0);
+    m_batch.clear();
+  }
+
+  void mergeHist(NetworkHistStats& hs)
+  {
+    //
+    // Run in reactor, the strand is not running until scheduled by reactor.
+    //
+
+    if (!m_pHistStrand || m_strand.isRunning() || 0 == m_pHistStrand->msgSizeIn.count) {
+      return;
+    }
+
+    hs.msgSizeIn.merge(m_pHistStrand->msgSizeIn);
+    hs.callbackTime.merge(m_pHistStrand->callbackTime);
+    m_pHistStrand->msgSizeIn.reset();
+    m_pHistStrand->callbackTime.reset();
+  }
+
+  void resetStrand()
+  {
+    m_inbound.clear();
+    Util::atomicCompareExchange(&m_bClosing, 0, 1);
+    m_bLeaving = false;
+  }
+
+  size_t getBytesMem() const
+  {
+    if (m_bPipeline) {
+      return m_batch.capacity() + m_bytesMemStrand;
+    }
+    return getBytesMemBuff();
+  }
+
+  void flushBatch()
+  {
+    if (!implNetworkBase::flushBatch_(m_pClient)) {
+      disconnect_i();
+    }
   }
 
   void trigger()
   {
+    if (m_bSuspended) {                 // Expired by server.
+      return;
+    }
+
+    if (m_bPipeline) {
+      schedule();
+    }
+
     if (!implNetworkBase::trigger_(m_pClient)) {
-      disconnect();
+      disconnect_i();
     }
   }
 
@@ -445,16 +1469,52 @@ public:
 
   virtual void disconnect()
   {
+    if (m_bPipeline) {                  // Disconnect by reactor.
+      Util::atomicCompareExchange(&m_bClosing, 1, 0);
+      m_pReply->push(implNetworkMsg::alloc(this, -1, 0));
+      return;
+    }
+
+    if (m_bSuspended) {                 // Expire next trigger.
+      m_bBye = true;
+      return;
+    }
+
+    if (m_bSession) {
+      implNetworkBase::flush_i(m_pClient);
+      uchar p[MAX_CTRL_PACKET_SIZE];
+      m_pClient->send(makeCtrlPacket(p, bye), p);
+      m_bBye = true;
+    }
+
+    disconnect_i();
+  }
+
+  void disconnect_i()
+  {
+    if (m_bSuspended) {
+      return;
+    }
+    implNetworkBase::flush_i(m_pClient);
     m_pClient->disconnect();
   }
 
   virtual int getConnectionState() const
   {
+    if (m_bLeaving) {
+      return CS_DISCONNECTING;          // Wait decode task done.
+    }
+    if (m_bSuspended) {
+      return CS_CONNECTED;              // Waiting resume.
+    }
     return m_pClient->getConnectionState();
   }
 
   virtual std::string getAddr() const
   {
+    if (m_bSuspended || m_bLeaving) {
+      return m_addr;
+    }
     return m_pClient->getAddr();
   }
 
@@ -462,16 +1522,41 @@ public:
   {
     NetworkClientStats ns;
 
-    *(SocketClientStats*)&ns = m_pClient->getNetStats();
+    if (m_bSuspended || m_bLeaving) {
+      ::memset(&ns, 0, sizeof(ns));
+    } else {
+      *(SocketClientStats*)&ns = m_pClient->getNetStats();
+    }
     ns.packetsSent = m_packetSent;
     ns.packetsRecv = m_packetRecv;
+    ns.bytesMem += sizeof(*this) + getBytesMem() + getBytesMemSession();
+    getRttStats(ns);
 
     return ns;
   }
 
   virtual bool send(int len, void const* pStream)
   {
-    return implNetworkBase::send_i(m_pClient, len, pStream);
+    if (m_bPipeline) {                  // Send by reactor.
+      if (0 >= len) {
+        return false;
+      }
+      m_pReply->push(implNetworkMsg::alloc(this, len, pStream));
+      return true;
+    }
+
+    if (!implNetworkBase::send_i(m_pClient, len, pStream)) {
+      if (m_bBye) {                     // Session dropped.
+        disconnect();
+      }
+      return false;
+    }
+    return true;
+  }
+
+  virtual bool send(int len, void const* pStream, int channel)
+  {
+    return send(len, pStream);          // Always reliable.
   }
 
   //
@@ -483,9 +1568,67 @@ public:
     m_pInterface->onNetworkStreamReady(m_pServer, (NetworkConnection*)this, len, pStream);
   }
 
+  virtual bool sendPong_i(uint stamp)
+  {
+    if (m_bPipeline) {                  // Send by reactor.
+      implNetworkMsg* p = implNetworkMsg::alloc(this, -2, 0);
+      p->stamp = stamp;
+      m_pReply->push(p);
+      return true;
+    }
+
+    return sendPong(stamp);
+  }
+
+  bool sendPong(uint stamp)
+  {
+    uchar p[MAX_CTRL_PACKET_SIZE];
+    return m_pClient->send(makeCtrlPacket(p, pong, stamp), p);
+  }
+
+  virtual void onPong_i(uint rtt)
+  {
+    if (m_bPipeline) {                  // RTT and keep alive are owned by reactor.
+      implNetworkMsg* p = implNetworkMsg::alloc(this, -3, 0);
+      p->stamp = rtt;
+      m_pReply->push(p);
+      return;
+    }
+
+    updateRtt(rtt);
+  }
+
+  virtual void onVersion_i(uint ver)
+  {
+    if (m_bPipeline) {                  // Keep alive is owned by reactor.
+      implNetworkMsg* p = implNetworkMsg::alloc(this, -4, 0);
+      p->stamp = ver;
+      m_pReply->push(p);
+      return;
+    }
+
+    setPeerVersion(ver);
+  }
+
+  virtual bool onSession_i(uint id, uint64 token, uint timeout)
+  {
+    SW2_TRACE_ERROR("Unexpected session."); // Only server starts a session.
+    return false;
+  }
+
+  virtual bool onResumed_i(uint streamRecv)
+  {
+    SW2_TRACE_ERROR("Unexpected resumed.");
+    return false;
+  }
+
   virtual void IncRecvPack()
   {
-    *m_svrPacketRecv += 1;
+    if (m_bPipeline) {
+      Util::atomicIncrement(m_svrPacketRecv);
+    } else {
+      *m_svrPacketRecv += 1;
+    }
   }
 
   virtual void IncSendPack()
@@ -496,9 +1639,40 @@ public:
 public:
 
   NetworkServer* m_pServer;
-  SocketConnection* m_pClient;
+  SocketConnection* m_pClient;          // 0 if suspended.
   NetworkServerCallback* m_pInterface;
-  long *m_svrPacketSent, *m_svrPacketRecv;
+  int m_id;                             // Id in connection pool.
+  std::string m_addr;                   // Client address when suspended.
+  long *m_svrPacketSent;
+  long volatile *m_svrPacketRecv;
+
+  bool m_bPipeline;                     // Is in pipeline mode.
+  long volatile m_bClosing;             // Is disconnect requested in pipeline mode, set by reactor or strand.
+  bool m_bLeaving;                      // Socket is gone, wait decode task done to release.
+  implNetworkMsgQueue m_inbound;        // Received data, decoded by strand.
+  implNetworkMsgQueue* m_pReply;        // Streams to send by reactor.
+  implNetworkStrand m_strand;           // Decode task.
+  long volatile m_bytesMemStrand;       // Bytes of buffers owned by decode task.
+};
+
+int implNetworkStrand::getConnectionState() const
+{
+  return m_pConn->m_bClosing ? CS_DISCONNECTING : CS_CONNECTED;
+}
+
+void implNetworkStrand::threadTask()
+{
+  m_pConn->runStrand();
+}
+
+//
+// New connection in session mode, waiting version or resume.
+//
+
+struct implNetworkPending
+{
+  std::string buff;                     // Received data before version or resume.
+  TimeoutTimer timeout;
 };
 
 template<bool SupportWebSocket>
@@ -515,11 +1689,35 @@ public:
       m_pServer = SocketServer::alloc(this);
     }
     m_packetSent = m_packetRecv = 0;
+    m_batchWindow = -1;
+    m_maxClient = 0;
+    m_bLean = m_bPipeline = false;
+    m_sessionTimeout = 0;
+    m_sessionMaxUnacked = MAX_SESSION_UNACKED;
+    m_hist.reset();
+    m_timeSample = Util::getTickCount();
   }
 
   virtual ~implNetworkServer()
   {
     SocketServer::free(m_pServer);
+
+    //
+    // Free allocated connections.
+    //
+
+    for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+      delete m_poolClient[i];
+    }
+
+    for (size_t i = 0; i < m_freeClient.size(); i++) {
+      delete m_freeClient[i];
+    }
+  }
+
+  implNetworkConnection& getConnection(int id) const
+  {
+    return *m_poolClient[id];
   }
 
   //
@@ -528,45 +1726,276 @@ public:
 
   virtual void onSocketClientLeave(SocketServer*, SocketConnection* pClient)
   {
+    if (DETACHED_CONNECTION == pClient->userData) {
+      return;
+    }
+
+    if (PENDING_CONNECTION == pClient->userData) {
+      m_pending.erase(pClient);
+      return;
+    }
+
     int id = (int)pClient->userData;
-    m_pInterface->onNetworkClientLeave(this, (NetworkConnection*)&m_poolClient[id]);
+    implNetworkConnection* pConn = m_poolClient[id];
+
+    //
+    // Pipeline mode, release after decode task done and its replies are
+    // sent, see trigger.
+    //
+
+    if (pConn->m_bPipeline) {
+      pConn->leave();
+      return;
+    }
+
+    //
+    // Dropped without bye, keep the session and wait resume.
+    //
+
+    if (pConn->m_bSession && !pConn->m_bBye) {
+      pConn->m_addr = pClient->getAddr();
+      pConn->m_pClient = 0;
+      pConn->suspend_i();
+      pConn->releaseBuff();
+      return;
+    }
+
+    leave_i(id);
+  }
+
+  void leave_i(int id)
+  {
+    implNetworkConnection* pConn = m_poolClient[id];
+    pConn->mergeHist(m_hist);
+
+    m_pInterface->onNetworkClientLeave(this, (NetworkConnection*)pConn);
+    pConn->releaseBuff();
+    pConn->resetSession();
+    m_freeClient.push_back(pConn);
     m_poolClient.free(id);
   }
 
   virtual bool onSocketNewClientReady(SocketServer*, SocketConnection* pNewClient)
   {
+    uchar p[MAX_CTRL_PACKET_SIZE];
+    if (!pNewClient->send(makeCtrlPacket(p, version, NETWORK_PROTOCOL_VERSION), p)) {
+      return false;
+    }
+
+    //
+    // Session mode, wait version or resume to decide a new session or resume
+    // an existing one.
+    //
+
+    if (isSessionMode()) {
+      pNewClient->userData = PENDING_CONNECTION;
+      m_pending[pNewClient].timeout.setTimeout(1000 * TIMEOUT_PENDING);
+      return true;
+    }
+
+    return accept_i(pNewClient, false);
+  }
+
+  bool accept_i(SocketConnection* pNewClient, bool bSession)
+  {
+    if (0 < m_maxClient && m_maxClient <= m_poolClient.size()) {
+      return false;
+    }
+
+    //
+    // Connection objects are allocated individually and reused, so the
+    // pointer of a connection keeps valid when the pool grows.
+    //
+
+    implNetworkConnection* pConn;
+    if (!m_freeClient.empty()) {
+      pConn = m_freeClient.back();
+      m_freeClient.pop_back();
+    } else {
+      pConn = new implNetworkConnection;
+    }
+
     int id = m_poolClient.alloc();
     if (-1 == id) {
+      m_freeClient.push_back(pConn);
       return false;
     }
 
+    m_poolClient[id] = pConn;
     pNewClient->userData = (uint_ptr)id;
 
-    implNetworkConnection& c = m_poolClient[id];
+    implNetworkConnection& c = *pConn;
+    c.m_id = id;
     c.userData = 0;
     c.m_buffLen = 0;
+    c.m_bLean = m_bLean;
+    c.m_pBuffPool = m_bLean && !m_bPipeline ? &m_buffPool : 0; // Shared pool is not thread safe.
+    c.m_bPipeline = m_bPipeline;
+    c.m_pReply = &m_reply;
+    if (m_bLean) {
+      std::string().swap(c.m_ss);
+      std::string().swap(c.m_batch);
+    }
+    c.resetBatch(m_batchWindow);
     c.m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
-    c.m_keepAliveTimeout.setTimeout(1000 * TIMEOUT_KEEP_ALIVE);
+    c.resetRtt();
+    c.m_peerVersion = 0;
     c.m_pClient = pNewClient;
     c.m_pServer = this;
     c.m_pInterface = m_pInterface;
     c.m_packetSent = c.m_packetRecv = 0;
     c.m_svrPacketSent = &m_packetSent;
     c.m_svrPacketRecv = &m_packetRecv;
+    c.m_pHist = &m_hist;
+    if (m_bPipeline && 0 == c.m_pHistStrand) {
+      c.m_pHistStrand = new implNetworkHistStrand;
+    } else if (!m_bPipeline) {
+      delete c.m_pHistStrand;
+      c.m_pHistStrand = 0;
+    }
+    if (c.m_pHistStrand) {
+      c.m_pHistStrand->msgSizeIn.reset();
+      c.m_pHistStrand->callbackTime.reset();
+    }
+    c.resetSession();
+    c.m_bSession = bSession;            // Keep streams sent in callback.
+    c.m_maxUnacked = (size_t)m_sessionMaxUnacked;
 
     //
     // Accept this new connection?
     //
 
     if (m_pInterface->onNetworkNewClientReady(this, (NetworkConnection*)&c)) {
+      if (bSession) {
+        startSession_i(c);
+      }
       return true;
     }
 
+    if (c.m_bPipeline) {
+      sendReply();
+    }
+
+    c.resetSession();
+    m_freeClient.push_back(pConn);
     m_poolClient.free(id);
 
     return false;                       // Not accept.
   }
 
+  //
+  // Session.
+  //
+
+  bool isSessionMode() const
+  {
+    return !SupportWebSocket && !m_bPipeline && 0 < m_sessionTimeout;
+  }
+
+  void startSession_i(implNetworkConnection& c)
+  {
+    uint64 token = 0;
+    if (!genToken(token) || 0 == token) {
+      SW2_TRACE_ERROR("Generate session token failed.");
+      c.m_bSession = false;             // Go on without session.
+      return;
+    }
+
+    c.m_sessionId = (uint)c.m_id;
+    c.m_token = token;
+    c.m_sessionTimeout = m_sessionTimeout;
+
+    uchar p[MAX_CTRL_PACKET_SIZE];
+    c.m_pClient->send(makeCtrlPacket(p, session, c.m_sessionId, (uint)token, (uint)(token >> 32), (uint)m_sessionTimeout), p);
+  }
+
+  bool resume_i(SocketConnection* pNewClient, uint id, uint64 token, uint streamRecv)
+  {
+    //
+    // The token is bound to the session id, only the connection of the id is
+    // compared.
+    //
+
+    if (!m_poolClient.isUsed((int)id)) {
+      return false;
+    }
+
+    implNetworkConnection& c = getConnection((int)id);
+    if (!c.m_bSession || 0 == c.m_token || !isSameToken(c.m_token, token) || !c.canResume(streamRecv)) {
+      return false;
+    }
+
+    if (c.m_pClient) {                  // Old connection is not dropped yet.
+      c.m_pClient->userData = DETACHED_CONNECTION;
+      c.m_pClient->disconnect();
+    }
+
+    //
+    // Bind the new connection to the session, and resend streams which are
+    // not received by the client.
+    //
+
+    pNewClient->userData = (uint_ptr)c.m_id;
+    c.m_pClient = pNewClient;
+    c.m_bSuspended = false;
+    c.m_buffLen = 0;
+    c.m_ss.clear();
+    c.m_batch.clear();
+    c.m_bBatch = false;
+    c.m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
+    c.resetRtt();
+    c.m_packetSent = c.m_packetRecv = 0;
+    c.processAck(streamRecv);
+
+    uchar p[MAX_CTRL_PACKET_SIZE];
+    return pNewClient->send(makeCtrlPacket(p, resumed, c.m_streamRecv), p) && c.resend_i(pNewClient);
+  }
+
+  void handlePending_i(SocketConnection* pClient, int len, void const* pStream)
+  {
+    std::string& buff = m_pending[pClient].buff;
+    buff.append((char const*)pStream, len);
+    if (PACKET_HEADER_SIZE > buff.length()) {
+      return;
+    }
+
+    uchar const* p = (uchar const*)buff.data();
+    ushort header = (ushort)(uint)(p[1] << 8) | (uint)p[0];
+    int lenPacket = PACKET_HEADER_SIZE;
+
+    bool ret;
+    if (version == header) {            // New session, version is processed by the connection.
+      lenPacket = 0;
+      ret = accept_i(pClient, true);
+    } else if (resume == header) {      // Resume a session.
+      lenPacket = PACKET_HEADER_SIZE + (resume & 0x3ff);
+      if (lenPacket > (int)buff.length()) {
+        return;
+      }
+      ret = resume_i(pClient, getCtrlValue(p, 0), getCtrlToken(p, 1), getCtrlValue(p, 3));
+    } else {                            // Old client without session support.
+      lenPacket = 0;
+      ret = accept_i(pClient, false);
+    }
+
+    std::string data = buff.substr(lenPacket);
+    m_pending.erase(pClient);
+
+    if (!ret) {
+      if (0 != lenPacket || version == header) { // Old client does not know bye.
+        uchar p2[MAX_CTRL_PACKET_SIZE];
+        pClient->send(makeCtrlPacket(p2, bye), p2);
+      }
+      pClient->userData = DETACHED_CONNECTION;
+      pClient->disconnect();
+      return;
+    }
+
+    if (!data.empty()) {
+      onSocketStreamReady(m_pServer, pClient, (int)data.length(), data.data());
+    }
+  }
+
   virtual void onSocketServerShutdown(SocketServer*)
   {
     m_pInterface->onNetworkServerShutdown(this);
@@ -579,10 +2008,60 @@ public:
 
   virtual void onSocketStreamReady(SocketServer*, SocketConnection* pClient, int len, void const* pStream)
   {
+    if (DETACHED_CONNECTION == pClient->userData) {
+      return;
+    }
+
+    if (PENDING_CONNECTION == pClient->userData) {
+      handlePending_i(pClient, len, pStream);
+      return;
+    }
+
     int id = (int)pClient->userData;
-    implNetworkConnection &c = m_poolClient[id];
+    implNetworkConnection &c = getConnection(id);
+    c.m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
+
+    if (c.m_bPipeline) {                // Decode in worker thread.
+      c.m_inbound.push(implNetworkMsg::alloc(&c, len, pStream));
+      c.schedule();
+      return;
+    }
+
     if (!c.handleStreamReady(c.m_pClient, len, pStream)) {
-      c.disconnect();
+      c.m_bBye = true;                  // Bad stream, do not resume.
+      c.disconnect_i();
+    } else {
+      c.flushBatch();                   // Streams batched in callbacks go with this trigger.
+    }
+  }
+
+  void sendReply()
+  {
+    //
+    // Send streams and process disconnect requests from worker threads.
+    //
+
+    implNetworkMsg* p = m_reply.popAll();
+    while (p) {
+      implNetworkMsg* pNext = p->pNext;
+      implNetworkConnection& c = *(implNetworkConnection*)p->pConn;
+      if (c.m_bLeaving) {
+        ;                               // Socket is gone, wait to release.
+      } else if (-4 == p->len) {
+        c.setPeerVersion(p->stamp);
+      } else if (-3 == p->len) {
+        c.updateRtt(p->stamp);
+      } else if (-2 == p->len) {
+        if (!c.sendPong(p->stamp)) {
+          c.disconnect_i();
+        }
+      } else if (0 > p->len) {
+        c.disconnect_i();
+      } else if (!c.send_i(c.m_pClient, p->len, p->data())) {
+        c.disconnect_i();
+      }
+      implNetworkMsg::free(p);
+      p = pNext;
     }
   }
 
@@ -596,7 +2075,7 @@ public:
     if (-1 == first) {
       return 0;
     } else {
-      return (NetworkConnection*)&m_poolClient[first];
+      return (NetworkConnection*)&getConnection(first);
     }
   }
 
@@ -606,11 +2085,11 @@ public:
       return 0;
     }
 
-    int next = m_poolClient.next((int)((implNetworkConnection*)pClient)->m_pClient->userData);
+    int next = m_poolClient.next(((implNetworkConnection*)pClient)->m_id);
     if (-1 == next) {
       return 0;
     } else {
-      return (NetworkConnection*)&m_poolClient[next];
+      return (NetworkConnection*)&getConnection(next);
     }
   }
 
@@ -621,6 +2100,17 @@ public:
     *(SocketServerStats*)&ns = m_pServer->getNetStats();
     ns.packetsSent = m_packetSent;
     ns.packetsRecv = m_packetRecv;
+    ns.bytesTick = 0;                   // No per tick arena, see NetworkServerStats::bytesTick.
+
+    for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+      ns.bytesMem += sizeof(implNetworkConnection) + getConnection(i).getBytesMem() + getConnection(i).getBytesMemSession();
+    }
+
+    for (size_t i = 0; i < m_freeClient.size(); i++) {
+      ns.bytesMem += sizeof(implNetworkConnection) + m_freeClient[i]->getBytesMemBuff();
+    }
+
+    ns.bytesMem += m_buffPool.getBytesMem();
 
     return ns;
   }
@@ -630,20 +2120,142 @@ public:
     return m_pServer->startup(addr);
   }
 
+  virtual bool startup(Ini const& conf1)
+  {
+    Ini conf = conf1;
+    m_maxClient = conf.find("MaxClient") ? conf["MaxClient"] : 0;
+    m_poolClient.reserve(conf.find("InitClient") ? conf["InitClient"] : (int)INIT_CLIENT);
+
+    setBatchWindow(conf.find("BatchWindow") ? conf["BatchWindow"] : -1);
+    setLeanMode(conf.find("LeanMode") ? conf["LeanMode"] : false);
+    setPipeline(conf.find("Pipeline") ? conf["Pipeline"] : false);
+    setSessionTimeout(conf.find("SessionTimeout") ? conf["SessionTimeout"] : 0);
+    m_sessionMaxUnacked = conf.find("SessionMaxUnacked") ? conf["SessionMaxUnacked"] : MAX_SESSION_UNACKED;
+
+    return startup(conf["AddrListen"].value);
+  }
+
   virtual void shutdown()
   {
+    //
+    // Close all sessions, suspended connections are expired next trigger.
+    //
+
+    for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+      getConnection(i).m_bBye = true;
+    }
+
     m_pServer->shutdown();
   }
 
+  virtual void setBatchWindow(int usec)
+  {
+    m_batchWindow = usec;
+
+    for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+      implNetworkConnection &c = getConnection(i);
+      c.flush_i(c.m_pClient);
+      c.m_batchWindow = usec;
+    }
+  }
+
+  virtual void setLeanMode(bool bLean)
+  {
+    m_bLean = bLean;
+    m_pServer->setLeanMode(bLean);
+  }
+
+  virtual void setPipeline(bool bPipeline)
+  {
+    m_bPipeline = bPipeline;
+  }
+
+  virtual void setSessionTimeout(int sec)
+  {
+    m_sessionTimeout = (std::min)(sec, MAX_SESSION_TIMEOUT);
+  }
+
   virtual void trigger()
   {
+    uint64 t = Util::getTickCountUs();
+
+    sendReply();
+
+    for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+      if (!getConnection(i).m_bLeaving) {
+        getConnection(i).flushBatch();
+      }
+    }
+
     m_pServer->trigger();
 
+    for (int i = m_poolClient.first(); -1 != i;) {
+      int next = m_poolClient.next(i);
+      implNetworkConnection& c = getConnection(i);
+      if (c.m_bLeaving) {
+        if (!c.m_strand.isRunning()) {
+          sendReply();                  // Drop replies of the task before reuse.
+          c.resetStrand();
+          leave_i(i);
+        }
+      } else if (c.m_bSuspended && (c.m_bBye || c.m_sessionExpire.isExpired())) {
+        leave_i(i);                     // Session expired.
+      } else {
+        c.trigger();
+      }
+      i = next;
+    }
+
+    //
+    // New connections never send version or resume are old clients, accept
+    // without session.
+    //
+
+    for (std::map<SocketConnection*, implNetworkPending>::iterator it = m_pending.begin(); m_pending.end() != it;) {
+      SocketConnection* pClient = it->first;
+      if (it->second.timeout.isExpired()) {
+        m_pending.erase(it++);
+        if (!accept_i(pClient, false)) {
+          pClient->userData = DETACHED_CONNECTION;
+          pClient->disconnect();
+        }
+      } else {
+        ++it;
+      }
+    }
+
+    if (INTERVAL_SAMPLE_QUEUE <= Util::getTickCount() - m_timeSample) {
+      m_timeSample = Util::getTickCount();
+      for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+        if (getConnection(i).m_pClient) {
+          m_hist.queueBytes.add((uint)getConnection(i).m_pClient->getNetStats().bytesBuff);
+        }
+        getConnection(i).mergeHist(m_hist);
+      }
+    }
+
+    m_hist.triggerTime.add((uint)(Util::getTickCountUs() - t));
+  }
+
+  void mergeHist_i() const
+  {
     for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
-      m_poolClient[i].trigger();
+      m_poolClient[i]->mergeHist(m_hist);
     }
   }
 
+  virtual NetworkHistStats getHistStats() const
+  {
+    mergeHist_i();                      // Histograms of strands not merged yet.
+    return m_hist;
+  }
+
+  virtual void resetHistStats()
+  {
+    mergeHist_i();
+    m_hist.reset();
+  }
+
   virtual std::string getAddr() const
   {
     return m_pServer->getAddr();
@@ -651,16 +2263,141 @@ public:
 
 public:
 
-  ObjectPool<implNetworkConnection, MAX_CLIENT> m_poolClient;
+  ObjectPool<implNetworkConnection*, INIT_CLIENT, true> m_poolClient; // Connected clients.
+  std::vector<implNetworkConnection*> m_freeClient; // Free connections for reuse.
 
   SocketServer* m_pServer;
   NetworkServerCallback* m_pInterface;
 
-  long m_packetSent, m_packetRecv;
+  long m_packetSent;
+  long volatile m_packetRecv;
+  int m_batchWindow;                    // Batch window of new connection.
+  int m_maxClient;                      // Max client connection, 0 is unlimited.
+  bool m_bLean;                         // Memory lean mode of new connection.
+  implNetworkBuffPool m_buffPool;       // Shared receive buffers in lean mode.
+  bool m_bPipeline;                     // Pipeline mode of new connection.
+  implNetworkMsgQueue m_reply;          // Streams to send from worker threads.
+
+  mutable NetworkHistStats m_hist;      // Histograms of all connections, strands are merged on read.
+  uint m_timeSample;                    // Last sample time of send buffer bytes.
+
+  int m_sessionTimeout;                 // Session keeps after dropped, sec, 0 is disabled.
+  int m_sessionMaxUnacked;              // Max bytes of unacked streams of a session.
+  std::map<SocketConnection*, implNetworkPending> m_pending; // New connections wait version or resume.
 };
 
 } // namespace impl
 
+void NetworkHistogram::reset()
+{
+  count = sum = 0;
+  min = max = 0;
+  ::memset(bucket, 0, sizeof(bucket));
+}
+
+void NetworkHistogram::merge(NetworkHistogram const& h)
+{
+  if (0 == h.count) {
+    return;
+  }
+
+  if (0 == count || min > h.min) {
+    min = h.min;
+  }
+  if (max < h.max) {
+    max = h.max;
+  }
+
+  count += h.count;
+  sum += h.sum;
+  for (int i = 0; i < NUM_BUCKET; i++) {
+    bucket[i] += h.bucket[i];
+  }
+}
+
+unsigned int NetworkHistogram::getPercentile(double p) const
+{
+  if (0 == count) {
+    return 0;
+  }
+
+  unsigned long long n = (unsigned long long)(count * p / 100.0 + 0.5);
+  unsigned long long c = 0;
+  for (int i = 0; i < NUM_BUCKET; i++) {
+    c += bucket[i];
+    if (c >= n && 0 < c) {
+      if (NUM_BUCKET - 1 == i) {
+        return max;
+      }
+      return (std::max)(min, (std::min)(max, getBucketMin(i + 1) - 1));
+    }
+  }
+
+  return max;
+}
+
+void NetworkHistStats::reset()
+{
+  msgSizeIn.reset();
+  msgSizeOut.reset();
+  triggerTime.reset();
+  callbackTime.reset();
+  queueBytes.reset();
+}
+
+void NetworkHistStats::storeToIni(Ini& ini) const
+{
+  char const* name[] = {"MsgSizeIn", "MsgSizeOut", "TriggerTime", "CallbackTime", "QueueBytes"};
+  NetworkHistogram const* hist[] = {&msgSizeIn, &msgSizeOut, &triggerTime, &callbackTime, &queueBytes};
+
+  for (int i = 0; i < 5; i++) {
+    NetworkHistogram const& h = *hist[i];
+    Ini& sec = ini[name[i]];
+    sec["Count"] = h.count;
+    sec["Sum"] = h.sum;
+    sec["Min"] = h.min;
+    sec["Max"] = h.max;
+    sec["P50"] = h.getPercentile(50);
+    sec["P90"] = h.getPercentile(90);
+    sec["P99"] = h.getPercentile(99);
+
+    std::string buckets;                // Non-empty buckets, format: min:count,...
+    for (int j = 0; j < NetworkHistogram::NUM_BUCKET; j++) {
+      if (h.bucket[j]) {
+        char buff[64];
+        ::sprintf(buff, "%s%u:%u", buckets.empty() ? "" : ",", NetworkHistogram::getBucketMin(j), h.bucket[j]);
+        buckets += buff;
+      }
+    }
+    sec["Buckets"] = buckets;
+  }
+}
+
+void NetworkHistStats::storeToJson(std::string& outs) const
+{
+  char const* name[] = {"msgSizeIn", "msgSizeOut", "triggerTime", "callbackTime", "queueBytes"};
+  NetworkHistogram const* hist[] = {&msgSizeIn, &msgSizeOut, &triggerTime, &callbackTime, &queueBytes};
+
+  outs = "{";
+  for (int i = 0; i < 5; i++) {
+    NetworkHistogram const& h = *hist[i];
+    char buff[256];
+    ::sprintf(buff, "%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"min\":%u,\"max\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"buckets\":[", i ? "," : "", name[i], h.count, h.sum, h.min, h.max, h.getPercentile(50), h.getPercentile(90), h.getPercentile(99));
+    outs += buff;
+
+    bool bFirst = true;
+    for (int j = 0; j < NetworkHistogram::NUM_BUCKET; j++) {
+      if (h.bucket[j]) {
+        ::sprintf(buff, "%s[%u,%u]", bFirst ? "" : ",", NetworkHistogram::getBucketMin(j), h.bucket[j]);
+        outs += buff;
+        bFirst = false;
+      }
+    }
+    outs += "]}";
+  }
+  outs += "}";
+}
+
 bool InitializeNetwork()
 {
   if (!InitializeSocket()) {
@@ -14,9 +14,20 @@
 ///
 /// Network module is based on Socket module, provides higher level network
 /// features. Include:
-/// - Disconnection detect.
+/// - Disconnection detect, keep alive ping with adaptive interval.
+/// - Round trip time measurement, see NetworkClientStats.
 /// - Full data stream control.
 /// - Formatted network data packet.
+/// - Optional send batching, coalesce small data streams into one stream.
+/// - Optional memory lean mode, idle connections hold no buffer.
+/// - Optional threaded decode pipeline, handle streams in worker threads.
+/// - Optional session resumption, a dropped client reconnects and resumes.
+/// - Optional reliable UDP transport, see UdpNetworkClient and UdpNetworkServer.
+/// - Latency and throughput histograms, see NetworkHistStats.
+///
+/// Ping, batch stream and session are used only if the peer sends its protocol
+/// version after connected, so old peers without them keep working with plain
+/// keep alive and streams.
 ///
 /// The usage of Network module is similar to Socket module:
 ///
@@ -167,6 +178,7 @@
 
 #pragma once
 
+#include "swIni.h"
 #include "swSocket.h"
 
 namespace sw2 {
@@ -192,6 +204,9 @@ struct NetworkClientStats : public SocketClientStats
 {
   unsigned long long packetsSent;       ///< Total packets sent.
   unsigned long long packetsRecv;       ///< Total packets received.
+
+  unsigned int rtt;                     ///< Smoothed round trip time in microseconds, 0 if not measured yet.
+  unsigned int rttJitter;               ///< Round trip time variation in microseconds.
 };
 
 ///
@@ -202,6 +217,147 @@ struct NetworkServerStats : public SocketServerStats
 {
   unsigned long long packetsSent;       ///< Total packets sent.
   unsigned long long packetsRecv;       ///< Total packets received.
+
+  unsigned int bytesTick;               ///< Bytes served by per tick arena in last tick, by UdpNetworkServer and SmallworldServer only. NetworkServer has no per tick arena, stream and batch buffers live across ticks, it is always 0.
+};
+
+///
+/// \brief Log-linear histogram.
+///
+/// Values less than 8 have their own buckets, each power of 2 range above is
+/// divided into 4 buckets, so the relative error of a bucket is less than 25%.
+///
+
+struct NetworkHistogram
+{
+  enum {
+    NUM_BUCKET = 124                    ///< Number of buckets, covers 32 bits values.
+  };
+
+  unsigned long long count;             ///< Number of recorded values.
+  unsigned long long sum;               ///< Sum of recorded values.
+  unsigned int min;                     ///< Min recorded value.
+  unsigned int max;                     ///< Max recorded value.
+  unsigned int bucket[NUM_BUCKET];      ///< Count of each bucket.
+
+  ///
+  /// \brief Clear all recorded values.
+  ///
+
+  void reset();
+
+  ///
+  /// \brief Record a value.
+  /// \param [in] v Value.
+  ///
+
+  void add(unsigned int v)
+  {
+    if (0 == count || min > v) {
+      min = v;
+    }
+    if (max < v) {
+      max = v;
+    }
+    count += 1;
+    sum += v;
+    bucket[getBucket(v)] += 1;
+  }
+
+  ///
+  /// \brief Merge recorded values of another histogram.
+  /// \param [in] h Histogram.
+  ///
+
+  void merge(NetworkHistogram const& h);
+
+  ///
+  /// \brief Get approximate value of a percentile.
+  /// \param [in] p Percentile, 0 ~ 100.
+  /// \return Return upper bound of the bucket of the percentile.
+  ///
+
+  unsigned int getPercentile(double p) const;
+
+  ///
+  /// \brief Get bucket index of a value.
+  /// \param [in] v Value.
+  /// \return Return bucket index.
+  ///
+
+  static int getBucket(unsigned int v)
+  {
+    if (8 > v) {
+      return (int)v;
+    }
+    int e = 0;                          // Index of highest bit.
+    unsigned int x = v;
+    if (x >= (1u << 16)) { x >>= 16; e += 16; }
+    if (x >= (1u << 8)) { x >>= 8; e += 8; }
+    if (x >= (1u << 4)) { x >>= 4; e += 4; }
+    if (x >= (1u << 2)) { x >>= 2; e += 2; }
+    if (x >= (1u << 1)) { e += 1; }
+    return 8 + 4 * (e - 3) + (int)((v >> (e - 2)) & 3);
+  }
+
+  ///
+  /// \brief Get lower bound of a bucket.
+  /// \param [in] i Bucket index.
+  /// \return Return min value of the bucket.
+  ///
+
+  static unsigned int getBucketMin(int i)
+  {
+    if (8 > i) {
+      return (unsigned int)i;
+    }
+    int e = 3 + (i - 8) / 4;
+    return (unsigned int)(4 + (i - 8) % 4) << (e - 2);
+  }
+};
+
+///
+/// \brief Network histograms.
+/// \note Histograms of a server are shared by all connections.
+///
+
+struct NetworkHistStats
+{
+  NetworkHistogram msgSizeIn;           ///< Size of received data streams, bytes.
+  NetworkHistogram msgSizeOut;          ///< Size of sent data streams, bytes.
+  NetworkHistogram triggerTime;         ///< Time spent in trigger, microseconds.
+  NetworkHistogram callbackTime;        ///< Time spent in onNetworkStreamReady, microseconds.
+  NetworkHistogram queueBytes;          ///< Bytes in send buffer of a connection, sampled every second.
+
+  ///
+  /// \brief Clear all histograms.
+  ///
+
+  void reset();
+
+  ///
+  /// \brief Save histograms to an INI.
+  /// \param [out] ini Destination INI, each histogram is saved as a section.
+  ///
+
+  void storeToIni(Ini& ini) const;
+
+  ///
+  /// \brief Save histograms to a JSON string.
+  /// \param [out] outs Destination stream.
+  ///
+
+  void storeToJson(std::string& outs) const;
+};
+
+///
+/// \brief Network data stream channel.
+///
+
+enum NETWORK_CHANNEL
+{
+  NC_RELIABLE = 0,                      ///< Reliable and ordered, default.
+  NC_UNRELIABLE_SEQUENCED               ///< Unreliable, old streams are dropped.
 };
 
 class NetworkClient;
@@ -308,6 +464,7 @@ public:
   /// \param [in] pClient The sender client.
   /// \param [in] len Data length(in byte)
   /// \param [in] pStream Data stream.
+  /// \note In pipeline mode this is called in a worker thread.
   ///
 
   virtual void onNetworkStreamReady(NetworkServer* pServer, NetworkConnection* pClient, int len, void const* pStream)
@@ -361,6 +518,18 @@ public:
 
   virtual bool send(int len, void const* pStream)=0;
 
+  ///
+  /// \brief Send a data stream to remote client with a channel.
+  /// \param [in] len Data length(in byte).
+  /// \param [in] pStream Data stream.
+  /// \param [in] channel See NETWORK_CHANNEL.
+  /// \return Return true if success else return false.
+  /// \note Only UDP transport supports NC_UNRELIABLE_SEQUENCED, a stream of this
+  ///       channel must fit in one datagram. TCP transport always sends reliable.
+  ///
+
+  virtual bool send(int len, void const* pStream, int channel)=0;
+
   uint_ptr userData;                    ///< User define data.
 };
 
@@ -399,6 +568,23 @@ public:
 
   virtual bool connect(std::string const& svrAddr)=0;
 
+  ///
+  /// \brief Set send batch window.
+  /// \param [in] usec Batch window in microseconds. If usec is less than 0 then
+  ///            batch mode is disabled(default). If usec is 0 then batched data
+  ///            streams are sent without waiting.
+  /// \note In batch mode, small data streams sent are queued and sent as a
+  ///       single batch stream when the batch window is expired. The window is
+  ///       checked after the stream ready callbacks of a connection return, so
+  ///       streams sent in callbacks are sent in the same trigger, and at the
+  ///       beginning of trigger for streams sent out of callbacks. Receiver
+  ///       unpacks the batch stream and notifies each data stream in order.
+  ///       Streams are not batched until the protocol version of the peer is
+  ///       received.
+  ///
+
+  virtual void setBatchWindow(int usec)=0;
+
   ///
   /// \brief Trigger network.
   /// \note Application should call trigger periodically to make module works
@@ -406,6 +592,19 @@ public:
   ///
 
   virtual void trigger()=0;
+
+  ///
+  /// \brief Get histograms.
+  /// \return Return histograms.
+  ///
+
+  virtual NetworkHistStats getHistStats() const=0;
+
+  ///
+  /// \brief Clear histograms.
+  ///
+
+  virtual void resetHistStats()=0;
 };
 
 ///
@@ -439,6 +638,25 @@ public:
 
   virtual bool startup(std::string const& addr)=0;
 
+  ///
+  /// \brief Startup server with configuration and begin to accept new connection.
+  /// \param [in] conf Server configuration.
+  /// \return Return true if success else return false.
+  /// \note Configuration settings:
+  ///       - AddrListen: listen port, format: ip:port, hostname:port or port.
+  ///       - MaxClient: max client connection, 0 or not set is unlimited.
+  ///       - InitClient: initial size of connection pool, grows when necessary.
+  ///       - BatchWindow: send batch window in microseconds, see setBatchWindow.
+  ///       - LeanMode: memory lean mode, see setLeanMode.
+  ///       - Pipeline: threaded decode pipeline mode, see setPipeline.
+  ///       - SessionTimeout: session resumption timeout, see setSessionTimeout.
+  ///       - SessionMaxUnacked: max bytes of sent streams not acked by a client
+  ///         of a session, default is 1MB. If exceeded, the session is closed
+  ///         and the client is disconnected.
+  ///
+
+  virtual bool startup(Ini const& conf)=0;
+
   ///
   /// \brief Stop to accept new connection, existing connections will still keep
   ///        connected.
@@ -446,6 +664,14 @@ public:
 
   virtual void shutdown()=0;
 
+  ///
+  /// \brief Set send batch window of all connections.
+  /// \param [in] usec Batch window in microseconds.
+  /// \see NetworkClient::setBatchWindow.
+  ///
+
+  virtual void setBatchWindow(int usec)=0;
+
   ///
   /// \brief Trigger network.
   /// \note Application should call trigger periodically to make module works
@@ -468,6 +694,65 @@ public:
 
   virtual NetworkServerStats getNetStats() const=0;
 
+  ///
+  /// \brief Get histograms of all connections.
+  /// \return Return histograms.
+  /// \note In pipeline mode, received stream histograms are recorded by each
+  ///       connection without lock, and merged when the connection is idle.
+  ///       Call in the thread calls trigger.
+  ///
+
+  virtual NetworkHistStats getHistStats() const=0;
+
+  ///
+  /// \brief Clear histograms.
+  ///
+
+  virtual void resetHistStats()=0;
+
+  ///
+  /// \brief Set memory lean mode.
+  /// \param [in] bLean Enable lean mode or not, default is disabled.
+  /// \note In lean mode, buffers of connections are allocated from shared pools
+  ///       of the server on demand and released after a message completes, so an
+  ///       idle connection holds no buffer. Apply to new connections only.
+  ///
+
+  virtual void setLeanMode(bool bLean)=0;
+
+  ///
+  /// \brief Set threaded decode pipeline mode.
+  /// \param [in] bPipeline Enable pipeline mode or not, default is disabled.
+  /// \note In pipeline mode, socket I/O still runs in trigger, but received data
+  ///       of connections are decoded and notified by onNetworkStreamReady in
+  ///       worker threads of thread pool. Streams of a connection are notified
+  ///       in order, streams of different connections are notified concurrently.
+  ///       NetworkConnection::send and disconnect are queued and done in next
+  ///       trigger. Thread pool must be initialized, see InitializeThreadPool.
+  ///       Apply to new connections only.
+  /// \note Callbacks of onNetworkStreamReady run off the thread of trigger, use
+  ///       only the NetworkConnection passed in. Do not call getFirstConnection,
+  ///       getNextConnection or other methods of NetworkServer from them.
+  ///
+
+  virtual void setPipeline(bool bPipeline)=0;
+
+  ///
+  /// \brief Set session resumption timeout.
+  /// \param [in] sec Session timeout in seconds, 0 is disabled and is default,
+  ///            max is 3600.
+  /// \note When enabled, a connection keeps its session and unacked sent streams
+  ///       for sec seconds after it is dropped without disconnect. The client
+  ///       reconnects automatically and resumes the session with a token, the
+  ///       connection is not left and streams are not lost. Both sides resend
+  ///       streams not received by the peer after resumed. The connection state
+  ///       keeps CS_CONNECTED during resumption. Not supported in pipeline mode
+  ///       and WebSocket server. Apply to new connections only. A client without
+  ///       protocol version is accepted without session.
+  ///
+
+  virtual void setSessionTimeout(int sec)=0;
+
   ///
   /// \brief Get first connection.
   /// \return Return first connection.
@@ -510,6 +795,66 @@ public:
   static void free(WebNetworkServer* pItf);
 };
 
+///
+/// \brief Reliable UDP network client.
+///
+/// The UDP transport provides connection handshake, selective ack and
+/// retransmission for reliable ordered streams, unreliable sequenced streams,
+/// keep alive and dead connection detect same as TCP transport. Data streams
+/// are not compatible with TCP transport. Batch window has no effect. A
+/// reliable stream is at most 1MB, a peer sends longer stream is disconnected.
+///
+
+class UdpNetworkClient : public NetworkClient
+{
+public:
+
+  ///
+  /// \brief Allocate a UDP client instance.
+  /// \param [in] pCallback Client callback.
+  /// \return If success return an interface pointer else return 0.
+  ///
+
+  static UdpNetworkClient* alloc(NetworkClientCallback* pCallback);
+
+  ///
+  /// \brief Release a unused UDP client instance.
+  /// \param [in] pItf Instance to free.
+  ///
+
+  static void free(UdpNetworkClient* pItf);
+};
+
+///
+/// \brief Reliable UDP network server.
+///
+/// All connections share one UDP socket. After shutdown, new connections are
+/// rejected and existing connections still keep connected. A connection is
+/// allocated and notified only after the client echoes a cookie of the server,
+/// so connect requests of spoofed addresses hold no resource. Batch window, lean
+/// mode, pipeline mode and session timeout have no effect.
+///
+
+class UdpNetworkServer : public NetworkServer
+{
+public:
+
+  ///
+  /// \brief Allocate a UDP server instance.
+  /// \param [in] pCallback Server callback.
+  /// \return If success return an interface pointer else return 0.
+  ///
+
+  static UdpNetworkServer* alloc(NetworkServerCallback* pCallback);
+
+  ///
+  /// \brief Release a unused UDP server instance.
+  /// \param [in] pItf Instance to free.
+  ///
+
+  static void free(UdpNetworkServer* pItf);
+};
+
 } // namespace sw2
 
 // end of swNetwork.h
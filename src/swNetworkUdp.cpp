@@ -0,0 +1,1388 @@
+
+//
+//  Reliable UDP network.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+
+#if defined(WIN32) || defined(_WIN32_WCE)
+# include <windows.h>
+# include <winsock.h>
+# if defined(_MSC_VER)
+#   pragma comment(lib, "Ws2_32")
+# endif
+#elif defined(_linux_)
+# include <errno.h>
+# include <netdb.h>
+# include <sys/socket.h>
+# include <sys/ioctl.h>
+# include <arpa/inet.h>
+# include <unistd.h>
+#endif
+
+#include "swNetwork.h"
+#include "swObjectPool.h"
+#include "swUtil.h"
+
+namespace sw2 {
+
+namespace impl {
+
+//
+// Portable defines.
+//
+
+#if defined(WIN32)
+# define errorno              (::WSAGetLastError())
+# define SOCKET_EWOULDBLOCK   WSAEWOULDBLOCK
+# define SOCKET_EAGAIN        WSAEWOULDBLOCK
+# define socklen_t int
+#elif defined(_linux_)
+# define errorno              errno
+# define SOCKET               int
+# define INVALID_SOCKET       (-1)
+# define SOCKET_ERROR         (-1)
+# define SOCKET_EAGAIN        EAGAIN
+# define SOCKET_EWOULDBLOCK   EWOULDBLOCK
+# define closesocket(s)       close((s))
+# define ioctlsocket(s,a,b)   ioctl((s),(a),(b))
+#endif
+
+//
+// Packet format.
+//
+// | type(1) | flag(1) | conn id(4) | ack(4) | ack bits(4) | seq(4) | data |
+//
+// type: see UDP_PACKET_TYPE.
+// flag: bit 0 is set if this is the last fragment of a reliable stream.
+// conn id: connection id assigned by server, or salt of client in SYN, COOKIE.
+// ack: next expected reliable seq, all packets before it are received.
+// ack bits: bit n is set if reliable packet ack+1+n is received.
+// seq: seq of reliable or unreliable data, salt of client in SYNACK, or cookie
+//      of server in SYN, COOKIE.
+//
+// Handshake: SYN(salt) -> COOKIE(salt, cookie) -> SYN(salt, cookie) -> SYNACK.
+// The cookie is a keyed hash of client address and salt, server keeps no
+// state and allocates no connection until the client echoes the cookie, so a
+// spoofed source address cannot occupy connections.
+//
+
+#define UDP_MAX_PACKET_SIZE 1200        // Max datagram size, bytes.
+#define UDP_HEADER_SIZE 18              // Packet header size, bytes.
+#define UDP_MAX_PAYLOAD_SIZE (UDP_MAX_PACKET_SIZE - UDP_HEADER_SIZE) // Max data size of a datagram, bytes.
+#define UDP_WINDOW_SIZE 256             // Max reliable packets in flight.
+#define UDP_MAX_STREAM_SIZE (1024 * 1024) // Max size of a reliable stream, bytes.
+#define UDP_MAX_TRIGGER_RECV 1024       // Max datagrams will be received in each trigger process.
+#define UDP_MIN_RTO 50                  // Min retransmission timeout, millisecond.
+#define UDP_MAX_RTO 2000                // Max retransmission timeout, millisecond.
+#define UDP_INTERVAL_SYN 200            // Resend interval of connect request, millisecond.
+#define UDP_COOKIE_LIFETIME 10          // A cookie is valid in this interval and the next, second.
+#define UDP_NUM_FIN 3                   // Times to send disconnect signal, it is not acked.
+#define UDP_FLAG_LAST 1                 // Last fragment of a reliable stream.
+#define INIT_CLIENT 64                  // Initial size of connection pool.
+#define INTERVAL_SAMPLE_QUEUE 1000      // Sample interval of send buffer bytes, millisecond.
+#define TIMEOUT_CONNECTING 10           // Connecting phase timeout, second.
+#define TIMEOUT_DISCONNECTING 10        // Disconnecting phase timeout, second.
+#define TIMEOUT_KEEP_ALIVE 25           // Send a keep alive signal if there's no data sent after this interval, second.
+#define TIMEOUT_DEAD_CONNECTION 60      // Force disconnect if there's no data received after this interval, second.
+
+enum UDP_PACKET_TYPE
+{
+  UPT_SYN = 1,                          // Connect request.
+  UPT_SYNACK,                           // Connect accepted.
+  UPT_FIN,                              // Disconnect or connect rejected.
+  UPT_ACK,                              // Ack only, also a keep alive signal.
+  UPT_DATA,                             // Reliable ordered data.
+  UPT_UDATA,                            // Unreliable sequenced data.
+  UPT_COOKIE                            // Connect challenge, echo cookie in SYN.
+};
+
+//
+// Implemented in swSocket.cpp.
+//
+
+std::string getAddr_i(struct sockaddr_in sa);
+bool setAddress_i(std::string const& addr, struct sockaddr_in* sa);
+
+//
+// Implemented in swNetwork.cpp.
+//
+
+bool genToken(uint64& token);
+
+//
+// Implementation.
+//
+
+inline void putUint_i(uchar* p, uint v)
+{
+  p[0] = (uchar)v;
+  p[1] = (uchar)(v >> 8);
+  p[2] = (uchar)(v >> 16);
+  p[3] = (uchar)(v >> 24);
+}
+
+inline uint getUint_i(uchar const* p)
+{
+  return (uint)p[0] | ((uint)p[1] << 8) | ((uint)p[2] << 16) | ((uint)p[3] << 24);
+}
+
+inline void putHeader_i(uchar* p, int type, int flag, uint connId, uint ack, uint ackBits, uint seq)
+{
+  p[0] = (uchar)type;
+  p[1] = (uchar)flag;
+  putUint_i(p + 2, connId);
+  putUint_i(p + 6, ack);
+  putUint_i(p + 10, ackBits);
+  putUint_i(p + 14, seq);
+}
+
+inline uint64 getAddrKey_i(struct sockaddr_in const& sa)
+{
+  return ((uint64)sa.sin_addr.s_addr << 16) | sa.sin_port;
+}
+
+bool genSalt_i(uint& salt)
+{
+  uint64 token;
+  if (!genToken(token)) {
+    SW2_TRACE_ERROR("Generate salt failed.");
+    return false;
+  }
+  salt = (uint)(token ^ (token >> 32));
+  if (0 == salt) {
+    salt = 1;
+  }
+  return true;
+}
+
+inline uint64 mix64_i(uint64 h)
+{
+  h ^= h >> 33;
+  h *= (uint64)0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= (uint64)0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+SOCKET createUdpSock()
+{
+  SOCKET s = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (INVALID_SOCKET == s) {
+    SW2_TRACE_ERROR("Create new UDP socket failed.");
+    return INVALID_SOCKET;
+  }
+
+  unsigned long v = 1;
+  if (SOCKET_ERROR == ioctlsocket(s, FIONBIO, &v)) {
+    SW2_TRACE_ERROR("Set non-block i/o failed.");
+    closesocket(s);
+    return INVALID_SOCKET;
+  }
+
+  return s;
+}
+
+int recvUdp_i(SOCKET s, uchar* buff, struct sockaddr_in &sa)
+{
+  //
+  // Return length of received datagram, 0 if it should be skipped or -1 if
+  // no more data.
+  //
+
+  socklen_t len = sizeof(sa);
+  int n = ::recvfrom(s, (char*)buff, UDP_MAX_PACKET_SIZE, 0, (struct sockaddr*)&sa, &len);
+  if (SOCKET_ERROR == n) {
+    int err = errorno;
+    if (SOCKET_EWOULDBLOCK == err || SOCKET_EAGAIN == err) {
+      return -1;
+    }
+    return 0;                           // Ex: ICMP port unreachable on Windows.
+  }
+
+  return UDP_HEADER_SIZE <= n ? n : 0;
+}
+
+//
+// Reliable data packet.
+//
+
+struct implUdpPacket
+{
+  uint seq;
+  uint timeSent;                        // Last sent time, microsecond.
+  int rto;                              // Retransmission timeout, millisecond.
+  int nSent;                            // Times sent.
+  bool bAcked;
+  int flag;
+  int len;
+  uchar data[UDP_MAX_PAYLOAD_SIZE];
+};
+
+//
+// Reliable UDP connection.
+//
+
+class implUdpBase
+{
+public:
+
+  uint m_connId;
+  uint m_sendSeq;                       // Next reliable seq to send.
+  uint m_recvSeq;                       // Next reliable seq expected.
+  uint m_sendUseq;                      // Next unreliable seq to send.
+  uint m_recvUseq;                      // Min unreliable seq expected.
+
+  std::deque<implUdpPacket*> m_sendQueue; // Unacked reliable packets, oldest first.
+  implUdpPacket* m_recvWin[UDP_WINDOW_SIZE]; // Out of order reliable packets.
+  std::string m_msg;                    // Reassembling stream.
+
+  int m_srtt, m_rttvar;                 // Smoothed RTT and variation, microsecond.
+  int m_rto;                            // Retransmission timeout, millisecond.
+  bool m_bAckPending;
+
+  TimeoutTimer m_keepAliveTimeout;
+  TimeoutTimer m_deadConnectionTimeout;
+
+  NetworkClientStats m_netStats;
+  NetworkHistStats* m_pHist;            // Histograms of client or server.
+  TickArena* m_pArena;                  // Per tick arena of client or server.
+
+  implUdpBase() : m_pHist(0), m_pArena(0)
+  {
+    ::memset(m_recvWin, 0, sizeof(m_recvWin));
+    reset(0);
+  }
+
+  virtual ~implUdpBase()
+  {
+    reset(0);
+  }
+
+  void reset(uint connId)
+  {
+    for (size_t i = 0; i < m_sendQueue.size(); i++) {
+      delete m_sendQueue[i];
+    }
+    m_sendQueue.clear();
+
+    for (int i = 0; i < UDP_WINDOW_SIZE; i++) {
+      delete m_recvWin[i];
+      m_recvWin[i] = 0;
+    }
+
+    m_msg.clear();
+    m_connId = connId;
+    m_sendSeq = m_recvSeq = m_sendUseq = m_recvUseq = 0;
+    m_srtt = -1;
+    m_rttvar = 0;
+    m_rto = 4 * UDP_MIN_RTO;
+    m_bAckPending = false;
+    m_keepAliveTimeout.setTimeout(1000 * TIMEOUT_KEEP_ALIVE);
+    m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
+    ::memset(&m_netStats, 0, sizeof(m_netStats));
+    m_netStats.startTime = ::time(0);
+  }
+
+  bool sendReliable_i(int len, void const* pStream)
+  {
+    if (0 >= len || UDP_MAX_STREAM_SIZE < len) {
+      return false;
+    }
+
+    m_pHist->msgSizeOut.add((uint)len);
+
+    //
+    // Split the stream into fragments.
+    //
+
+    uchar const* p = (uchar const*)pStream;
+    while (0 < len) {
+      implUdpPacket* pk = new implUdpPacket;
+      pk->seq = m_sendSeq++;
+      pk->timeSent = 0;
+      pk->rto = m_rto;
+      pk->nSent = 0;
+      pk->bAcked = false;
+      pk->len = (std::min)(len, (int)UDP_MAX_PAYLOAD_SIZE);
+      pk->flag = len == pk->len ? UDP_FLAG_LAST : 0;
+      ::memcpy(pk->data, p, pk->len);
+      m_sendQueue.push_back(pk);
+      p += pk->len;
+      len -= pk->len;
+    }
+
+    return true;
+  }
+
+  bool sendUnreliable_i(int len, void const* pStream)
+  {
+    if (0 >= len || UDP_MAX_PAYLOAD_SIZE < len) {
+      return false;
+    }
+
+    m_pHist->msgSizeOut.add((uint)len);
+    sendPacket_i(UPT_UDATA, 0, m_sendUseq++, len, pStream);
+    return true;
+  }
+
+  void sendPacket_i(int type, int flag, uint seq, int len, void const* pData)
+  {
+    uchar buff[UDP_MAX_PACKET_SIZE];
+    putHeader_i(buff, type, flag, m_connId, m_recvSeq, getAckBits(), seq);
+    if (0 < len) {
+      ::memcpy(buff + UDP_HEADER_SIZE, pData, len);
+    }
+
+    sendTo_i(buff, UDP_HEADER_SIZE + len);
+
+    m_netStats.bytesSent += UDP_HEADER_SIZE + len;
+    m_netStats.packetsSent += 1;
+    m_bAckPending = false;              // Ack is piggybacked.
+    m_keepAliveTimeout.setTimeout(1000 * TIMEOUT_KEEP_ALIVE);
+  }
+
+  void sendFin_i()
+  {
+    for (int i = 0; i < UDP_NUM_FIN; i++) {
+      sendPacket_i(UPT_FIN, 0, 0, 0, 0);
+    }
+  }
+
+  uint getAckBits() const
+  {
+    uint bits = 0;
+    for (uint i = 0; i < 32; i++) {
+      implUdpPacket const* pk = m_recvWin[(m_recvSeq + 1 + i) % UDP_WINDOW_SIZE];
+      if (pk && m_recvSeq + 1 + i == pk->seq) {
+        bits |= 1u << i;
+      }
+    }
+    return bits;
+  }
+
+  void updateRtt(int rtt)
+  {
+    if (0 > m_srtt) {
+      m_srtt = rtt;
+      m_rttvar = rtt / 2;
+    } else {
+      m_rttvar = (3 * m_rttvar + abs(m_srtt - rtt)) / 4;
+      m_srtt = (7 * m_srtt + rtt) / 8;
+    }
+    m_rto = (std::max)((int)UDP_MIN_RTO, (std::min)((m_srtt + 4 * m_rttvar) / 1000, (int)UDP_MAX_RTO));
+  }
+
+  void processAck(uint ack, uint ackBits)
+  {
+    uint now = (uint)Util::getTickCountUs();
+    for (size_t i = 0; i < m_sendQueue.size(); i++) {
+      implUdpPacket* pk = m_sendQueue[i];
+      int d = (int)(pk->seq - ack);
+      if (32 < d) {
+        break;
+      }
+      if (pk->bAcked || 0 == pk->nSent) {
+        continue;
+      }
+      if (0 > d || (0 < d && (ackBits & (1u << (d - 1))))) {
+        pk->bAcked = true;
+        if (1 == pk->nSent) {           // Karn's algorithm, skip retransmitted.
+          updateRtt((int)(now - pk->timeSent));
+        }
+      }
+    }
+
+    while (!m_sendQueue.empty() && m_sendQueue.front()->bAcked) {
+      delete m_sendQueue.front();
+      m_sendQueue.pop_front();
+    }
+  }
+
+  //
+  // Handle a received packet of this connection, return false if peer
+  // disconnected or sent a stream too long.
+  //
+
+  bool handlePacket_i(uchar const* p, int len)
+  {
+    m_netStats.bytesRecv += len;
+    m_netStats.packetsRecv += 1;
+    m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
+
+    int type = p[0];
+    if (UPT_FIN == type) {
+      return false;
+    }
+
+    processAck(getUint_i(p + 6), getUint_i(p + 10));
+
+    uint seq = getUint_i(p + 14);
+    uchar const* pData = p + UDP_HEADER_SIZE;
+    int lenData = len - UDP_HEADER_SIZE;
+
+    if (UPT_UDATA == type) {
+      if (0 <= (int)(seq - m_recvUseq)) { // Drop old streams.
+        m_recvUseq = seq + 1;
+        notifyStreamReady_i(lenData, pData);
+      }
+      return true;
+    }
+
+    if (UPT_DATA != type) {
+      return true;
+    }
+
+    m_bAckPending = true;
+
+    int d = (int)(seq - m_recvSeq);
+    if (0 > d || UDP_WINDOW_SIZE <= d) { // Duplicated or out of window.
+      return true;
+    }
+
+    implUdpPacket*& slot = m_recvWin[seq % UDP_WINDOW_SIZE];
+    if (0 == slot) {
+      slot = new implUdpPacket;
+      slot->seq = seq;
+      slot->flag = p[1];
+      slot->len = lenData;
+      ::memcpy(slot->data, pData, lenData);
+    }
+
+    //
+    // Deliver in order.
+    //
+
+    while (true) {
+      implUdpPacket*& pk = m_recvWin[m_recvSeq % UDP_WINDOW_SIZE];
+      if (0 == pk) {
+        break;
+      }
+
+      implUdpPacket* pCurr = pk;
+      pk = 0;
+      m_recvSeq += 1;
+
+      if (m_msg.empty() && (pCurr->flag & UDP_FLAG_LAST)) {
+        notifyStreamReady_i(pCurr->len, pCurr->data); // Single fragment, no copy.
+      } else {
+        if (UDP_MAX_STREAM_SIZE < m_msg.length() + pCurr->len) { // Last fragment never comes.
+          SW2_TRACE_ERROR("Stream too long.");
+          delete pCurr;
+          sendFin_i();
+          return false;
+        }
+        m_msg.append((char const*)pCurr->data, pCurr->len);
+        if (pCurr->flag & UDP_FLAG_LAST) {
+
+          //
+          // Deliver a copy in the arena, m_msg keeps its capacity for next
+          // stream and may be reset in the callback.
+          //
+
+          int len = (int)m_msg.length();
+          void* pMsg = m_pArena->alloc(len);
+          ::memcpy(pMsg, m_msg.data(), len);
+          m_msg.clear();
+          notifyStreamReady_i(len, pMsg);
+        }
+      }
+
+      delete pCurr;
+    }
+
+    return true;
+  }
+
+  //
+  // Send new and retransmit timeout packets, and ack or keep alive signal.
+  //
+
+  void flush_i()
+  {
+    if (!m_sendQueue.empty()) {
+      uint now = (uint)Util::getTickCountUs();
+      uint base = m_sendQueue.front()->seq;
+      for (size_t i = 0; i < m_sendQueue.size(); i++) {
+        implUdpPacket* pk = m_sendQueue[i];
+        if (UDP_WINDOW_SIZE <= (int)(pk->seq - base)) {
+          break;
+        }
+        if (pk->bAcked) {
+          continue;
+        }
+        if (0 == pk->nSent) {
+          pk->rto = m_rto;
+        } else if ((int)(now - pk->timeSent) >= 1000 * pk->rto) {
+          pk->rto = (std::min)(2 * pk->rto, (int)UDP_MAX_RTO); // Backoff.
+        } else {
+          continue;
+        }
+        pk->nSent += 1;
+        pk->timeSent = now;
+        sendPacket_i(UPT_DATA, pk->flag, pk->seq, pk->len, pk->data);
+      }
+    }
+
+    if (m_bAckPending || m_keepAliveTimeout.isExpired()) {
+      sendPacket_i(UPT_ACK, 0, 0, 0, 0);
+    }
+  }
+
+  void getNetStats_i(NetworkClientStats &ns, int sizeObj) const
+  {
+    ns = m_netStats;
+    ns.upTime = (time_t)::difftime(::time(0), ns.startTime);
+    ns.bytesBuff = getBytesSendBuff();
+    ns.rtt = 0 > m_srtt ? 0 : (std::max)(1, m_srtt);
+    ns.rttJitter = m_rttvar;
+    ns.bytesMem = sizeObj + m_msg.capacity() + m_sendQueue.size() * sizeof(implUdpPacket);
+    for (int i = 0; i < UDP_WINDOW_SIZE; i++) {
+      if (m_recvWin[i]) {
+        ns.bytesMem += sizeof(implUdpPacket);
+      }
+    }
+  }
+
+  void notifyStreamReady_i(int len, void const* pStream)
+  {
+    uint64 t = Util::getTickCountUs();
+    onStreamReady_i(len, pStream);
+    m_pHist->msgSizeIn.add((uint)len);
+    m_pHist->callbackTime.add((uint)(Util::getTickCountUs() - t));
+  }
+
+  uint getBytesSendBuff() const
+  {
+    uint n = 0;
+    for (size_t i = 0; i < m_sendQueue.size(); i++) {
+      n += m_sendQueue[i]->len;
+    }
+    return n;
+  }
+
+  virtual void sendTo_i(void const* p, int len)=0;
+  virtual void onStreamReady_i(int len, void const* pStream)=0;
+};
+
+//
+// UDP client.
+//
+
+class implUdpNetworkClient : public implUdpBase, public UdpNetworkClient
+{
+public:
+
+  NetworkClientCallback* m_pInterface;
+
+  SOCKET m_socket;
+  struct sockaddr_in m_sa;              // Server address.
+  int m_state;
+  uint m_salt;
+  uint m_cookie;                        // Cookie of server to echo in SYN, 0 if not received.
+  uint m_timeSyn;                       // Last sent time of connect request.
+  TimeoutTimer m_timer;                 // Connecting or disconnecting timeout.
+
+  NetworkHistStats m_hist;
+  TickArena m_arena;                    // Reassembled streams of a trigger.
+  uint m_timeSample;                    // Last sample time of send buffer bytes.
+
+  explicit implUdpNetworkClient(NetworkClientCallback* pCallback) : m_pInterface(pCallback)
+  {
+    NetworkClient::userData = 0;
+    m_socket = INVALID_SOCKET;
+    m_state = CS_DISCONNECTED;
+    m_salt = m_cookie = m_timeSyn = 0;
+    m_pHist = &m_hist;
+    m_pArena = &m_arena;
+    m_hist.reset();
+    m_timeSample = Util::getTickCount();
+  }
+
+  virtual ~implUdpNetworkClient()
+  {
+    if (CS_CONNECTED == m_state || CS_DISCONNECTING == m_state) {
+      sendFin_i();
+    }
+    close_i(false);
+  }
+
+  void close_i(bool bNotify)
+  {
+    if (INVALID_SOCKET != m_socket) {
+      closesocket(m_socket);
+      m_socket = INVALID_SOCKET;
+    }
+
+    m_state = CS_DISCONNECTED;
+
+    if (bNotify) {
+      m_pInterface->onNetworkServerLeave(this);
+    }
+  }
+
+  void handlePacket(uchar const* p, int len)
+  {
+    uint connId = getUint_i(p + 2);
+
+    if (CS_CONNECTING == m_state) {
+      if (UPT_SYNACK == p[0] && m_salt == getUint_i(p + 14)) {
+        m_connId = connId;
+        m_state = CS_CONNECTED;
+        m_netStats.startTime = ::time(0);
+        m_deadConnectionTimeout.setTimeout(1000 * TIMEOUT_DEAD_CONNECTION);
+        m_pInterface->onNetworkServerReady(this);
+      } else if (m_salt == connId && UPT_COOKIE == p[0] && 0 == m_cookie) {
+        m_cookie = getUint_i(p + 14);
+        m_timeSyn = Util::getTickCount();
+        sendPacket_i(UPT_SYN, 0, m_cookie, 0, 0);
+      } else if (m_salt == connId && UPT_FIN == p[0]) {
+        close_i(false);                 // Rejected.
+      }
+      return;
+    }
+
+    if (m_connId != connId || UPT_SYNACK == p[0] || UPT_SYN == p[0] || UPT_COOKIE == p[0]) {
+      return;
+    }
+
+    if (!handlePacket_i(p, len)) {
+      close_i(true);
+    }
+  }
+
+  //
+  // Implement implUdpBase.
+  //
+
+  virtual void sendTo_i(void const* p, int len)
+  {
+    ::sendto(m_socket, (char const*)p, len, 0, (struct sockaddr*)&m_sa, sizeof(m_sa));
+  }
+
+  virtual void onStreamReady_i(int len, void const* pStream)
+  {
+    m_pInterface->onNetworkStreamReady(this, len, pStream);
+  }
+
+  //
+  // Implement UdpNetworkClient.
+  //
+
+  virtual bool connect(std::string const& svrAddr)
+  {
+    if (CS_DISCONNECTED != m_state) {
+      return false;
+    }
+
+    if (!setAddress_i(svrAddr, &m_sa)) {
+      return false;
+    }
+
+    m_socket = createUdpSock();
+    if (INVALID_SOCKET == m_socket) {
+      return false;
+    }
+
+    if (!genSalt_i(m_salt)) {
+      closesocket(m_socket);
+      m_socket = INVALID_SOCKET;
+      return false;
+    }
+
+    reset(m_salt);                      // Salt is sent as conn id of SYN.
+    m_cookie = 0;
+
+    m_state = CS_CONNECTING;
+    m_timer.setTimeout(1000 * TIMEOUT_CONNECTING);
+    m_timeSyn = Util::getTickCount();
+    sendPacket_i(UPT_SYN, 0, 0, 0, 0);
+
+    return true;
+  }
+
+  virtual void disconnect()
+  {
+    if (CS_CONNECTING == m_state) {
+      close_i(false);
+    } else if (CS_CONNECTED == m_state) {
+      m_state = CS_DISCONNECTING;
+      m_timer.setTimeout(1000 * TIMEOUT_DISCONNECTING);
+    }
+  }
+
+  virtual int getConnectionState() const
+  {
+    return m_state;
+  }
+
+  virtual std::string getAddr() const
+  {
+    return getAddr_i(m_sa);
+  }
+
+  virtual NetworkClientStats getNetStats() const
+  {
+    NetworkClientStats ns;
+    getNetStats_i(ns, sizeof(*this));
+    return ns;
+  }
+
+  virtual bool send(int len, void const* pStream)
+  {
+    if (CS_CONNECTED != m_state) {
+      return false;
+    }
+
+    return sendReliable_i(len, pStream);
+  }
+
+  virtual bool send(int len, void const* pStream, int channel)
+  {
+    if (CS_CONNECTED != m_state) {
+      return false;
+    }
+
+    if (NC_UNRELIABLE_SEQUENCED == channel) {
+      return sendUnreliable_i(len, pStream);
+    } else {
+      return sendReliable_i(len, pStream);
+    }
+  }
+
+  virtual void setBatchWindow(int usec)
+  {
+  }
+
+  virtual NetworkHistStats getHistStats() const
+  {
+    return m_hist;
+  }
+
+  virtual void resetHistStats()
+  {
+    m_hist.reset();
+  }
+
+  virtual void trigger()
+  {
+    if (INVALID_SOCKET == m_socket) {
+      return;
+    }
+
+    uint64 t = Util::getTickCountUs();
+
+    m_arena.reset();                    // Streams of last trigger are handled.
+    trigger_i();
+
+    if (INTERVAL_SAMPLE_QUEUE <= Util::getTickCount() - m_timeSample) {
+      m_timeSample = Util::getTickCount();
+      if (CS_CONNECTED == m_state) {
+        m_hist.queueBytes.add(getBytesSendBuff());
+      }
+    }
+
+    m_hist.triggerTime.add((uint)(Util::getTickCountUs() - t));
+  }
+
+  void trigger_i()
+  {
+    //
+    // Receive.
+    //
+
+    uchar buff[UDP_MAX_PACKET_SIZE];
+    for (int i = 0; i < UDP_MAX_TRIGGER_RECV && INVALID_SOCKET != m_socket; i++) {
+      struct sockaddr_in sa;
+      int n = recvUdp_i(m_socket, buff, sa);
+      if (0 > n) {
+        break;
+      }
+      if (0 < n && getAddrKey_i(sa) == getAddrKey_i(m_sa)) {
+        handlePacket(buff, n);
+      }
+    }
+
+    //
+    // Update state.
+    //
+
+    switch (m_state)
+    {
+    case CS_CONNECTING:
+      if (m_timer.isExpired()) {
+        close_i(false);
+      } else if (UDP_INTERVAL_SYN <= Util::getTickCount() - m_timeSyn) {
+        m_timeSyn = Util::getTickCount();
+        sendPacket_i(UPT_SYN, 0, m_cookie, 0, 0);
+      }
+      break;
+
+    case CS_CONNECTED:
+      if (m_deadConnectionTimeout.isExpired()) {
+        close_i(true);
+      } else {
+        flush_i();
+      }
+      break;
+
+    case CS_DISCONNECTING:
+      flush_i();
+      if (m_sendQueue.empty() || m_timer.isExpired()) {
+        sendFin_i();
+        close_i(true);
+      }
+      break;
+    }
+  }
+};
+
+//
+// UDP server connection.
+//
+
+class implUdpNetworkServer;
+
+class implUdpNetworkConnection : public implUdpBase, public NetworkConnection
+{
+public:
+
+  implUdpNetworkServer* m_pServer;
+  int m_id;                             // ID in connection pool.
+  struct sockaddr_in m_sa;              // Client address.
+  int m_state;
+  uint m_salt;
+  TimeoutTimer m_timer;                 // Disconnecting timeout.
+
+  //
+  // Implement implUdpBase.
+  //
+
+  virtual void sendTo_i(void const* p, int len);
+  virtual void onStreamReady_i(int len, void const* pStream);
+
+  //
+  // Implement NetworkConnection.
+  //
+
+  virtual void disconnect()
+  {
+    if (CS_CONNECTED == m_state) {
+      m_state = CS_DISCONNECTING;
+      m_timer.setTimeout(1000 * TIMEOUT_DISCONNECTING);
+    }
+  }
+
+  virtual int getConnectionState() const
+  {
+    return m_state;
+  }
+
+  virtual std::string getAddr() const
+  {
+    return getAddr_i(m_sa);
+  }
+
+  virtual NetworkClientStats getNetStats() const
+  {
+    NetworkClientStats ns;
+    getNetStats_i(ns, sizeof(*this));
+    return ns;
+  }
+
+  virtual bool send(int len, void const* pStream)
+  {
+    if (CS_CONNECTED != m_state) {
+      return false;
+    }
+
+    return sendReliable_i(len, pStream);
+  }
+
+  virtual bool send(int len, void const* pStream, int channel)
+  {
+    if (CS_CONNECTED != m_state) {
+      return false;
+    }
+
+    if (NC_UNRELIABLE_SEQUENCED == channel) {
+      return sendUnreliable_i(len, pStream);
+    } else {
+      return sendReliable_i(len, pStream);
+    }
+  }
+};
+
+//
+// UDP server.
+//
+
+class implUdpNetworkServer : public UdpNetworkServer
+{
+public:
+
+  explicit implUdpNetworkServer(NetworkServerCallback* pCallback) : m_pInterface(pCallback)
+  {
+    NetworkServer::userData = 0;
+    m_socket = INVALID_SOCKET;
+    m_bAccept = false;
+    m_maxClient = 0;
+    m_secret = 0;
+    ::memset(&m_netStats, 0, sizeof(m_netStats));
+    m_hist.reset();
+    m_timeSample = Util::getTickCount();
+  }
+
+  virtual ~implUdpNetworkServer()
+  {
+    for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+      implUdpNetworkConnection* pConn = m_poolClient[i];
+      if (CS_CONNECTED == pConn->m_state || CS_DISCONNECTING == pConn->m_state) {
+        pConn->sendFin_i();
+      }
+      delete pConn;
+    }
+
+    for (size_t i = 0; i < m_freeClient.size(); i++) {
+      delete m_freeClient[i];
+    }
+
+    if (INVALID_SOCKET != m_socket) {
+      closesocket(m_socket);
+    }
+  }
+
+  implUdpNetworkConnection& getConnection(int id) const
+  {
+    return *m_poolClient[id];
+  }
+
+  void sendTo(struct sockaddr_in const& sa, void const* p, int len)
+  {
+    ::sendto(m_socket, (char const*)p, len, 0, (struct sockaddr const*)&sa, sizeof(sa));
+    m_netStats.bytesSent += len;
+    m_netStats.packetsSent += 1;
+  }
+
+  void close_i(implUdpNetworkConnection* pConn)
+  {
+    pConn->m_state = CS_DISCONNECTED;
+    m_pInterface->onNetworkClientLeave(this, (NetworkConnection*)pConn);
+
+    m_addrMap.erase(getAddrKey_i(pConn->m_sa));
+    pConn->reset(0);
+    std::string().swap(pConn->m_msg);
+    m_freeClient.push_back(pConn);
+    m_poolClient.free(pConn->m_id);
+    m_netStats.currOnline -= 1;
+  }
+
+  uint genCookie(uint64 key, uint salt, uint period) const
+  {
+    uint64 h = mix64_i(mix64_i(m_secret ^ key) ^ (((uint64)salt << 32) | period) ^ (m_secret >> 17));
+    uint cookie = (uint)(h ^ (h >> 32));
+    return 0 != cookie ? cookie : 1;
+  }
+
+  bool isValidCookie(uint64 key, uint salt, uint cookie) const
+  {
+    uint period = Util::getTickCount() / (1000 * UDP_COOKIE_LIFETIME);
+    return cookie == genCookie(key, salt, period) || cookie == genCookie(key, salt, period - 1);
+  }
+
+  void handleSyn(struct sockaddr_in const& sa, uint salt, uint cookie)
+  {
+    uint64 key = getAddrKey_i(sa);
+    std::map<uint64, int>::iterator it = m_addrMap.find(key);
+    if (m_addrMap.end() != it && salt == m_poolClient[it->second]->m_salt) {
+      m_poolClient[it->second]->sendPacket_i(UPT_SYNACK, 0, salt, 0, 0); // SYNACK lost, resend.
+      return;
+    }
+
+    uchar buff[UDP_HEADER_SIZE];
+
+    //
+    // Challenge with a cookie, allocate nothing until the client proves it
+    // receives from this address.
+    //
+
+    if (0 == cookie || !isValidCookie(key, salt, cookie)) {
+      if (m_bAccept) {
+        putHeader_i(buff, UPT_COOKIE, 0, salt, 0, 0, genCookie(key, salt, Util::getTickCount() / (1000 * UDP_COOKIE_LIFETIME)));
+        sendTo(sa, buff, UDP_HEADER_SIZE);
+      }
+      return;
+    }
+
+    if (m_addrMap.end() != it) {
+      close_i(m_poolClient[it->second]); // Client restarted.
+    }
+
+    putHeader_i(buff, UPT_FIN, 0, salt, 0, 0, 0);
+
+    uint connId;
+    if (!m_bAccept || (0 < m_maxClient && m_maxClient <= m_poolClient.size()) || !genSalt_i(connId)) {
+      sendTo(sa, buff, UDP_HEADER_SIZE);
+      return;
+    }
+
+    //
+    // Connection objects are allocated individually and reused, so the
+    // pointer of a connection keeps valid when the pool grows.
+    //
+
+    implUdpNetworkConnection* pConn;
+    if (!m_freeClient.empty()) {
+      pConn = m_freeClient.back();
+      m_freeClient.pop_back();
+    } else {
+      pConn = new implUdpNetworkConnection;
+    }
+
+    int id = m_poolClient.alloc();
+    if (-1 == id) {
+      m_freeClient.push_back(pConn);
+      sendTo(sa, buff, UDP_HEADER_SIZE);
+      return;
+    }
+
+    m_poolClient[id] = pConn;
+    pConn->reset(connId);               // Random, not guessable by other peers.
+    pConn->userData = 0;
+    pConn->m_pServer = this;
+    pConn->m_pHist = &m_hist;
+    pConn->m_pArena = &m_arena;
+    pConn->m_id = id;
+    pConn->m_sa = sa;
+    pConn->m_state = CS_CONNECTED;
+    pConn->m_salt = salt;
+    m_addrMap[key] = id;
+
+    //
+    // Accept this new connection?
+    //
+
+    if (!m_pInterface->onNetworkNewClientReady(this, (NetworkConnection*)pConn)) {
+      m_addrMap.erase(key);
+      pConn->reset(0);
+      m_freeClient.push_back(pConn);
+      m_poolClient.free(id);
+      sendTo(sa, buff, UDP_HEADER_SIZE);
+      return;
+    }
+
+    m_netStats.hits += 1;
+    m_netStats.currOnline += 1;
+    m_netStats.maxOnline = (std::max)(m_netStats.maxOnline, m_netStats.currOnline);
+
+    pConn->sendPacket_i(UPT_SYNACK, 0, salt, 0, 0);
+  }
+
+  void handlePacket(struct sockaddr_in const& sa, uchar const* p, int len)
+  {
+    m_netStats.bytesRecv += len;
+    m_netStats.packetsRecv += 1;
+
+    uint connId = getUint_i(p + 2);
+    if (UPT_SYN == p[0]) {
+      handleSyn(sa, connId, getUint_i(p + 14));
+      return;
+    }
+
+    std::map<uint64, int>::iterator it = m_addrMap.find(getAddrKey_i(sa));
+    if (m_addrMap.end() == it) {
+      return;
+    }
+
+    implUdpNetworkConnection* pConn = m_poolClient[it->second];
+    if (connId != pConn->m_connId || UPT_SYNACK == p[0]) {
+      return;
+    }
+
+    if (!pConn->handlePacket_i(p, len) && CS_DISCONNECTED != pConn->m_state) {
+      close_i(pConn);
+    }
+  }
+
+  //
+  // Implement UdpNetworkServer.
+  //
+
+  virtual bool startup(std::string const& addr)
+  {
+    struct sockaddr_in sa;
+    if (!setAddress_i(addr, &sa)) {
+      return false;
+    }
+
+    //
+    // Connections share the socket, restart on the same socket.
+    //
+
+    if (INVALID_SOCKET != m_socket) {
+      if (0 < m_poolClient.size()) {
+        if (getAddrKey_i(sa) != getAddrKey_i(m_sa)) {
+          SW2_TRACE_ERROR("Restart UDP server on different address with connections.");
+          return false;
+        }
+      } else {
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+      }
+    }
+
+    if (INVALID_SOCKET == m_socket) {
+      m_socket = createUdpSock();
+      if (INVALID_SOCKET == m_socket) {
+        return false;
+      }
+
+      if (SOCKET_ERROR == ::bind(m_socket, (struct sockaddr*)&sa, sizeof(sa))) {
+        SW2_TRACE_ERROR("Bind UDP socket failed.");
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+        return false;
+      }
+
+      if (!genToken(m_secret)) {
+        SW2_TRACE_ERROR("Generate cookie secret failed.");
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+        return false;
+      }
+
+      m_sa = sa;
+      m_netStats.startTime = ::time(0);
+    }
+
+    m_bAccept = true;
+    m_pInterface->onNetworkServerStartup(this);
+
+    return true;
+  }
+
+  virtual bool startup(Ini const& conf1)
+  {
+    Ini conf = conf1;
+    m_maxClient = conf.find("MaxClient") ? conf["MaxClient"] : 0;
+    m_poolClient.reserve(conf.find("InitClient") ? conf["InitClient"] : (int)INIT_CLIENT);
+
+    return startup(conf["AddrListen"].value);
+  }
+
+  virtual void shutdown()
+  {
+    if (m_bAccept) {
+      m_bAccept = false;
+      m_pInterface->onNetworkServerShutdown(this);
+    }
+  }
+
+  virtual void setBatchWindow(int usec)
+  {
+  }
+
+  virtual void setLeanMode(bool bLean)
+  {
+  }
+
+  virtual void setPipeline(bool bPipeline)
+  {
+  }
+
+  virtual void setSessionTimeout(int sec)
+  {
+  }
+
+  virtual void trigger()
+  {
+    if (INVALID_SOCKET == m_socket) {
+      return;
+    }
+
+    uint64 t = Util::getTickCountUs();
+
+    m_arena.reset();                    // Streams of last trigger are handled.
+    trigger_i();
+
+    if (INTERVAL_SAMPLE_QUEUE <= Util::getTickCount() - m_timeSample) {
+      m_timeSample = Util::getTickCount();
+      for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+        m_hist.queueBytes.add(getConnection(i).getBytesSendBuff());
+      }
+    }
+
+    m_hist.triggerTime.add((uint)(Util::getTickCountUs() - t));
+  }
+
+  void trigger_i()
+  {
+    //
+    // Receive.
+    //
+
+    uchar buff[UDP_MAX_PACKET_SIZE];
+    for (int i = 0; i < UDP_MAX_TRIGGER_RECV; i++) {
+      struct sockaddr_in sa;
+      int n = recvUdp_i(m_socket, buff, sa);
+      if (0 > n) {
+        break;
+      }
+      if (0 < n) {
+        handlePacket(sa, buff, n);
+      }
+    }
+
+    //
+    // Update connections.
+    //
+
+    for (int i = m_poolClient.first(); -1 != i;) {
+      int next = m_poolClient.next(i);
+      implUdpNetworkConnection* pConn = m_poolClient[i];
+
+      if (CS_CONNECTED == pConn->m_state) {
+        if (pConn->m_deadConnectionTimeout.isExpired()) {
+          close_i(pConn);
+        } else {
+          pConn->flush_i();
+        }
+      } else if (CS_DISCONNECTING == pConn->m_state) {
+        pConn->flush_i();
+        if (pConn->m_sendQueue.empty() || pConn->m_timer.isExpired()) {
+          pConn->sendFin_i();
+          close_i(pConn);
+        }
+      }
+
+      i = next;
+    }
+  }
+
+  virtual std::string getAddr() const
+  {
+    return INVALID_SOCKET != m_socket ? getAddr_i(m_sa) : "";
+  }
+
+  virtual NetworkServerStats getNetStats() const
+  {
+    NetworkServerStats ns = m_netStats;
+    ns.upTime = (time_t)::difftime(::time(0), ns.startTime);
+    ns.bytesBuff = ns.bytesMem = 0;
+
+    for (int i = m_poolClient.first(); -1 != i; i = m_poolClient.next(i)) {
+      NetworkClientStats cs = getConnection(i).getNetStats();
+      ns.bytesBuff += cs.bytesBuff;
+      ns.bytesMem += cs.bytesMem;
+    }
+
+    ns.bytesMem += m_freeClient.size() * sizeof(implUdpNetworkConnection) + m_arena.getCapacity();
+    ns.bytesTick = (uint)m_arena.getLastTickBytes();
+
+    return ns;
+  }
+
+  virtual NetworkHistStats getHistStats() const
+  {
+    return m_hist;
+  }
+
+  virtual void resetHistStats()
+  {
+    m_hist.reset();
+  }
+
+  virtual NetworkConnection* getFirstConnection() const
+  {
+    int first = m_poolClient.first();
+    if (-1 == first) {
+      return 0;
+    } else {
+      return (NetworkConnection*)&getConnection(first);
+    }
+  }
+
+  virtual NetworkConnection* getNextConnection(NetworkConnection* pClient) const
+  {
+    if (0 == pClient) {
+      return 0;
+    }
+
+    int next = m_poolClient.next(((implUdpNetworkConnection*)pClient)->m_id);
+    if (-1 == next) {
+      return 0;
+    } else {
+      return (NetworkConnection*)&getConnection(next);
+    }
+  }
+
+public:
+
+  NetworkServerCallback* m_pInterface;
+
+  SOCKET m_socket;
+  struct sockaddr_in m_sa;              // Listen address.
+  bool m_bAccept;                       // Accept new connection or not.
+  int m_maxClient;                      // Max client connection, 0 is unlimited.
+  uint64 m_secret;                      // Key of cookies.
+
+  ObjectPool<implUdpNetworkConnection*, INIT_CLIENT, true> m_poolClient; // Connected clients.
+  std::vector<implUdpNetworkConnection*> m_freeClient; // Free connections for reuse.
+  std::map<uint64, int> m_addrMap;      // Client address to connection ID.
+
+  NetworkServerStats m_netStats;
+  NetworkHistStats m_hist;              // Histograms of all connections.
+  TickArena m_arena;                    // Reassembled streams of a trigger.
+  uint m_timeSample;                    // Last sample time of send buffer bytes.
+};
+
+void implUdpNetworkConnection::sendTo_i(void const* p, int len)
+{
+  m_pServer->sendTo(m_sa, p, len);
+}
+
+void implUdpNetworkConnection::onStreamReady_i(int len, void const* pStream)
+{
+  m_pServer->m_pInterface->onNetworkStreamReady(m_pServer, (NetworkConnection*)this, len, pStream);
+}
+
+} // namespace impl
+
+UdpNetworkClient* UdpNetworkClient::alloc(NetworkClientCallback* pCallback)
+{
+  assert(pCallback);
+  return new impl::implUdpNetworkClient(pCallback);
+}
+
+void UdpNetworkClient::free(UdpNetworkClient* pClient)
+{
+  delete (impl::implUdpNetworkClient*)pClient;
+}
+
+UdpNetworkServer* UdpNetworkServer::alloc(NetworkServerCallback* pCallback)
+{
+  assert(pCallback);
+  return new impl::implUdpNetworkServer(pCallback);
+}
+
+void UdpNetworkServer::free(UdpNetworkServer* pServer)
+{
+  delete (impl::implUdpNetworkServer*)pServer;
+}
+
+} // namespace sw2
+
+// end of swNetworkUdp.cpp
@@ -87,7 +87,11 @@
 
 #pragma once
 
+#include <new>
+#include <string>
+
 #include "swinc.h"
+#include "swUtil.h"
 
 namespace sw2 {
 
@@ -100,7 +104,6 @@ class ObjectPoolBase
 {
 protected:
   int mCapacity;
-  T* mEntity;                           // Entities, object pool.
 
   int mNumUsed;                         // Number used entity.
   int mFree1, mFreeN;                   // Free list head and tail.
@@ -389,21 +392,76 @@ public:
   const T& operator[](int index) const
   {
     assert(isUsed(index));
-    return mEntity[index];
+    return static_cast<PoolT const&>(*this).entity_(index);
   }
 };
 
+//
+// Number of bits of N.
+//
+
+template<size_t N>
+struct ObjectPoolBits
+{
+  enum { value = 1 + ObjectPoolBits<(N >> 1)>::value };
+};
+
+template<>
+struct ObjectPoolBits<0>
+{
+  enum { value = 0 };
+};
+
+//
+// Auto grow pool, entities are stored in fixed size blocks. Grow adds blocks
+// to the block table, entities are never moved, so pointers to entities keep
+// valid.
+//
+
 template<typename T, size_t INIT_SIZE = 16, bool AUTO_GROW = false>
 class ObjectPool : public ObjectPoolBase<ObjectPool<T, INIT_SIZE, AUTO_GROW>, T>
 {
   typedef ObjectPoolBase<ObjectPool<T, INIT_SIZE, AUTO_GROW>, T> Base;
+  friend class ObjectPoolBase<ObjectPool<T, INIT_SIZE, AUTO_GROW>, T>;
+
+  enum {
+    BLOCK_SHIFT = ObjectPoolBits<(16 < INIT_SIZE ? INIT_SIZE : 16) - 1>::value, // INIT_SIZE round up to power of 2, at least 16.
+    BLOCK_SIZE = 1 << BLOCK_SHIFT
+  };
+
+  T** mBlock;                           // Block table.
+  int mNumBlock, mMaxBlock;             // Number of blocks, size of block table.
+
+  T& entity_(int index) const
+  {
+    return mBlock[index >> BLOCK_SHIFT][index & (BLOCK_SIZE - 1)];
+  }
+
+  void init_()
+  {
+    mBlock = 0;
+    mNumBlock = mMaxBlock = 0;
+    Base::mCapacity = Base::mNumUsed = 0;
+    Base::mFree1 = Base::mFreeN = Base::mUsed1 = Base::mUsedN = -1;
+    Base::mLstNext = Base::mLstPrev = 0;
+    Base::mLstUsed = 0;
+  }
+
+  void allocBlock_(int index)
+  {
+    T *&pBlock = mBlock[index >> BLOCK_SHIFT];
+    if (0 == pBlock) {
+      pBlock = new T [BLOCK_SIZE];
+    }
+  }
 
   void copy_(ObjectPool const& pool)
   {
     grow_(pool.mCapacity);
 
-    for (int i = 0; i < pool.mCapacity; i++) {
-      Base::mEntity[i] = pool.mEntity[i];
+    for (int i = pool.first(); -1 != i; i = pool.next(i)) {
+      allocBlock_(i);
+      entity_(i) = pool.entity_(i);
     }
 
     ::memcpy(Base::mLstNext, pool.mLstNext, Base::mCapacity * sizeof(int));
@@ -426,41 +484,39 @@ class ObjectPool : public ObjectPoolBase<ObjectPool<T, INIT_SIZE, AUTO_GROW>, T>
     int newSize = size;
 
     //
-    // Re-allocate new pool.
+    // Grow block table to cover new size, a block is allocated when an entity
+    // of it is allocated first time.
     //
 
-    T *pT = 0;
-    int *pLstNext = 0, *pLstPrev = 0;
-    bool *pLstUsed = 0;
-
-    pT = new T [newSize];
-    if (0 == pT) {
-      goto failed;
+    int numBlock = (newSize + BLOCK_SIZE - 1) >> BLOCK_SHIFT;
+    if (mMaxBlock < numBlock) {
+      int maxBlock = numBlock > 2 * mMaxBlock ? numBlock : 2 * mMaxBlock;
+      T **pBlock = new T* [maxBlock];
+      if (0 < mNumBlock) {
+        ::memcpy(pBlock, mBlock, mNumBlock * sizeof(T*));
+      }
+      delete [] mBlock;
+      mBlock = pBlock;
+      mMaxBlock = maxBlock;
     }
 
-    pLstNext = new int [newSize];
-    if (0 == pLstNext) {
-      goto failed;
+    for (; mNumBlock < numBlock; mNumBlock++) {
+      mBlock[mNumBlock] = 0;
     }
 
-    pLstPrev = new int [newSize];
-    if (0 == pLstPrev) {
-      goto failed;
-    }
+    //
+    // Re-allocate lists.
+    //
 
-    pLstUsed = new bool [newSize];
-    if (0 == pLstUsed) {
-      goto failed;
-    }
+    int *pLstNext = new int [newSize];
+    int *pLstPrev = new int [newSize];
+    bool *pLstUsed = new bool [newSize];
 
     //
     // Duplicate old pool settings to new pool.
     //
 
     if (0 < Base::mCapacity) {
-      for (int i = 0; i < Base::mCapacity; i++) {
-        pT[i] = Base::mEntity[i];
-      }
       ::memcpy(pLstNext, Base::mLstNext, Base::mCapacity * sizeof(int));
       ::memcpy(pLstPrev, Base::mLstPrev, Base::mCapacity * sizeof(int));
       ::memcpy(pLstUsed, Base::mLstUsed, Base::mCapacity * sizeof(bool));
@@ -493,56 +549,40 @@ class ObjectPool : public ObjectPoolBase<ObjectPool<T, INIT_SIZE, AUTO_GROW>, T>
 
     Base::mCapacity = newSize;
 
-    delete [] Base::mEntity;
     delete [] Base::mLstNext;
     delete [] Base::mLstPrev;
     delete [] Base::mLstUsed;
 
-    Base::mEntity = pT;
     Base::mLstNext = pLstNext;
     Base::mLstPrev = pLstPrev;
     Base::mLstUsed = pLstUsed;
-
-    return;
-
-failed:
-    delete [] pT;
-    delete [] pLstNext;
-    delete [] pLstPrev;
-    delete [] pLstUsed;
   }
 
 public:
 
   ObjectPool()
   {
-    Base::mEntity = 0;
-    Base::mCapacity = Base::mNumUsed = 0;
-    Base::mFree1 = Base::mFreeN = Base::mUsed1 = Base::mUsedN = -1;
-    Base::mLstNext = Base::mLstPrev = 0;
-    Base::mLstUsed = 0;
+    init_();
     grow_(INIT_SIZE);
   }
 
   ObjectPool(ObjectPool const& pool)
   {
-    Base::mEntity = 0;
-    Base::mCapacity = Base::mNumUsed = 0;
-    Base::mFree1 = Base::mFreeN = Base::mUsed1 = Base::mUsedN = -1;
-    Base::mLstNext = Base::mLstPrev = 0;
-    Base::mLstUsed = 0;
+    init_();
     copy_(pool);
   }
 
   ~ObjectPool()
   {
-    delete [] Base::mEntity, Base::mEntity = 0;
-    delete [] Base::mLstNext, Base::mLstNext = 0;
-    delete [] Base::mLstPrev, Base::mLstPrev = 0;
-    delete [] Base::mLstUsed, Base::mLstUsed = 0;
+    for (int i = 0; i < mNumBlock; i++) {
+      delete [] mBlock[i];
+    }
+    delete [] mBlock;
+    delete [] Base::mLstNext;
+    delete [] Base::mLstPrev;
+    delete [] Base::mLstUsed;
 
-    Base::mCapacity = Base::mNumUsed = 0;
-    Base::mFree1 = Base::mUsed1 = Base::mFreeN = Base::mUsedN = -1;
+    init_();
   }
 
   ObjectPool& operator=(ObjectPool const& pool)
@@ -556,13 +596,30 @@ public:
     return *this;
   }
 
+  ///
+  /// \brief Reserve pool capacity.
+  /// \param [in] size Min capacity of the pool.
+  ///
+
+  void reserve(int size)
+  {
+    if (Base::mCapacity < size) {
+      grow_(size);
+    }
+  }
+
   int alloc()
   {
     if (-1 == Base::mFree1) {
       grow_(2 * Base::mCapacity);
     }
 
-    return Base::alloc();
+    int id = Base::alloc();
+    if (-1 != id) {
+      allocBlock_(id);
+    }
+
+    return id;
   }
 
   int alloc(int index)
@@ -575,7 +632,12 @@ public:
       grow_(2 * Base::mCapacity);
     }
 
-    return Base::alloc(index);
+    int id = Base::alloc(index);
+    if (-1 != id) {
+      allocBlock_(id);
+    }
+
+    return id;
   }
 };
 
@@ -589,12 +651,17 @@ class ObjectPool<T, POOL_SIZE, false> : public ObjectPoolBase<ObjectPool<T, POOL
   bool mLstUsedInst[POOL_SIZE];         // IsUsed flag.
 
   typedef ObjectPoolBase<ObjectPool, T> Base;
+  friend class ObjectPoolBase<ObjectPool, T>;
+
+  T& entity_(int index) const
+  {
+    return const_cast<T&>(mEntityInst[index]);
+  }
 
 public:
 
   ObjectPool()
   {
-    Base::mEntity = mEntityInst;
     Base::mLstNext = mLstNextInst;
     Base::mLstPrev = mLstPrevInst;
     Base::mLstUsed = mLstUsedInst;
@@ -625,6 +692,1195 @@ public:
   }
 };
 
+///
+/// \brief Lazy object pool.
+///
+/// LazyObjectPool has same interface as ObjectPool, but entities are raw
+/// storage. An object is constructed when it is allocated and destroyed when it
+/// is freed, so a large pool costs no construction at startup, untouched
+/// entities use no physical memory, and freed objects release their resources.
+///
+/// \note An object can not be accessed after it is freed.
+///
+
+#if defined(_MSC_VER)
+# define SW2_ALIGNOF(T) __alignof(T)
+#else
+# define SW2_ALIGNOF(T) __alignof__(T)
+#endif
+
+template<class T>
+union ObjectPoolStorage
+{
+  char buff[sizeof(T)];
+  double alignDouble;                   // Alignment.
+  uint64 alignInt;
+  void* alignPtr;
+};
+
+template<typename T, size_t INIT_SIZE = 16, bool AUTO_GROW = false>
+class LazyObjectPool : private ObjectPool<ObjectPoolStorage<T>, INIT_SIZE, AUTO_GROW>
+{
+  typedef ObjectPool<ObjectPoolStorage<T>, INIT_SIZE, AUTO_GROW> Base;
+
+  //
+  // Storage is aligned as double, uint64 or pointer, an over aligned T fails
+  // to compile here.
+  //
+
+  typedef char AlignCheck_[SW2_ALIGNOF(T) <= SW2_ALIGNOF(ObjectPoolStorage<T>) ? 1 : -1];
+
+  T* ptr_(int index) const
+  {
+    return (T*)const_cast<ObjectPoolStorage<T>&>(Base::operator[](index)).buff;
+  }
+
+  void copy_(LazyObjectPool const& pool)
+  {
+    for (int i = pool.first(); -1 != i; i = pool.next(i)) {
+      if (-1 != Base::alloc(i)) {
+        new (ptr_(i)) T(pool[i]);
+      }
+    }
+  }
+
+public:
+
+  using Base::available;
+  using Base::capacity;
+  using Base::size;
+  using Base::isUsed;
+  using Base::first;
+  using Base::next;
+  using Base::firstFree;
+  using Base::nextFree;
+  using Base::last;
+  using Base::prev;
+
+  LazyObjectPool()
+  {
+  }
+
+  LazyObjectPool(LazyObjectPool const& pool) : Base()
+  {
+    copy_(pool);
+  }
+
+  ~LazyObjectPool()
+  {
+    clear();
+  }
+
+  LazyObjectPool& operator=(LazyObjectPool const& pool)
+  {
+    if (&pool != this) {
+      clear();
+      copy_(pool);
+    }
+    return *this;
+  }
+
+  ///
+  /// \brief Allocate a free entity and default construct the object.
+  /// \return Return a new ID(index) if success else return -1.
+  ///
+
+  int alloc()
+  {
+    int id = Base::alloc();
+    if (-1 != id) {
+      new (ptr_(id)) T();
+    }
+    return id;
+  }
+
+  ///
+  /// \brief Allocate a free entity with specified ID(index) and default
+  ///        construct the object.
+  /// \param [in] index Specified ID(index).
+  /// \return Return a new ID(index) if success else return -1.
+  ///
+
+  int alloc(int index)
+  {
+    int id = Base::alloc(index);
+    if (-1 != id) {
+      new (ptr_(id)) T();
+    }
+    return id;
+  }
+
+  ///
+  /// \brief Allocate a free entity and construct the object with arguments.
+  /// \return Return a new ID(index) if success else return -1.
+  ///
+
+  template<class A1>
+  int allocWith(A1 const& a1)
+  {
+    int id = Base::alloc();
+    if (-1 != id) {
+      new (ptr_(id)) T(a1);
+    }
+    return id;
+  }
+
+  template<class A1, class A2>
+  int allocWith(A1 const& a1, A2 const& a2)
+  {
+    int id = Base::alloc();
+    if (-1 != id) {
+      new (ptr_(id)) T(a1, a2);
+    }
+    return id;
+  }
+
+  template<class A1, class A2, class A3>
+  int allocWith(A1 const& a1, A2 const& a2, A3 const& a3)
+  {
+    int id = Base::alloc();
+    if (-1 != id) {
+      new (ptr_(id)) T(a1, a2, a3);
+    }
+    return id;
+  }
+
+  ///
+  /// \brief Destroy the object and release the entity.
+  /// \param [in] index The entity ID(index).
+  ///
+
+  void free(int index)
+  {
+    if (!isUsed(index)) {
+      return;
+    }
+
+    ptr_(index)->~T();
+    Base::free(index);
+  }
+
+  ///
+  /// \brief Free all used entities.
+  ///
+
+  void clear()
+  {
+    while (-1 != first()) {
+      free(first());
+    }
+  }
+
+  ///
+  /// \brief Free all used entities and reset pool to initial state.
+  ///
+
+  void reset()
+  {
+    clear();
+    Base::reset();
+  }
+
+  T& operator[](int index)
+  {
+    assert(isUsed(index));
+    return *ptr_(index);
+  }
+
+  const T& operator[](int index) const
+  {
+    assert(isUsed(index));
+    return *ptr_(index);
+  }
+};
+
+///
+/// \brief Dense object pool.
+///
+/// DenseObjectPool has same interface as ObjectPool, IDs(indices) of objects
+/// are stable, but keeps IDs of used entities in a dense array and marks used
+/// entities in a bitset. Iteration walks the dense array instead of chasing a
+/// linked list, so it streams through contiguous memory even after a lot of
+/// alloc and free.
+///
+/// \note Free moves the last used ID to the freed position, so iteration order
+///       changes after free. To free entities during iteration, iterate from
+///       last() to prev(), entities not visited yet are not moved.
+///
+
+template<class PoolT, class T>
+class DenseObjectPoolBase
+{
+protected:
+  int mCapacity;
+  T* mEntity;                           // Entities, object pool.
+
+  int mNumUsed;                         // Number used entity.
+
+  int* mDense;                          // IDs, used IDs first then free IDs.
+  int* mPos;                            // Position of ID in mDense.
+  uint* mUsed;                          // IsUsed bitset.
+
+  void swap_(int pos1, int pos2)
+  {
+    int index1 = mDense[pos1], index2 = mDense[pos2];
+    mDense[pos1] = index2;
+    mPos[index2] = pos1;
+    mDense[pos2] = index1;
+    mPos[index1] = pos2;
+  }
+
+  void copy_(DenseObjectPoolBase const& pool)
+  {
+    for (int i = 0; i < pool.mCapacity; i++) {
+      mEntity[i] = pool.mEntity[i];
+    }
+
+    ::memcpy(mDense, pool.mDense, mCapacity * sizeof(int));
+    ::memcpy(mPos, pool.mPos, mCapacity * sizeof(int));
+    ::memcpy(mUsed, pool.mUsed, ((mCapacity + 31) / 32) * sizeof(uint));
+
+    mNumUsed = pool.mNumUsed;
+  }
+
+public:
+
+  ///
+  /// \brief Get free entity count.
+  /// \return Return free entity count.
+  ///
+
+  int available() const
+  {
+    return capacity() - mNumUsed;
+  }
+
+  ///
+  /// \brief Get pool capacity.
+  /// \return Return pool capacity.
+  ///
+
+  int capacity() const
+  {
+    return mCapacity;
+  }
+
+  ///
+  /// \brief Get used entity count.
+  /// \return Return used entity count.
+  ///
+
+  int size() const
+  {
+    return mNumUsed;
+  }
+
+  ///
+  /// \brief Check is an entity used.
+  /// \param [in] index The ID(index) of entity.
+  /// \return Return true if the entity is used else return false.
+  ///
+
+  bool isUsed(int index) const
+  {
+    if (0 > index || mCapacity <= index) {
+      return false;
+    } else {
+      return 0 != (mUsed[index >> 5] & (1u << (index & 31)));
+    }
+  }
+
+  ///
+  /// \brief Allocate a free entity.
+  /// \return Return a new ID(index) if success else return -1.
+  ///
+
+  int alloc()
+  {
+    if (mCapacity == mNumUsed) {
+      return -1;
+    }
+
+    int found = mDense[mNumUsed];
+    mUsed[found >> 5] |= 1u << (found & 31);
+    mNumUsed += 1;
+
+    return found;
+  }
+
+  ///
+  /// \brief Allocate a free entity with specified ID(index).
+  /// \param [in] index Specified ID(index).
+  /// \return Return a new ID(index) if success else return -1.
+  /// \note If the specified ID is used then return failed(-1).
+  ///
+
+  int alloc(int index)
+  {
+    if (isUsed(index)) {
+      return -1;
+    }
+
+    swap_(mPos[index], mNumUsed);
+
+    return alloc();
+  }
+
+  ///
+  /// \brief Release a unused entity.
+  /// \param [in] index The entity ID(index).
+  ///
+
+  void free(int index)
+  {
+    if (!isUsed(index)) {
+      return;
+    }
+
+    mNumUsed -= 1;
+    swap_(mPos[index], mNumUsed);       // Swap with last used.
+    mUsed[index >> 5] &= ~(1u << (index & 31));
+  }
+
+  ///
+  /// \brief Reset pool to initial state.
+  ///
+
+  void reset()
+  {
+    mNumUsed = 0;
+    for (int i = 0; i < capacity(); i++) {
+      mDense[i] = mPos[i] = i;
+    }
+    ::memset(mUsed, 0, ((capacity() + 31) / 32) * sizeof(uint));
+  }
+
+  ///
+  /// \brief Free all used entities.
+  ///
+
+  void clear()
+  {
+    while (0 < mNumUsed) {
+      free(mDense[mNumUsed - 1]);
+    }
+  }
+
+  ///
+  /// \brief Get first used entity.
+  /// \return Return first used entity.
+  ///
+
+  int first() const
+  {
+    return 0 < mNumUsed ? mDense[0] : -1;
+  }
+
+  ///
+  /// \brief Get next used entity.
+  /// \param [in] cursor Current entity ID(index).
+  /// \return Return next used entity.
+  ///
+
+  int next(int cursor) const
+  {
+    assert(isUsed(cursor));
+    int pos = mPos[cursor] + 1;
+    return mNumUsed > pos ? mDense[pos] : -1;
+  }
+
+  ///
+  /// \brief Get last used entity.
+  /// \return Return last used entity.
+  ///
+
+  int last() const
+  {
+    return 0 < mNumUsed ? mDense[mNumUsed - 1] : -1;
+  }
+
+  ///
+  /// \brief Get previous used entity.
+  /// \param [in] cursor Current entity ID(index).
+  /// \return Return previous used entity.
+  ///
+
+  int prev(int cursor) const
+  {
+    assert(isUsed(cursor));
+    int pos = mPos[cursor];
+    return 0 < pos ? mDense[pos - 1] : -1;
+  }
+
+  ///
+  /// \brief Get ID of a used entity by its position.
+  /// \param [in] pos Position, 0..size()-1.
+  /// \return Return the ID(index) of the entity.
+  /// \note Used IDs are packed, for (i = 0; i < size(); i++) visits all used
+  ///       entities.
+  ///
+
+  int indexAt(int pos) const
+  {
+    assert(0 <= pos && mNumUsed > pos);
+    return mDense[pos];
+  }
+
+  ///
+  /// \brief Apply a function to all used entities.
+  /// \param [in] f Function or functor, f(T&).
+  /// \return Return the function.
+  /// \note Do not alloc or free in f.
+  ///
+
+  template<class F>
+  F forEach(F f)
+  {
+    for (int i = 0; i < mNumUsed; i++) {
+      f(mEntity[mDense[i]]);
+    }
+    return f;
+  }
+
+  ///
+  /// \brief Get object of the specified entity.
+  /// \param [in] index The entity ID(index) of object.
+  /// \return Return the reference to the specified entity.
+  ///
+
+  T& operator[](int index)
+  {
+    return const_cast<T&>(static_cast<PoolT const&>(*this)[index]);
+  }
+
+  const T& operator[](int index) const
+  {
+    assert(isUsed(index));
+    return mEntity[index];
+  }
+};
+
+template<typename T, size_t INIT_SIZE = 16, bool AUTO_GROW = false>
+class DenseObjectPool : public DenseObjectPoolBase<DenseObjectPool<T, INIT_SIZE, AUTO_GROW>, T>
+{
+  typedef DenseObjectPoolBase<DenseObjectPool<T, INIT_SIZE, AUTO_GROW>, T> Base;
+
+  void init_()
+  {
+    Base::mEntity = 0;
+    Base::mCapacity = Base::mNumUsed = 0;
+    Base::mDense = Base::mPos = 0;
+    Base::mUsed = 0;
+  }
+
+  void grow_(int size)
+  {
+    if (0 == size) {
+      return;
+    }
+
+    int newSize = size, nUsed = (newSize + 31) / 32, nUsedOld = (Base::mCapacity + 31) / 32;
+
+    T *pT = new T [newSize];
+    int *pDense = new int [newSize];
+    int *pPos = new int [newSize];
+    uint *pUsed = new uint [nUsed];
+
+    //
+    // Duplicate old pool settings to new pool, new IDs are free.
+    //
+
+    for (int i = 0; i < Base::mCapacity; i++) {
+      pT[i] = Base::mEntity[i];
+    }
+
+    if (0 < Base::mCapacity) {
+      ::memcpy(pDense, Base::mDense, Base::mCapacity * sizeof(int));
+      ::memcpy(pPos, Base::mPos, Base::mCapacity * sizeof(int));
+      ::memcpy(pUsed, Base::mUsed, nUsedOld * sizeof(uint));
+    }
+
+    for (int i = Base::mCapacity; i < newSize; i++) {
+      pDense[i] = pPos[i] = i;
+    }
+
+    ::memset(pUsed + nUsedOld, 0, (nUsed - nUsedOld) * sizeof(uint));
+
+    //
+    // Done.
+    //
+
+    delete [] Base::mEntity;
+    delete [] Base::mDense;
+    delete [] Base::mPos;
+    delete [] Base::mUsed;
+
+    Base::mCapacity = newSize;
+    Base::mEntity = pT;
+    Base::mDense = pDense;
+    Base::mPos = pPos;
+    Base::mUsed = pUsed;
+  }
+
+public:
+
+  DenseObjectPool()
+  {
+    init_();
+    grow_(INIT_SIZE);
+  }
+
+  DenseObjectPool(DenseObjectPool const& pool)
+  {
+    init_();
+    grow_(pool.mCapacity);
+    Base::copy_(pool);
+  }
+
+  ~DenseObjectPool()
+  {
+    delete [] Base::mEntity;
+    delete [] Base::mDense;
+    delete [] Base::mPos;
+    delete [] Base::mUsed;
+    init_();
+  }
+
+  DenseObjectPool& operator=(DenseObjectPool const& pool)
+  {
+    if (&pool == this) {
+      return *this;
+    }
+
+    this->~DenseObjectPool();
+    grow_(pool.mCapacity);
+    Base::copy_(pool);
+    return *this;
+  }
+
+  ///
+  /// \brief Reserve pool capacity.
+  /// \param [in] size Min capacity of the pool.
+  ///
+
+  void reserve(int size)
+  {
+    if (Base::mCapacity < size) {
+      grow_(size);
+    }
+  }
+
+  int alloc()
+  {
+    if (Base::mCapacity == Base::mNumUsed) {
+      grow_(2 * Base::mCapacity);
+    }
+
+    return Base::alloc();
+  }
+
+  int alloc(int index)
+  {
+    if (0 > index) {
+      return -1;
+    }
+
+    while (Base::mCapacity <= index) {
+      grow_(2 * Base::mCapacity);
+    }
+
+    return Base::alloc(index);
+  }
+};
+
+template<typename T, size_t POOL_SIZE>
+class DenseObjectPool<T, POOL_SIZE, false> : public DenseObjectPoolBase<DenseObjectPool<T, POOL_SIZE, false>, T>
+{
+  T mEntityInst[POOL_SIZE];             // Entities, object pool.
+
+  int mDenseInst[POOL_SIZE];            // IDs, used IDs first then free IDs.
+  int mPosInst[POOL_SIZE];              // Position of ID in mDense.
+  uint mUsedInst[(POOL_SIZE + 31) / 32]; // IsUsed bitset.
+
+  typedef DenseObjectPoolBase<DenseObjectPool, T> Base;
+
+  void init_()
+  {
+    Base::mEntity = mEntityInst;
+    Base::mDense = mDenseInst;
+    Base::mPos = mPosInst;
+    Base::mUsed = mUsedInst;
+    Base::mCapacity = POOL_SIZE;
+  }
+
+public:
+
+  DenseObjectPool()
+  {
+    init_();
+    Base::reset();
+  }
+
+  DenseObjectPool(DenseObjectPool const& pool)
+  {
+    init_();
+    Base::copy_(pool);
+  }
+
+  DenseObjectPool& operator=(DenseObjectPool const& pool)
+  {
+    if (&pool != this) {
+      Base::copy_(pool);
+    }
+    return *this;
+  }
+
+  int alloc()
+  {
+    return Base::alloc();
+  }
+
+  int alloc(int index)
+  {
+    if (0 > index || (int)POOL_SIZE <= index) {
+      return -1;
+    }
+
+    return Base::alloc(index);
+  }
+};
+
+///
+/// \brief Concurrent object pool.
+///
+/// ConcurrentObjectPool is a fixed size pool for multiple threads without lock.
+/// Free entities are kept in a lock free stack of indices, the stack head is
+/// tagged to avoid ABA problem. Every entity has a generation which is odd if
+/// the entity is used, alloc returns a handle of generation and index, so a
+/// stale handle of a freed or reused entity is detected by lookup.
+///
+/// \note A handle has 15 bits generation and 16 bits index, POOL_SIZE must be
+///       less than 65536. A stale handle may be valid again after the entity
+///       is reused 16384 times.
+/// \note Lookup does not keep the entity alive, the owner of an entity decides
+///       when to free it.
+///
+
+template<typename T, size_t POOL_SIZE>
+class ConcurrentObjectPool
+{
+  enum {
+    INDEX_BITS = 16,
+    INDEX_MASK = (1 << INDEX_BITS) - 1,
+    GEN_MASK = 0x7fff
+  };
+
+  typedef char POOL_SIZE_CHECK[(int)POOL_SIZE < INDEX_MASK ? 1 : -1];
+
+  T mEntity[POOL_SIZE];                 // Entities, object pool.
+
+  long volatile mGen[POOL_SIZE];        // Generation, odd if used.
+  int volatile mNext[POOL_SIZE];        // Next index of free stack.
+  long volatile mHead;                  // Free stack head, tag and index + 1.
+  long volatile mNumUsed;               // Number used entity.
+
+  static long makeHead_(long head, int index)
+  {
+    unsigned long tag = ((unsigned long)head >> INDEX_BITS) + 1;
+    return (long)((tag << INDEX_BITS) | (unsigned long)(index + 1));
+  }
+
+  static int makeHandle_(long gen, int index)
+  {
+    return (int)((gen & GEN_MASK) << INDEX_BITS) | index;
+  }
+
+  static bool isMatch_(long gen, int handle)
+  {
+    return 0 != (gen & 1) && (gen & GEN_MASK) == ((handle >> INDEX_BITS) & GEN_MASK);
+  }
+
+  int pop_()
+  {
+    while (true) {
+      long head = mHead;
+      int index = (int)(head & INDEX_MASK) - 1;
+      if (-1 == index) {
+        return -1;
+      }
+      if (head == Util::atomicCompareExchange(&mHead, makeHead_(head, mNext[index]), head)) {
+        return index;
+      }
+    }
+  }
+
+  void push_(int index)
+  {
+    while (true) {
+      long head = mHead;
+      mNext[index] = (int)(head & INDEX_MASK) - 1;
+      if (head == Util::atomicCompareExchange(&mHead, makeHead_(head, index), head)) {
+        return;
+      }
+    }
+  }
+
+  ConcurrentObjectPool(ConcurrentObjectPool const&);
+  ConcurrentObjectPool& operator=(ConcurrentObjectPool const&);
+
+public:
+
+  ConcurrentObjectPool() : mHead(0), mNumUsed(0)
+  {
+    for (int i = (int)POOL_SIZE - 1; 0 <= i; i--) {
+      mGen[i] = 0;
+      push_(i);
+    }
+  }
+
+  ///
+  /// \brief Get free entity count.
+  /// \return Return free entity count.
+  ///
+
+  int available() const
+  {
+    return capacity() - size();
+  }
+
+  ///
+  /// \brief Get pool capacity.
+  /// \return Return pool capacity.
+  ///
+
+  int capacity() const
+  {
+    return (int)POOL_SIZE;
+  }
+
+  ///
+  /// \brief Get used entity count.
+  /// \return Return used entity count.
+  ///
+
+  int size() const
+  {
+    return (int)mNumUsed;
+  }
+
+  ///
+  /// \brief Allocate a free entity.
+  /// \return Return handle of the entity if success else return -1.
+  ///
+
+  int alloc()
+  {
+    int index = pop_();
+    if (-1 == index) {
+      return -1;
+    }
+
+    long gen = Util::atomicIncrement(&mGen[index]); // Odd, used.
+    Util::atomicIncrement(&mNumUsed);
+
+    return makeHandle_(gen, index);
+  }
+
+  ///
+  /// \brief Release a used entity.
+  /// \param [in] handle Handle of the entity.
+  /// \return Return true if success else return false if the handle is stale.
+  /// \note Only one of threads free a same handle succeeds.
+  ///
+
+  bool free(int handle)
+  {
+    if (0 > handle || (int)POOL_SIZE <= getIndex(handle)) {
+      return false;
+    }
+
+    int index = getIndex(handle);
+    long gen = mGen[index];
+    if (!isMatch_(gen, handle)) {
+      return false;
+    }
+
+    if (gen != Util::atomicCompareExchange(&mGen[index], gen + 1, gen)) {
+      return false;                     // Freed by another thread.
+    }
+
+    Util::atomicDecrement(&mNumUsed);
+    push_(index);
+
+    return true;
+  }
+
+  ///
+  /// \brief Check is a handle valid.
+  /// \param [in] handle Handle of the entity.
+  /// \return Return true if the entity of the handle is used else return false.
+  ///
+
+  bool isUsed(int handle) const
+  {
+    if (0 > handle || (int)POOL_SIZE <= getIndex(handle)) {
+      return false;
+    }
+
+    return isMatch_(mGen[getIndex(handle)], handle);
+  }
+
+  ///
+  /// \brief Get object of a handle.
+  /// \param [in] handle Handle of the entity.
+  /// \return Return pointer to the object if the handle is valid else return 0.
+  ///
+
+  T* get(int handle)
+  {
+    return isUsed(handle) ? &mEntity[getIndex(handle)] : 0;
+  }
+
+  const T* get(int handle) const
+  {
+    return isUsed(handle) ? &mEntity[getIndex(handle)] : 0;
+  }
+
+  ///
+  /// \brief Get handles of all used entities.
+  /// \param [out] handles Handles of used entities.
+  /// \note Entities may be allocated or freed during snapshot by other threads,
+  ///       use get to lookup an entity of the snapshot.
+  ///
+
+  void snapshot(std::vector<int> &handles) const
+  {
+    handles.clear();
+    for (int i = 0; i < (int)POOL_SIZE; i++) {
+      long gen = mGen[i];
+      if (0 != (gen & 1)) {
+        handles.push_back(makeHandle_(gen, i));
+      }
+    }
+  }
+
+  ///
+  /// \brief Get index of a handle.
+  /// \param [in] handle Handle of the entity.
+  /// \return Return index of the entity, 0..POOL_SIZE-1.
+  ///
+
+  static int getIndex(int handle)
+  {
+    return handle & INDEX_MASK;
+  }
+};
+
+///
+/// \brief Per tick arena.
+///
+/// TickArena serves short-lived memory which dies by the end of a tick, e.g.
+/// temporary encode buffers and reassembled streams. Memory is bumped from
+/// blocks and reset releases all of it at once at the beginning of next tick.
+/// If a tick uses more than a block, the blocks are merged into one big enough
+/// for a tick at reset, so a steady tick costs no heap allocation.
+///
+/// \note Free only takes back the last allocation, other memory is released
+///       by reset.
+/// \note Not thread safe, an arena is owned by the thread triggers the tick.
+///
+
+class TickArena
+{
+  enum { ALIGN = 16 };
+
+  struct Block
+  {
+    Block* pNext;                       // Previous full block.
+    size_t size;                        // Data size.
+  };
+
+  Block* mBlock;                        // Current block, list of blocks.
+  size_t mPos;                          // Bump position of current block.
+  size_t mBlockSize;                    // Min block size.
+
+  size_t mTickBytes;                    // Bytes served this tick.
+  size_t mLastTickBytes;                // Bytes served last tick.
+  size_t mPeakTickBytes;                // Max bytes served of a tick.
+
+  static size_t alignSize_(size_t size)
+  {
+    return (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  }
+
+  static char* data_(Block* p)
+  {
+    return (char*)p + alignSize_(sizeof(Block));
+  }
+
+  void pushBlock_(size_t size)
+  {
+    Block* p = (Block*)::operator new(alignSize_(sizeof(Block)) + size);
+    p->pNext = mBlock;
+    p->size = size;
+    mBlock = p;
+    mPos = 0;
+  }
+
+  void release_()
+  {
+    while (mBlock) {
+      Block* p = mBlock;
+      mBlock = p->pNext;
+      ::operator delete(p);
+    }
+    mPos = 0;
+  }
+
+  TickArena(TickArena const&);
+  TickArena& operator=(TickArena const&);
+
+public:
+
+  ///
+  /// \brief Constructor.
+  /// \param [in] blockSize Min block size in bytes, the first block is
+  ///             allocated on first use.
+  ///
+
+  explicit TickArena(size_t blockSize = 16384) : mBlock(0), mPos(0), mBlockSize(alignSize_(blockSize)), mTickBytes(0), mLastTickBytes(0), mPeakTickBytes(0)
+  {
+  }
+
+  ~TickArena()
+  {
+    release_();
+  }
+
+  ///
+  /// \brief Allocate memory.
+  /// \param [in] size Size in bytes.
+  /// \return Return pointer to the memory, aligned to 16 bytes.
+  /// \note The memory is valid until reset.
+  ///
+
+  void* alloc(size_t size)
+  {
+    size = alignSize_(0 < size ? size : 1);
+    if (0 == mBlock || mBlock->size - mPos < size) {
+      size_t sizeBlock = mBlock ? 2 * mBlock->size : mBlockSize;
+      pushBlock_(size > sizeBlock ? size : sizeBlock);
+    }
+
+    void* p = data_(mBlock) + mPos;
+    mPos += size;
+    mTickBytes += size;
+
+    return p;
+  }
+
+  ///
+  /// \brief Free memory.
+  /// \param [in] p Pointer of the memory.
+  /// \param [in] size Size in bytes.
+  /// \note Only the last allocation is taken back, or this does nothing.
+  ///
+
+  void free(void* p, size_t size)
+  {
+    shrink(p, size, 0);
+  }
+
+  ///
+  /// \brief Shrink last allocation.
+  /// \param [in] p Pointer of the memory.
+  /// \param [in] size Allocated size in bytes.
+  /// \param [in] newSize New size in bytes, the tail is taken back.
+  /// \note Does nothing if p is not the last allocation.
+  ///
+
+  void shrink(void* p, size_t size, size_t newSize)
+  {
+    if (0 == mBlock || (char*)p + alignSize_(0 < size ? size : 1) != data_(mBlock) + mPos) {
+      return;
+    }
+
+    size_t n = alignSize_(0 < size ? size : 1) - (0 < newSize ? alignSize_(newSize) : 0);
+    mPos -= n;
+    mTickBytes -= n;
+  }
+
+  ///
+  /// \brief Start a new tick, release all memory served in last tick.
+  ///
+
+  void reset()
+  {
+    mLastTickBytes = mTickBytes;
+    if (mPeakTickBytes < mTickBytes) {
+      mPeakTickBytes = mTickBytes;
+    }
+    mTickBytes = 0;
+
+    if (mBlock && mBlock->pNext) {      // Grew last tick, merge to a block fits a tick.
+      size_t size = getCapacity();
+      release_();
+      pushBlock_(size);
+    }
+
+    mPos = 0;
+  }
+
+  ///
+  /// \brief Release all blocks.
+  ///
+
+  void clear()
+  {
+    release_();
+    mTickBytes = 0;
+  }
+
+  ///
+  /// \brief Get capacity.
+  /// \return Return total size of blocks in bytes.
+  ///
+
+  size_t getCapacity() const
+  {
+    size_t size = 0;
+    for (Block* p = mBlock; p; p = p->pNext) {
+      size += p->size;
+    }
+    return size;
+  }
+
+  ///
+  /// \brief Get bytes served this tick.
+  /// \return Return bytes served since last reset.
+  ///
+
+  size_t getTickBytes() const
+  {
+    return mTickBytes;
+  }
+
+  ///
+  /// \brief Get bytes served last tick.
+  /// \return Return bytes served between last two resets.
+  ///
+
+  size_t getLastTickBytes() const
+  {
+    return mLastTickBytes;
+  }
+
+  ///
+  /// \brief Get max bytes served of a tick.
+  /// \return Return max bytes served of a tick.
+  ///
+
+  size_t getPeakTickBytes() const
+  {
+    return mPeakTickBytes;
+  }
+};
+
+///
+/// \brief STL allocator of TickArena.
+///
+/// ArenaAllocator allocates elements of STL containers from a TickArena, the
+/// container should be destroyed or cleared before the arena is reset.
+///
+/// Example:
+///
+/// \code
+/// TickArena arena;
+/// std::vector<int, ArenaAllocator<int> > v((ArenaAllocator<int>(arena)));
+/// ArenaString s((ArenaAllocator<char>(arena)));
+/// \endcode
+///
+
+template<class T>
+class ArenaAllocator
+{
+public:
+
+  typedef T value_type;
+  typedef T* pointer;
+  typedef T const* const_pointer;
+  typedef T& reference;
+  typedef T const& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<class U>
+  struct rebind
+  {
+    typedef ArenaAllocator<U> other;
+  };
+
+  explicit ArenaAllocator(TickArena& arena) : mArena(&arena)
+  {
+  }
+
+  template<class U>
+  ArenaAllocator(ArenaAllocator<U> const& a) : mArena(a.mArena)
+  {
+  }
+
+  pointer address(reference r) const
+  {
+    return &r;
+  }
+
+  const_pointer address(const_reference r) const
+  {
+    return &r;
+  }
+
+  pointer allocate(size_type n, void const* = 0)
+  {
+    return (pointer)mArena->alloc(n * sizeof(T));
+  }
+
+  void deallocate(pointer p, size_type n)
+  {
+    mArena->free(p, n * sizeof(T));
+  }
+
+  size_type max_size() const
+  {
+    return (size_type)-1 / sizeof(T);
+  }
+
+  void construct(pointer p, const_reference v)
+  {
+    new(p) T(v);
+  }
+
+  void destroy(pointer p)
+  {
+    p->~T();
+  }
+
+  TickArena* mArena;                    // Arena serves memory.
+};
+
+template<class T, class U>
+bool operator==(ArenaAllocator<T> const& a, ArenaAllocator<U> const& b)
+{
+  return a.mArena == b.mArena;
+}
+
+template<class T, class U>
+bool operator!=(ArenaAllocator<T> const& a, ArenaAllocator<U> const& b)
+{
+  return a.mArena != b.mArena;
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+
 } // namespace sw2
 
 // end of swObjectPool.h
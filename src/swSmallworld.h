@@ -31,7 +31,8 @@ enum SMALLWORLD_CONST1
   SMALLWORLD_MAX_PLAYER             = 1000, ///< Max online player count.
   SMALLWORLD_MAX_CHANNEL            = 10,   ///< Max channel count.
   SMALLWORLD_MAX_CHANNEL_PLAYER     = 100,  ///< Max player of a channel.
-  SMALLWORLD_MAX_DATA_STREAM_LENGTH = 1000  ///< Max data stream length, in bytes.
+  SMALLWORLD_MAX_DATA_STREAM_LENGTH = 1000, ///< Max data stream length, in bytes.
+  SMALLWORLD_MAX_CHAT_LENGTH        = 512   ///< Max chat message length, in bytes.
 };
 
 ///
@@ -172,7 +173,7 @@ public:
 
   ///
   /// Send a public message to all players in current channel.
-  /// \param [in] msg Message text.
+  /// \param [in] msg Message text, max SMALLWORLD_MAX_CHAT_LENGTH bytes.
   /// \return Return true if success else return false.
   /// \note If success the message will reflect to self.
   ///
@@ -182,7 +183,7 @@ public:
   ///
   /// Send a private message to a player in the server.
   /// \param [in] idWho Target player ID.
-  /// \param [in] msg Message text.
+  /// \param [in] msg Message text, max SMALLWORLD_MAX_CHAT_LENGTH bytes.
   /// \return Return true if success else return false.
   /// \note If success the message will reflect to self.
   ///
@@ -624,7 +625,11 @@ public:
   ///       AddrListen = "2266"\n
   ///       MaxPlayer = 1000\n
   ///       MaxChannel = 10\n
-  ///       MaxChannelPlayer = 100
+  ///       MaxChannelPlayer = 100\n
+  ///       SessionTimeout = 30
+  /// \note SessionTimeout is optional, a dropped client resumes its session
+  ///       within this seconds without login again, see
+  ///       NetworkServer::setSessionTimeout.
   ///
 
   virtual bool startup(Ini const& conf)=0;
@@ -123,9 +123,12 @@ class implSmallworldAccount : public SmallworldAccount, public NetworkServerCall
 {
 public:
 
-  explicit implSmallworldAccount(SmallworldAccountCallback* pCallback) : m_pCallback(pCallback), m_pServer(0)
+  explicit implSmallworldAccount(SmallworldAccountCallback* pCallback) : m_pCallback(pCallback), m_pServer(0), m_dispatcher(getPacketHandler(), *this)
   {
     SmallworldAccount::userData = 0;
+    m_dispatcher.registerHandler<evSmallworldLogin, &implSmallworldAccount::onLogin>();
+    m_dispatcher.registerHandler<evSmallworldRequest, &implSmallworldAccount::onRequest>();
+    m_dispatcher.setDefaultHandler(&implSmallworldAccount::onUnknown);
   }
 
   virtual ~implSmallworldAccount()
@@ -331,117 +334,108 @@ public:
     assert(pClient);
 
     BitStream bs((char*)pStream, len);
-    const BitStreamPacket *p;
-    while (readPacket(bs, &p)) {
+    m_dispatcher.dispatch(bs, pClient);
+  }
 
-      //
-      // Server Login.
-      //
+  //
+  // Packet handlers, return false to stop handling rest packets.
+  //
 
-      if (EID_LOGIN == p->getId()) {
-        implSmallworldAccountPeer& peer = m_pool[(int)pClient->userData];
+  bool onLogin(NetworkConnection* pClient, evSmallworldLogin &l)
+  {
+    implSmallworldAccountPeer& peer = m_pool[(int)pClient->userData];
 
-        //
-        // Duplicated login?
-        //
+    //
+    // Duplicated login?
+    //
 
-        if (peer.m_bVerified) {
-          SW2_TRACE_ERROR("[AC] Duplicate login received from %s, Kick", pClient->getAddr().c_str());
-          pClient->disconnect();
-          return;
-        }
+    if (peer.m_bVerified) {
+      SW2_TRACE_ERROR("[AC] Duplicate login received from %s, Kick", pClient->getAddr().c_str());
+      pClient->disconnect();
+      return false;
+    }
 
-        //
-        // Normal login.
-        //
+    //
+    // Normal login.
+    //
 
-        evSmallworldLogin* pl = (evSmallworldLogin*)p; // Store login information.
+    if (SMALLWORLD_VERSION_MAJOR != l.verMajor ||
+        SMALLWORLD_VERSION_MINOR != l.verMinor) {
+      evSmallworldNotify n;
+      n.code = evSmallworldNotify::NC_VERSION_MISMATCH;
+      send(pClient, n);                 // Ignore failed.
+      pClient->disconnect();
+      return false;
+    }
 
-        if (SMALLWORLD_VERSION_MAJOR != pl->verMajor ||
-            SMALLWORLD_VERSION_MINOR != pl->verMinor) {
-          evSmallworldNotify n;
-          n.code = evSmallworldNotify::NC_VERSION_MISMATCH;
-          send(pClient, n);             // Ignore failed.
-          pClient->disconnect();
-          return;
-        }
+    peer.userData = (uint_ptr)0;
+    peer.m_bVerified = true;
 
-        peer.userData = (uint_ptr)0;
-        peer.m_bVerified = true;
-
-        //
-        // Callback new server ready.
-        //
-
-        if (m_pCallback->onSmallworldNewServerReady(this, &peer)) { // Accept?
-          evSmallworldNotify n;
-          n.code = evSmallworldNotify::NC_LOGIN_ACCEPTED;
-          n.id = peer.m_idServer;
-          if (!send(pClient, n)) {
-            SW2_TRACE_ERROR("[AC] Reply Login Accepted Failed from %s, Kick", pClient->getAddr().c_str());
-            pClient->disconnect();
-            m_pCallback->onSmallworldServerLeave(this, &peer);
-            peer.m_bVerified = false;
-          }
-        } else {
-          evSmallworldNotify n;
-          n.code = evSmallworldNotify::NC_LOGIN_NOT_ALLOWED;
-          send(pClient, n);             // Ignore failed.
-          pClient->disconnect();
-          peer.m_bVerified = false;       // Avoid to notify server leave.
-        }
+    //
+    // Callback new server ready.
+    //
 
+    if (m_pCallback->onSmallworldNewServerReady(this, &peer)) { // Accept?
+      evSmallworldNotify n;
+      n.code = evSmallworldNotify::NC_LOGIN_ACCEPTED;
+      n.id = peer.m_idServer;
+      if (!send(pClient, n)) {
+        SW2_TRACE_ERROR("[AC] Reply Login Accepted Failed from %s, Kick", pClient->getAddr().c_str());
+        pClient->disconnect();
+        m_pCallback->onSmallworldServerLeave(this, &peer);
+        peer.m_bVerified = false;
       }
+    } else {
+      evSmallworldNotify n;
+      n.code = evSmallworldNotify::NC_LOGIN_NOT_ALLOWED;
+      send(pClient, n);                 // Ignore failed.
+      pClient->disconnect();
+      peer.m_bVerified = false;         // Avoid to notify server leave.
+    }
 
-      //
-      // Request player login/out.
-      //
-
-      else if (EID_REQUEST == p->getId()) {
-        implSmallworldAccountPeer& peer = m_pool[(int)pClient->userData];
-
-        //
-        // Verified?
-        //
-
-        if (!peer.m_bVerified) {
-          SW2_TRACE_ERROR("[AC] Request before login from %s, Kick", pClient->getAddr().c_str());
-          pClient->disconnect();
-          return;
-        }
-
-        //
-        // Handle request.
-        //
+    return true;
+  }
 
-        evSmallworldRequest* pr = (evSmallworldRequest*)p;
+  bool onRequest(NetworkConnection* pClient, evSmallworldRequest &r)
+  {
+    implSmallworldAccountPeer& peer = m_pool[(int)pClient->userData];
 
-        std::string token(32, 0);
-        BitStream bs((char*)token.data(), (int)token.length());
-        bs << pr->idPlayer << pr->time;
-        token.resize(bs.getByteCount());
+    //
+    // Verified?
+    //
 
-        if (evSmallworldRequest::NC_PLAYER_LOGIN == pr->code) { // Player login request.
-          m_pCallback->onSmallworldRequestPlayerLogin(this, &peer, pr->stream, token);
-        } else if (evSmallworldRequest::NC_PLAYER_LOGOUT == pr->code) { // Player logout request.
-          m_pCallback->onSmallworldRequestPlayerLogout(this, &peer, pr->stream, token);
-        } else {                        // Invalid request, kick.
-          SW2_TRACE_ERROR("[AC] Invalid request from %s, Kick", pClient->getAddr().c_str());
-          pClient->disconnect();
-        }
+    if (!peer.m_bVerified) {
+      SW2_TRACE_ERROR("[AC] Request before login from %s, Kick", pClient->getAddr().c_str());
+      pClient->disconnect();
+      return false;
+    }
 
-      } else {
+    //
+    // Handle request.
+    //
 
-        //
-        // Unknown command.
-        //
+    std::string token(32, 0);
+    BitStream bs((char*)token.data(), (int)token.length());
+    bs << r.idPlayer << r.time;
+    token.resize(bs.getByteCount());
+
+    if (evSmallworldRequest::NC_PLAYER_LOGIN == r.code) { // Player login request.
+      m_pCallback->onSmallworldRequestPlayerLogin(this, &peer, r.stream, token);
+    } else if (evSmallworldRequest::NC_PLAYER_LOGOUT == r.code) { // Player logout request.
+      m_pCallback->onSmallworldRequestPlayerLogout(this, &peer, r.stream, token);
+    } else {                            // Invalid request, kick.
+      SW2_TRACE_ERROR("[AC] Invalid request from %s, Kick", pClient->getAddr().c_str());
+      pClient->disconnect();
+    }
 
-        SW2_TRACE_ERROR("[AC] Unknown event received from %s, Kick", pClient->getAddr().c_str());
-        pClient->disconnect();
-      }
+    return true;
+  }
 
-      freePacket(p);
-    }
+  bool onUnknown(NetworkConnection* pClient, BitStreamPacket &)
+  {
+    SW2_TRACE_ERROR("[AC] Unknown event received from %s, Kick", pClient->getAddr().c_str());
+    pClient->disconnect();
+    return true;
   }
 
 public:
@@ -450,6 +444,7 @@ public:
   NetworkServer* m_pServer;             // Network server.
   ObjectPool<implSmallworldAccountPeer, SMALLWORLD_MAX_PEER> m_pool; // implSmallworldAccountPeer object pool.
   CONFIG_ACCOUNT m_conf;                // Configuration.
+  BitStreamPacketDispatcher<EID_LAST_TAG, implSmallworldAccount, NetworkConnection*> m_dispatcher; // Packet handlers.
 };
 
 } // namespace impl
@@ -297,6 +297,11 @@ public:
       return false;
     }
 
+    if (SMALLWORLD_MAX_CHAT_LENGTH < msg.length()) {
+      SW2_TRACE_ERROR("send message too long");
+      return false;
+    }
+
     evSmallworldChat ec;
     ec.code = evSmallworldChat::NC_CHAT;
     ec.msg = msg;
@@ -320,6 +325,11 @@ public:
       return false;
     }
 
+    if (SMALLWORLD_MAX_CHAT_LENGTH < msg.length()) {
+      SW2_TRACE_ERROR("send pmessage too long");
+      return false;
+    }
+
     evSmallworldChat ec;
     ec.code = evSmallworldChat::NC_PM_TO;
     ec.idWho = idWho;
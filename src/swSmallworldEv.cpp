@@ -8,6 +8,8 @@
 //  2014/03/02 Waync created.
 //
 
+#include <string.h>
+
 #include "swSmallworldEv.h"
 
 #include "swUtil.h"
@@ -23,6 +25,7 @@ namespace impl {
 #define SW2_SMALLWORLD_TAG "sw2sw"
 #define SW2_SMALLWORLD_HEADER_MAGIC_BITS 32
 #define SW2_SMALLWORLD_HEADER_MAGIC 0xfeed
+#define SW2_SMALLWORLD_SEND_BUFFER_SIZE 2048 // Encode buffer on stack, in bytes.
 
 //
 // evSmallworldNotify.
@@ -152,70 +155,6 @@ bool evSmallworldLogin::write(BitStream& bs) const
   return true;
 }
 
-//
-// evSmallworldRequest.
-//
-
-bool evSmallworldRequest::read(BitStream& bs)
-{
-  if (!(bs >> setBitCount(BITCOUNT<NC_LAST_TAG - 1>::value) >> (uint&)code)) {
-    return false;
-  }
-
-  if (NC_LAST_TAG <= code) {
-    return false;
-  }
-
-  if (!(bs >> setBitCount(BITCOUNT<SMALLWORLD_MAX_PLAYER - 1>::value) >> (uint&)idPlayer)) {
-    return false;
-  }
-
-  if (SMALLWORLD_MAX_PLAYER <= idPlayer) {
-    return false;
-  }
-
-  if (!(bs >> time)) {
-    return false;
-  }
-
-  if (!(bs >> setBitCount(BITCOUNT<SMALLWORLD_MAX_DATA_STREAM_LENGTH>::value) >> stream)) {
-    return false;
-  }
-
-  if (SMALLWORLD_MAX_DATA_STREAM_LENGTH < (int)stream.length()) {
-    return false;
-  }
-
-  return true;
-}
-
-bool evSmallworldRequest::write(BitStream& bs) const
-{
-  assert(NC_LAST_TAG > (uint)code);
-
-  if (!(bs << setBitCount(BITCOUNT<NC_LAST_TAG - 1>::value) << (uint)code)) {
-    return false;
-  }
-
-  assert(SMALLWORLD_MAX_PLAYER > (uint)idPlayer);
-
-  if (!(bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_PLAYER - 1>::value) << (uint)idPlayer)) {
-    return false;
-  }
-
-  if (!(bs << time)) {
-    return false;
-  }
-
-  assert(SMALLWORLD_MAX_DATA_STREAM_LENGTH > (int)stream.length());
-
-  if (!(bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_DATA_STREAM_LENGTH>::value) << stream)) {
-    return false;
-  }
-
-  return true;
-}
-
 //
 // evSmallworldChannel.
 //
@@ -307,7 +246,7 @@ bool evSmallworldChat::read(BitStream& bs)
   switch (code)
   {
   case NC_CHAT:
-    if (!(bs >> msg)) {
+    if (!(bs >> setVarint(SMALLWORLD_MAX_CHAT_LENGTH) >> msg)) { // Reject before allocation.
       return false;
     }
     break;
@@ -321,7 +260,7 @@ bool evSmallworldChat::read(BitStream& bs)
     if (SMALLWORLD_MAX_PLAYER <= idWho) {
       return false;
     }
-    if (!(bs >> msg)) {
+    if (!(bs >> setVarint(SMALLWORLD_MAX_CHAT_LENGTH) >> msg)) { // Reject before allocation.
       return false;
     }
     break;
@@ -340,6 +279,10 @@ bool evSmallworldChat::write(BitStream& bs) const
 {
   assert(NC_LAST_TAG > (uint)code);
 
+  if (SMALLWORLD_MAX_CHAT_LENGTH < msg.length()) { // Peer rejects it.
+    return false;
+  }
+
   if (!(bs << setBitCount(BITCOUNT<NC_LAST_TAG - 1>::value) << (uint)code)) {
     return false;
   }
@@ -347,7 +290,7 @@ bool evSmallworldChat::write(BitStream& bs) const
   switch (code)
   {
   case NC_CHAT:
-    if (!(bs << msg)) {
+    if (!(bs << setVarint() << msg)) { // Short message uses less bytes.
       return false;
     }
     break;
@@ -359,7 +302,7 @@ bool evSmallworldChat::write(BitStream& bs) const
     if (!(bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_PLAYER - 1>::value) << (uint)idWho)) {
       return false;
     }
-    if (!(bs << msg)) {
+    if (!(bs << setVarint() << msg)) {
       return false;
     }
     break;
@@ -482,13 +425,70 @@ void initBitStreamPacketHandler()
 
 bool send(NetworkConnection* pConn, const BitStreamPacket &p)
 {
-  std::string buff;
-  BitStream bs(buff);
-  if (!g_bph.writePacket(bs, p)) {
+  assert(pConn);
+
+  //
+  // Encode to a buffer on stack, no heap allocation per packet. Network layer
+  // copies the stream to its send buffer. Clear unused bits of last byte.
+  //
+
+  char buff[SW2_SMALLWORLD_SEND_BUFFER_SIZE];
+  BitStream bs(buff, sizeof(buff));
+  if (g_bph.writePacket(bs, p)) {
+    if (0 != bs.getBitPtr()) {
+      buff[bs.getBytePtr()] &= (char)((1 << bs.getBitPtr()) - 1);
+    }
+    return pConn->send(bs.getByteCount(), buff);
+  }
+
+  //
+  // Too big, e.g. a long chat message, use a growing buffer.
+  //
+
+  std::string sbuff;
+  BitStream bs2(sbuff);
+  if (!g_bph.writePacket(bs2, p)) {
     return false;
   }
-  assert(pConn);
-  return pConn->send(bs.getByteCount(), buff.data());
+
+  return pConn->send(bs2.getByteCount(), sbuff.data());
+}
+
+//
+// Encode to a buffer of per tick arena, to broadcast a packet to players with
+// a single encode.
+//
+
+char const* encode(TickArena &arena, const BitStreamPacket &p, int &len)
+{
+  char* buff = (char*)arena.alloc(SW2_SMALLWORLD_SEND_BUFFER_SIZE);
+  BitStream bs(buff, SW2_SMALLWORLD_SEND_BUFFER_SIZE);
+  if (g_bph.writePacket(bs, p)) {
+    if (0 != bs.getBitPtr()) {
+      buff[bs.getBytePtr()] &= (char)((1 << bs.getBitPtr()) - 1);
+    }
+    len = bs.getByteCount();
+    arena.shrink(buff, SW2_SMALLWORLD_SEND_BUFFER_SIZE, len); // Take back unused tail.
+    return buff;
+  }
+
+  arena.free(buff, SW2_SMALLWORLD_SEND_BUFFER_SIZE);
+
+  //
+  // Too big, use a growing buffer and keep a copy in the arena.
+  //
+
+  std::string sbuff;
+  BitStream bs2(sbuff);
+  if (!g_bph.writePacket(bs2, p)) {
+    return 0;
+  }
+
+  len = bs2.getByteCount();
+  buff = (char*)arena.alloc(len);
+  ::memcpy(buff, sbuff.data(), len);
+
+  return buff;
 }
 
 bool freePacket(const BitStreamPacket *p)
@@ -501,6 +501,11 @@ bool readPacket(BitStream &bs, const BitStreamPacket **pp)
   return g_bph.readPacket(bs, pp);
 }
 
+BitStreamPacketHandler<EID_LAST_TAG>& getPacketHandler()
+{
+  return g_bph;
+}
+
 } // namespace impl
 
 bool InitializeSmallworld()
@@ -12,6 +12,7 @@
 
 #include "swSmallworld.h"
 #include "swBitStreamPacket.h"
+#include "swObjectPool.h"
 
 namespace sw2 {
 
@@ -22,7 +23,7 @@ namespace impl {
 //
 
 #define SMALLWORLD_VERSION_MAJOR 1      // Version major.
-#define SMALLWORLD_VERSION_MINOR 1      // Version minor.
+#define SMALLWORLD_VERSION_MINOR 2      // Version minor.
 #define SMALLWORLD_MAX_LOGIN_STREAM_LENGTH 127 // Max data stream length, in bytes.
 
 //
@@ -108,13 +109,18 @@ struct evSmallworldRequest : public BitStreamPacket
     NC_LAST_TAG
   };
 
-  virtual bool read(BitStream& bs);
-  virtual bool write(BitStream& bs) const;
-
   int code;                             // Notify code.
   int idPlayer;                         // Request id, for verify.
   uint time;                            // Time stamp, for verify.
   std::string stream;
+
+  typedef BitStreamSchema<
+    BitStreamUIntField<evSmallworldRequest, int, &evSmallworldRequest::code, NC_LAST_TAG - 1>,
+    BitStreamUIntField<evSmallworldRequest, int, &evSmallworldRequest::idPlayer, SMALLWORLD_MAX_PLAYER - 1>,
+    BitStreamUIntField<evSmallworldRequest, uint, &evSmallworldRequest::time, 0xffffffff>,
+    BitStreamStringField<evSmallworldRequest, &evSmallworldRequest::stream, SMALLWORLD_MAX_DATA_STREAM_LENGTH> > Schema;
+
+  SW2_DECLARE_BITSTREAM_SCHEMA(Schema)
 };
 
 struct evSmallworldChannel : public BitStreamPacket
@@ -191,8 +197,10 @@ struct evSmallworldGame : public BitStreamPacket
 };
 
 bool send(NetworkConnection* pConn, const BitStreamPacket &p);
+char const* encode(TickArena &arena, const BitStreamPacket &p, int &len);
 bool freePacket(const BitStreamPacket *p);
 bool readPacket(BitStream &bs, const BitStreamPacket **pp);
+BitStreamPacketHandler<EID_LAST_TAG>& getPacketHandler();
 
 } // namespace impl
 
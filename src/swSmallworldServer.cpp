@@ -48,6 +48,7 @@ struct CONFIG_SERVER
  int maxPlayer;                         // Max player count at the same time.
  int maxChannel;                        // Max channel count.
  int maxChannelPlayer;                  // Max player count in a channel.
+ int sessionTimeout;                    // Session keeps after client dropped, sec, 0 is disabled.
 };
 
 //
@@ -174,10 +175,19 @@ public:
   virtual void onNetworkServerLeave(NetworkClient* pClient);
   virtual void onNetworkStreamReady(NetworkClient* pClient, int len, void const* pStream);
 
+  //
+  // Packet handlers.
+  //
+
+  bool onNotify(NetworkClient* pClient, evSmallworldNotify &n);
+  bool onRequest(NetworkClient* pClient, evSmallworldRequest &r);
+  bool onUnknown(NetworkClient* pClient, BitStreamPacket &p);
+
 public:
 
   implSmallworldServer* m_pServer;      // Interface to impl::implSmallworldServer.
   NetworkClient* m_pClient;             // Network client, account client.
+  BitStreamPacketDispatcher<EID_LAST_TAG, implSmallworldServerAccountClient, NetworkClient*> m_dispatcher; // Packet handlers.
 };
 
 class implSmallworldServer : public SmallworldServer, public NetworkServerCallback
@@ -253,9 +263,10 @@ public:
   NetworkServer* m_pServer;             // Network server.
   ObjectPool<implSmallworldServerPlayer, SMALLWORLD_MAX_PLAYER> m_player; // implSmallworldServerPlayer object pool(all players in the server).
   ObjectPool<implSmallworldServerGame, SMALLWORLD_MAX_PLAYER> m_game; // STRUCT_GAME object pool(all games in the server).
-  ObjectPool<int, SMALLWORLD_MAX_PLAYER> m_channelPlayer[SMALLWORLD_MAX_CHANNEL]; // Channel player ID pool.
-  ObjectPool<int, SMALLWORLD_MAX_PLAYER> m_channelGame[SMALLWORLD_MAX_CHANNEL]; // Channel game ID pool.
+  DenseObjectPool<int, SMALLWORLD_MAX_PLAYER> m_channelPlayer[SMALLWORLD_MAX_CHANNEL]; // Channel player ID pool, dense for broadcast.
+  DenseObjectPool<int, SMALLWORLD_MAX_PLAYER> m_channelGame[SMALLWORLD_MAX_CHANNEL]; // Channel game ID pool.
   StageStack<implSmallworldServer> m_stage; // Stage controller.
+  TickArena m_arena;                    // Per tick arena, broadcast streams.
   bool m_bReady2Go;                     // Ready flag, initialized but not up.
   bool m_bReady;                        // Ready flag, intialized and up.
 };
@@ -355,6 +366,7 @@ bool implSmallworldServer::startup(Ini const& conf1)
   m_conf.maxPlayer = conf.find("MaxPlayer") ? conf["MaxPlayer"] : (int)SMALLWORLD_MAX_PLAYER;
   m_conf.maxChannel = conf.find("MaxChannel") ? conf["MaxChannel"] : (int)SMALLWORLD_MAX_CHANNEL;
   m_conf.maxChannelPlayer = conf.find("MaxChannelPlayer") ? conf["MaxChannelPlayer"] : (int)SMALLWORLD_MAX_CHANNEL_PLAYER;
+  m_conf.sessionTimeout = conf.find("SessionTimeout") ? conf["SessionTimeout"] : 0;
 
   m_conf.maxChannel = std::max(0, std::min(m_conf.maxChannel, (int)SMALLWORLD_MAX_CHANNEL));
   m_conf.maxChannelPlayer = std::max(0, std::min(m_conf.maxChannelPlayer, (int)SMALLWORLD_MAX_CHANNEL_PLAYER));
@@ -386,6 +398,8 @@ void implSmallworldServer::shutdown()
 
 void implSmallworldServer::trigger()
 {
+  m_arena.reset();                      // Streams of last tick are sent.
+
   if (m_acClient.m_pClient) {
     m_acClient.m_pClient->trigger();
   }
@@ -395,7 +409,9 @@ void implSmallworldServer::trigger()
 
 NetworkServerStats implSmallworldServer::getNetStats()
 {
-  return m_pServer->getNetStats();
+  NetworkServerStats ns = m_pServer->getNetStats();
+  ns.bytesTick += (uint)m_arena.getLastTickBytes();
+  return ns;
 }
 
 SmallworldPlayer* implSmallworldServer::getFirstPlayer()
@@ -601,6 +617,7 @@ void implSmallworldServer::stageStartup(int state, uint_ptr)
 {
   if (JOIN == state) {
     SW2_TRACE_MESSAGE("Startup Server...");
+    m_pServer->setSessionTimeout(m_conf.sessionTimeout);
     if (!m_pServer->startup(m_conf.addrListen)) {
       SW2_TRACE_ERROR("Startup Server Failed!!!");
     }
@@ -692,8 +709,11 @@ void implSmallworldServer::stageReady(int state, uint_ptr)
   }
 }
 
-implSmallworldServerAccountClient::implSmallworldServerAccountClient() : m_pServer(0), m_pClient(0)
+implSmallworldServerAccountClient::implSmallworldServerAccountClient() : m_pServer(0), m_pClient(0), m_dispatcher(getPacketHandler(), *this)
 {
+  m_dispatcher.registerHandler<evSmallworldNotify, &implSmallworldServerAccountClient::onNotify>();
+  m_dispatcher.registerHandler<evSmallworldRequest, &implSmallworldServerAccountClient::onRequest>();
+  m_dispatcher.setDefaultHandler(&implSmallworldServerAccountClient::onUnknown);
 }
 
 void implSmallworldServerAccountClient::onNetworkServerLeave(NetworkClient* pClient)
@@ -706,131 +726,136 @@ void implSmallworldServerAccountClient::onNetworkStreamReady(NetworkClient* pCli
   assert(m_pServer);
 
   BitStream bs((char*)pStream, len);
-  const BitStreamPacket *p;
-  while (readPacket(bs, &p)) {
-    if (EID_NOTIFY == p->getId()) {
-      evSmallworldNotify* pNotify = (evSmallworldNotify*)p;
-      switch (pNotify->code)
-      {
-      case evSmallworldNotify::NC_NEED_LOGIN:
-        {
-          evSmallworldLogin el;
-          assert(m_pClient);
-          if (!send(m_pClient, el)) {
-            m_pClient->disconnect();
-          }
-        }
-        break;
-
-      case evSmallworldNotify::NC_LOGIN_ACCEPTED:
-        m_pServer->m_stage.push(&implSmallworldServer::stageStartup);
-        break;
+  m_dispatcher.dispatch(bs, pClient);
+}
 
-      default:
-        SW2_TRACE_WARNING("Unknown notify code received, ignore"); // Ignore.
-        break;
+bool implSmallworldServerAccountClient::onNotify(NetworkClient* pClient, evSmallworldNotify &n)
+{
+  switch (n.code)
+  {
+  case evSmallworldNotify::NC_NEED_LOGIN:
+    {
+      evSmallworldLogin el;
+      assert(m_pClient);
+      if (!send(m_pClient, el)) {
+        m_pClient->disconnect();
       }
-    } else if (EID_REQUEST == p->getId()) {
-      evSmallworldRequest* pReq = (evSmallworldRequest*)p;
+    }
+    break;
 
-      implSmallworldServerPlayer& peer = m_pServer->m_player[pReq->idPlayer];
+  case evSmallworldNotify::NC_LOGIN_ACCEPTED:
+    m_pServer->m_stage.push(&implSmallworldServer::stageStartup);
+    break;
 
-      //
-      // Is still alive?
-      //
+  default:
+    SW2_TRACE_WARNING("Unknown notify code received, ignore"); // Ignore.
+    break;
+  }
 
-      if (0 != peer.m_pNetPeer) {
+  return true;
+}
 
-        //
-        // Verify time stamp, because it is internal verification so use assert.
-        //
+bool implSmallworldServerAccountClient::onRequest(NetworkClient* pClient, evSmallworldRequest &r)
+{
+  implSmallworldServerPlayer& peer = m_pServer->m_player[r.idPlayer];
 
-        assert(peer.m_timer.getExpiredTime() == pReq->time);
-
-        switch (pReq->code)
-        {
-        case evSmallworldRequest::NC_PLAYER_LOGIN: // Login success(login).
-          peer.m_bVerified = true;
-          peer.m_stage.popAndPush(&implSmallworldServerPlayer::stageReady);
-          break;
-
-        case evSmallworldRequest::NC_PLAYER_LOGOUT: // Logout success(logout).
-          m_pServer->m_player.free(peer.m_idPlayer);
-          peer.m_stage.popAll();
-          break;
-
-        case evSmallworldRequest::NC_ACCOUNT_OR_PASSWORD: // (login)
-          {
-            evSmallworldNotify n;
-            n.code = evSmallworldNotify::NC_ACCOUNT_OR_PASSWORD;
-            send(peer.m_pNetPeer, n);
-            peer.m_pNetPeer->disconnect();
-          }
-          break;
-
-        case evSmallworldRequest::NC_DUPLICATE_LOGIN: // (login)
-          {
-            evSmallworldNotify n;
-            n.code = evSmallworldNotify::NC_DUPLICATE_LOGIN;
-            send(peer.m_pNetPeer, n);
-            peer.m_pNetPeer->disconnect();
-          }
-          break;
-
-        case evSmallworldRequest::NC_NOT_ALLOWED: // (login)
-          {
-            evSmallworldNotify n;
-            n.code = evSmallworldNotify::NC_LOGIN_NOT_ALLOWED;
-            send(peer.m_pNetPeer, n);
-            peer.m_pNetPeer->disconnect();
-          }
-          break;
-
-        case evSmallworldRequest::NC_NOT_LOGIN: // (logout)
-          assert(0); // bug
-          break;
-
-        default:
-          SW2_TRACE_WARNING("Unknown request code received, ignore"); // Ignore.
-          break;
-        }
-      } else {
+  //
+  // Is still alive?
+  //
 
-        //
-        // Connections is dead.
-        //
+  if (0 != peer.m_pNetPeer) {
 
-        switch (pReq->code)
-        {
-        case evSmallworldRequest::NC_PLAYER_LOGIN: // Login success(login)
-          pReq->code = evSmallworldRequest::NC_PLAYER_LOGOUT;
-          if (!send(m_pServer->m_acClient.m_pClient, *pReq)) { // Logout immediately.
-            m_pServer->m_player.free(peer.m_idPlayer);
-            peer.m_stage.popAll();
-          }
-          break;
-
-        case evSmallworldRequest::NC_NOT_LOGIN: // (logout)
-          assert(0);                    // Should be a bug.
-          break;
-
-        default:                        // Clean up anyway.
-          m_pServer->m_player.free(peer.m_idPlayer);
-          peer.m_stage.popAll();
-          break;
-        }
+    //
+    // Verify time stamp, because it is internal verification so use assert.
+    //
+
+    assert(peer.m_timer.getExpiredTime() == r.time);
+
+    switch (r.code)
+    {
+    case evSmallworldRequest::NC_PLAYER_LOGIN: // Login success(login).
+      peer.m_bVerified = true;
+      peer.m_stage.popAndPush(&implSmallworldServerPlayer::stageReady);
+      break;
+
+    case evSmallworldRequest::NC_PLAYER_LOGOUT: // Logout success(logout).
+      m_pServer->m_player.free(peer.m_idPlayer);
+      peer.m_stage.popAll();
+      break;
+
+    case evSmallworldRequest::NC_ACCOUNT_OR_PASSWORD: // (login)
+      {
+        evSmallworldNotify n;
+        n.code = evSmallworldNotify::NC_ACCOUNT_OR_PASSWORD;
+        send(peer.m_pNetPeer, n);
+        peer.m_pNetPeer->disconnect();
       }
-    } else {
+      break;
 
-      //
-      // Ignore unknown event.
-      //
+    case evSmallworldRequest::NC_DUPLICATE_LOGIN: // (login)
+      {
+        evSmallworldNotify n;
+        n.code = evSmallworldNotify::NC_DUPLICATE_LOGIN;
+        send(peer.m_pNetPeer, n);
+        peer.m_pNetPeer->disconnect();
+      }
+      break;
 
-      SW2_TRACE_WARNING("Unknown Event received, ignore");
+    case evSmallworldRequest::NC_NOT_ALLOWED: // (login)
+      {
+        evSmallworldNotify n;
+        n.code = evSmallworldNotify::NC_LOGIN_NOT_ALLOWED;
+        send(peer.m_pNetPeer, n);
+        peer.m_pNetPeer->disconnect();
+      }
+      break;
+
+    case evSmallworldRequest::NC_NOT_LOGIN: // (logout)
+      assert(0); // bug
+      break;
+
+    default:
+      SW2_TRACE_WARNING("Unknown request code received, ignore"); // Ignore.
+      break;
     }
+  } else {
+
+    //
+    // Connections is dead.
+    //
+
+    switch (r.code)
+    {
+    case evSmallworldRequest::NC_PLAYER_LOGIN: // Login success(login)
+      r.code = evSmallworldRequest::NC_PLAYER_LOGOUT;
+      if (!send(m_pServer->m_acClient.m_pClient, r)) { // Logout immediately.
+        m_pServer->m_player.free(peer.m_idPlayer);
+        peer.m_stage.popAll();
+      }
+      break;
+
+    case evSmallworldRequest::NC_NOT_LOGIN: // (logout)
+      assert(0);                        // Should be a bug.
+      break;
 
-    freePacket(p);
+    default:                            // Clean up anyway.
+      m_pServer->m_player.free(peer.m_idPlayer);
+      peer.m_stage.popAll();
+      break;
+    }
   }
+
+  return true;
+}
+
+bool implSmallworldServerAccountClient::onUnknown(NetworkClient* pClient, BitStreamPacket &p)
+{
+  //
+  // Ignore unknown event.
+  //
+
+  SW2_TRACE_WARNING("Unknown Event received, ignore");
+  return true;
 }
 
 implSmallworldServerPlayer::~implSmallworldServerPlayer()
@@ -901,12 +926,18 @@ bool implSmallworldServerPlayer::sendMessage(const std::string& msg)
   chat.idWho = m_idPlayer;
   chat.msg = msg;
 
+  int len;
+  char const* pStream = impl::encode(m_pServer->m_arena, chat, len); // Encode once for all players.
+  if (0 == pStream) {
+    return false;
+  }
+
   for (int i = m_pServer->m_channelPlayer[m_iChannel].first(); -1 != i; i = m_pServer->m_channelPlayer[m_iChannel].next(i)) {
     implSmallworldServerPlayer& peer = m_pServer->m_player[m_pServer->m_channelPlayer[m_iChannel][i]];
     if (!peer.m_bVerified || !peer.m_bNeedMessage) { // Only send to verified player.
       continue;
     }
-    if (!impl::send(peer.m_pNetPeer, chat)) {
+    if (!peer.m_pNetPeer->send(len, pStream)) {
       peer.m_pNetPeer->disconnect();
     }
   }
@@ -1318,13 +1349,16 @@ bool implSmallworldServerPlayer::quitGame()
     eg.code = evSmallworldGame::NC_GAME_REMOVE;
     eg.idGame = m_idGame;
 
+    int len;
+    char const* pStream = impl::encode(m_pServer->m_arena, eg, len);
+
     int i = m_pServer->m_channelPlayer[m_iChannel].first();
-    for (; -1 != i; i = m_pServer->m_channelPlayer[m_iChannel].next(i)) {
+    for (; 0 != pStream && -1 != i; i = m_pServer->m_channelPlayer[m_iChannel].next(i)) {
       const implSmallworldServerPlayer& peer = m_pServer->m_player[m_pServer->m_channelPlayer[m_iChannel][i]];
       if (!peer.m_bVerified || !peer.m_bNeedGameList || 0 == peer.m_pNetPeer) {
         continue;
       }
-      if (!impl::send(peer.m_pNetPeer, eg)) {
+      if (!peer.m_pNetPeer->send(len, pStream)) {
         m_pNetPeer->disconnect();
       }
     }
@@ -1807,13 +1841,16 @@ void implSmallworldServerPlayer::broadcastEnterChannel()
     ch.code = evSmallworldChannel::NC_PLAYER_ADD;
     ch.idPlayer = m_idPlayer;
 
+    int len;
+    char const* pStream = impl::encode(m_pServer->m_arena, ch, len);
+
     int iter = m_pServer->m_channelPlayer[m_iChannel].first();
-    for (; -1 != iter; iter = m_pServer->m_channelPlayer[m_iChannel].next(iter)) {
+    for (; 0 != pStream && -1 != iter; iter = m_pServer->m_channelPlayer[m_iChannel].next(iter)) {
       const implSmallworldServerPlayer& peer = m_pServer->m_player[m_pServer->m_channelPlayer[m_iChannel][iter]];
       if (!peer.m_bVerified || !peer.m_bNeedPlayerList || 0 == peer.m_pNetPeer) {
         continue;
       }
-      if (!impl::send(peer.m_pNetPeer, ch)) {
+      if (!peer.m_pNetPeer->send(len, pStream)) {
         peer.m_pNetPeer->disconnect();
       }
     }
@@ -1865,13 +1902,15 @@ void implSmallworldServerPlayer::broadcastLeaveChannel()
     evSmallworldChannel ch;
     ch.code = evSmallworldChannel::NC_PLAYER_REMOVE;
     ch.idPlayer = m_idPlayer;
+    int len;
+    char const* pStream = impl::encode(m_pServer->m_arena, ch, len);
     int i = m_pServer->m_channelPlayer[m_iChannel].first();
-    for (; -1 != i; i = m_pServer->m_channelPlayer[m_iChannel].next(i)) {
+    for (; 0 != pStream && -1 != i; i = m_pServer->m_channelPlayer[m_iChannel].next(i)) {
       implSmallworldServerPlayer& peer = m_pServer->m_player[m_pServer->m_channelPlayer[m_iChannel][i]];
       if (!peer.m_bVerified || !peer.m_bNeedPlayerList || 0 == peer.m_pNetPeer || m_idPlayer == peer.m_idPlayer) {
         continue;
       }
-      if (!impl::send(peer.m_pNetPeer, ch)) {
+      if (!peer.m_pNetPeer->send(len, pStream)) {
         peer.m_pNetPeer->disconnect();
       }
     }
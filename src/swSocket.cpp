@@ -25,6 +25,7 @@
 #elif defined(_linux_)
 # include <errno.h>
 # include <netdb.h>
+# include <poll.h>
 # include <sys/socket.h>
 # include <sys/ioctl.h>
 # include <netinet/tcp.h>
@@ -72,6 +73,7 @@ namespace impl {
 #define MAX_PACKET_BUFFER_SIZE 512      // Max buffer size, bytes.
 #define MAX_TRIGGER_READ_SIZE 2048      // Max data size will be read in each trigger process, bytes.
 #define MAX_TRIGGER_WIRTE_SIZE 2048     // Max data size will be written in each trigger process, bytes.
+#define MAX_LEAN_FREE_BUFF 64           // Max shared free packet buffers kept in lean mode.
 
 //
 // Packet buffer.
@@ -205,8 +207,10 @@ public:
     m_socket(INVALID_SOCKET),
     m_pSvrNetStats(0),
     m_pFreeBuff(0),
+    m_ppFreeBuff(&m_pFreeBuff),
     m_pBuff(0),
-    m_pBuffLast(0)
+    m_pBuffLast(0),
+    m_bLean(false)
   {
     memset(&m_netStats, 0, sizeof(SocketClientStats));
     m_trigger.initialize(this, &implSocketBase::stageDisconnected);
@@ -220,13 +224,13 @@ public:
 
     if (m_pBuff) {
       assert(m_pBuffLast && 0 == m_pBuffLast->pNext);
-      m_pBuffLast->pNext = m_pFreeBuff;
-      m_pFreeBuff = m_pBuff;
+      m_pBuffLast->pNext = *m_ppFreeBuff;
+      *m_ppFreeBuff = m_pBuff;
       m_pBuff = m_pBuffLast = 0;
     }
 
     //
-    // Free buffers.
+    // Free own buffers, shared buffers are freed by the owner.
     //
 
     while (m_pFreeBuff) {
@@ -236,6 +240,37 @@ public:
     }
   }
 
+  size_t getBytesMemBuff() const
+  {
+    size_t s = m_addr.capacity();
+    implSocketPacketBuffer *p;
+    for (p = m_pBuff; p; p = p->pNext) {
+      s += sizeof(implSocketPacketBuffer);
+    }
+    for (p = m_pFreeBuff; p; p = p->pNext) {
+      s += sizeof(implSocketPacketBuffer);
+    }
+    return s;
+  }
+
+  void setFreeBuffList(implSocketPacketBuffer** ppFreeBuff)
+  {
+    //
+    // Move own free buffers to the shared list.
+    //
+
+    if (&m_pFreeBuff != ppFreeBuff) {
+      while (m_pFreeBuff) {
+        implSocketPacketBuffer* p = m_pFreeBuff;
+        m_pFreeBuff = m_pFreeBuff->pNext;
+        p->pNext = *ppFreeBuff;
+        *ppFreeBuff = p;
+      }
+    }
+
+    m_ppFreeBuff = ppFreeBuff;
+  }
+
   unsigned long long getBytesSendBuff() const
   {
     unsigned long long s = 0;
@@ -320,8 +355,8 @@ public:
 
     if (m_pBuff) {
       assert(m_pBuffLast && 0 == m_pBuffLast->pNext);
-      m_pBuffLast->pNext = m_pFreeBuff;
-      m_pFreeBuff = m_pBuff;
+      m_pBuffLast->pNext = *m_ppFreeBuff;
+      *m_ppFreeBuff = m_pBuff;
       m_pBuff = m_pBuffLast = 0;
     }
 
@@ -375,9 +410,9 @@ public:
       // Allocate packet buffer.
       //
 
-      if (m_pFreeBuff) {
-        pBuff = m_pFreeBuff;
-        m_pFreeBuff = m_pFreeBuff->pNext;
+      if (*m_ppFreeBuff) {
+        pBuff = *m_ppFreeBuff;
+        *m_ppFreeBuff = pBuff->pNext;
       } else {
         pBuff = new implSocketPacketBuffer;
       }
@@ -387,8 +422,8 @@ public:
         SW2_TRACE_ERROR("Send stream, out of memory.");
 
         if (0 != pHead) {               // Release allocated buffer(s).
-          pLast->pNext = m_pFreeBuff;
-          m_pFreeBuff = pHead;
+          pLast->pNext = *m_ppFreeBuff;
+          *m_ppFreeBuff = pHead;
         }
 
         //
@@ -468,8 +503,8 @@ public:
           m_pBuffLast = 0;
         }
 
-        p->pNext = m_pFreeBuff;
-        m_pFreeBuff = p;
+        p->pNext = *m_ppFreeBuff;
+        *m_ppFreeBuff = p;
       }
 
       //
@@ -700,21 +735,24 @@ public:
 
     if (TRIGGER == state) {
       int n;
+#if defined(WIN32)
       fd_set wset;
       FD_ZERO(&wset);
       FD_SET(m_socket, &wset);
-#if defined(WIN32)
       fd_set eset;
       FD_ZERO(&eset);
       FD_SET(m_socket, &eset);
-#endif
       struct timeval tval;
       tval.tv_sec = tval.tv_usec = 0;
 
-#if defined(WIN32)
       if ((n = ::select((int)(m_socket + 1), 0, &wset, &eset, &tval)) <= 0) {
 #else
-      if ((n = ::select((int)(m_socket + 1), 0, &wset, 0, &tval)) <= 0) {
+      struct pollfd pfd;                // Use poll, fd_set can't hold socket >= FD_SETSIZE.
+      pfd.fd = m_socket;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+
+      if ((n = ::poll(&pfd, 1, 0)) <= 0) {
 #endif
 
         //
@@ -747,7 +785,7 @@ public:
         if (FD_ISSET(m_socket, &wset) || eset_set) {
           if (eset_set) {
 #else
-        if (FD_ISSET(m_socket, &wset)) {
+        if (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) {
           int error = 0, len = sizeof(error);
           if (SOCKET_ERROR == ::getsockopt(m_socket, SOL_SOCKET, SO_ERROR, (char*)&error, (socklen_t*)&len) || 0 != error) {
 #endif
@@ -821,8 +859,10 @@ public:
   SocketServerStats* m_pSvrNetStats;
 
   implSocketPacketBuffer* m_pFreeBuff;  // Free list of packet buffer.
+  implSocketPacketBuffer** m_ppFreeBuff; // Free list in use, own or shared by server.
 
   implSocketPacketBuffer *m_pBuff, *m_pBuffLast; // Buffer list for queued data.
+  bool m_bLean;                         // Memory lean mode.
   TimeoutTimer m_lastProcessTimeout;    // Since last process trigger.
   StageStack<implSocketBase> m_trigger;
 };
@@ -879,9 +919,15 @@ public:
     SocketClientStats s = m_netStats;
     s.upTime = (time_t)::difftime(::time(0), s.startTime);
     s.bytesBuff = getBytesSendBuff();
+    s.bytesMem = getBytesMem();
     return s;
   }
 
+  size_t getBytesMem() const
+  {
+    return sizeof(*this) + getBytesMemBuff();
+  }
+
   virtual bool send(int len, void const* pStream)
   {
     return implSocketBase::send_i(len, pStream);
@@ -950,9 +996,15 @@ public:
     SocketClientStats s = m_netStats;
     s.upTime = (time_t)::difftime(::time(0), s.startTime);
     s.bytesBuff = getBytesSendBuff();
+    s.bytesMem = getBytesMem();
     return s;
   }
 
+  size_t getBytesMem() const
+  {
+    return sizeof(*this) + getBytesMemBuff();
+  }
+
   virtual bool send(int len, void const* pStream)
   {
     return implSocketBase::send_i(len, pStream);
@@ -1022,9 +1074,15 @@ public:
     SocketClientStats s = m_netStats;
     s.upTime = (time_t)::difftime(::time(0), s.startTime);
     s.bytesBuff = getBytesSendBuff();
+    s.bytesMem = getBytesMem();
     return s;
   }
 
+  size_t getBytesMem() const
+  {
+    return sizeof(*this) + getBytesMemBuff() + m_stream.capacity() + m_cache.capacity();
+  }
+
   virtual bool send(int lenStream, void const* pStream)
   {
     if (!m_hasUpgrade) {
@@ -1064,8 +1122,13 @@ public:
 
   virtual void onBeforeCheckNewClientReady()
   {
-    m_stream.clear();
-    m_cache.clear();
+    if (m_bLean) {
+      std::string().swap(m_stream);
+      std::string().swap(m_cache);
+    } else {
+      m_stream.clear();
+      m_cache.clear();
+    }
     m_hasUpgrade = false;
   }
 
@@ -1092,6 +1155,10 @@ public:
     } else {
       webSockUpgrade();
     }
+
+    if (m_bLean && m_stream.empty()) {  // Release buffer of idle connection.
+      std::string().swap(m_stream);
+    }
   }
 
   //
@@ -1272,8 +1339,8 @@ public:
       m_hasUpgrade = true;
       if (!m_cache.empty()) {
         send((int)m_cache.size(), m_cache.c_str());
-        m_cache.clear();
       }
+      std::string().swap(m_cache);      // Not used after upgraded.
     }
   }
 
@@ -1296,6 +1363,8 @@ public:
     m_listen(INVALID_SOCKET),
     m_pClient(0),
     m_pFreeClient(0),
+    m_pFreeBuff(0),
+    m_bLean(false),
     m_pCallback(pCallback)
   {
     SocketServer::userData = 0;
@@ -1337,6 +1406,16 @@ public:
     }
 
     m_pFreeClient = 0;
+
+    //
+    // Free shared buffers.
+    //
+
+    while (m_pFreeBuff) {
+      implSocketPacketBuffer* pBuff = m_pFreeBuff;
+      m_pFreeBuff = m_pFreeBuff->pNext;
+      delete pBuff;
+    }
   }
 
   //
@@ -1362,14 +1441,27 @@ public:
     SocketServerStats s = m_netStats;
     s.upTime = (time_t)difftime(time(0), s.startTime);
     s.bytesBuff = 0;
+    s.bytesMem = 0;
     ConnT *client = m_pClient;
     while (client) {
       s.bytesBuff += client->getBytesSendBuff();
+      s.bytesMem += client->getBytesMem();
       client = client->m_pNext;
     }
+    for (client = m_pFreeClient; client; client = client->m_pNext) {
+      s.bytesMem += client->getBytesMem();
+    }
+    for (implSocketPacketBuffer *p = m_pFreeBuff; p; p = p->pNext) {
+      s.bytesMem += sizeof(implSocketPacketBuffer);
+    }
     return s;
   }
 
+  virtual void setLeanMode(bool bLean)
+  {
+    m_bLean = bLean;
+  }
+
   virtual void shutdown()
   {
     if (INVALID_SOCKET != m_listen) {
@@ -1510,6 +1602,8 @@ public:
       pClient->m_pCallback = m_pCallback;
       pClient->m_pServer = this;
       pClient->m_pSvrNetStats = &m_netStats;
+      pClient->m_bLean = m_bLean;
+      pClient->setFreeBuffList(m_bLean ? &m_pFreeBuff : &pClient->m_pFreeBuff);
       pClient->userData = 0;
       pClient->m_socket = s;
       pClient->m_state = CS_CONNECTED;
@@ -1576,6 +1670,32 @@ public:
         client = (ConnT*)client->m_pNext;
       }
     }
+
+    //
+    // Lean mode, release shared free buffers more than kept.
+    //
+
+    if (m_bLean) {
+      trimFreeBuff();
+    }
+  }
+
+  void trimFreeBuff()
+  {
+    implSocketPacketBuffer* p = m_pFreeBuff;
+    for (int i = 1; p && MAX_LEAN_FREE_BUFF > i; i++) {
+      p = p->pNext;
+    }
+
+    if (0 == p) {
+      return;
+    }
+
+    while (p->pNext) {
+      implSocketPacketBuffer* pBuff = p->pNext;
+      p->pNext = pBuff->pNext;
+      delete pBuff;
+    }
   }
 
   virtual std::string getAddr() const
@@ -1592,6 +1712,9 @@ public:
   ConnT* m_pClient;                     // Active client(s).
   ConnT* m_pFreeClient;                 // Available client(s).
 
+  implSocketPacketBuffer* m_pFreeBuff;  // Shared free list of packet buffer in lean mode.
+  bool m_bLean;                         // Memory lean mode of new connection.
+
   SocketServerCallback* m_pCallback;
 };
 
@@ -149,6 +149,8 @@ struct SocketClientStats
   unsigned long long bytesBuff;         ///< Total bytes in send buffer.
   unsigned long long bytesSent;         ///< Total bytes sent.
   unsigned long long bytesRecv;         ///< Total bytes received.
+
+  unsigned long long bytesMem;          ///< Total bytes of memory used by the connection.
 };
 
 ///
@@ -164,6 +166,8 @@ struct SocketServerStats
   unsigned long long bytesSent;         ///< Total bytes sent.
   unsigned long long bytesRecv;         ///< Total bytes received.
 
+  unsigned long long bytesMem;          ///< Total bytes of memory used by connections.
+
   unsigned int hits;                    ///< Total hit count.
   unsigned int currOnline;              ///< Current online count.
   unsigned int maxOnline;               ///< Max online count.
@@ -438,6 +442,16 @@ public:
 
   virtual SocketServerStats getNetStats() const=0;
 
+  ///
+  /// \brief Set memory lean mode.
+  /// \param [in] bLean Enable lean mode or not, default is disabled.
+  /// \note In lean mode, send buffers of connections are allocated from a shared
+  ///       pool of the server and released after used. This saves memory of idle
+  ///       connections but costs more allocations. Apply to new connections only.
+  ///
+
+  virtual void setLeanMode(bool bLean)=0;
+
   ///
   /// \brief Get first connection.
   /// \return Return first connection.
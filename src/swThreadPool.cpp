@@ -213,8 +213,7 @@ public:
     return i;
   }
 
-  ObjectPool<implThreadTask, MAX_THREAD_TASK> m_poolTask; // Task pool.
-  implLock m_poolLock;
+  ConcurrentObjectPool<implThreadTask, MAX_THREAD_TASK> m_poolTask; // Task pool, lock free.
 
   std::queue<int> m_queue;              // Task queue, wait for available worker thread to run task.
   implLock m_queueLock;
@@ -250,16 +249,11 @@ public:
       return -1;
     }
 
-    lockPool();
-
     int idTask = m_poolTask.alloc();
     if (-1 != idTask) {
-      implThreadTask& task = m_poolTask[idTask];
-      task.reset(pTask);
+      m_poolTask.get(idTask)->reset(pTask);
     }
 
-    unlockPool();
-
     if (-1 != idTask) {
       m_taskMap[pTask] = idTask;
     }
@@ -282,9 +276,7 @@ public:
       return;
     }
 
-    lockPool();
     m_poolTask.free(it->second);
-    unlockPool();
 
     m_taskMap.erase(pTask);
   }
@@ -394,24 +386,14 @@ public:
   }
 
   //
-  // Lock/unlock task queue/pool.
+  // Lock/unlock task queue.
   //
 
-  void lockPool()
-  {
-    m_poolLock.lock();
-  }
-
   void lockQueue()
   {
     m_queueLock.lock();
   }
 
-  void unlockPool()
-  {
-    m_poolLock.unlock();
-  }
-
   void unlockQueue()
   {
     m_queueLock.unlock();
@@ -441,11 +423,8 @@ public:
       return false;
     }
 
-    lockPool();
-    bool bRunning = m_poolTask[it->second].isRunning();
-    unlockPool();
-
-    return bRunning;
+    implThreadTask* pt = m_poolTask.get(it->second);
+    return 0 != pt && pt->isRunning();
   }
 
   bool runTask(int idTask)
@@ -458,15 +437,17 @@ public:
     // ThreadTask::runTask already check is it running. So schedule it now.
     //
 
-    lockPool();
-    m_poolTask[idTask].setQueued();     // Schedule it.
+    implThreadTask* pt = m_poolTask.get(idTask);
+    if (0 == pt) {                      // Stale task handle.
+      return false;
+    }
+
+    pt->setQueued();                    // Schedule it.
 
     lockQueue();
     m_queue.push(idTask);               // Queue it.
     unlockQueue();
 
-    unlockPool();
-
     //
     // Fire a signal to run it.
     //
@@ -597,11 +578,9 @@ public:
 
   void execTask_i(int idTask)
   {
-    if (-1 != idTask) {
-      lockPool();
-      implThreadTask& task = m_poolTask[idTask];
-      unlockPool();
-      task.runTask();
+    implThreadTask* pt = m_poolTask.get(idTask);
+    if (0 != pt) {                      // Skip a task freed after queued.
+      pt->runTask();
     }
   }
 };
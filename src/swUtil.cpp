@@ -100,6 +100,17 @@ public:
 
     return 0;
   }
+
+  uint64 getTickCountUs() const
+  {
+    timeval currTick;
+    if (0 == gettimeofday(&currTick, 0)) {
+      return (uint64)(currTick.tv_sec - mLastTick.tv_sec) * 1000000 +
+             (currTick.tv_usec - mLastTick.tv_usec);
+    }
+
+    return 0;
+  }
 };
 #endif // _linux_
 
@@ -140,6 +151,70 @@ uint Util::getTickCount()
   return 0;
 }
 
+uint64 Util::getTickCountUs()
+{
+#if defined(WIN32)
+  static LARGE_INTEGER freq, lastTick;
+  if (0 == freq.QuadPart) {
+    ::QueryPerformanceFrequency(&freq);
+    ::QueryPerformanceCounter(&lastTick);
+  }
+  LARGE_INTEGER currTick;
+  ::QueryPerformanceCounter(&currTick);
+  return (uint64)((currTick.QuadPart - lastTick.QuadPart) * 1000000 / freq.QuadPart);
+#elif defined(_linux_)
+  static implGetTickCount impl;
+  return impl.getTickCountUs();
+#endif
+  return 0;
+}
+
+long Util::atomicIncrement(long volatile* pValue)
+{
+#if defined(WIN32)
+  return ::InterlockedIncrement(pValue);
+#elif defined(_linux_)
+  return __sync_add_and_fetch(pValue, 1);
+#endif
+}
+
+long Util::atomicDecrement(long volatile* pValue)
+{
+#if defined(WIN32)
+  return ::InterlockedDecrement(pValue);
+#elif defined(_linux_)
+  return __sync_sub_and_fetch(pValue, 1);
+#endif
+}
+
+long Util::atomicCompareExchange(long volatile* pDest, long exchange, long comparand)
+{
+#if defined(WIN32)
+  return ::InterlockedCompareExchange(pDest, exchange, comparand);
+#elif defined(_linux_)
+  return __sync_val_compare_and_swap(pDest, comparand, exchange);
+#endif
+}
+
+void* Util::atomicCompareExchangePointer(void* volatile* pDest, void* exchange, void* comparand)
+{
+#if defined(WIN32)
+  return ::InterlockedCompareExchangePointer(pDest, exchange, comparand);
+#elif defined(_linux_)
+  return __sync_val_compare_and_swap(pDest, comparand, exchange);
+#endif
+}
+
+void* Util::atomicExchangePointer(void* volatile* pDest, void* exchange)
+{
+#if defined(WIN32)
+  return ::InterlockedExchangePointer(pDest, exchange);
+#elif defined(_linux_)
+  __sync_synchronize();                 // Test and set is an acquire barrier only.
+  return __sync_lock_test_and_set(pDest, exchange);
+#endif
+}
+
 bool Util::isBIG5(int ch)
 {
   return (0xa140 <= ch && 0xa3bf >= ch) ||
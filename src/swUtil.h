@@ -100,6 +100,58 @@ namespace Util {
 
   uint getTickCount();
 
+  ///
+  /// \brief Get the tick count from the application up to now.(microseconds)
+  /// \return Return the tick count from the application up to now.
+  ///
+
+  uint64 getTickCountUs();
+
+  ///
+  /// \brief Atomic increase a value.
+  /// \param [in,out] pValue Value to increase.
+  /// \return Return increased value.
+  ///
+
+  long atomicIncrement(long volatile* pValue);
+
+  ///
+  /// \brief Atomic decrease a value.
+  /// \param [in,out] pValue Value to decrease.
+  /// \return Return decreased value.
+  ///
+
+  long atomicDecrement(long volatile* pValue);
+
+  ///
+  /// \brief Atomic compare and exchange a value.
+  /// \param [in,out] pDest Destination value.
+  /// \param [in] exchange New value, set to pDest if pDest equals to comparand.
+  /// \param [in] comparand Value to compare with pDest.
+  /// \return Return initial value of pDest.
+  ///
+
+  long atomicCompareExchange(long volatile* pDest, long exchange, long comparand);
+
+  ///
+  /// \brief Atomic compare and exchange a pointer.
+  /// \param [in,out] pDest Destination pointer.
+  /// \param [in] exchange New pointer, set to pDest if pDest equals to comparand.
+  /// \param [in] comparand Pointer to compare with pDest.
+  /// \return Return initial pointer of pDest.
+  ///
+
+  void* atomicCompareExchangePointer(void* volatile* pDest, void* exchange, void* comparand);
+
+  ///
+  /// \brief Atomic exchange a pointer.
+  /// \param [in,out] pDest Destination pointer.
+  /// \param [in] exchange New pointer.
+  /// \return Return initial pointer of pDest.
+  ///
+
+  void* atomicExchangePointer(void* volatile* pDest, void* exchange);
+
   ///
   /// \brief Check is this a BIG5 code?
   /// \param [in] ch A char.(double char)
@@ -8,11 +8,17 @@
 //  2008/05/25 Waync created.
 //
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <string>
+#include <vector>
 
 #include "CppUnitLite/TestHarness.h"
 
 #include "swBitStreamPacket.h"
+#include "swThreadPool.h"
 #include "swUtil.h"
 using namespace sw2;
 
@@ -255,6 +261,391 @@ TEST(BitStream, growbuff)
   }
 }
 
+//
+// Test word kernels against a bit by bit reference, bit n of a stream is bit
+// (n % 8) of byte (n / 8).
+//
+
+static void refWriteBits(std::string &s, int pos, void const* p, int bitCount)
+{
+  for (int i = 0; i < bitCount; i++) {
+    int bit = (((uchar const*)p)[i / 8] >> (i % 8)) & 1;
+    char &c = s[(pos + i) / 8];
+    c = (char)((c & ~(1 << ((pos + i) % 8))) | (bit << ((pos + i) % 8)));
+  }
+}
+
+TEST(BitStream, wordkernel)
+{
+  ::srand(1);
+
+  std::string src(64, 0);
+  for (int i = 0; i < (int)src.length(); i++) {
+    src[i] = (char)::rand();
+  }
+
+  for (int n = 0; n < 500; n++) {
+
+    //
+    // Write random bits at random offset of a dirty buffer, bits out of the
+    // range must keep unchanged.
+    //
+
+    std::string buff(80, 0), ref;
+    for (int i = 0; i < (int)buff.length(); i++) {
+      buff[i] = (char)::rand();
+    }
+    ref = buff;
+
+    int bytePtr = ::rand() % 8, bitPtr = ::rand() % 8;
+    int bitCount = ::rand() % (8 * (int)src.length());
+
+    BitStream bs(&buff[0], (int)buff.length());
+    bs.setPtr(bytePtr, bitPtr);
+    CHECK(bs.write(src.data(), bitCount));
+    refWriteBits(ref, 8 * bytePtr + bitPtr, src.data(), bitCount);
+    CHECK(ref == buff);
+    CHECK(8 * bytePtr + bitPtr + bitCount == 8 * bs.getBytePtr() + bs.getBitPtr());
+
+    //
+    // Read back to a dirty buffer.
+    //
+
+    std::string out(src.length(), 0), refOut;
+    for (int i = 0; i < (int)out.length(); i++) {
+      out[i] = (char)::rand();
+    }
+    refOut = out;
+    refWriteBits(refOut, 0, src.data(), bitCount);
+
+    bs.setPtr(bytePtr, bitPtr);
+    CHECK(bs.read(&out[0], bitCount));
+    CHECK(refOut == out);
+  }
+
+  //
+  // Mixed fields.
+  //
+
+  std::string s, ref(64, 0);
+  BitStream bs(s);
+  int pos = 0;
+  for (int i = 0; i < 200; i++) {
+    uint u = (uint)::rand() * 7919;
+    int bc = 1 + ::rand() % 32;
+    bs << setBitCount(bc) << u;
+    refWriteBits(ref, pos, &u, bc);
+    pos += bc;
+    if (0 == i % 3) {
+      bool b = 0 != ::rand() % 2;
+      bs << b;
+      uchar ub = b ? 1 : 0;
+      refWriteBits(ref, pos, &ub, 1);
+      pos += 1;
+    }
+    if ((int)ref.length() < pos / 8 + 8) {
+      ref.resize(2 * ref.length(), 0);
+    }
+  }
+  CHECK(0 == ::memcmp(s.data(), ref.data(), (pos + 7) / 8));
+}
+
+TEST(BitStream, blob)
+{
+  std::string blob(1000, 0);
+  for (int i = 0; i < (int)blob.length(); i++) {
+    blob[i] = (char)i;
+  }
+
+  for (int align = 0; align < 2; align++) {
+
+    std::string s;
+    BitStream bs(s);
+    bs.setAlignBlob(1 == align);
+
+    bs << true << blob;
+    CHECK(bs.writeBlob(blob.data(), 10));
+    bs << setBitCount(3) << 5u;
+    CHECK(bs.writeBlob(blob.data(), (int)blob.length()));
+    bs << setBitCount(5) << 7u << alignByte();
+    CHECK(bs.writeBlob(blob.data(), 20));
+    CHECK(bs.isByteAligned());
+
+    int len = bs.getByteCount();
+    bs.reset();
+
+    bool b;
+    std::string s2;
+    bs >> b >> s2;
+    CHECK(bs && b && blob == s2);
+    char buff[10];
+    CHECK(bs.readBlob(buff, 10) && 0 == ::memcmp(buff, blob.data(), 10));
+    uint u;
+    bs >> setBitCount(3) >> u;
+    CHECK(bs && 5 == u);
+
+    //
+    // View is valid only if the blob is aligned.
+    //
+
+    int by = bs.getBytePtr(), bi = bs.getBitPtr();
+    char const* p = bs.readView((int)blob.length());
+    if (align) {
+      CHECK(p && 0 == ::memcmp(p, blob.data(), blob.length()));
+    } else {
+      CHECK(0 == p && !bs && by == bs.getBytePtr() && bi == bs.getBitPtr());
+      std::string s3(blob.length(), 0);
+      CHECK(bs.readBlob(&s3[0], (int)s3.length()) && blob == s3);
+    }
+
+    bs >> setBitCount(5) >> u >> alignByte();
+    CHECK(bs && 7 == u);
+    p = bs.readView(20);
+    CHECK(p && 0 == ::memcmp(p, blob.data(), 20));
+    CHECK(len == bs.getBytePtr());
+
+    //
+    // Out of range, the string buffer may be bigger than written data.
+    //
+
+    int end = (int)s.length();
+    bs.setPtr(end);
+    CHECK(0 == bs.readView(1) && end == bs.getBytePtr());
+    CHECK(!bs.readBlob(buff, 1) && end == bs.getBytePtr());
+  }
+
+  //
+  // Fixed buffer, write out of range keeps no change.
+  //
+
+  char buff[16];
+  BitStream bs(buff, sizeof(buff));
+  bs.setAlignBlob(true);
+  bs << true;
+  CHECK(!bs.writeBlob(blob.data(), 16) && 0 == bs.getBytePtr() && 1 == bs.getBitPtr());
+  CHECK(bs.writeBlob(blob.data(), 15) && 16 == bs.getBytePtr());
+}
+
+//
+// Hostile length of string/blob from stream, fail without overflow of bits.
+//
+
+TEST(BitStream, hostileLength)
+{
+  const uint lens[] = {0x20000000, 0x7fffffff, 0xffffffff, 29};
+
+  for (int align = 0; align < 2; align++) {
+    for (int i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); i++) {
+      char buff[32] = {0};
+      BitStream bs(buff, sizeof(buff));
+      bs.setAlignBlob(1 == align);
+      bs << lens[i];
+      bs.reset();
+
+      std::string s;
+      bs >> s;
+      CHECK(!bs && s.empty() && 0 == bs.getBytePtr() && 0 == bs.getBitPtr());
+
+      bs.setPtr(4);
+      CHECK(0 == bs.readView((int)lens[i]) && 4 == bs.getBytePtr());
+      CHECK(!bs.readBlob(buff, (int)lens[i]) && 4 == bs.getBytePtr());
+    }
+
+    //
+    // Exact fit.
+    //
+
+    char buff[8] = {0};
+    BitStream bs(buff, sizeof(buff));
+    bs.setAlignBlob(1 == align);
+    bs << 4u;
+    bs.reset();
+    std::string s;
+    bs >> s;
+    CHECK(bs && 4 == s.length() && 8 == bs.getBytePtr());
+  }
+}
+
+TEST(BitStream, varint)
+{
+  const uint64 big = ((uint64)0x89abcdef << 32) | 0x01234567;
+
+  std::string s;
+  BitStream bs(s);
+
+  //
+  // Small numbers use less bytes, signed numbers are zigzag encoded.
+  //
+
+  bs << setVarint() << 0u;
+  CHECK(1 == bs.getByteCount());
+  bs << setVarint() << 127u;
+  CHECK(2 == bs.getByteCount());
+  bs << setVarint() << 300u;
+  CHECK(4 == bs.getByteCount());
+  bs << setVarint() << -1;
+  CHECK(5 == bs.getByteCount());
+  bs << setVarint() << -65;
+  CHECK(7 == bs.getByteCount());
+  bs << setVarint() << 0xffffffffu << setVarint() << (int)0x80000000;
+  bs << setVarint() << big << setVarint() << (int64)-1 << setVarint() << (0 - (int64)big);
+  bs << 5;                              // Varint is for next integer only.
+
+  //
+  // Varint string length.
+  //
+
+  bs << setVarint() << std::string("hello");
+  int len = bs.getByteCount();
+
+  bs.reset();
+
+  uint u1, u2, u3, u4;
+  int i1, i2, i3, i4;
+  uint64 u5;
+  int64 i5, i6;
+  bs >> setVarint() >> u1 >> setVarint() >> u2 >> setVarint() >> u3;
+  CHECK(bs && 0 == u1 && 127 == u2 && 300 == u3);
+  bs >> setVarint() >> i1 >> setVarint() >> i2;
+  CHECK(bs && -1 == i1 && -65 == i2);
+  bs >> setVarint() >> u4 >> setVarint() >> i3;
+  CHECK(bs && 0xffffffff == u4 && (int)0x80000000 == i3);
+  bs >> setVarint() >> u5 >> setVarint() >> i5 >> setVarint() >> i6;
+  CHECK(bs && big == u5 && -1 == i5 && 0 - (int64)big == i6);
+  bs >> i4;
+  CHECK(bs && 5 == i4);
+  std::string str;
+  bs >> setVarint() >> str;
+  CHECK(bs && "hello" == str && len == bs.getByteCount());
+
+  //
+  // Value out of range of 32-bit keeps no change.
+  //
+
+  bs.reset();
+  bs << setVarint() << big;
+  bs.reset();
+  CHECK(!(bs >> setVarint() >> u1) && 0 == bs.getBytePtr() && 0 == bs.getBitPtr());
+
+  //
+  // Max value of read, a longer string fails before allocation.
+  //
+
+  bs.reset();
+  bs << setVarint() << 300u << setVarint() << std::string("hello") << setVarint() << 300u;
+  bs.reset();
+  CHECK(!(bs >> setVarint(299) >> u1) && 0 == bs.getBytePtr());
+  CHECK(bs >> setVarint(300) >> u1 && 300 == u1);
+  int by = bs.getBytePtr();
+  CHECK(!(bs >> setVarint(4) >> str) && str.empty() && by == bs.getBytePtr());
+  CHECK(bs >> setVarint(5) >> str && "hello" == str);
+  CHECK(bs >> setVarint() >> u1 && 300 == u1); // Max is for next read only.
+
+  //
+  // Fixed buffer, write out of range keeps no change.
+  //
+
+  char buff[2];
+  BitStream bs2(buff, sizeof(buff));
+  bs2 << true;
+  CHECK(!(bs2 << setVarint() << 300u) && 0 == bs2.getBytePtr() && 1 == bs2.getBitPtr());
+  CHECK(bs2 << setVarint() << 100u);
+}
+
+TEST(BitStream, int64)
+{
+  const uint64 big = ((uint64)0x89abcdef << 32) | 0x01234567;
+  const double pi = 3.14159265358979;
+
+  std::string s;
+  BitStream bs(s);
+
+  bs << big << (int64)-1 << (0 - (int64)(big >> 1));
+  bs << setBitCount(40) << (big & 0xffffffffff) << setBitCount(20) << (int64)-1000;
+  bs << setBitCount(3) << (uint64)5 << pi << -pi;
+  CHECK(64 * 3 + 40 + 20 + 3 + 64 * 2 == 8 * bs.getBytePtr() + bs.getBitPtr());
+
+  bs.reset();
+
+  uint64 u1, u2, u3;
+  int64 i1, i2, i3;
+  double d1, d2;
+  bs >> u1 >> i1 >> i2;
+  CHECK(bs && big == u1 && -1 == i1 && 0 - (int64)(big >> 1) == i2);
+  bs >> setBitCount(40) >> u2 >> setBitCount(20) >> i3;
+  CHECK(bs && (big & 0xffffffffff) == u2 && -1000 == i3);
+  bs >> setBitCount(3) >> u3 >> d1 >> d2;
+  CHECK(bs && 5 == u3 && pi == d1 && -pi == d2);
+
+  //
+  // Out of range, the string buffer may be bigger than written data.
+  //
+
+  bs.setPtr((int)s.length());
+  CHECK(!(bs >> u1) && !(bs >> i1) && !(bs >> d1));
+}
+
+TEST(BitStream, quantize)
+{
+  std::string s;
+  BitStream bs(s);
+
+  FloatPoint pt(-123.456f, 789.012f);
+  FloatPoint3 pt3(1.5f, -2.25f, 999.9f);
+  float q[4] = {0.1f, -0.7f, 0.5f, 0.4f};   // Normalized below.
+  float len = ::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  for (int i = 0; i < 4; i++) {
+    q[i] /= len;
+  }
+
+  bs << setQuantize(-1000, 1000, 16) << 12.34f;
+  bs << setQuantize(-1000, 1000, 16) << 5000.0f; // Clamped.
+  bs << 3.5f;                           // Quantize is for next float only.
+  bs << setQuantize(-1000, 1000, 20) << pt;
+  bs << setQuantize(-1000, 1000, 12) << pt3;
+  bs << pt;
+  CHECK(bs.writeQuaternion(q));
+  CHECK(16 * 2 + 32 + 20 * 2 + 12 * 3 + 32 * 2 + 2 + 10 * 3 == 8 * bs.getBytePtr() + bs.getBitPtr());
+
+  bs.reset();
+
+  float f1, f2, f3;
+  bs >> setQuantize(-1000, 1000, 16) >> f1 >> setQuantize(-1000, 1000, 16) >> f2 >> f3;
+  CHECK(bs && ::fabs(12.34f - f1) <= 2000.0f / 65535 && 1000.0f == f2 && 3.5f == f3);
+
+  FloatPoint pt2, pt4;
+  FloatPoint3 pt5;
+  bs >> setQuantize(-1000, 1000, 20) >> pt2 >> setQuantize(-1000, 1000, 12) >> pt5 >> pt4;
+  CHECK(bs && ::fabs(pt.x - pt2.x) <= 2000.0f / 0xfffff && ::fabs(pt.y - pt2.y) <= 2000.0f / 0xfffff);
+  CHECK(::fabs(pt3.x - pt5.x) <= 2000.0f / 0xfff && ::fabs(pt3.y - pt5.y) <= 2000.0f / 0xfff && ::fabs(pt3.z - pt5.z) <= 2000.0f / 0xfff);
+  CHECK(pt.x == pt4.x && pt.y == pt4.y);
+
+  //
+  // Largest component is negative, q and -q are same rotation.
+  //
+
+  float q2[4];
+  CHECK(bs.readQuaternion(q2));
+  float dot = q[0] * q2[0] + q[1] * q2[1] + q[2] * q2[2] + q[3] * q2[3];
+  CHECK(0.999f < ::fabs(dot));
+  for (int i = 0; i < 4; i++) {
+    CHECK(::fabs(-q[i] - q2[i]) < 0.002f);
+  }
+
+  //
+  // Fixed buffer, write out of range keeps no change.
+  //
+
+  char buff[8];
+  BitStream bs2(buff, sizeof(buff));
+  bs2 << true;
+  CHECK(!(bs2 << pt3) && 0 == bs2.getBytePtr() && 1 == bs2.getBitPtr());
+  CHECK(!bs2.writeQuaternion(q, 21) && 0 == bs2.getBytePtr() && 1 == bs2.getBitPtr());
+  CHECK(bs2 << setQuantize(0, 1, 21) << pt3);
+  bs2.reset();
+  CHECK(!bs2.readQuaternion(q2, 21) && 0 == bs2.getBytePtr() && 0 == bs2.getBitPtr());
+}
+
 class TestBitPacket : public BitStreamPacket
 {
 public:
@@ -315,4 +706,426 @@ TEST(BitStreamPacket, readwrite)
   h.freePacket(p2);
 }
 
+TEST(BitStreamPacket, cache)
+{
+  BitStreamPacketHandler<4> h;
+  SW2_REGISTER_BITSTREAM_PACKET(h, 1, TestBitPacket);
+  h.setCacheSize(2);
+
+  TestBitPacket p;
+  p.a = 1;
+  p.b = true;
+  p.c = 1.0f;
+  p.e = 2;
+
+  std::string s;
+  BitStream bs(s);
+  h.writePacket(bs, p);
+
+  //
+  // Bounded cache, 3 packets are freed but only 2 are cached.
+  //
+
+  const BitStreamPacket *pp[3];
+  for (int i = 0; i < 3; i++) {
+    bs.reset();
+    CHECK(h.readPacket(bs, &pp[i]));
+  }
+  CHECK(0 == h.getCacheHit() && 3 == h.getCacheMiss());
+  for (int i = 0; i < 3; i++) {
+    CHECK(h.freePacket(pp[i]));
+  }
+  for (int i = 0; i < 3; i++) {
+    bs.reset();
+    CHECK(h.readPacket(bs, &pp[i]));
+  }
+  CHECK(2 == h.getCacheHit() && 4 == h.getCacheMiss());
+  for (int i = 0; i < 3; i++) {
+    CHECK(h.freePacket(pp[i]));
+  }
+}
+
+//
+// Decode packets on multiple threads with magazines.
+//
+
+class TestPacketDecoder : public ThreadTask
+{
+public:
+  BitStreamPacketHandler<4> *mHandler;
+  std::string mStream;
+  int mCount, mDecoded;
+
+  virtual void threadTask()
+  {
+    BitStreamPacketHandler<4>::Magazine mag(*mHandler);
+    BitStream bs(mStream);
+    const BitStreamPacket *pp[20];
+    for (int i = 0; i < mCount; i++) {
+      for (int j = 0; j < 20; j++) {
+        bs.reset();
+        if (mHandler->readPacket(bs, &pp[j], mag)) {
+          mDecoded += 1;
+        }
+      }
+      for (int j = 0; j < 20; j++) {
+        mHandler->freePacket(pp[j], mag);
+      }
+    }
+  }
+};
+
+TEST(BitStreamPacket, magazine)
+{
+  const int n = 4;
+  CHECK(InitializeThreadPool(n));
+
+  {
+    BitStreamPacketHandler<4> h;
+    SW2_REGISTER_BITSTREAM_PACKET(h, 1, TestBitPacket);
+    h.setThreadSafe(true);
+
+    TestBitPacket p;
+    p.a = 1;
+    p.b = true;
+    p.c = 1.0f;
+    p.e = 2;
+
+    TestPacketDecoder test[n];
+    std::vector<ThreadTask*> v;
+    for (int i = 0; i < n; i++) {
+      TestPacketDecoder &t = test[i];
+      t.mHandler = &h;
+      BitStream bs(t.mStream);
+      h.writePacket(bs, p);
+      t.mCount = 500;
+      t.mDecoded = 0;
+      v.push_back(&t);
+    }
+    ThreadTaskPipe().run(v);
+
+    //
+    // All counts are added after magazines are released, most are hits.
+    //
+
+    for (int i = 0; i < n; i++) {
+      CHECK(500 * 20 == test[i].mDecoded);
+    }
+    CHECK(n * 500 * 20 == h.getCacheHit() + h.getCacheMiss());
+    CHECK(h.getCacheMiss() <= n * 20 * 2);
+  }
+
+  UninitializeThreadPool();
+}
+
+class TestDeltaPacket : public BitStreamPacket
+{
+public:
+  SW2_DECLARE_BITSTREAM_PACKET(2, TestDeltaPacket)
+  uint id;
+  FloatPoint3 pos;
+  int hp;
+  std::string name;
+  virtual bool read(BitStream &bs)
+  {
+    for (int i = 0; i < getFieldCount(); i++) {
+      if (!readField(bs, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  virtual bool write(BitStream &bs) const
+  {
+    for (int i = 0; i < getFieldCount(); i++) {
+      if (!writeField(bs, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  virtual int getFieldCount() const
+  {
+    return 4;
+  }
+  virtual bool readField(BitStream &bs, int index)
+  {
+    switch (index)
+    {
+    case 0:
+      return bs >> setBitCount(10) >> id;
+    case 1:
+      return bs >> setQuantize(-100, 100, 16) >> pos;
+    case 2:
+      return bs >> setVarint() >> hp;
+    case 3:
+      return bs >> name;
+    }
+    return false;
+  }
+  virtual bool writeField(BitStream &bs, int index) const
+  {
+    switch (index)
+    {
+    case 0:
+      return bs << setBitCount(10) << id;
+    case 1:
+      return bs << setQuantize(-100, 100, 16) << pos;
+    case 2:
+      return bs << setVarint() << hp;
+    case 3:
+      return bs << name;
+    }
+    return false;
+  }
+};
+
+TEST(BitStreamPacket, delta)
+{
+  BitStreamPacketBaseline<8> sender(&TestDeltaPacket::staticCreatePacket);
+  BitStreamPacketBaseline<8> receiver(&TestDeltaPacket::staticCreatePacket);
+
+  TestDeltaPacket p, p2;
+  p.id = 7;
+  p.pos = FloatPoint3(1.5f, -2.5f, 30);
+  p.hp = 100;
+  p.name = "Hello baseline";
+
+  //
+  // No acked baseline, full encode.
+  //
+
+  std::string s;
+  BitStream bs(s);
+  CHECK(sender.writePacket(bs, 1, p));
+  int full = bs.getByteCount();
+  bs.reset();
+  CHECK(receiver.readPacket(bs, 1, p2));
+  CHECK(7 == p2.id && 0.01f > ::fabs(-2.5f - p2.pos.y) && 100 == p2.hp && p.name == p2.name);
+  sender.ack(1);
+
+  //
+  // Only changed field is sent.
+  //
+
+  p.hp = 90;
+  bs.reset();
+  CHECK(sender.writePacket(bs, 2, p));
+  CHECK(full > 4 * bs.getByteCount());
+  bs.reset();
+  CHECK(receiver.readPacket(bs, 2, p2));
+  CHECK(7 == p2.id && 0.01f > ::fabs(-2.5f - p2.pos.y) && 90 == p2.hp && p.name == p2.name);
+
+  //
+  // Seq 2 is not acked, still use baseline 1.
+  //
+
+  p.name = "Changed";
+  bs.reset();
+  CHECK(sender.writePacket(bs, 3, p));
+  bs.reset();
+  CHECK(receiver.readPacket(bs, 3, p2));
+  CHECK(90 == p2.hp && "Changed" == p2.name);
+
+  //
+  // Receiver lost baseline, fail to decode.
+  //
+
+  BitStreamPacketBaseline<8> receiver2(&TestDeltaPacket::staticCreatePacket);
+  bs.reset();
+  CHECK(!receiver2.readPacket(bs, 3, p2));
+
+  //
+  // Acked baseline is too old, fallback to full encode.
+  //
+
+  bs.reset();
+  CHECK(sender.writePacket(bs, 9, p));
+  CHECK(full < bs.getByteCount() + 8);
+  bs.reset();
+  CHECK(receiver2.readPacket(bs, 9, p2));
+  CHECK(7 == p2.id && 90 == p2.hp && "Changed" == p2.name);
+}
+
+class TestSchemaPacket : public BitStreamPacket
+{
+public:
+  SW2_DECLARE_BITSTREAM_PACKET(3, TestSchemaPacket)
+  uint id;
+  int hp;
+  bool bAlive;
+  float speed;
+  std::string name;
+  typedef BitStreamSchema<
+    BitStreamUIntField<TestSchemaPacket, uint, &TestSchemaPacket::id, 999>,
+    BitStreamIntField<TestSchemaPacket, &TestSchemaPacket::hp, 12>,
+    BitStreamBoolField<TestSchemaPacket, &TestSchemaPacket::bAlive>,
+    BitStreamFloatField<TestSchemaPacket, &TestSchemaPacket::speed>,
+    BitStreamStringField<TestSchemaPacket, &TestSchemaPacket::name, 12> > Schema;
+  SW2_DECLARE_BITSTREAM_SCHEMA(Schema)
+};
+
+TEST(BitStreamPacket, schema)
+{
+  CHECK(10 + 12 + 1 + 32 + 4 + 8 * 12 == TestSchemaPacket::MAX_BITS);
+
+  TestSchemaPacket p, p2;
+  p.id = 999;
+  p.hp = -100;
+  p.bAlive = true;
+  p.speed = 1.5f;
+  p.name = "Hello";
+  CHECK(5 == p.getFieldCount());
+
+  char buff[(TestSchemaPacket::MAX_BITS + 7) / 8];
+  BitStream bs(buff, sizeof(buff));
+  CHECK(p.write(bs));
+  bs.reset();
+  CHECK(p2.read(bs));
+  CHECK(999 == p2.id && -100 == p2.hp && p2.bAlive && 1.5f == p2.speed && p.name == p2.name);
+
+  //
+  // Max size fits the presized buffer.
+  //
+
+  p.name.assign(12, 'x');
+  bs.reset();
+  CHECK(p.write(bs));
+
+  //
+  // Field out of range, read fails.
+  //
+
+  bs.reset();
+  bs << setBitCount(10) << 1000u;
+  bs.reset();
+  CHECK(!p2.read(bs));
+
+  std::string s(32, 'x');                // String too long.
+  BitStream bs2(s);
+  bs2 << setBitCount(10) << 1u << setBitCount(12) << 1 << true << 1.0f << setBitCount(4) << 13u;
+  bs2.reset();
+  CHECK(!p2.read(bs2) && 1 == p2.id);
+
+  //
+  // Fields for delta encoding.
+  //
+
+  bs.reset();
+  CHECK(p.writeField(bs, 1) && !p.writeField(bs, 5));
+  bs.reset();
+  p2.hp = 0;
+  CHECK(p2.readField(bs, 1) && -100 == p2.hp);
+}
+
+class TestDispatchHandler
+{
+public:
+  std::vector<int> mIds;
+  int mStopAt;
+
+  TestDispatchHandler() : mStopAt(-1)
+  {
+  }
+
+  bool onBitPacket(int arg, TestBitPacket &p)
+  {
+    mIds.push_back(arg * 100 + (int)p.a);
+    return mStopAt != (int)p.a;
+  }
+
+  bool onSchemaPacket(int arg, TestSchemaPacket &p)
+  {
+    mIds.push_back(arg * 100 + (int)p.id);
+    return true;
+  }
+
+  bool onUnknown(int arg, BitStreamPacket &p)
+  {
+    mIds.push_back(-p.getId());
+    return true;
+  }
+};
+
+TEST(BitStreamPacket, dispatch)
+{
+  BitStreamPacketHandler<4> h;
+  SW2_REGISTER_BITSTREAM_PACKET(h, 1, TestBitPacket);
+  SW2_REGISTER_BITSTREAM_PACKET(h, 2, TestDeltaPacket);
+
+  TestDispatchHandler t;
+  BitStreamPacketDispatcher<4, TestDispatchHandler, int> d(h, t);
+  CHECK((d.registerHandler<TestBitPacket, &TestDispatchHandler::onBitPacket>()));
+  CHECK((d.registerHandler<TestSchemaPacket, &TestDispatchHandler::onSchemaPacket>()));
+
+  TestBitPacket p;
+  p.b = true;
+  p.c = 1.0f;
+  p.d = "dispatch";
+  p.e = 2;
+  TestSchemaPacket p2;
+  p2.id = 7;
+  p2.hp = 1;
+  p2.bAlive = true;
+  p2.speed = 0;
+  TestDeltaPacket p3;
+  p3.id = 1;
+  p3.hp = 1;
+
+  std::string s;
+  BitStream bs(s);
+  p.a = 1;
+  CHECK(h.writePacket(bs, p));
+  CHECK(h.writePacket(bs, p2));
+  p.a = 2;
+  CHECK(h.writePacket(bs, p));
+  CHECK(h.writePacket(bs, p3));
+  p.a = 3;
+  CHECK(h.writePacket(bs, p));
+  int end = bs.getBytePtr(), endBit = bs.getBitPtr();
+
+  //
+  // Stop at packet without handler.
+  //
+
+  bs.reset();
+  CHECK(3 == d.dispatch(bs, 5));
+  CHECK(3 == (int)t.mIds.size() && 501 == t.mIds[0] && 507 == t.mIds[1] && 502 == t.mIds[2]);
+  int pos = bs.getBytePtr(), posBit = bs.getBitPtr();
+  CHECK(0 == d.dispatch(bs, 5));
+  CHECK(pos == bs.getBytePtr() && posBit == bs.getBitPtr());
+
+  //
+  // Default handler, decoded by packet handler.
+  //
+
+  d.setDefaultHandler(&TestDispatchHandler::onUnknown);
+  t.mIds.clear();
+  bs.reset();
+  CHECK(5 == d.dispatch(bs, 1));
+  CHECK(5 == (int)t.mIds.size() && -2 == t.mIds[3] && 103 == t.mIds[4]);
+  CHECK(end == bs.getBytePtr() && endBit == bs.getBitPtr());
+
+  //
+  // Handler stops dispatching.
+  //
+
+  t.mStopAt = 2;
+  t.mIds.clear();
+  bs.reset();
+  CHECK(3 == d.dispatch(bs, 1));
+  CHECK(3 == (int)t.mIds.size() && 102 == t.mIds[2]);
+
+  //
+  // Invalid packet.
+  //
+
+  char buff[1];                         // Truncated packet.
+  BitStream bs2(buff, sizeof(buff));
+  CHECK(bs2 << setBitCount(2) << 1u);
+  bs2.reset();
+  CHECK(0 == d.dispatch(bs2, 1));
+  CHECK(0 == bs2.getBytePtr() && 0 == bs2.getBitPtr());
+}
+
 // end of TestBitStream.cpp
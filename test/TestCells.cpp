@@ -13,6 +13,7 @@
 #include "CppUnitLite/TestHarness.h"
 
 #include "swCells.h"
+#include "swThreadPool.h"
 #include "swUtil.h"
 using namespace sw2;
 
@@ -323,4 +324,179 @@ TEST(Cells, search2_2)
   }
 }
 
+//
+// Batch move is the same as move one by one.
+//
+
+template<typename ValueT>
+static bool testMoveBatch(ValueT cellw)
+{
+  const int N = 200;
+
+  Cells<int,ValueT> grid1, grid2;
+  grid1.init(-100, -100, cellw, cellw, 30, 30); // Cell size is not power of 2.
+  grid2.init(-100, -100, cellw, cellw, 30, 30);
+
+  std::vector<int> ids;
+  for (int i = 0; i < N; ++i) {
+    ValueT x = (ValueT)Util::rangeRand<int>(-100, 100), y = (ValueT)Util::rangeRand<int>(-100, 100);
+    ids.push_back(grid1.alloc(i, x, y));
+    if (ids[i] != grid2.alloc(i, x, y)) {
+      return false;
+    }
+  }
+  grid1.free(ids[3]);
+  grid2.free(ids[3]);
+  ids.push_back(-1);                    // Invalid IDs.
+  ids.push_back(N + 10);
+
+  std::vector<ValueT> xs(ids.size()), ys(ids.size());
+  for (int n = 0; n < 10; ++n) {
+
+    //
+    // Move one by one, half are on cell boundary.
+    //
+
+    int moved = 0;
+    for (size_t i = 0; i < ids.size(); ++i) {
+      if (0 == i % 2) {
+        xs[i] = (ValueT)(-100 + cellw * Util::rangeRand<int>(0, 30));
+        ys[i] = (ValueT)(-100 + cellw * Util::rangeRand<int>(0, 30));
+      } else {
+        xs[i] = (ValueT)Util::rangeRand<int>(-110, 110);
+        ys[i] = (ValueT)Util::rangeRand<int>(-110, 110);
+      }
+      if (grid1.move(ids[i], xs[i], ys[i])) {
+        moved += 1;
+      }
+    }
+
+    if (moved != grid2.moveBatch(&ids[0], &xs[0], &ys[0], (int)ids.size())) {
+      return false;
+    }
+
+    for (int i = 0; i < N; ++i) {
+      int id = ids[i];
+      if (3 == i) {
+        continue;
+      }
+      if (grid1.objcell[id] != grid2.objcell[id] || grid1.objx[id] != grid2.objx[id] || grid1.objy[id] != grid2.objy[id]) {
+        return false;
+      }
+    }
+
+    TestCellsFilter<ValueT> f1, f2;
+    grid1.search(-30, -40, 50, 60, N, f1);
+    grid2.search(-30, -40, 50, 60, N, f2);
+    std::sort(f1.v.begin(), f1.v.end());
+    std::sort(f2.v.begin(), f2.v.end());
+    if (f1.v.empty() || f1.v != f2.v) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+TEST(Cells, moveBatch)
+{
+  CHECK(testMoveBatch<int>(7));
+  CHECK(testMoveBatch<float>(7.0f));
+}
+
+//
+// Test batch search, same result of search one by one.
+//
+
+static bool testQueryBatch(int nThread)
+{
+  const int N = 500;
+
+  typedef Cells<int,float> CellsT;
+  CellsT grid;
+  grid.init(-100, -100, 10, 10, 20, 20);
+  for (int i = 0; i < N; ++i) {
+    grid.alloc(i, (float)Util::rangeRand<int>(-100, 99), (float)Util::rangeRand<int>(-100, 99));
+  }
+
+  CellsQueryBatch<CellsT> batch;
+  std::vector<TestCellsFilter<float> > f(100);
+  for (int n = 0; n < 2; ++n) {         // Reuse the batch.
+    batch.clear();
+    for (int i = 0; i < (int)f.size(); ++i) {
+      float x = (float)Util::rangeRand<int>(-120, 120), y = (float)Util::rangeRand<int>(-120, 120);
+      uint nMax = (uint)Util::rangeRand<int>(0, 40);
+      f[i].v.clear();
+      if (0 == i % 2) {
+        grid.search(x, y, 30.0f, nMax, f[i]);
+        batch.addSearch(x, y, 30.0f, nMax);
+      } else {
+        grid.search(x, y, x + 20, y + 50, nMax, f[i]);
+        batch.addSearch(x, y, x + 20, y + 50, nMax);
+      }
+    }
+
+    batch.run(grid, nThread);
+
+    if ((int)f.size() != batch.size()) {
+      return false;
+    }
+    for (int i = 0; i < (int)f.size(); ++i) {
+      int const* p = batch.getResult(i);
+      if ((int)f[i].v.size() != batch.getCount(i) || !std::equal(f[i].v.begin(), f[i].v.end(), p)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+//
+// Test batch search with huge max count, result buffer is bounded by number
+// of objects.
+//
+
+static bool testQueryBatchMax()
+{
+  typedef Cells<int,float> CellsT;
+  CellsT grid;
+  grid.init(-100, -100, 10, 10, 20, 20);
+  for (int i = 0; i < 10; ++i) {
+    grid.alloc(i, (float)(10 * i - 50), 0.0f);
+  }
+
+  CellsQueryBatch<CellsT> batch;
+  batch.addSearch(0.0f, 0.0f, 200.0f, 0xffffffff);
+  batch.addSearch(-100.0f, -100.0f, 100.0f, 100.0f, 0xffffffff);
+  batch.addSearch(0.0f, 0.0f, 200.0f, 3);
+  batch.run(grid, 0);
+
+  if (10 != batch.getCount(0) || 10 != batch.getCount(1) || 3 != batch.getCount(2)) {
+    return false;
+  }
+
+  std::vector<int> v(batch.getResult(1), batch.getResult(1) + 10);
+  std::sort(v.begin(), v.end());
+  for (int i = 0; i < 10; ++i) {
+    if (i != v[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+TEST(Cells, queryBatch)
+{
+  CHECK(testQueryBatch(4));             // ThreadPool not initialized.
+  CHECK(testQueryBatchMax());
+
+  CHECK(InitializeThreadPool(4));
+  CHECK(testQueryBatch(0));
+  CHECK(testQueryBatch(1));
+  CHECK(testQueryBatch(4));
+  UninitializeThreadPool();
+}
+
 // end of TestCells.cpp
@@ -0,0 +1,1112 @@
+
+//
+//  Network unit test.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "CppUnitLite/TestHarness.h"
+
+#include "swIni.h"
+#include "swNetwork.h"
+#include "swSocket.h"
+#include "swThreadPool.h"
+#include "swUtil.h"
+using namespace sw2;
+
+class TestNetworkClient : public NetworkClientCallback
+{
+public:
+
+  NetworkClient* mClient;
+
+  std::vector<std::string> mData;
+
+  bool mReady;
+
+  TestNetworkClient() : mReady(false)
+  {
+    mClient = NetworkClient::alloc(this);
+  }
+
+  virtual ~TestNetworkClient()
+  {
+    NetworkClient::free(mClient);
+  }
+
+  virtual void onNetworkServerReady(NetworkClient*)
+  {
+    mReady = true;
+  }
+
+  virtual void onNetworkServerLeave(NetworkClient*)
+  {
+    mReady = false;
+  }
+
+  virtual void onNetworkStreamReady(NetworkClient*, int len, void const* pStream)
+  {
+    mData.push_back(std::string((char const*)pStream, len));
+  }
+};
+
+class TestNetworkServer : public NetworkServerCallback
+{
+public:
+
+  NetworkServer* mServer;
+
+  std::vector<std::string> mData;
+
+  int mOnline;
+
+  TestNetworkServer() : mOnline(0)
+  {
+    mServer = NetworkServer::alloc(this);
+  }
+
+  virtual ~TestNetworkServer()
+  {
+    NetworkServer::free(mServer);
+  }
+
+  virtual bool onNetworkNewClientReady(NetworkServer*, NetworkConnection*)
+  {
+    mOnline += 1;
+    return true;
+  }
+
+  virtual void onNetworkClientLeave(NetworkServer*, NetworkConnection*)
+  {
+    mOnline -= 1;
+  }
+
+  virtual void onNetworkStreamReady(NetworkServer*, NetworkConnection* pClient, int len, void const* pStream)
+  {
+    mData.push_back(std::string((char const*)pStream, len));
+    pClient->send(len, pStream);        // Echo.
+  }
+};
+
+//
+// TCP relay between clients and server, drops all connections to simulate
+// network failure.
+//
+
+class TestNetworkRelay : public SocketServerCallback, public SocketClientCallback
+{
+public:
+
+  SocketServer* mServer;
+  std::string mAddrServer;
+
+  std::vector<SocketClient*> mUpstream; // All upstream clients.
+  std::map<SocketConnection*, SocketClient*> mConn;
+  std::map<SocketClient*, SocketConnection*> mClient;
+  std::map<SocketClient*, std::string> mPending; // Data wait upstream connected.
+
+  TestNetworkRelay()
+  {
+    mServer = SocketServer::alloc(this);
+  }
+
+  virtual ~TestNetworkRelay()
+  {
+    SocketServer::free(mServer);
+    for (size_t i = 0; i < mUpstream.size(); i++) {
+      SocketClient::free(mUpstream[i]);
+    }
+  }
+
+  bool startup(std::string const& addr, std::string const& addrServer)
+  {
+    mAddrServer = addrServer;
+    return mServer->startup(addr);
+  }
+
+  void drop()
+  {
+    for (std::map<SocketConnection*, SocketClient*>::iterator it = mConn.begin(); mConn.end() != it; ++it) {
+      it->first->disconnect();
+      it->second->disconnect();
+    }
+    mConn.clear();
+    mClient.clear();
+  }
+
+  void trigger()
+  {
+    mServer->trigger();
+    for (size_t i = 0; i < mUpstream.size(); i++) {
+      mUpstream[i]->trigger();
+    }
+  }
+
+  virtual bool onSocketNewClientReady(SocketServer*, SocketConnection* pNewClient)
+  {
+    SocketClient* pClient = SocketClient::alloc(this);
+    mUpstream.push_back(pClient);
+    mConn[pNewClient] = pClient;
+    mClient[pClient] = pNewClient;
+    return pClient->connect(mAddrServer);
+  }
+
+  virtual void onSocketClientLeave(SocketServer*, SocketConnection* pClient)
+  {
+    if (mConn.end() != mConn.find(pClient)) {
+      mClient.erase(mConn[pClient]);
+      mConn[pClient]->disconnect();
+      mConn.erase(pClient);
+    }
+  }
+
+  virtual void onSocketStreamReady(SocketServer*, SocketConnection* pClient, int len, void const* pStream)
+  {
+    if (mConn.end() == mConn.find(pClient)) {
+      return;
+    }
+    SocketClient* pUpstream = mConn[pClient];
+    if (CS_CONNECTED == pUpstream->getConnectionState()) {
+      pUpstream->send(len, pStream);
+    } else {
+      mPending[pUpstream].append((char const*)pStream, len);
+    }
+  }
+
+  virtual void onSocketServerReady(SocketClient* pClient)
+  {
+    std::string &s = mPending[pClient];
+    if (!s.empty()) {
+      pClient->send((int)s.length(), s.data());
+    }
+    mPending.erase(pClient);
+  }
+
+  virtual void onSocketServerLeave(SocketClient* pClient)
+  {
+    if (mClient.end() != mClient.find(pClient)) {
+      mConn.erase(mClient[pClient]);
+      mClient[pClient]->disconnect();
+      mClient.erase(pClient);
+    }
+  }
+
+  virtual void onSocketStreamReady(SocketClient* pClient, int len, void const* pStream)
+  {
+    if (mClient.end() != mClient.find(pClient)) {
+      mClient[pClient]->send(len, pStream);
+    }
+  }
+};
+
+static bool connectNetwork(TestNetworkServer &s, TestNetworkClient &c, std::string const& addr)
+{
+  if (!s.mServer->startup(addr) || !c.mClient->connect(addr)) {
+    return false;
+  }
+
+  sw2::TimeoutTimer lt(5000);
+  while (!lt.isExpired() && (0 == s.mOnline || !c.mReady)) {
+    s.mServer->trigger();
+    c.mClient->trigger();
+  }
+
+  return 1 == s.mOnline && c.mReady;
+}
+
+static void disconnectNetwork(TestNetworkServer &s, TestNetworkClient &c)
+{
+  c.mClient->disconnect();
+  s.mServer->shutdown();
+
+  sw2::TimeoutTimer lt(5000);
+  while (!lt.isExpired() && (0 != s.mOnline || CS_DISCONNECTED != c.mClient->getConnectionState())) {
+    s.mServer->trigger();
+    c.mClient->trigger();
+  }
+}
+
+static std::string getTestStream(int i)
+{
+  std::string s(1 + (i * 7) % 48, 'a' + i % 26);
+  if (0 == i % 10) {
+    s.append(1000, 'z');                // Bigger than a batched stream.
+  }
+  return s;
+}
+
+//
+// Test send/recv data streams.
+//
+
+TEST(Network, sendrecv)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkServer s;
+    TestNetworkClient c;
+    CHECK(connectNetwork(s, c, "127.0.0.1:2346"));
+
+    const int COUNT = 100;
+    for (int i = 0; i < COUNT; i++) {
+      std::string str = getTestStream(i);
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+    }
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    CHECK(COUNT == (int)s.mData.size() && COUNT == (int)c.mData.size());
+    for (int i = 0; i < COUNT && i < (int)c.mData.size(); i++) {
+      CHECK(getTestStream(i) == s.mData[i] && getTestStream(i) == c.mData[i]);
+    }
+
+    disconnectNetwork(s, c);
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test batch mode.
+//
+
+TEST(Network, batch)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkServer s;
+    TestNetworkClient c;
+    CHECK(connectNetwork(s, c, "127.0.0.1:2347"));
+
+    s.mServer->setBatchWindow(0);
+    c.mClient->setBatchWindow(1000);
+
+    //
+    // Batch stream is sent only after protocol version of peer is received.
+    //
+
+    sw2::TimeoutTimer lt(100);
+    while (!lt.isExpired()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    const int COUNT = 100;
+    for (int i = 0; i < COUNT; i++) {
+      std::string str = getTestStream(i);
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+    }
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    //
+    // Streams are received in order, and less packets are sent.
+    //
+
+    CHECK(COUNT == (int)s.mData.size() && COUNT == (int)c.mData.size());
+    for (int i = 0; i < COUNT && i < (int)c.mData.size(); i++) {
+      CHECK(getTestStream(i) == s.mData[i] && getTestStream(i) == c.mData[i]);
+    }
+
+    CHECK(COUNT > (int)c.mClient->getNetStats().packetsSent);
+    CHECK(COUNT > (int)s.mServer->getNetStats().packetsSent);
+
+    disconnectNetwork(s, c);
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test histograms.
+//
+
+TEST(Network, histogram)
+{
+  //
+  // Log-linear buckets.
+  //
+
+  for (uint v = 0; v < 100000; v += 1 + v / 16) {
+    int i = NetworkHistogram::getBucket(v);
+    CHECK(NetworkHistogram::getBucketMin(i) <= v && v < NetworkHistogram::getBucketMin(i + 1));
+  }
+  CHECK(NetworkHistogram::NUM_BUCKET - 1 == NetworkHistogram::getBucket(0xffffffff));
+
+  NetworkHistogram h;
+  h.reset();
+  for (uint v = 1; v <= 1000; v++) {
+    h.add(v);
+  }
+  CHECK(1000 == h.count && 1 == h.min && 1000 == h.max);
+  CHECK(500 <= h.getPercentile(50) && 500 * 1.25 > h.getPercentile(50));
+  CHECK(1000 == h.getPercentile(100));
+
+  //
+  // Recorded by network.
+  //
+
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkServer s;
+    TestNetworkClient c;
+    CHECK(connectNetwork(s, c, "127.0.0.1:2351"));
+
+    s.mServer->resetHistStats();
+    c.mClient->resetHistStats();
+
+    const int COUNT = 100;
+    for (int i = 0; i < COUNT; i++) {
+      std::string str = getTestStream(i);
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+    }
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    NetworkHistStats hs = s.mServer->getHistStats();
+    CHECK(COUNT == hs.msgSizeIn.count && COUNT == hs.msgSizeOut.count);
+    CHECK(COUNT == hs.callbackTime.count && 0 < hs.triggerTime.count);
+    CHECK(1 == hs.msgSizeIn.min && 1045 == hs.msgSizeIn.max);
+
+    NetworkHistStats hc = c.mClient->getHistStats();
+    CHECK(COUNT == hc.msgSizeIn.count && COUNT == hc.msgSizeOut.count);
+    CHECK(hs.msgSizeIn.sum == hc.msgSizeOut.sum);
+
+    Ini ini;
+    hs.storeToIni(ini);
+    CHECK(COUNT == (int)ini["MsgSizeIn"]["Count"] && 1045 == (int)ini["MsgSizeIn"]["Max"]);
+
+    std::string json;
+    hs.storeToJson(json);
+    CHECK(std::string::npos != json.find("\"msgSizeIn\":{\"count\":100,"));
+
+    disconnectNetwork(s, c);
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test RTT measured by keep alive ping.
+//
+
+TEST(Network, rtt)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkServer s;
+    TestNetworkClient c;
+    CHECK(connectNetwork(s, c, "127.0.0.1:2352"));
+
+    CHECK(0 == c.mClient->getNetStats().rtt);
+
+    sw2::TimeoutTimer lt(3000);         // First ping is sent in 1 second.
+    while (!lt.isExpired() && (0 == c.mClient->getNetStats().rtt || 0 == s.mServer->getFirstConnection()->getNetStats().rtt)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    NetworkClientStats cs = c.mClient->getNetStats();
+    CHECK(0 < cs.rtt && 1000000 > cs.rtt);
+
+    NetworkClientStats ss = s.mServer->getFirstConnection()->getNetStats();
+    CHECK(0 < ss.rtt && 1000000 > ss.rtt);
+
+    disconnectNetwork(s, c);
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test lean mode, idle connection holds no buffer.
+//
+
+TEST(Network, lean)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkServer s;
+    TestNetworkClient c;
+    s.mServer->setLeanMode(true);
+    CHECK(connectNetwork(s, c, "127.0.0.1:2349"));
+
+    const int COUNT = 20;
+    for (int i = 0; i < COUNT; i++) {
+      std::string str = getTestStream(i) + std::string(3000, 'x');
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+    }
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    CHECK(COUNT == (int)s.mData.size() && COUNT == (int)c.mData.size());
+    for (int i = 0; i < COUNT && i < (int)c.mData.size(); i++) {
+      CHECK(getTestStream(i) + std::string(3000, 'x') == c.mData[i]);
+    }
+
+    for (int i = 0; i < 10; i++) {
+      s.mServer->trigger();
+    }
+
+    NetworkConnection* pConn = s.mServer->getFirstConnection();
+    CHECK(0 != pConn && 1024 > pConn->getNetStats().bytesMem);
+
+    disconnectNetwork(s, c);
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test pipeline mode, streams are handled in worker threads and in order.
+//
+
+class TestPipelineServer : public TestNetworkServer
+{
+public:
+
+  long volatile mRecv;
+
+  TestPipelineServer() : mRecv(0)
+  {
+  }
+
+  virtual void onNetworkStreamReady(NetworkServer*, NetworkConnection* pClient, int len, void const* pStream)
+  {
+    Util::atomicIncrement(&mRecv);
+    pClient->send(len, pStream);        // Echo in worker thread.
+  }
+};
+
+TEST(Network, pipeline)
+{
+  CHECK(InitializeNetwork());
+  CHECK(InitializeThreadPool(4));
+
+  {
+    TestPipelineServer s;
+    s.mServer->setPipeline(true);
+    CHECK(s.mServer->startup("127.0.0.1:2350"));
+
+    const int NUM_CLIENT = 4;
+    std::vector<TestNetworkClient*> c;
+    for (int i = 0; i < NUM_CLIENT; i++) {
+      c.push_back(new TestNetworkClient);
+      CHECK(c[i]->mClient->connect("127.0.0.1:2350"));
+    }
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && NUM_CLIENT != s.mOnline) {
+      s.mServer->trigger();
+      for (int i = 0; i < NUM_CLIENT; i++) {
+        c[i]->mClient->trigger();
+      }
+    }
+
+    CHECK(NUM_CLIENT == s.mOnline);
+
+    const int COUNT = 100;
+    for (int j = 0; j < COUNT; j++) {
+      std::string str = getTestStream(j);
+      for (int i = 0; i < NUM_CLIENT; i++) {
+        CHECK(c[i]->mClient->send((int)str.length(), str.data()));
+      }
+    }
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired()) {
+      s.mServer->trigger();
+      int n = 0;
+      for (int i = 0; i < NUM_CLIENT; i++) {
+        c[i]->mClient->trigger();
+        n += (int)c[i]->mData.size();
+      }
+      if (NUM_CLIENT * COUNT == n) {
+        break;
+      }
+    }
+
+    CHECK(NUM_CLIENT * COUNT == s.mRecv);
+
+    //
+    // Histograms of worker threads are merged when read.
+    //
+
+    lt.setTimeout(1000);
+    while (!lt.isExpired() && NUM_CLIENT * COUNT != (int)s.mServer->getHistStats().callbackTime.count) {
+      s.mServer->trigger();
+    }
+
+    NetworkHistStats hs = s.mServer->getHistStats();
+    CHECK(NUM_CLIENT * COUNT == (int)hs.msgSizeIn.count && NUM_CLIENT * COUNT == (int)hs.callbackTime.count);
+    CHECK(1 == hs.msgSizeIn.min && 1045 == hs.msgSizeIn.max);
+
+    for (int i = 0; i < NUM_CLIENT; i++) {
+      CHECK(COUNT == (int)c[i]->mData.size());
+      for (int j = 0; j < COUNT && j < (int)c[i]->mData.size(); j++) {
+        CHECK(getTestStream(j) == c[i]->mData[j]);
+      }
+    }
+
+    for (int i = 0; i < NUM_CLIENT; i++) {
+      c[i]->mClient->disconnect();
+    }
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && 0 != s.mOnline) {
+      s.mServer->trigger();
+      for (int i = 0; i < NUM_CLIENT; i++) {
+        c[i]->mClient->trigger();
+      }
+    }
+
+    for (int i = 0; i < NUM_CLIENT; i++) {
+      delete c[i];
+    }
+  }
+
+  UninitializeThreadPool();
+  UninitializeNetwork();
+}
+
+//
+// Test pipeline mode, a client leaves while its stream is handled by a slow
+// callback. The reactor is not blocked, the connection is released after the
+// callback is done. RTT is measured by reactor.
+//
+
+class TestSlowPipelineServer : public TestNetworkServer
+{
+public:
+
+  long volatile mBusy, mDone;
+  bool mLeaveAfterDone;
+
+  TestSlowPipelineServer() : mBusy(0), mDone(0), mLeaveAfterDone(false)
+  {
+  }
+
+  virtual void onNetworkClientLeave(NetworkServer* pServer, NetworkConnection* pClient)
+  {
+    mLeaveAfterDone = 1 == mDone;
+    TestNetworkServer::onNetworkClientLeave(pServer, pClient);
+  }
+
+  virtual void onNetworkStreamReady(NetworkServer*, NetworkConnection*, int, void const*)
+  {
+    Util::atomicIncrement(&mBusy);
+    Util::sleep(500);
+    Util::atomicIncrement(&mDone);
+  }
+};
+
+TEST(Network, pipelineLeave)
+{
+  CHECK(InitializeNetwork());
+  CHECK(InitializeThreadPool(4));
+
+  {
+    TestSlowPipelineServer s;
+    TestNetworkClient c;
+    s.mServer->setPipeline(true);
+    CHECK(connectNetwork(s, c, "127.0.0.1:2355"));
+
+    NetworkConnection* pConn = s.mServer->getFirstConnection();
+    CHECK(0 != pConn);
+
+    sw2::TimeoutTimer lt(3000);         // First ping is sent in 1 second.
+    while (pConn && !lt.isExpired() && 0 == pConn->getNetStats().rtt) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    CHECK(pConn && 0 < pConn->getNetStats().rtt);
+
+    std::string str = getTestStream(0);
+    CHECK(c.mClient->send((int)str.length(), str.data()));
+
+    lt.setTimeout(3000);
+    while (!lt.isExpired() && 0 == s.mBusy) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    c.mClient->disconnect();
+
+    uint64 worst = 0;
+    lt.setTimeout(3000);
+    while (!lt.isExpired() && 0 != s.mOnline) {
+      uint64 t = Util::getTickCountUs();
+      s.mServer->trigger();
+      worst = (std::max)(worst, Util::getTickCountUs() - t);
+      c.mClient->trigger();
+    }
+
+    CHECK(0 == s.mOnline && s.mLeaveAfterDone);
+    CHECK(250000 > worst);
+  }
+
+  UninitializeThreadPool();
+  UninitializeNetwork();
+}
+
+//
+// Test startup with configuration, connection pool grows and max client limit.
+//
+
+TEST(Network, maxclient)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    const int MAX_CLIENT = 100;         // Bigger than initial pool size.
+
+    Ini conf;
+    conf["AddrListen"] = "127.0.0.1:2348";
+    conf["MaxClient"] = MAX_CLIENT;
+    conf["InitClient"] = 8;
+
+    TestNetworkServer s;
+    CHECK(s.mServer->startup(conf));
+
+    std::vector<TestNetworkClient*> c;
+    for (int i = 0; i < MAX_CLIENT + 1; i++) {
+      c.push_back(new TestNetworkClient);
+      CHECK(c[i]->mClient->connect("127.0.0.1:2348"));
+    }
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && MAX_CLIENT != s.mOnline) {
+      s.mServer->trigger();
+      for (int i = 0; i < (int)c.size(); i++) {
+        c[i]->mClient->trigger();
+      }
+    }
+
+    for (int i = 0; i < 10; i++) {
+      s.mServer->trigger();
+      Util::sleep(10);
+    }
+
+    CHECK(MAX_CLIENT == s.mOnline);
+
+    //
+    // All accepted connections work.
+    //
+
+    for (int i = 0; i < (int)c.size(); i++) {
+      if (c[i]->mReady) {
+        CHECK(c[i]->mClient->send(5, "hello"));
+      }
+    }
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && MAX_CLIENT != (int)s.mData.size()) {
+      s.mServer->trigger();
+      for (int i = 0; i < (int)c.size(); i++) {
+        c[i]->mClient->trigger();
+      }
+    }
+
+    CHECK(MAX_CLIENT == (int)s.mData.size());
+
+    for (int i = 0; i < (int)c.size(); i++) {
+      c[i]->mClient->disconnect();
+    }
+
+    s.mServer->shutdown();
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && 0 != s.mOnline) {
+      s.mServer->trigger();
+      for (int i = 0; i < (int)c.size(); i++) {
+        c[i]->mClient->trigger();
+      }
+    }
+
+    CHECK(0 == s.mOnline);
+
+    for (int i = 0; i < (int)c.size(); i++) {
+      delete c[i];
+    }
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test session resumption, a dropped connection is resumed without leave and
+// no stream is lost.
+//
+
+TEST(Network, resume)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkRelay r;
+    CHECK(r.startup("127.0.0.1:2354", "127.0.0.1:2353"));
+
+    TestNetworkServer s;
+    s.mServer->setSessionTimeout(10);
+    TestNetworkClient c;
+    CHECK(s.mServer->startup("127.0.0.1:2353"));
+    CHECK(c.mClient->connect("127.0.0.1:2354"));
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && (0 == s.mOnline || !c.mReady)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+    CHECK(1 == s.mOnline && c.mReady);
+
+    const int COUNT = 20;
+    for (int i = 0; i < COUNT; i++) {
+      std::string str = getTestStream(i);
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+    }
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+    CHECK(COUNT == (int)c.mData.size());
+
+    //
+    // Drop connections, streams sent after dropped are kept and sent after
+    // resumed.
+    //
+
+    r.drop();
+    for (int i = COUNT; i < 2 * COUNT; i++) {
+      std::string str = getTestStream(i);
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && 2 * COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+      CHECK(1 == s.mOnline && c.mReady);
+    }
+
+    CHECK(2 * COUNT == (int)s.mData.size() && 2 * COUNT == (int)c.mData.size());
+    for (int i = 0; i < 2 * COUNT && i < (int)c.mData.size() && i < (int)s.mData.size(); i++) {
+      CHECK(getTestStream(i) == s.mData[i] && getTestStream(i) == c.mData[i]);
+    }
+    CHECK(CS_CONNECTED == c.mClient->getConnectionState());
+    CHECK(1 < r.mUpstream.size());     // Reconnected.
+
+    //
+    // Disconnect on purpose, server is notified at once.
+    //
+
+    c.mClient->disconnect();
+    lt.setTimeout(2000);
+    while (!lt.isExpired() && (0 != s.mOnline || CS_DISCONNECTED != c.mClient->getConnectionState())) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+    CHECK(0 == s.mOnline && !c.mReady);
+
+    //
+    // Session expires if can not resume.
+    //
+
+    s.mServer->setSessionTimeout(1);
+    CHECK(c.mClient->connect("127.0.0.1:2354"));
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && (0 == s.mOnline || !c.mReady)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+    CHECK(1 == s.mOnline && c.mReady);
+
+    r.mServer->shutdown();
+    r.drop();
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && (0 != s.mOnline || c.mReady)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+    CHECK(0 == s.mOnline && !c.mReady);
+    CHECK(CS_DISCONNECTED == c.mClient->getConnectionState());
+
+    s.mServer->shutdown();
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test an old client without protocol version, it sends and receives only
+// keep alive and plain streams.
+//
+
+class TestNetworkOldClient : public SocketClientCallback
+{
+public:
+
+  SocketClient* mClient;
+
+  std::vector<std::string> mData;
+  std::string mBuff, mStream;
+  long mPacketSent, mPacketRecv;
+  bool mBad;
+
+  TestNetworkOldClient() : mPacketSent(0), mPacketRecv(0), mBad(false)
+  {
+    mClient = SocketClient::alloc(this);
+  }
+
+  virtual ~TestNetworkOldClient()
+  {
+    SocketClient::free(mClient);
+  }
+
+  bool send(std::string const& s)
+  {
+    ushort beg = 0xc000, end = 0x8000;
+    if (!mClient->send(2, &beg)) {
+      return false;
+    }
+    for (size_t i = 0; i < s.length(); i += 1022) {
+      int len = (int)std::min(s.length() - i, (size_t)1022);
+      ushort header = (ushort)(len | ((mPacketSent++ & 0xf) << 12));
+      if (!mClient->send(2, &header) || !mClient->send(len, s.data() + i)) {
+        return false;
+      }
+    }
+    return mClient->send(2, &end);
+  }
+
+  virtual void onSocketServerReady(SocketClient*)
+  {
+  }
+
+  virtual void onSocketServerLeave(SocketClient*)
+  {
+  }
+
+  virtual void onSocketStreamReady(SocketClient*, int len, void const* pStream)
+  {
+    //
+    // Same as the old packet layer.
+    //
+
+    mBuff.append((char const*)pStream, len);
+    while (2 <= mBuff.length()) {
+      uchar const* p = (uchar const*)mBuff.data();
+      ushort header = (ushort)((p[1] << 8) | p[0]);
+      if (0xc00 != header && 0xc000 != header && 0x8000 != header && ((header >> 12) & 0xf) != (mPacketRecv & 0xf)) {
+        mBad = true;
+        return;
+      }
+      int lenPacket = header & 0x3ff;
+      if (lenPacket + 2 > (int)mBuff.length()) {
+        break;
+      }
+      if (0 == lenPacket) {
+        if (0xc000 == header) {
+          mStream = "";
+        } else if (0x8000 == header) {
+          mData.push_back(mStream);
+        } else if (0xc00 != header) {
+          mBad = true;
+          return;
+        }
+      } else if (0 == ((header >> 10) & 0x3)) {
+        mPacketRecv += 1;
+        mStream.append((char const*)p + 2, lenPacket);
+      }
+      mBuff.erase(0, lenPacket + 2);
+    }
+  }
+};
+
+TEST(Network, oldClient)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkServer s;
+    s.mServer->setSessionTimeout(10);
+    s.mServer->setBatchWindow(0);
+    TestNetworkOldClient c;
+    CHECK(s.mServer->startup("127.0.0.1:2356"));
+    CHECK(c.mClient->connect("127.0.0.1:2356"));
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && CS_CONNECTED != c.mClient->getConnectionState()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    const int COUNT = 20;
+    for (int i = 0; i < COUNT; i++) {
+      CHECK(c.send(getTestStream(i)));
+    }
+
+    //
+    // Wait over the first keep alive, no ping, batch stream or session is
+    // sent to the old client.
+    //
+
+    lt.setTimeout(1500);
+    while (!lt.isExpired() && !c.mBad) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    CHECK(!c.mBad);
+    CHECK(1 == s.mOnline);
+    CHECK(COUNT == (int)s.mData.size() && COUNT == (int)c.mData.size());
+    for (int i = 0; i < COUNT && i < (int)c.mData.size() && i < (int)s.mData.size(); i++) {
+      CHECK(getTestStream(i) == s.mData[i] && getTestStream(i) == c.mData[i]);
+    }
+
+    c.mClient->disconnect();
+    s.mServer->shutdown();
+    lt.setTimeout(2000);
+    while (!lt.isExpired() && 0 != s.mOnline) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test a client sends session, only server starts a session, the client is
+// disconnected.
+//
+
+TEST(Network, badSession)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestNetworkServer s;
+    TestNetworkOldClient c;
+    CHECK(s.mServer->startup("127.0.0.1:2357"));
+    CHECK(c.mClient->connect("127.0.0.1:2357"));
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && 0 == s.mOnline) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+    CHECK(1 == s.mOnline);
+
+    uchar p[18] = {0x10, 0x5c};         // Session: id, token and timeout.
+    ::memset(p + 2, 0xff, 16);
+    CHECK(c.mClient->send(sizeof(p), p));
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && 0 != s.mOnline) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+    CHECK(0 == s.mOnline);
+    CHECK(0 == s.mServer->getFirstConnection()); // Released, not suspended.
+
+    s.mServer->shutdown();
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test unacked streams of a session are bounded, the session is closed if
+// exceeded.
+//
+
+TEST(Network, maxUnacked)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    Ini conf;
+    conf["AddrListen"] = "127.0.0.1:2358";
+    conf["SessionTimeout"] = 10;
+    conf["SessionMaxUnacked"] = 4096;
+
+    TestNetworkServer s;
+    TestNetworkClient c;
+    CHECK(s.mServer->startup(conf));
+    CHECK(c.mClient->connect("127.0.0.1:2358"));
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && (0 == s.mOnline || !c.mReady)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+    CHECK(1 == s.mOnline && c.mReady);
+
+    NetworkConnection* pConn = s.mServer->getFirstConnection();
+    CHECK(0 != pConn);
+
+    std::string str(1000, 'a');
+    int nSent = 0;
+    for (int i = 0; pConn && i < 10; i++) {
+      if (pConn->send((int)str.length(), str.data())) {
+        nSent += 1;
+      } else {
+        break;
+      }
+    }
+    CHECK(4 == nSent);                  // Not acked yet.
+
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && (0 != s.mOnline || c.mReady)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+    CHECK(0 == s.mOnline && !c.mReady);
+
+    s.mServer->shutdown();
+  }
+
+  UninitializeNetwork();
+}
+
+// end of TestNetwork.cpp
@@ -0,0 +1,488 @@
+
+//
+//  Reliable UDP network unit test.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#if defined(WIN32)
+# include <windows.h>
+# include <winsock.h>
+# define socklen_t int
+#else
+# include <sys/socket.h>
+# include <sys/ioctl.h>
+# include <arpa/inet.h>
+# include <unistd.h>
+# define SOCKET int
+# define closesocket(s) close((s))
+# define ioctlsocket(s,a,b) ioctl((s),(a),(b))
+#endif
+
+#include "CppUnitLite/TestHarness.h"
+
+#include "swNetwork.h"
+#include "swUtil.h"
+using namespace sw2;
+
+class TestUdpClient : public NetworkClientCallback
+{
+public:
+
+  UdpNetworkClient* mClient;
+
+  std::vector<std::string> mData;
+
+  bool mReady, mLeave;
+
+  TestUdpClient() : mReady(false), mLeave(false)
+  {
+    mClient = UdpNetworkClient::alloc(this);
+  }
+
+  virtual ~TestUdpClient()
+  {
+    UdpNetworkClient::free(mClient);
+  }
+
+  virtual void onNetworkServerReady(NetworkClient*)
+  {
+    mReady = true;
+  }
+
+  virtual void onNetworkServerLeave(NetworkClient*)
+  {
+    mReady = false;
+    mLeave = true;
+  }
+
+  virtual void onNetworkStreamReady(NetworkClient*, int len, void const* pStream)
+  {
+    mData.push_back(std::string((char const*)pStream, len));
+  }
+};
+
+class TestUdpServer : public NetworkServerCallback
+{
+public:
+
+  UdpNetworkServer* mServer;
+
+  std::vector<std::string> mData;       // Reliable streams.
+  std::vector<int> mUnreliable;         // Seq of unreliable streams.
+
+  int mOnline;
+
+  TestUdpServer() : mOnline(0)
+  {
+    mServer = UdpNetworkServer::alloc(this);
+  }
+
+  virtual ~TestUdpServer()
+  {
+    UdpNetworkServer::free(mServer);
+  }
+
+  virtual bool onNetworkNewClientReady(NetworkServer*, NetworkConnection*)
+  {
+    mOnline += 1;
+    return true;
+  }
+
+  virtual void onNetworkClientLeave(NetworkServer*, NetworkConnection*)
+  {
+    mOnline -= 1;
+  }
+
+  virtual void onNetworkStreamReady(NetworkServer*, NetworkConnection* pClient, int len, void const* pStream)
+  {
+    std::string s((char const*)pStream, len);
+    if ('u' == s[0]) {
+      mUnreliable.push_back(::atoi(s.c_str() + 1));
+    } else {
+      mData.push_back(s);
+      pClient->send(len, pStream);      // Echo.
+    }
+  }
+};
+
+//
+// Lossy network simulator, relays datagrams between clients and server with
+// packet loss and random latency, datagrams may be reordered.
+//
+
+class TestUdpRelay
+{
+public:
+
+  struct Datagram
+  {
+    uint timeDeliver;
+    SOCKET s;
+    struct sockaddr_in to;
+    std::string data;
+  };
+
+  SOCKET mSocket;                       // Listen for clients.
+  struct sockaddr_in mServer;
+  std::map<std::string, SOCKET> mUpstream; // Client address to upstream socket.
+  std::map<SOCKET, struct sockaddr_in> mClient;
+  std::vector<Datagram> mQueue;
+
+  int mLoss;                            // Loss rate, percent.
+  int mMinLatency, mMaxLatency;         // Latency, millisecond.
+  bool mDropLast;                       // Clear last fragment flag of reliable data from clients.
+
+  TestUdpRelay(int loss, int minLatency, int maxLatency) : mLoss(loss), mMinLatency(minLatency), mMaxLatency(maxLatency), mDropLast(false)
+  {
+    mSocket = -1;
+  }
+
+  ~TestUdpRelay()
+  {
+    if (-1 != (int)mSocket) {
+      closesocket(mSocket);
+    }
+    for (std::map<std::string, SOCKET>::iterator it = mUpstream.begin(); mUpstream.end() != it; ++it) {
+      closesocket(it->second);
+    }
+  }
+
+  static void setAddr(struct sockaddr_in &sa, int port)
+  {
+    ::memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+    sa.sin_port = htons(port);
+  }
+
+  static SOCKET createSock()
+  {
+    SOCKET s = ::socket(AF_INET, SOCK_DGRAM, 0);
+    unsigned long v = 1;
+    ioctlsocket(s, FIONBIO, &v);
+    return s;
+  }
+
+  bool startup(int port, int portServer)
+  {
+    struct sockaddr_in sa;
+    setAddr(sa, port);
+    setAddr(mServer, portServer);
+    mSocket = createSock();
+    return 0 == ::bind(mSocket, (struct sockaddr*)&sa, sizeof(sa));
+  }
+
+  void relay(SOCKET from, SOCKET to, struct sockaddr_in const* pTo)
+  {
+    char buff[2048];
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    int n;
+    while (0 < (n = ::recvfrom(from, buff, sizeof(buff), 0, (struct sockaddr*)&sa, &len))) {
+      SOCKET s = to;
+      if (from == mSocket) {            // From client.
+        char addr[64];
+        ::sprintf(addr, "%d", ntohs(sa.sin_port));
+        if (mUpstream.end() == mUpstream.find(addr)) {
+          mUpstream[addr] = createSock();
+          mClient[mUpstream[addr]] = sa;
+        }
+        s = mUpstream[addr];
+        if (mDropLast && 1 < n && 5 == buff[0]) { // Reliable data.
+          buff[1] = 0;
+        }
+      }
+      if (::rand() % 100 < mLoss) {
+        continue;
+      }
+      Datagram d;
+      d.timeDeliver = Util::getTickCount() + mMinLatency + ::rand() % (mMaxLatency - mMinLatency + 1);
+      d.s = s;
+      d.to = pTo ? *pTo : mClient[from];
+      d.data.assign(buff, n);
+      mQueue.push_back(d);
+    }
+  }
+
+  void trigger()
+  {
+    relay(mSocket, 0, &mServer);
+    for (std::map<SOCKET, struct sockaddr_in>::iterator it = mClient.begin(); mClient.end() != it; ++it) {
+      relay(it->first, mSocket, 0);
+    }
+
+    uint now = Util::getTickCount();
+    for (size_t i = 0; i < mQueue.size();) {
+      Datagram &d = mQueue[i];
+      if (0 <= (int)(now - d.timeDeliver)) {
+        ::sendto(d.s, d.data.data(), (int)d.data.length(), 0, (struct sockaddr*)&d.to, sizeof(d.to));
+        mQueue.erase(mQueue.begin() + i);
+      } else {
+        i += 1;
+      }
+    }
+  }
+};
+
+static bool connectUdp(TestUdpServer &s, TestUdpClient &c, TestUdpRelay* r, std::string const& addrSvr, std::string const& addr)
+{
+  if (!s.mServer->startup(addrSvr) || !c.mClient->connect(addr)) {
+    return false;
+  }
+
+  sw2::TimeoutTimer lt(5000);
+  while (!lt.isExpired() && (0 == s.mOnline || !c.mReady)) {
+    s.mServer->trigger();
+    c.mClient->trigger();
+    if (r) {
+      r->trigger();
+    }
+  }
+
+  return 1 == s.mOnline && c.mReady;
+}
+
+static std::string getUdpTestStream(int i)
+{
+  char buff[32];
+  ::sprintf(buff, "r%d:", i);
+  std::string s(buff);
+  s.append(1 + (i * 7) % 48, 'a' + i % 26);
+  if (0 == i % 10) {
+    s.append(3000, 'z');                // Fragmented.
+  }
+  return s;
+}
+
+//
+// Test send/recv data streams on loopback.
+//
+
+TEST(UdpNetwork, sendrecv)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestUdpServer s;
+    TestUdpClient c;
+    CHECK(connectUdp(s, c, 0, "127.0.0.1:2360", "127.0.0.1:2360"));
+
+    const int COUNT = 100;
+    for (int i = 0; i < COUNT; i++) {
+      std::string str = getUdpTestStream(i);
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+    }
+
+    sw2::TimeoutTimer lt(5000);
+    while (!lt.isExpired() && COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    CHECK(COUNT == (int)s.mData.size() && COUNT == (int)c.mData.size());
+    for (int i = 0; i < COUNT && i < (int)c.mData.size(); i++) {
+      CHECK(getUdpTestStream(i) == s.mData[i] && getUdpTestStream(i) == c.mData[i]);
+    }
+
+    //
+    // Disconnect, both sides are notified.
+    //
+
+    c.mClient->disconnect();
+    lt.setTimeout(5000);
+    while (!lt.isExpired() && (0 != s.mOnline || !c.mLeave)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+    }
+
+    CHECK(0 == s.mOnline && c.mLeave);
+    CHECK(CS_DISCONNECTED == c.mClient->getConnectionState());
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test reliable and unreliable channels with packet loss and latency.
+//
+
+TEST(UdpNetwork, lossy)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestUdpRelay r(20, 5, 30);          // 20% loss each way, 5~30ms latency.
+    CHECK(r.startup(2362, 2361));
+
+    TestUdpServer s;
+    TestUdpClient c;
+    CHECK(connectUdp(s, c, &r, "127.0.0.1:2361", "127.0.0.1:2362"));
+
+    const int COUNT = 50;
+    for (int i = 0; i < COUNT; i++) {
+      std::string str = getUdpTestStream(i);
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+      char buff[32];
+      ::sprintf(buff, "u%d", i);
+      CHECK(c.mClient->send((int)::strlen(buff), buff, NC_UNRELIABLE_SEQUENCED));
+    }
+
+    sw2::TimeoutTimer lt(20000);
+    while (!lt.isExpired() && COUNT != (int)c.mData.size()) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+
+    //
+    // Reliable streams are all received in order.
+    //
+
+    CHECK(COUNT == (int)s.mData.size() && COUNT == (int)c.mData.size());
+    for (int i = 0; i < COUNT && i < (int)c.mData.size(); i++) {
+      CHECK(getUdpTestStream(i) == s.mData[i] && getUdpTestStream(i) == c.mData[i]);
+    }
+
+    //
+    // Unreliable streams may be lost, but never duplicated or out of order.
+    //
+
+    CHECK(COUNT >= (int)s.mUnreliable.size());
+    for (int i = 1; i < (int)s.mUnreliable.size(); i++) {
+      CHECK(s.mUnreliable[i - 1] < s.mUnreliable[i]);
+    }
+
+    CHECK(0 < c.mClient->getNetStats().packetsSent);
+    CHECK(0 < c.mClient->getNetStats().rtt);
+    CHECK(1 == s.mServer->getNetStats().currOnline);
+
+    //
+    // Server disconnects the client.
+    //
+
+    s.mServer->getFirstConnection()->disconnect();
+    lt.setTimeout(10000);
+    while (!lt.isExpired() && (0 != s.mOnline || !c.mLeave)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+
+    CHECK(0 == s.mOnline);
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test a peer never sends the last fragment, the reassembled stream is bounded
+// and the peer is disconnected.
+//
+
+TEST(UdpNetwork, streamTooLong)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestUdpRelay r(0, 0, 0);
+    r.mDropLast = true;
+    CHECK(r.startup(2364, 2363));
+
+    TestUdpServer s;
+    TestUdpClient c;
+    CHECK(connectUdp(s, c, &r, "127.0.0.1:2363", "127.0.0.1:2364"));
+
+    std::string big(1024 * 1024 + 1, 'z');
+    CHECK(!c.mClient->send((int)big.length(), big.data())); // Too long to send.
+
+    std::string str(64 * 1024, 'z');
+    for (int i = 0; i < 20; i++) {      // Over 1MB in total.
+      CHECK(c.mClient->send((int)str.length(), str.data()));
+    }
+
+    sw2::TimeoutTimer lt(10000);
+    while (!lt.isExpired() && (0 != s.mOnline || !c.mLeave)) {
+      s.mServer->trigger();
+      c.mClient->trigger();
+      r.trigger();
+    }
+
+    CHECK(0 == s.mOnline && c.mLeave);
+    CHECK(s.mData.empty());
+  }
+
+  UninitializeNetwork();
+}
+
+//
+// Test connect request is challenged by cookie.
+//
+
+TEST(UdpNetwork, cookie)
+{
+  CHECK(InitializeNetwork());
+
+  {
+    TestUdpServer s;
+    CHECK(s.mServer->startup("127.0.0.1:2365"));
+
+    struct sockaddr_in sa;
+    TestUdpRelay::setAddr(sa, 2365);
+    SOCKET so = TestUdpRelay::createSock();
+
+    unsigned char syn[18] = {1, 0, 0x78, 0x56, 0x34, 0x12}; // SYN, salt 0x12345678, no cookie.
+    ::sendto(so, (char const*)syn, sizeof(syn), 0, (struct sockaddr*)&sa, sizeof(sa));
+
+    unsigned char buff[64];
+    int n = 0;
+    sw2::TimeoutTimer lt(2000);
+    while (!lt.isExpired() && 0 >= n) {
+      s.mServer->trigger();
+      n = ::recvfrom(so, (char*)buff, sizeof(buff), 0, 0, 0);
+    }
+
+    CHECK(18 == n && 7 == buff[0]);     // COOKIE.
+    CHECK(0 == ::memcmp(buff + 2, syn + 2, 4));
+    CHECK(0 == s.mOnline && 0 == s.mServer->getNetStats().currOnline);
+
+    syn[14] = buff[14] ^ 1;             // Wrong cookie.
+    ::memcpy(syn + 15, buff + 15, 3);
+    ::sendto(so, (char const*)syn, sizeof(syn), 0, (struct sockaddr*)&sa, sizeof(sa));
+
+    sw2::TimeoutTimer lt2(200);
+    while (!lt2.isExpired()) {
+      s.mServer->trigger();
+    }
+    CHECK(0 == s.mOnline);
+
+    ::memcpy(syn + 14, buff + 14, 4);   // Echo cookie.
+    ::sendto(so, (char const*)syn, sizeof(syn), 0, (struct sockaddr*)&sa, sizeof(sa));
+
+    n = 0;
+    sw2::TimeoutTimer lt3(2000);
+    while (!lt3.isExpired() && (0 >= n || 7 == buff[0])) {
+      s.mServer->trigger();
+      n = ::recvfrom(so, (char*)buff, sizeof(buff), 0, 0, 0);
+    }
+
+    CHECK(18 == n && 2 == buff[0]);     // SYNACK.
+    CHECK(1 == s.mOnline);
+
+    closesocket(so);
+  }
+
+  UninitializeNetwork();
+}
+
+// end of TestNetworkUdp.cpp
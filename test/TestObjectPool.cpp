@@ -8,12 +8,16 @@
 //  2008/05/25 Waync created.
 //
 
+#include <string.h>
+
 #include <algorithm>
+#include <string>
 #include <vector>
 
 #include "CppUnitLite/TestHarness.h"
 
 #include "swObjectPool.h"
+#include "swThreadPool.h"
 #include "swUtil.h"
 using namespace sw2;
 
@@ -341,4 +345,378 @@ TEST(ObjectPool, firstFree)
   }
 }
 
+//
+// Test pointers to entities keep valid after auto grow.
+//
+
+TEST(ObjectPool, growStable)
+{
+  ObjectPool<int, 2, true> p;
+  std::vector<int*> v;
+  for (int i = 0; i < 1000; i++) {
+    int id = p.alloc();
+    CHECK(i == id);
+    p[id] = i;
+    v.push_back(&p[id]);
+  }
+  CHECK(1024 == p.capacity());
+  for (int i = 0; i < 1000; i++) {
+    CHECK(&p[i] == v[i] && i == *v[i]);
+  }
+
+  CHECK(5000 == p.alloc(5000) && &p[999] == v[999]);
+  p.reserve(10000);
+  CHECK(10000 == p.capacity() && &p[0] == v[0]);
+
+  ObjectPool<int, 2, true> p2(p);
+  CHECK(1001 == p2.size() && 999 == p2[999] && &p2[999] != v[999]);
+}
+
+//
+// Test objects are constructed on alloc and destroyed on free.
+//
+
+class TestLazyObj
+{
+public:
+  static int sAlive;
+  int a;
+  std::string s;
+  TestLazyObj() : a(0) { sAlive += 1; }
+  TestLazyObj(int a_, std::string const& s_) : a(a_), s(s_) { sAlive += 1; }
+  TestLazyObj(TestLazyObj const& o) : a(o.a), s(o.s) { sAlive += 1; }
+  ~TestLazyObj() { sAlive -= 1; }
+};
+
+int TestLazyObj::sAlive = 0;
+
+TEST(LazyObjectPool, allocfree)
+{
+  {
+    LazyObjectPool<TestLazyObj, 64> p;
+    CHECK(0 == TestLazyObj::sAlive && 64 == p.capacity());
+
+    int id1 = p.alloc();
+    int id2 = p.allocWith(5, std::string("five"));
+    int id3 = p.alloc(10);
+    CHECK(0 == id1 && 1 == id2 && 10 == id3);
+    CHECK(3 == TestLazyObj::sAlive && 3 == p.size());
+    CHECK(0 == p[id1].a && 5 == p[id2].a && "five" == p[id2].s);
+
+    p.free(id1);
+    p.free(id1);
+    CHECK(2 == TestLazyObj::sAlive && !p.isUsed(id1));
+
+    LazyObjectPool<TestLazyObj, 64> p2(p);
+    CHECK(4 == TestLazyObj::sAlive && 2 == p2.size() && "five" == p2[id2].s);
+
+    p2 = p2;
+    p2 = p;
+    CHECK(4 == TestLazyObj::sAlive);
+
+    p.clear();
+    CHECK(2 == TestLazyObj::sAlive && 0 == p.size());
+  }
+  CHECK(0 == TestLazyObj::sAlive);
+
+  {
+    LazyObjectPool<TestLazyObj, 2, true> p;
+    std::vector<TestLazyObj*> v;
+    for (int i = 0; i < 100; i++) {
+      int id = p.allocWith(i, std::string("x"));
+      v.push_back(&p[id]);
+    }
+    CHECK(100 == TestLazyObj::sAlive && 128 == p.capacity());
+    for (int i = 0; i < 100; i++) {
+      CHECK(&p[i] == v[i] && i == v[i]->a);
+    }
+    p.reset();
+    CHECK(0 == TestLazyObj::sAlive && 0 == p.firstFree());
+    p.alloc(200);
+    CHECK(1 == TestLazyObj::sAlive);
+  }
+  CHECK(0 == TestLazyObj::sAlive);
+}
+
+//
+// Test dense pool has same used entities as ObjectPool after random alloc and
+// free.
+//
+
+TEST(DenseObjectPool, churn)
+{
+  const int N = 100;
+  ObjectPool<int, N> p1;
+  DenseObjectPool<int, N> p2;
+  DenseObjectPool<int, 4, true> p3;
+
+  CHECK(N == p2.capacity() && 0 == p2.size() && -1 == p2.first() && -1 == p2.last());
+
+  ::srand(1);
+  for (int n = 0; n < 2000; n++) {
+    int i = ::rand() % N;
+    if (p1.isUsed(i)) {
+      p1.free(i);
+      p2.free(i);
+      p3.free(i);
+    } else if (0 == n % 3) {
+      CHECK(i == p1.alloc(i) && i == p2.alloc(i) && i == p3.alloc(i));
+    } else {
+      int id = p2.alloc();
+      CHECK(-1 != id && id == p3.alloc(id) && id == p1.alloc(id));
+      p2[id] = p3[id] = id;
+    }
+    CHECK(p1.size() == p2.size() && p1.size() == p3.size());
+  }
+
+  std::vector<int> v1, v2, v3;
+  for (int i = p1.first(); -1 != i; i = p1.next(i)) {
+    v1.push_back(i);
+  }
+  for (int i = p2.first(); -1 != i; i = p2.next(i)) {
+    v2.push_back(i);
+  }
+  for (int i = p3.last(); -1 != i; i = p3.prev(i)) {
+    v3.push_back(i);
+  }
+  std::sort(v1.begin(), v1.end());
+  std::sort(v2.begin(), v2.end());
+  std::sort(v3.begin(), v3.end());
+  CHECK(v1 == v2 && v1 == v3);
+
+  for (int i = 0; i < N; i++) {
+    CHECK(p1.isUsed(i) == p2.isUsed(i) && p1.isUsed(i) == p3.isUsed(i));
+  }
+  CHECK(!p2.isUsed(-1) && !p2.isUsed(N));
+  CHECK(-1 == p2.alloc(v1[0]) && -1 == p2.alloc(N));
+
+  //
+  // Full.
+  //
+
+  while (-1 != p2.alloc()) {
+  }
+  CHECK(N == p2.size() && 0 == p2.available());
+
+  p2.clear();
+  CHECK(0 == p2.size() && -1 == p2.first());
+}
+
+//
+// Test free during reverse iteration and dense access.
+//
+
+struct TestDenseSum
+{
+  int sum;
+  TestDenseSum() : sum(0) {}
+  void operator()(int &i) { sum += i; }
+};
+
+TEST(DenseObjectPool, iterate)
+{
+  DenseObjectPool<int, 2, true> p;
+  for (int i = 0; i < 10; i++) {
+    p[p.alloc()] = i;
+  }
+  CHECK(10 == p.size() && 16 == p.capacity());
+  CHECK(45 == p.forEach(TestDenseSum()).sum);
+
+  for (int i = p.last(); -1 != i;) {
+    int prev = p.prev(i);
+    if (0 == p[i] % 2) {
+      p.free(i);
+    }
+    i = prev;
+  }
+  CHECK(5 == p.size() && 25 == p.forEach(TestDenseSum()).sum);
+
+  int sum = 0;
+  for (int i = 0; i < p.size(); i++) {
+    sum += p[p.indexAt(i)];
+  }
+  CHECK(25 == sum);
+
+  DenseObjectPool<int, 2, true> p2(p);
+  CHECK(5 == p2.size() && 25 == p2.forEach(TestDenseSum()).sum);
+  DenseObjectPool<int, 16> p3, p4;
+  p3[p3.alloc(5)] = 5;
+  p4 = p3;
+  CHECK(1 == p4.size() && 5 == p4.first() && 5 == p4[5]);
+}
+
+//
+// Test handles of concurrent pool, stale handle and snapshot.
+//
+
+TEST(ConcurrentObjectPool, handle)
+{
+  typedef ConcurrentObjectPool<int, 4> PoolT;
+  PoolT p;
+  CHECK(0 == p.size() && 4 == p.capacity() && 4 == p.available());
+
+  int h[4];
+  for (int i = 0; i < 4; i++) {
+    h[i] = p.alloc();
+    CHECK(0 <= h[i] && p.isUsed(h[i]));
+    *p.get(h[i]) = i;
+  }
+  CHECK(-1 == p.alloc() && 4 == p.size());
+
+  CHECK(p.free(h[1]));
+  CHECK(!p.free(h[1]) && !p.isUsed(h[1]) && 0 == p.get(h[1]));
+
+  int h1 = p.alloc();                   // Reuse the entity with a new handle.
+  CHECK(PoolT::getIndex(h1) == PoolT::getIndex(h[1]));
+  CHECK(h1 != h[1] && 0 == p.get(h[1]) && 0 != p.get(h1));
+  CHECK(!p.free(h[1]) && p.isUsed(h1));
+  CHECK(!p.isUsed(-1) && 0 == p.get(0xffff));
+
+  p.free(h[2]);
+  std::vector<int> v;
+  p.snapshot(v);
+  CHECK(3 == (int)v.size() && 3 == p.size());
+  CHECK(v.end() != std::find(v.begin(), v.end(), h1));
+  CHECK(v.end() == std::find(v.begin(), v.end(), h[2]));
+  for (size_t i = 0; i < v.size(); i++) {
+    CHECK(p.free(v[i]));
+  }
+  CHECK(0 == p.size() && 4 == p.available());
+}
+
+//
+// Test alloc/free by multiple threads, an entity is owned by one thread only.
+//
+
+typedef ConcurrentObjectPool<int, 64> TestConcurrentPool;
+
+class TestConcurrentPoolTask : public ThreadTask
+{
+public:
+
+  TestConcurrentPool* mPool;
+  int mId;
+  int mFail;
+
+  virtual void threadTask()
+  {
+    mFail = 0;
+    for (int n = 0; n < 20000; n++) {
+      int h = mPool->alloc();
+      if (-1 == h) {
+        continue;
+      }
+      *mPool->get(h) = mId;
+      if (0 == n % 1000) {
+        Util::sleep(1);                 // Let others run with an entity owned.
+      }
+      if (mId != *mPool->get(h) || !mPool->free(h)) {
+        mFail += 1;
+      }
+    }
+  }
+};
+
+TEST(ConcurrentObjectPool, threads)
+{
+  CHECK(InitializeThreadPool(8));
+
+  { // guard
+    TestConcurrentPool *p = new TestConcurrentPool;
+    TestConcurrentPoolTask t[8];
+    for (int i = 0; i < 8; i++) {
+      t[i].mPool = p;
+      t[i].mId = i;
+      CHECK(t[i].runTask());
+    }
+
+continue_1:
+
+    for (int i = 0; i < 8; i++) {
+      if (t[i].isRunning()) {
+        Util::sleep(1);
+        goto continue_1;
+      }
+    }
+
+    for (int i = 0; i < 8; i++) {
+      CHECK(0 == t[i].mFail);
+    }
+    CHECK(0 == p->size() && 64 == p->available());
+
+    for (int i = 0; i < 64; i++) {      // Free stack is still intact.
+      CHECK(-1 != p->alloc());
+    }
+    CHECK(-1 == p->alloc());
+    delete p;
+  }
+
+  UninitializeThreadPool();
+}
+
+//
+// Test per tick arena, bump, free last, reset and stats.
+//
+
+TEST(TickArena, alloc)
+{
+  TickArena a(64);
+  CHECK(0 == a.getCapacity() && 0 == a.getTickBytes());
+
+  char* p1 = (char*)a.alloc(10);
+  char* p2 = (char*)a.alloc(20);
+  CHECK(0 == ((size_t)p1 & 15) && p1 + 16 == p2);
+  CHECK(48 == a.getTickBytes() && 64 == a.getCapacity());
+
+  a.free(p1, 10);                       // Not last, ignored.
+  CHECK(48 == a.getTickBytes());
+  a.free(p2, 20);
+  CHECK(16 == a.getTickBytes() && p2 == a.alloc(1));
+
+  char* p3 = (char*)a.alloc(100);       // Grow a block.
+  ::memset(p3, 1, 100);
+  CHECK(144 == a.getTickBytes() && 64 + 128 == a.getCapacity());
+  a.shrink(p3, 100, 10);
+  CHECK(48 == a.getTickBytes());
+
+  a.reset();                            // Merge blocks.
+  CHECK(48 == a.getLastTickBytes() && 48 == a.getPeakTickBytes());
+  CHECK(0 == a.getTickBytes() && 192 == a.getCapacity());
+  for (int i = 0; i < 12; i++) {
+    a.alloc(16);
+  }
+  CHECK(192 == a.getCapacity());
+
+  a.reset();
+  a.reset();
+  CHECK(0 == a.getLastTickBytes() && 192 == a.getPeakTickBytes());
+  a.clear();
+  CHECK(0 == a.getCapacity());
+}
+
+//
+// Test STL containers allocate from arena.
+//
+
+TEST(TickArena, allocator)
+{
+  TickArena a;
+
+  std::vector<int, ArenaAllocator<int> > v((ArenaAllocator<int>(a)));
+  for (int i = 0; i < 100; i++) {
+    v.push_back(i);
+  }
+  CHECK(100 == v.size() && 99 == v[99] && 0 < a.getTickBytes());
+
+  ArenaString s((ArenaAllocator<char>(a)));
+  s = "hello arena ";
+  s += std::string(100, 'x').c_str();
+  CHECK(112 == s.length() && 0 == s.find("hello arena x"));
+
+  v.clear();
+  s.clear();
+  a.reset();
+  CHECK(0 == a.getTickBytes() && 0 < a.getLastTickBytes());
+}
+
 // end of TestObjectPool.cpp
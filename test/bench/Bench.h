@@ -0,0 +1,59 @@
+
+//
+//  Benchmark harness.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#pragma once
+
+#include <string>
+
+//
+// Benchmark case, use BENCH macro to declare a benchmark.
+//
+
+class Bench
+{
+public:
+
+  Bench(char const* group, char const* name);
+  virtual ~Bench() {}
+
+  virtual void run()=0;
+
+  std::string getName() const;
+
+  static Bench* getFirst();
+
+  char const* mGroup;
+  char const* mName;
+  Bench* mNext;
+};
+
+//
+// Report a measured value of current benchmark, output format:
+// group.name.item: value unit
+// or with -csv option:
+// group.name,item,value,unit
+//
+
+void BenchReport(char const* item, double value, char const* unit);
+
+//
+// Number of operator new calls since start, for allocs/op.
+//
+
+long BenchGetAllocCount();
+
+#define BENCH(group, name) \
+  class group##name##Bench : public Bench \
+  { public: group##name##Bench() : Bench(#group, #name) {} \
+            void run(); } \
+    group##name##Instance; \
+  void group##name##Bench::run()
+
+// end of Bench.h
@@ -0,0 +1,802 @@
+
+//
+//  BitStream benchmark.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+
+#include "swBitStream.h"
+#include "swBitStreamPacket.h"
+#include "swSmallworld.h"
+#include "swUtil.h"
+using namespace sw2;
+
+//
+// Byte by byte reference of the previous BitStream implementation, write and
+// read bits with mask and shift, used as baseline. The baseline is compiled
+// with bench flags, build the library with same flags to compare, e.g.
+// make -C src FLAGS="-Wall -D_linux_ -O2".
+//
+
+static const uchar sBitMask[] = {0, 1, 3, 7, 0xf, 0x1f, 0x3f, 0x7f, 0xff};
+
+static int calcBitsCount(int bitCount, int bitPtr, int bitPtr2)
+{
+  int nb = 8 < bitPtr2 + bitCount ? 8 - bitPtr2 : bitCount;
+  return 8 < nb + bitPtr ? 8 - bitPtr : nb;
+}
+
+static void legacyWrite(uchar* d, int& bitPtr, void const* pStream, int bitCount)
+{
+  uchar const* s = (uchar const*)pStream;
+  int sbitptr = 0;
+  while (0 < bitCount) {
+    int nb = calcBitsCount(bitCount, sbitptr, bitPtr & 7);
+    uchar mb = sBitMask[nb];
+    d[bitPtr >> 3] &= ~(mb << (bitPtr & 7));
+    d[bitPtr >> 3] |= ((*s >> sbitptr) & mb) << (bitPtr & 7);
+    bitPtr += nb;
+    if (8 <= (sbitptr += nb)) {
+      s += 1;
+      sbitptr &= 7;
+    }
+    bitCount -= nb;
+  }
+}
+
+static void legacyRead(uchar const* s, int& bitPtr, void* pStream, int bitCount)
+{
+  uchar* d = (uchar*)pStream;
+  int dbitptr = 0;
+  while (0 < bitCount) {
+    int nb = calcBitsCount(bitCount, dbitptr, bitPtr & 7);
+    uchar mb = sBitMask[nb];
+    *d &= ~(mb << dbitptr);
+    *d |= ((s[bitPtr >> 3] >> (bitPtr & 7)) & mb) << dbitptr;
+    bitPtr += nb;
+    if (8 <= (dbitptr += nb)) {
+      d += 1;
+      dbitptr &= 7;
+    }
+    bitCount -= nb;
+  }
+}
+
+//
+// Mixed field widths of a typical game packet.
+//
+
+static const int sFieldBits[] = {1, 3, 5, 7, 8, 12, 16, 20, 27, 32};
+static const int NUM_FIELD = sizeof(sFieldBits) / sizeof(sFieldBits[0]);
+static const int NUM_RECORD = 1000;     // Records per buffer, a record has all fields.
+static const int NUM_LOOP = 2000;
+
+static int getRecordBits()
+{
+  int bits = 0;
+  for (int i = 0; i < NUM_FIELD; i++) {
+    bits += sFieldBits[i];
+  }
+  return bits;
+}
+
+static double getMBs(uint64 t)
+{
+  double bytes = (double)NUM_LOOP * NUM_RECORD * getRecordBits() / 8;
+  return t ? bytes / t : 0;             // Bytes per microsecond is MB/s.
+}
+
+//
+// Write uint fields of mixed widths, MB/s of encoded stream.
+//
+
+BENCH(BitStream, writeMixed)
+{
+  std::string buff(NUM_RECORD * getRecordBits() / 8 + 8, 0);
+  uchar* d = (uchar*)&buff[0];
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < NUM_LOOP; n++) {
+    int bitPtr = 0;
+    for (int r = 0; r < NUM_RECORD; r++) {
+      for (int i = 0; i < NUM_FIELD; i++) {
+        uint u = (uint)(r * 2654435761u + i);
+        uchar b[4];                     // Previous uint write builds a temporary.
+        b[0] = (uchar)u;
+        b[1] = (uchar)(u >> 8);
+        b[2] = (uchar)(u >> 16);
+        b[3] = (uchar)(u >> 24);
+        legacyWrite(d, bitPtr, b, sFieldBits[i]);
+      }
+    }
+  }
+  BenchReport("legacy", getMBs(Util::getTickCountUs() - t), "MB/s");
+
+  std::string legacy = buff;
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < NUM_LOOP; n++) {
+    BitStream bs(&buff[0], (int)buff.length());
+    for (int r = 0; r < NUM_RECORD; r++) {
+      for (int i = 0; i < NUM_FIELD; i++) {
+        bs << setBitCount(sFieldBits[i]) << (uint)(r * 2654435761u + i);
+      }
+    }
+  }
+  BenchReport("word", getMBs(Util::getTickCountUs() - t), "MB/s");
+
+  BenchReport("identical", legacy == buff ? 1 : 0, "bool");
+}
+
+//
+// Read uint fields of mixed widths, MB/s of encoded stream.
+//
+
+BENCH(BitStream, readMixed)
+{
+  std::string buff(NUM_RECORD * getRecordBits() / 8 + 8, 0);
+  BitStream bs(&buff[0], (int)buff.length());
+  for (int r = 0; r < NUM_RECORD; r++) {
+    for (int i = 0; i < NUM_FIELD; i++) {
+      bs << setBitCount(sFieldBits[i]) << (uint)(r * 2654435761u + i);
+    }
+  }
+
+  uchar const* s = (uchar const*)buff.data();
+  uint sum1 = 0, sum2 = 0;
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < NUM_LOOP; n++) {
+    int bitPtr = 0;
+    for (int r = 0; r < NUM_RECORD; r++) {
+      for (int i = 0; i < NUM_FIELD; i++) {
+        uchar b[4] = {0};
+        legacyRead(s, bitPtr, b, sFieldBits[i]);
+        sum1 += (uint)b[0] | ((uint)b[1] << 8) | ((uint)b[2] << 16) | ((uint)b[3] << 24);
+      }
+    }
+  }
+  BenchReport("legacy", getMBs(Util::getTickCountUs() - t), "MB/s");
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < NUM_LOOP; n++) {
+    bs.reset();
+    for (int r = 0; r < NUM_RECORD; r++) {
+      for (int i = 0; i < NUM_FIELD; i++) {
+        uint u = 0;
+        bs >> setBitCount(sFieldBits[i]) >> u;
+        sum2 += u;
+      }
+    }
+  }
+  BenchReport("word", getMBs(Util::getTickCountUs() - t), "MB/s");
+
+  BenchReport("identical", sum1 == sum2 ? 1 : 0, "bool");
+}
+
+//
+// Write and read unaligned buffers, MB/s.
+//
+
+BENCH(BitStream, unalignedBuffer)
+{
+  const int SIZE = 1000;
+  const int LOOP = 20000;
+
+  std::string src(SIZE, 'x'), buff(SIZE + 8, 0), out(SIZE, 0);
+  double bytes = (double)LOOP * SIZE;
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    int bitPtr = 3;
+    legacyWrite((uchar*)&buff[0], bitPtr, src.data(), 8 * SIZE);
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+  BenchReport("legacyWrite", t2 ? bytes / t2 : 0, "MB/s");
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    BitStream bs(&buff[0], (int)buff.length());
+    bs.setPtr(0, 3);
+    bs.write(src.data(), 8 * SIZE);
+  }
+  t2 = Util::getTickCountUs() - t;
+  BenchReport("wordWrite", t2 ? bytes / t2 : 0, "MB/s");
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    int bitPtr = 3;
+    legacyRead((uchar const*)buff.data(), bitPtr, &out[0], 8 * SIZE);
+  }
+  t2 = Util::getTickCountUs() - t;
+  BenchReport("legacyRead", t2 ? bytes / t2 : 0, "MB/s");
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    BitStream bs(&buff[0], (int)buff.length());
+    bs.setPtr(0, 3);
+    bs.read(&out[0], 8 * SIZE);
+  }
+  t2 = Util::getTickCountUs() - t;
+  BenchReport("wordRead", t2 ? bytes / t2 : 0, "MB/s");
+}
+
+//
+// Read and write strings after a bool field, unaligned vs aligned blobs, MB/s
+// of string data.
+//
+
+static double measureString(int align, int view)
+{
+  const int SIZE = 4000;
+  const int LOOP = 20000;
+
+  std::string msg(SIZE, 'x'), buff, s;
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    BitStream bs(buff);
+    bs.setAlignBlob(0 != align);
+    bs << true << msg;
+    bs.reset();
+    bool b;
+    if (view) {
+      uint len;
+      bs >> b >> len;
+      char const* p = bs.readView(len);
+      if (0 == p || 'x' != p[SIZE - 1]) {
+        return 0;
+      }
+    } else {
+      bs >> b >> s;
+    }
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+
+  return t2 ? (double)LOOP * SIZE / t2 : 0;
+}
+
+BENCH(BitStream, string)
+{
+  BenchReport("unaligned", measureString(0, 0), "MB/s");
+  BenchReport("aligned", measureString(1, 0), "MB/s");
+  BenchReport("alignedView", measureString(1, 1), "MB/s");
+}
+
+//
+// Packet size of Smallworld events, fixed 32-bit string length vs varint
+// string length. Layout mirrors swSmallworldEv.cpp: 32-bit magic, 3-bit event
+// id, 4-bit code, 10-bit player id. A session mix of chat, channel and game
+// events, chat messages are 1~120 characters.
+//
+
+static const int EV_HEADER_BITS = 32 + 3 + 4;
+
+static int writeSmallworldEvent(BitStream& bs, int i, bool varint)
+{
+  bs.reset();
+  bs << setBitCount(EV_HEADER_BITS) << 0u;
+  switch (i % 4)
+  {
+  case 0:                               // Channel or game, no string.
+    bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_PLAYER - 1>::value) << (uint)(i % SMALLWORLD_MAX_PLAYER);
+    bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_CHANNEL - 1>::value) << (uint)(i % SMALLWORLD_MAX_CHANNEL);
+    break;
+  default:                              // Chat.
+    {
+      std::string msg(1 + (i * 2654435761u) % 120, 'x');
+      bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_PLAYER - 1>::value) << (uint)(i % SMALLWORLD_MAX_PLAYER);
+      if (varint) {
+        bs << setVarint();
+      }
+      bs << msg;
+    }
+    break;
+  }
+  return bs.getByteCount();
+}
+
+BENCH(BitStream, smallworldEvents)
+{
+  const int COUNT = 10000;
+
+  std::string buff;
+  BitStream bs(buff);
+
+  int fixed = 0, varint = 0;
+  for (int i = 0; i < COUNT; i++) {
+    fixed += writeSmallworldEvent(bs, i, false);
+    varint += writeSmallworldEvent(bs, i, true);
+  }
+
+  BenchReport("fixedBytes", (double)fixed / COUNT, "B/event");
+  BenchReport("varintBytes", (double)varint / COUNT, "B/event");
+  BenchReport("reduction", 100.0 * (fixed - varint) / fixed, "%");
+}
+
+//
+// Snapshot of moving entities, position, velocity and rotation. Full floats vs
+// quantized, position in [-4096,4096] 18 bits, velocity in [-64,64] 12 bits,
+// rotation smallest three 10 bits. Bytes/entity, max error and ns/entity.
+//
+
+struct BenchEntity
+{
+  FloatPoint3 pos, vel;
+  float rot[4];
+};
+
+static void initEntities(std::vector<BenchEntity>& v)
+{
+  for (int i = 0; i < (int)v.size(); i++) {
+    BenchEntity& e = v[i];
+    e.pos = FloatPoint3((i * 37 % 8000) - 4000.5f, (i * 53 % 8000) - 4000.25f, (i % 100) * 0.75f);
+    e.vel = FloatPoint3((i % 128) - 64.0f, (i % 17) * 0.5f, (i % 7) - 3.0f);
+    float a = i * 0.01f;
+    e.rot[0] = 0; e.rot[1] = ::sin(a); e.rot[2] = 0; e.rot[3] = ::cos(a);
+  }
+}
+
+static void writeEntities(BitStream& bs, std::vector<BenchEntity> const& v, bool quantize)
+{
+  bs.reset();
+  for (int i = 0; i < (int)v.size(); i++) {
+    BenchEntity const& e = v[i];
+    if (quantize) {
+      bs << setQuantize(-4096, 4096, 18) << e.pos << setQuantize(-64, 64, 12) << e.vel;
+      bs.writeQuaternion(e.rot);
+    } else {
+      bs << e.pos << e.vel << e.rot[0] << e.rot[1] << e.rot[2] << e.rot[3];
+    }
+  }
+}
+
+BENCH(BitStream, quantize)
+{
+  const int COUNT = 5000;
+  const int LOOP = 200;
+
+  std::vector<BenchEntity> v(COUNT), v2(COUNT);
+  initEntities(v);
+
+  std::string buff;
+  BitStream bs(buff);
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    writeEntities(bs, v, false);
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+  BenchReport("floatBytes", (double)bs.getByteCount() / COUNT, "B/entity");
+  BenchReport("floatWrite", 1000.0 * t2 / LOOP / COUNT, "ns/entity");
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    writeEntities(bs, v, true);
+  }
+  t2 = Util::getTickCountUs() - t;
+  BenchReport("quantizeBytes", (double)bs.getByteCount() / COUNT, "B/entity");
+  BenchReport("quantizeWrite", 1000.0 * t2 / LOOP / COUNT, "ns/entity");
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    for (int i = 0; i < COUNT; i++) {
+      BenchEntity& e = v2[i];
+      bs >> setQuantize(-4096, 4096, 18) >> e.pos >> setQuantize(-64, 64, 12) >> e.vel;
+      bs.readQuaternion(e.rot);
+    }
+  }
+  t2 = Util::getTickCountUs() - t;
+  BenchReport("quantizeRead", 1000.0 * t2 / LOOP / COUNT, "ns/entity");
+
+  float errPos = 0, errRot = 0;
+  for (int i = 0; i < COUNT; i++) {
+    errPos = std::max(errPos, (float)::fabs(v[i].pos.x - v2[i].pos.x));
+    errPos = std::max(errPos, (float)::fabs(v[i].pos.y - v2[i].pos.y));
+    errPos = std::max(errPos, (float)::fabs(v[i].pos.z - v2[i].pos.z));
+    float dot = 0;
+    for (int j = 0; j < 4; j++) {
+      dot += v[i].rot[j] * v2[i].rot[j];
+    }
+    errRot = std::max(errRot, (float)(1 - ::fabs(dot)));
+  }
+  BenchReport("maxPosError", errPos, "unit");
+  BenchReport("maxRotError", errRot, "1-dot");
+}
+
+//
+// Replicate entity state every tick, full encode vs delta against acked
+// baseline. 10% of entities move and 2% change hp each tick, acks arrive 3
+// ticks later. Bytes/tick and us/tick of encode.
+//
+
+class BenchEntityPacket : public BitStreamPacket
+{
+public:
+  SW2_DECLARE_BITSTREAM_PACKET(1, BenchEntityPacket)
+  uint id;
+  FloatPoint3 pos;
+  float rot[4];
+  int hp;
+  virtual bool read(BitStream &bs)
+  {
+    for (int i = 0; i < getFieldCount(); i++) {
+      if (!readField(bs, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  virtual bool write(BitStream &bs) const
+  {
+    for (int i = 0; i < getFieldCount(); i++) {
+      if (!writeField(bs, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  virtual int getFieldCount() const
+  {
+    return 4;
+  }
+  virtual bool readField(BitStream &bs, int index)
+  {
+    switch (index)
+    {
+    case 0:
+      return bs >> setBitCount(16) >> id;
+    case 1:
+      return bs >> setQuantize(-4096, 4096, 18) >> pos;
+    case 2:
+      return bs.readQuaternion(rot);
+    case 3:
+      return bs >> setVarint() >> hp;
+    }
+    return false;
+  }
+  virtual bool writeField(BitStream &bs, int index) const
+  {
+    switch (index)
+    {
+    case 0:
+      return bs << setBitCount(16) << id;
+    case 1:
+      return bs << setQuantize(-4096, 4096, 18) << pos;
+    case 2:
+      return bs.writeQuaternion(rot);
+    case 3:
+      return bs << setVarint() << hp;
+    }
+    return false;
+  }
+};
+
+BENCH(BitStreamPacket, delta)
+{
+  const int COUNT = 1000;
+  const int TICK = 60;
+  const int ACK_DELAY = 3;
+
+  std::vector<BenchEntityPacket> v(COUNT);
+  std::vector<BitStreamPacketBaseline<16>*> base(COUNT);
+  for (int i = 0; i < COUNT; i++) {
+    BenchEntityPacket& p = v[i];
+    p.id = i;
+    p.pos = FloatPoint3((float)(i % 100), (float)(i / 100), 0);
+    p.rot[0] = p.rot[1] = p.rot[2] = 0;
+    p.rot[3] = 1;
+    p.hp = 100;
+    base[i] = new BitStreamPacketBaseline<16>(&BenchEntityPacket::staticCreatePacket);
+  }
+
+  std::string buff;
+  uint64 full = 0, delta = 0, tFull = 0, tDelta = 0;
+
+  for (uint tick = 1; tick <= TICK; tick++) {
+    for (int i = 0; i < COUNT; i++) {
+      uint r = (i + tick) * 2654435761u;
+      if (10 > r % 100) {
+        v[i].pos.x += 0.5f;
+      }
+      if (2 > (r >> 8) % 100) {
+        v[i].hp -= 1;
+      }
+    }
+
+    BitStream bs(buff);
+    uint64 t = Util::getTickCountUs();
+    for (int i = 0; i < COUNT; i++) {
+      v[i].write(bs);
+    }
+    tFull += Util::getTickCountUs() - t;
+    full += bs.getByteCount();
+
+    bs.reset();
+    t = Util::getTickCountUs();
+    for (int i = 0; i < COUNT; i++) {
+      base[i]->writePacket(bs, tick, v[i]);
+      if (ACK_DELAY < tick) {
+        base[i]->ack(tick - ACK_DELAY);
+      }
+    }
+    tDelta += Util::getTickCountUs() - t;
+    delta += bs.getByteCount();
+  }
+
+  BenchReport("fullBytes", (double)full / TICK, "B/tick");
+  BenchReport("deltaBytes", (double)delta / TICK, "B/tick");
+  BenchReport("reduction", 100.0 * (full - delta) / full, "%");
+  BenchReport("fullEncode", (double)tFull / TICK, "us/tick");
+  BenchReport("deltaEncode", (double)tDelta / TICK, "us/tick");
+
+  for (int i = 0; i < COUNT; i++) {
+    delete base[i];
+  }
+}
+
+//
+// Hand written read/write of a Smallworld request event vs same fields by a
+// schema, ns/op of write and read back.
+//
+
+class BenchHandPacket : public BitStreamPacket
+{
+public:
+  SW2_DECLARE_BITSTREAM_PACKET(1, BenchHandPacket)
+  int code;
+  int idPlayer;
+  uint time;
+  std::string stream;
+  virtual bool read(BitStream &bs)
+  {
+    if (!(bs >> setBitCount(BITCOUNT<7 - 1>::value) >> (uint&)code) || 7 <= code) {
+      return false;
+    }
+    if (!(bs >> setBitCount(BITCOUNT<SMALLWORLD_MAX_PLAYER - 1>::value) >> (uint&)idPlayer) || SMALLWORLD_MAX_PLAYER <= idPlayer) {
+      return false;
+    }
+    if (!(bs >> time)) {
+      return false;
+    }
+    if (!(bs >> setBitCount(BITCOUNT<SMALLWORLD_MAX_DATA_STREAM_LENGTH>::value) >> stream)) {
+      return false;
+    }
+    return SMALLWORLD_MAX_DATA_STREAM_LENGTH >= (int)stream.length();
+  }
+  virtual bool write(BitStream &bs) const
+  {
+    if (!(bs << setBitCount(BITCOUNT<7 - 1>::value) << (uint)code)) {
+      return false;
+    }
+    if (!(bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_PLAYER - 1>::value) << (uint)idPlayer)) {
+      return false;
+    }
+    if (!(bs << time)) {
+      return false;
+    }
+    return bs << setBitCount(BITCOUNT<SMALLWORLD_MAX_DATA_STREAM_LENGTH>::value) << stream;
+  }
+};
+
+class BenchSchemaPacket : public BitStreamPacket
+{
+public:
+  SW2_DECLARE_BITSTREAM_PACKET(1, BenchSchemaPacket)
+  int code;
+  int idPlayer;
+  uint time;
+  std::string stream;
+  typedef BitStreamSchema<
+    BitStreamUIntField<BenchSchemaPacket, int, &BenchSchemaPacket::code, 7 - 1>,
+    BitStreamUIntField<BenchSchemaPacket, int, &BenchSchemaPacket::idPlayer, SMALLWORLD_MAX_PLAYER - 1>,
+    BitStreamUIntField<BenchSchemaPacket, uint, &BenchSchemaPacket::time, 0xffffffff>,
+    BitStreamStringField<BenchSchemaPacket, &BenchSchemaPacket::stream, SMALLWORLD_MAX_DATA_STREAM_LENGTH> > Schema;
+  SW2_DECLARE_BITSTREAM_SCHEMA(Schema)
+};
+
+template<class PacketT>
+static double measurePacket()
+{
+  const int LOOP = 200000;
+
+  PacketT p, p2;
+  p.code = 1;
+  p.idPlayer = 123;
+  p.time = 0x12345678;
+  p.stream = "account:password";
+
+  char buff[(BenchSchemaPacket::MAX_BITS + 7) / 8];
+  BitStream bs(buff, sizeof(buff));
+  BitStreamPacket &bp = p, &bp2 = p2;   // Virtual calls as the packet handler.
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    bp.write(bs);
+    bs.reset();
+    bp2.read(bs);
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+
+  return p.stream == p2.stream ? 1000.0 * t2 / LOOP : 0;
+}
+
+BENCH(BitStreamPacket, schema)
+{
+  BenchReport("handWritten", measurePacket<BenchHandPacket>(), "ns/op");
+  BenchReport("schema", measurePacket<BenchSchemaPacket>(), "ns/op");
+  BenchReport("maxBytes", (BenchSchemaPacket::MAX_BITS + 7) / 8, "B");
+}
+
+//
+// Encode a packet for send, a new string per packet vs a buffer on stack as
+// impl::send of Smallworld, ns/op.
+//
+
+BENCH(BitStreamPacket, sendBuffer)
+{
+  const int LOOP = 200000;
+
+  BitStreamPacketHandler<2> h(32, 0xfeed);
+  BenchSchemaPacket p;
+  p.code = 1;
+  p.idPlayer = 123;
+  p.time = 0x12345678;
+  p.stream = "account:password";
+
+  uint sum1 = 0, sum2 = 0;
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    std::string buff;
+    BitStream bs(buff);
+    h.writePacket(bs, p);
+    sum1 += (uchar)buff[bs.getByteCount() - 1];
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+  BenchReport("string", 1000.0 * t2 / LOOP, "ns/op");
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    char buff[2048];
+    BitStream bs(buff, sizeof(buff));
+    h.writePacket(bs, p);
+    buff[bs.getBytePtr()] &= (char)((1 << bs.getBitPtr()) - 1);
+    sum2 += (uchar)buff[bs.getByteCount() - 1];
+  }
+  t2 = Util::getTickCountUs() - t;
+  BenchReport("stack", 1000.0 * t2 / LOOP, "ns/op");
+
+  BenchReport("identical", sum1 == sum2 ? 1 : 0, "bool");
+}
+
+//
+// Read and free packets, shared cache without lock, with lock and magazine,
+// ns/op of a read/free cycle.
+//
+
+static double measureCache(int mode)
+{
+  const int LOOP = 200000;
+
+  BitStreamPacketHandler<2> h;
+  SW2_REGISTER_BITSTREAM_PACKET(h, 1, BenchSchemaPacket);
+  h.setThreadSafe(0 != mode);
+  BitStreamPacketHandler<2>::Magazine mag(h);
+
+  BenchSchemaPacket p;
+  p.code = 1;
+  p.idPlayer = 123;
+  p.time = 0;
+  char buff[64];
+  BitStream bs(buff, sizeof(buff));
+  h.writePacket(bs, p);
+
+  const BitStreamPacket *pp = 0;
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    if (2 == mode) {
+      h.readPacket(bs, &pp, mag);
+      h.freePacket(pp, mag);
+    } else {
+      h.readPacket(bs, &pp);
+      h.freePacket(pp);
+    }
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+
+  return 1000.0 * t2 / LOOP;
+}
+
+BENCH(BitStreamPacket, cache)
+{
+  BenchReport("noLock", measureCache(0), "ns/op");
+  BenchReport("lock", measureCache(1), "ns/op");
+  BenchReport("magazine", measureCache(2), "ns/op");
+}
+
+//
+// Handle a batch of packets, read from cache and switch by ID vs dispatch to
+// typed handlers, ns/op per packet.
+//
+
+class BenchDispatchHandler
+{
+public:
+  uint sum;
+  bool onPacket(int, BenchSchemaPacket &p)
+  {
+    sum += p.time;
+    return true;
+  }
+};
+
+BENCH(BitStreamPacket, dispatch)
+{
+  const int BATCH = 32;
+  const int LOOP = 10000;
+
+  BitStreamPacketHandler<2> h(32, 0xfeed);
+  SW2_REGISTER_BITSTREAM_PACKET(h, 1, BenchSchemaPacket);
+
+  BenchSchemaPacket p;
+  p.code = 1;
+  p.idPlayer = 123;
+  p.stream = "player";
+  std::string s;
+  BitStream bs(s);
+  for (int i = 0; i < BATCH; i++) {
+    p.time = i;
+    h.writePacket(bs, p);
+  }
+
+  uint sum1 = 0;
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    const BitStreamPacket *pp;
+    while (h.readPacket(bs, &pp)) {
+      switch (pp->getId())
+      {
+      case 1:
+        sum1 += ((const BenchSchemaPacket*)pp)->time;
+        break;
+      }
+      h.freePacket(pp);
+    }
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+  BenchReport("readPacket", 1000.0 * t2 / LOOP / BATCH, "ns/op");
+
+  BenchDispatchHandler bh;
+  bh.sum = 0;
+  BitStreamPacketDispatcher<2, BenchDispatchHandler, int> d(h, bh);
+  d.registerHandler<BenchSchemaPacket, &BenchDispatchHandler::onPacket>();
+
+  t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    d.dispatch(bs, 0);
+  }
+  t2 = Util::getTickCountUs() - t;
+  BenchReport("dispatch", 1000.0 * t2 / LOOP / BATCH, "ns/op");
+
+  BenchReport("identical", sum1 == bh.sum ? 1 : 0, "bool");
+}
+
+// end of BenchBitStream.cpp
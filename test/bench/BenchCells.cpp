@@ -0,0 +1,156 @@
+
+//
+//  Cells benchmark.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <vector>
+
+#include "Bench.h"
+
+#include "swCells.h"
+#include "swThreadPool.h"
+#include "swUtil.h"
+using namespace sw2;
+
+//
+// NPCs walk a few units every tick, most of them stay in the same cell. ns
+// per object of move one by one versus moveBatch.
+//
+
+static const int NUM_NPC = 10000;
+static const int NUM_TICK = 200;
+
+template<typename ValueT>
+class BenchCellsNpc
+{
+public:
+
+  Cells<int, ValueT, NUM_NPC> grid;
+  std::vector<int> ids;
+  std::vector<ValueT> xs, ys;
+  uint seed;
+
+  BenchCellsNpc() : seed(1)
+  {
+    grid.init(0, 0, 30, 30, 64, 64);    // 1920 x 1920.
+    for (int i = 0; i < NUM_NPC; i++) {
+      xs.push_back((ValueT)(rand_() % 1920));
+      ys.push_back((ValueT)(rand_() % 1920));
+      ids.push_back(grid.alloc(i, xs[i], ys[i]));
+    }
+  }
+
+  uint rand_()
+  {
+    seed = seed * 1103515245 + 12345;   // Same walk of each instance.
+    return seed >> 16;
+  }
+
+  void walk()
+  {
+    for (int i = 0; i < NUM_NPC; i++) {
+      xs[i] = (ValueT)((int)(xs[i] + 1920 + rand_() % 5 - 2) % 1920);
+      ys[i] = (ValueT)((int)(ys[i] + 1920 + rand_() % 5 - 2) % 1920);
+    }
+  }
+};
+
+template<typename ValueT>
+static void measureMove(char const* name)
+{
+  BenchCellsNpc<ValueT> b1, b2;
+  uint64 t1 = 0, t2 = 0;
+  char item[32];
+
+  for (int n = 0; n < NUM_TICK; n++) {
+    b1.walk();
+    uint64 t = Util::getTickCountUs();
+    for (int i = 0; i < NUM_NPC; i++) {
+      b1.grid.move(b1.ids[i], b1.xs[i], b1.ys[i]);
+    }
+    t1 += Util::getTickCountUs() - t;
+
+    b2.walk();
+    t = Util::getTickCountUs();
+    b2.grid.moveBatch(&b2.ids[0], &b2.xs[0], &b2.ys[0], NUM_NPC);
+    t2 += Util::getTickCountUs() - t;
+  }
+
+  ::sprintf(item, "move_%s", name);
+  BenchReport(item, 1000.0 * t1 / NUM_TICK / NUM_NPC, "ns/obj");
+  ::sprintf(item, "moveBatch_%s", name);
+  BenchReport(item, 1000.0 * t2 / NUM_TICK / NUM_NPC, "ns/obj");
+  ::sprintf(item, "identical_%s", name);
+  BenchReport(item, b1.grid.objcell == b2.grid.objcell ? 1 : 0, "bool");
+}
+
+BENCH(Cells, move)
+{
+  measureMove<int>("int");
+  measureMove<float>("float");
+}
+
+//
+// Every NPC searches around itself, radius 60 and max 32 objects. ns per
+// query of search one by one versus CellsQueryBatch of 0-8 tasks.
+//
+
+struct BenchCellsCount
+{
+  int n;
+  BenchCellsCount() : n(0) {}
+  bool operator()(int, float, float) { n += 1; return true; }
+};
+
+BENCH(Cells, query)
+{
+  typedef Cells<int, float, NUM_NPC> CellsT;
+  const int LOOP = 20;
+
+  BenchCellsNpc<float> b;
+  char item[32];
+
+  int sum1 = 0;
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    for (int i = 0; i < NUM_NPC; i++) {
+      BenchCellsCount c;
+      b.grid.search(b.xs[i], b.ys[i], 60.0f, 32, c);
+      sum1 += c.n;
+    }
+  }
+  BenchReport("search", 1000.0 * (Util::getTickCountUs() - t) / LOOP / NUM_NPC, "ns/query");
+
+  if (!InitializeThreadPool(8)) {
+    return;
+  }
+
+  CellsQueryBatch<CellsT> batch;
+  for (int nThread = 0; nThread <= 8; nThread = nThread ? 2 * nThread : 1) {
+    int sum2 = 0;
+    t = Util::getTickCountUs();
+    for (int n = 0; n < LOOP; n++) {
+      batch.clear();
+      for (int i = 0; i < NUM_NPC; i++) {
+        batch.addSearch(b.xs[i], b.ys[i], 60.0f, 32);
+      }
+      batch.run(b.grid, nThread);
+      for (int i = 0; i < NUM_NPC; i++) {
+        sum2 += batch.getCount(i);
+      }
+    }
+    ::sprintf(item, "batch%d", nThread);
+    BenchReport(item, 1000.0 * (Util::getTickCountUs() - t) / LOOP / NUM_NPC, "ns/query");
+    ::sprintf(item, "identical%d", nThread);
+    BenchReport(item, sum1 == sum2 ? 1 : 0, "bool");
+  }
+
+  UninitializeThreadPool();
+}
+
+// end of BenchCells.cpp
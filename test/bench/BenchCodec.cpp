@@ -0,0 +1,263 @@
+
+//
+//  BitStream and packet codec benchmark.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <string>
+
+#include "Bench.h"
+
+#include "swBitStream.h"
+#include "swBitStreamPacket.h"
+#include "swSmallworld.h"
+#include "swUtil.h"
+#include "../../src/swSmallworldEv.h"
+using namespace sw2;
+
+//
+// Measure a codec loop, report ns/op, MB/s of encoded stream and allocs/op.
+//
+
+class CodecTimer
+{
+public:
+
+  CodecTimer() : mTime(Util::getTickCountUs()), mAlloc(BenchGetAllocCount())
+  {
+  }
+
+  void report(char const* item, int ops, double bytes)
+  {
+    uint64 t = Util::getTickCountUs() - mTime;
+    long alloc = BenchGetAllocCount() - mAlloc; // Before report, it allocates.
+    BenchReport(item, 1000.0 * t / ops, "ns/op");
+    BenchReport(item, t ? bytes / t : 0, "MB/s"); // Bytes per microsecond is MB/s.
+    BenchReport(item, (double)alloc / ops, "allocs/op");
+  }
+
+  uint64 mTime;
+  long mAlloc;
+};
+
+static const int NUM_VALUE = 1000;      // Values per buffer.
+static const int NUM_LOOP = 1000;
+
+//
+// Write and read uint of a bit width.
+//
+
+static void measureUInt(int bitCount)
+{
+  std::string buff(NUM_VALUE * 4 + 8, 0);
+  double bytes = (double)NUM_LOOP * NUM_VALUE * bitCount / 8;
+  char item[32];
+
+  CodecTimer tw;
+  for (int n = 0; n < NUM_LOOP; n++) {
+    BitStream bs(&buff[0], (int)buff.length());
+    for (int i = 0; i < NUM_VALUE; i++) {
+      bs << setBitCount(bitCount) << (uint)(i * 2654435761u);
+    }
+  }
+  ::sprintf(item, "write%d", bitCount);
+  tw.report(item, NUM_LOOP * NUM_VALUE, bytes);
+
+  CodecTimer tr;
+  for (int n = 0; n < NUM_LOOP; n++) {
+    BitStream bs(&buff[0], (int)buff.length());
+    for (int i = 0; i < NUM_VALUE; i++) {
+      uint u;
+      bs >> setBitCount(bitCount) >> u;
+    }
+  }
+  ::sprintf(item, "read%d", bitCount);
+  tr.report(item, NUM_LOOP * NUM_VALUE, bytes);
+}
+
+BENCH(Codec, uint)
+{
+  static const int bits[] = {1, 3, 5, 8, 13, 16, 24, 32};
+  for (int i = 0; i < (int)(sizeof(bits) / sizeof(bits[0])); i++) {
+    measureUInt(bits[i]);
+  }
+}
+
+//
+// Write and read float, double and quantized float.
+//
+
+template<class T>
+static void measureFloat(char const* name, setQuantize q)
+{
+  std::string buff(NUM_VALUE * sizeof(T) + 8, 0);
+  char item[32];
+
+  CodecTimer tw;
+  BitStream bs(&buff[0], (int)buff.length());
+  for (int n = 0; n < NUM_LOOP; n++) {
+    bs.reset();
+    bs << q;
+    for (int i = 0; i < NUM_VALUE; i++) {
+      bs << (T)(i * 0.001);
+    }
+  }
+  double bytes = (double)NUM_LOOP * bs.getByteCount();
+  ::sprintf(item, "write_%s", name);
+  tw.report(item, NUM_LOOP * NUM_VALUE, bytes);
+
+  T sum = 0;
+  CodecTimer tr;
+  for (int n = 0; n < NUM_LOOP; n++) {
+    bs.reset();
+    bs >> q;
+    for (int i = 0; i < NUM_VALUE; i++) {
+      T f;
+      bs >> f;
+      sum += f;
+    }
+  }
+  ::sprintf(item, "read_%s", name);
+  tr.report(item, NUM_LOOP * NUM_VALUE, bytes + (0 < sum ? 0 : 1));
+}
+
+BENCH(Codec, float)
+{
+  measureFloat<float>("float", setQuantize(0, 0, 0));
+  measureFloat<double>("double", setQuantize(0, 0, 0));
+  measureFloat<float>("quantize12", setQuantize(0, 1, 12));
+}
+
+//
+// Write and read strings of a length.
+//
+
+static void measureString(int len)
+{
+  const int COUNT = 100;                // Strings per buffer.
+  const int LOOP = 1000;
+
+  std::string buff(COUNT * (len + 4) + 8, 0);
+  std::string s(len, 'x');
+  char item[32];
+
+  CodecTimer tw;
+  BitStream bs(&buff[0], (int)buff.length());
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    for (int i = 0; i < COUNT; i++) {
+      bs << s;
+    }
+  }
+  double bytes = (double)LOOP * bs.getByteCount();
+  ::sprintf(item, "write%d", len);
+  tw.report(item, LOOP * COUNT, bytes);
+
+  std::string s2;                       // Reused, no allocation after first.
+  CodecTimer tr;
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    for (int i = 0; i < COUNT; i++) {
+      bs >> s2;
+    }
+  }
+  ::sprintf(item, "read%d", len);
+  tr.report(item, LOOP * COUNT, bytes + (s == s2 ? 0 : 1));
+}
+
+BENCH(Codec, string)
+{
+  measureString(8);
+  measureString(64);
+  measureString(512);
+}
+
+//
+// Encode and decode Smallworld events by the packet handler of Smallworld,
+// write with writePacket to a stack buffer as impl::send, read with
+// readPacket/freePacket.
+//
+
+static void measureEvent(char const* name, BitStreamPacket const& p)
+{
+  const int LOOP = 100000;
+
+  BitStreamPacketHandler<impl::EID_LAST_TAG> &h = impl::getPacketHandler();
+  char buff[SMALLWORLD_MAX_DATA_STREAM_LENGTH + 64];
+  char item[32];
+
+  CodecTimer tw;
+  BitStream bs(buff, sizeof(buff));
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    h.writePacket(bs, p);
+  }
+  double bytes = (double)LOOP * bs.getByteCount();
+  ::sprintf(item, "write_%s", name);
+  tw.report(item, LOOP, bytes);
+
+  int count = 0;
+  CodecTimer tr;
+  for (int n = 0; n < LOOP; n++) {
+    bs.reset();
+    const BitStreamPacket *p2;
+    if (h.readPacket(bs, &p2)) {
+      count += 1;
+      h.freePacket(p2);
+    }
+  }
+  ::sprintf(item, "read_%s", name);
+  tr.report(item, LOOP, LOOP == count ? bytes : 0);
+}
+
+BENCH(Codec, smallworld)
+{
+  if (!InitializeSmallworld()) {
+    return;
+  }
+
+  impl::evSmallworldNotify en;
+  en.code = impl::evSmallworldNotify::NC_LOGIN_ACCEPTED;
+  en.id = 123;
+  measureEvent("notify", en);
+
+  impl::evSmallworldLogin el;
+  el.verMajor = SMALLWORLD_VERSION_MAJOR;
+  el.verMinor = SMALLWORLD_VERSION_MINOR;
+  el.bNeedPlayerList = el.bNeedGameList = el.bNeedMessage = true;
+  el.stream = "account:password";
+  measureEvent("login", el);
+
+  impl::evSmallworldChannel ec;
+  ec.code = impl::evSmallworldChannel::NC_PLAYER_ADD;
+  ec.idPlayer = 123;
+  ec.iChannel = 3;
+  measureEvent("channel", ec);
+
+  impl::evSmallworldChat et;
+  et.code = impl::evSmallworldChat::NC_CHAT_FROM;
+  et.idWho = 123;
+  et.msg = "Hello everyone in this channel, good game!";
+  measureEvent("chat", et);
+
+  impl::evSmallworldGame eg;
+  eg.code = impl::evSmallworldGame::NC_JOIN;
+  eg.idGame = 12;
+  eg.idPlayer = 123;
+  measureEvent("game", eg);
+
+  impl::evSmallworldRequest er;
+  er.code = impl::evSmallworldRequest::NC_PLAYER_LOGIN;
+  er.idPlayer = 123;
+  er.time = 0x12345678;
+  er.stream = "account:password";
+  measureEvent("request", er);
+
+  UninitializeSmallworld();
+}
+
+// end of BenchCodec.cpp
@@ -0,0 +1,290 @@
+
+//
+//  Network benchmark.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <vector>
+
+#include "Bench.h"
+
+#include "swIni.h"
+#include "swNetwork.h"
+#include "swThreadPool.h"
+#include "swUtil.h"
+using namespace sw2;
+
+class BenchNetworkClient : public NetworkClientCallback
+{
+public:
+
+  NetworkClient* mClient;
+
+  int mRecv;
+  bool mReady;
+
+  BenchNetworkClient() : mRecv(0), mReady(false)
+  {
+    mClient = NetworkClient::alloc(this);
+  }
+
+  virtual ~BenchNetworkClient()
+  {
+    NetworkClient::free(mClient);
+  }
+
+  virtual void onNetworkServerReady(NetworkClient*)
+  {
+    mReady = true;
+  }
+
+  virtual void onNetworkServerLeave(NetworkClient*)
+  {
+    mReady = false;
+  }
+
+  virtual void onNetworkStreamReady(NetworkClient*, int, void const*)
+  {
+    mRecv += 1;
+  }
+};
+
+class BenchNetworkServer : public NetworkServerCallback
+{
+public:
+
+  NetworkServer* mServer;
+
+  int mOnline;
+
+  BenchNetworkServer() : mOnline(0)
+  {
+    mServer = NetworkServer::alloc(this);
+  }
+
+  virtual ~BenchNetworkServer()
+  {
+    NetworkServer::free(mServer);
+  }
+
+  virtual bool onNetworkNewClientReady(NetworkServer*, NetworkConnection*)
+  {
+    mOnline += 1;
+    return true;
+  }
+
+  virtual void onNetworkClientLeave(NetworkServer*, NetworkConnection*)
+  {
+    mOnline -= 1;
+  }
+
+  virtual void onNetworkStreamReady(NetworkServer*, NetworkConnection* pClient, int len, void const* pStream)
+  {
+    pClient->send(len, pStream);        // Echo.
+  }
+};
+
+class BenchHeavyServer : public BenchNetworkServer
+{
+public:
+
+  virtual void onNetworkStreamReady(NetworkServer*, NetworkConnection* pClient, int len, void const* pStream)
+  {
+    //
+    // Simulate a CPU heavy handler, about tens of microseconds.
+    //
+
+    uint h = 0;
+    for (int i = 0; i < 20000; i++) {
+      h = h * 31 + ((uchar const*)pStream)[i % len];
+    }
+
+    if (0 != h) {
+      pClient->send(len, pStream);      // Echo.
+    }
+  }
+};
+
+static void triggerAll(BenchNetworkServer& s, std::vector<BenchNetworkClient*>& c)
+{
+  s.mServer->trigger();
+  for (size_t i = 0; i < c.size(); i++) {
+    c[i]->mClient->trigger();
+  }
+}
+
+static double measureIdleConnection(bool bLean, char const* addr)
+{
+  const int NUM_CLIENT = 4000;          // 2 sockets per connection, keep under fd limit.
+
+  Ini conf;
+  conf["AddrListen"] = addr;
+  conf["LeanMode"] = bLean;
+
+  BenchNetworkServer s;
+  if (!s.mServer->startup(conf)) {
+    return 0;
+  }
+
+  //
+  // Connect all clients.
+  //
+
+  std::vector<BenchNetworkClient*> c;
+  for (int i = 0; i < NUM_CLIENT; i++) {
+    c.push_back(new BenchNetworkClient);
+    c[i]->mClient->connect(addr);
+    if (0 == i % 200) {
+      triggerAll(s, c);
+    }
+  }
+
+  TimeoutTimer lt(60000);
+  while (!lt.isExpired() && NUM_CLIENT != s.mOnline) {
+    triggerAll(s, c);
+  }
+
+  //
+  // Each client sends a message bigger than a packet, then keeps idle.
+  //
+
+  std::string msg(4000, 'x');
+  for (int i = 0; i < NUM_CLIENT; i++) {
+    c[i]->mClient->send((int)msg.length(), msg.data());
+  }
+
+  lt.setTimeout(60000);
+  int recv = 0;
+  while (!lt.isExpired() && NUM_CLIENT != recv) {
+    triggerAll(s, c);
+    recv = 0;
+    for (int i = 0; i < NUM_CLIENT; i++) {
+      recv += c[i]->mRecv;
+    }
+  }
+
+  for (int i = 0; i < 10; i++) {
+    triggerAll(s, c);
+  }
+
+  NetworkServerStats ns = s.mServer->getNetStats();
+  double bytes = s.mOnline ? ns.bytesMem / (double)s.mOnline : 0;
+
+  //
+  // Disconnect all clients.
+  //
+
+  for (int i = 0; i < NUM_CLIENT; i++) {
+    c[i]->mClient->disconnect();
+  }
+
+  lt.setTimeout(60000);
+  while (!lt.isExpired() && 0 != s.mOnline) {
+    triggerAll(s, c);
+  }
+
+  for (int i = 0; i < NUM_CLIENT; i++) {
+    delete c[i];
+  }
+
+  return bytes;
+}
+
+static double measureHeavyHandler(bool bPipeline, char const* addr)
+{
+  const int NUM_CLIENT = 16;
+  const int NUM_MSG = 500;
+
+  BenchHeavyServer s;
+  s.mServer->setPipeline(bPipeline);
+  if (!s.mServer->startup(addr)) {
+    return 0;
+  }
+
+  std::vector<BenchNetworkClient*> c;
+  for (int i = 0; i < NUM_CLIENT; i++) {
+    c.push_back(new BenchNetworkClient);
+    c[i]->mClient->connect(addr);
+  }
+
+  TimeoutTimer lt(10000);
+  while (!lt.isExpired() && NUM_CLIENT != s.mOnline) {
+    triggerAll(s, c);
+  }
+
+  //
+  // Send all messages, and wait all echoed.
+  //
+
+  std::string msg(64, 'x');
+  uint64 t = Util::getTickCountUs();
+
+  for (int j = 0; j < NUM_MSG; j++) {
+    for (int i = 0; i < NUM_CLIENT; i++) {
+      c[i]->mClient->send((int)msg.length(), msg.data());
+    }
+  }
+
+  lt.setTimeout(60000);
+  int recv = 0;
+  while (!lt.isExpired() && NUM_CLIENT * NUM_MSG != recv) {
+    triggerAll(s, c);
+    recv = 0;
+    for (int i = 0; i < NUM_CLIENT; i++) {
+      recv += c[i]->mRecv;
+    }
+  }
+
+  t = Util::getTickCountUs() - t;
+
+  for (int i = 0; i < NUM_CLIENT; i++) {
+    c[i]->mClient->disconnect();
+  }
+
+  lt.setTimeout(10000);
+  while (!lt.isExpired() && 0 != s.mOnline) {
+    triggerAll(s, c);
+  }
+
+  for (int i = 0; i < NUM_CLIENT; i++) {
+    delete c[i];
+  }
+
+  return t ? recv * 1000000.0 / t : 0;
+}
+
+//
+// Memory used by an idle connection of server.
+//
+
+BENCH(Network, idleConnection)
+{
+  InitializeNetwork();
+
+  BenchReport("default", measureIdleConnection(false, "127.0.0.1:2400"), "bytes/conn");
+  BenchReport("lean", measureIdleConnection(true, "127.0.0.1:2401"), "bytes/conn");
+
+  UninitializeNetwork();
+}
+
+//
+// Throughput of heavy stream handler, with and without pipeline mode.
+//
+
+BENCH(Network, heavyHandler)
+{
+  InitializeNetwork();
+  InitializeThreadPool(8);
+
+  BenchReport("default", measureHeavyHandler(false, "127.0.0.1:2402"), "msg/s");
+  BenchReport("pipeline", measureHeavyHandler(true, "127.0.0.1:2403"), "msg/s");
+
+  UninitializeThreadPool();
+  UninitializeNetwork();
+}
+
+// end of BenchNetwork.cpp
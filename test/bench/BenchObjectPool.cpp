@@ -0,0 +1,353 @@
+
+//
+//  ObjectPool benchmark.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+
+#include "swObjectPool.h"
+#include "swThreadPool.h"
+#include "swUtil.h"
+using namespace sw2;
+
+//
+// Iterate a pool after churn, ns per used entity of a walk.
+//
+
+struct BenchPoolObj
+{
+  int value;
+  char payload[60];                     // A cache line per object.
+};
+
+static const int POOL_SIZE = 1 << 16;
+
+template<class PoolT>
+static void churnPool(PoolT &p)
+{
+  for (int i = 0; i < POOL_SIZE; i++) {
+    p[p.alloc()].value = i;
+  }
+
+  ::srand(1);
+  for (int n = 0; n < 4 * POOL_SIZE; n++) {
+    int i = ::rand() % POOL_SIZE;
+    if (p.isUsed(i)) {
+      p.free(i);
+    } else {
+      p[p.alloc(i)].value = i;
+    }
+  }
+}
+
+template<class PoolT>
+static double measureIterate(PoolT &p, int &sum)
+{
+  const int LOOP = 200;
+
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    for (int i = p.first(); -1 != i; i = p.next(i)) {
+      sum += p[i].value;
+    }
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+
+  return 1000.0 * t2 / LOOP / p.size();
+}
+
+struct BenchPoolSum
+{
+  int sum;
+  BenchPoolSum() : sum(0) {}
+  void operator()(BenchPoolObj &o) { sum += o.value; }
+};
+
+BENCH(ObjectPool, iterate)
+{
+  ObjectPool<BenchPoolObj, POOL_SIZE> *p1 = new ObjectPool<BenchPoolObj, POOL_SIZE>;
+  DenseObjectPool<BenchPoolObj, POOL_SIZE> *p2 = new DenseObjectPool<BenchPoolObj, POOL_SIZE>;
+  churnPool(*p1);
+  churnPool(*p2);
+
+  int sum1 = 0, sum2 = 0;
+  BenchReport("list", measureIterate(*p1, sum1), "ns/obj");
+  BenchReport("dense", measureIterate(*p2, sum2), "ns/obj");
+
+  const int LOOP = 200;
+  int sum3 = 0;
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < LOOP; n++) {
+    sum3 += p2->forEach(BenchPoolSum()).sum;
+  }
+  BenchReport("forEach", 1000.0 * (Util::getTickCountUs() - t) / LOOP / p2->size(), "ns/obj");
+
+  BenchReport("identical", sum1 == sum2 && sum2 == sum3 ? 1 : 0, "bool");
+
+  delete p1;
+  delete p2;
+}
+
+//
+// Alloc entities to an auto grow pool, ns/alloc and the worst alloc which
+// grows the pool.
+//
+
+BENCH(ObjectPool, grow)
+{
+  const int COUNT = 1 << 20;
+
+  ObjectPool<BenchPoolObj, 16, true> p;
+  uint64 worst = 0;
+
+  uint64 t = Util::getTickCountUs();
+  for (int i = 0; i < COUNT; i++) {
+    uint64 t1 = Util::getTickCountUs();
+    p[p.alloc()].value = i;
+    uint64 t2 = Util::getTickCountUs() - t1;
+    if (worst < t2) {
+      worst = t2;
+    }
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+
+  BenchReport("alloc", 1000.0 * t2 / COUNT, "ns/op");
+  BenchReport("worst", (double)worst, "us");
+}
+
+//
+// Construct a pool of 4096 entities with a string, as the child node pool of
+// Bigworld, time and resident memory, then alloc 100 entities.
+//
+
+struct BenchNodeObj
+{
+  std::string id;
+  char payload[224];
+};
+
+static long getRss()
+{
+  long size = 0, rss = 0;
+  FILE *f = ::fopen("/proc/self/statm", "r");
+  if (f) {
+    if (2 != ::fscanf(f, "%ld %ld", &size, &rss)) {
+      rss = 0;
+    }
+    ::fclose(f);
+  }
+  return rss * 4;                       // KB of 4K pages.
+}
+
+template<class PoolT>
+static void measureStartup(char const* name)
+{
+  char item[32];
+
+  long rss = getRss();
+  uint64 t = Util::getTickCountUs();
+  PoolT *p = new PoolT;
+  uint64 t2 = Util::getTickCountUs() - t;
+  long rss2 = getRss();
+
+  ::sprintf(item, "%sStartup", name);
+  BenchReport(item, (double)t2, "us");
+  ::sprintf(item, "%sRss", name);
+  BenchReport(item, (double)(rss2 - rss), "KB");
+
+  for (int i = 0; i < 100; i++) {
+    (*p)[p->alloc()].id = "node";
+  }
+  ::sprintf(item, "%sRss100", name);
+  BenchReport(item, (double)(getRss() - rss), "KB");
+
+  t = Util::getTickCountUs();
+  delete p;
+  ::sprintf(item, "%sShutdown", name);
+  BenchReport(item, (double)(Util::getTickCountUs() - t), "us");
+}
+
+BENCH(ObjectPool, lazy)
+{
+  measureStartup<ObjectPool<BenchNodeObj, 4096> >("default");
+  measureStartup<LazyObjectPool<BenchNodeObj, 4096> >("lazy");
+}
+
+//
+// Alloc, lookup and free by 1-32 threads, a pool guarded by a mutex as the
+// task pool of ThreadPool was versus the lock free pool, ns per op of all
+// threads.
+//
+
+static const int CONCURRENT_POOL_SIZE = 4096;
+static const int CONCURRENT_OPS = 100000; // Ops per thread.
+
+class BenchLockedPool
+{
+public:
+
+  BenchLockedPool() : mLock(ThreadLock::alloc())
+  {
+  }
+
+  ~BenchLockedPool()
+  {
+    ThreadLock::free(mLock);
+  }
+
+  int alloc()
+  {
+    mLock->lock();
+    int i = mPool.alloc();
+    mLock->unlock();
+    return i;
+  }
+
+  void free(int i)
+  {
+    mLock->lock();
+    mPool.free(i);
+    mLock->unlock();
+  }
+
+  BenchPoolObj* get(int i)
+  {
+    mLock->lock();
+    BenchPoolObj* p = mPool.isUsed(i) ? &mPool[i] : 0;
+    mLock->unlock();
+    return p;
+  }
+
+  ThreadLock* mLock;
+  ObjectPool<BenchPoolObj, CONCURRENT_POOL_SIZE> mPool;
+};
+
+template<class PoolT>
+class BenchPoolTask : public ThreadTask
+{
+public:
+
+  PoolT* mPool;
+
+  virtual void threadTask()
+  {
+    int h[4];
+    for (int n = 0; n < CONCURRENT_OPS; n += 4) {
+      for (int i = 0; i < 4; i++) {
+        h[i] = mPool->alloc();
+      }
+      for (int i = 0; i < 4; i++) {
+        BenchPoolObj* p = mPool->get(h[i]);
+        if (p) {
+          p->value = n;
+        }
+        mPool->free(h[i]);
+      }
+    }
+  }
+};
+
+template<class PoolT>
+static double measureConcurrent(int nThread)
+{
+  PoolT *p = new PoolT;
+  std::vector<BenchPoolTask<PoolT> > t(nThread);
+
+  uint64 t1 = Util::getTickCountUs();
+  for (int i = 0; i < nThread; i++) {
+    t[i].mPool = p;
+    t[i].runTask();
+  }
+
+  for (int i = 0; i < nThread; i++) {
+    while (t[i].isRunning()) {
+      Util::sleep(1);
+    }
+  }
+  uint64 t2 = Util::getTickCountUs() - t1;
+
+  delete p;
+  return 1000.0 * t2 / nThread / CONCURRENT_OPS;
+}
+
+BENCH(ObjectPool, concurrent)
+{
+  if (!InitializeThreadPool(32)) {
+    return;
+  }
+
+  char item[32];
+  for (int n = 1; n <= 32; n *= 2) {
+    ::sprintf(item, "locked%d", n);
+    BenchReport(item, measureConcurrent<BenchLockedPool>(n), "ns/op");
+    ::sprintf(item, "lockfree%d", n);
+    BenchReport(item, measureConcurrent<ConcurrentObjectPool<BenchPoolObj, CONCURRENT_POOL_SIZE> >(n), "ns/op");
+  }
+
+  UninitializeThreadPool();
+}
+
+//
+// Transient strings and vectors of a tick, e.g. decoded messages and split
+// tokens, from heap versus from a per tick arena. ns and allocs per tick,
+// bytes served by the arena per tick.
+//
+
+template<class StrT, class VecT, class AllocT>
+static void runTick(AllocT const& a, int &sum)
+{
+  for (int i = 0; i < 100; i++) {
+    StrT s(a);                          // A decoded chat message.
+    s.assign(40 + i % 50, 'a');
+    s += " from player";
+    VecT v(a);                          // Split tokens.
+    for (int j = 0; j < 8; j++) {
+      v.push_back((int)s.length() + j);
+    }
+    sum += (int)s.length() + v[7];
+  }
+}
+
+BENCH(ObjectPool, arena)
+{
+  const int TICK = 10000;
+  int sum1 = 0, sum2 = 0;
+
+  long alloc = BenchGetAllocCount();
+  uint64 t = Util::getTickCountUs();
+  for (int n = 0; n < TICK; n++) {
+    runTick<std::string, std::vector<int> >(std::allocator<char>(), sum1);
+  }
+  uint64 t2 = Util::getTickCountUs() - t;
+  long alloc2 = BenchGetAllocCount() - alloc;
+  BenchReport("heap", 1000.0 * t2 / TICK, "ns/tick");
+  BenchReport("heap", (double)alloc2 / TICK, "allocs/tick");
+
+  TickArena arena;
+  alloc = BenchGetAllocCount();
+  t = Util::getTickCountUs();
+  for (int n = 0; n < TICK; n++) {
+    arena.reset();
+    runTick<ArenaString, std::vector<int, ArenaAllocator<int> > >(ArenaAllocator<char>(arena), sum2);
+  }
+  t2 = Util::getTickCountUs() - t;
+  alloc2 = BenchGetAllocCount() - alloc;
+  BenchReport("arena", 1000.0 * t2 / TICK, "ns/tick");
+  BenchReport("arena", (double)alloc2 / TICK, "allocs/tick");
+  BenchReport("arena", (double)arena.getLastTickBytes(), "bytes/tick");
+
+  BenchReport("identical", sum1 == sum2 ? 1 : 0, "bool");
+}
+
+// end of BenchObjectPool.cpp
@@ -0,0 +1,115 @@
+
+//
+//  Benchmarks.
+//
+//  Copyright (c) 2026 Waync Cheng.
+//  All Rights Reserved.
+//
+//  Usage: bench.exe [-csv] [filter], only run benchmarks with name contains
+//  filter, -csv outputs comma separated values for scripts.
+//
+//  2026/10/18 Waync created.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "Bench.h"
+
+#include "swUtil.h"
+
+static Bench* sFirst = 0, *sLast = 0;
+static Bench* sCurr = 0;
+static bool sCsv = false;
+static long volatile sAllocCount = 0;
+
+//
+// Count allocations.
+//
+
+void* operator new(size_t size)
+{
+  sw2::Util::atomicIncrement(&sAllocCount);
+  void* p = ::malloc(size ? size : 1);
+  if (0 == p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+  ::free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+  ::free(p);
+}
+
+long BenchGetAllocCount()
+{
+  return sAllocCount;
+}
+
+Bench::Bench(char const* group, char const* name) : mGroup(group), mName(name), mNext(0)
+{
+  if (0 == sFirst) {                    // Keep declaration order.
+    sFirst = this;
+  } else {
+    sLast->mNext = this;
+  }
+  sLast = this;
+}
+
+std::string Bench::getName() const
+{
+  return std::string(mGroup) + "." + mName;
+}
+
+Bench* Bench::getFirst()
+{
+  return sFirst;
+}
+
+void BenchReport(char const* item, double value, char const* unit)
+{
+  if (sCsv) {
+    printf("%s,%s,%.2f,%s\n", sCurr->getName().c_str(), item, value, unit);
+  } else {
+    printf("%s.%s: %.2f %s\n", sCurr->getName().c_str(), item, value, unit);
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+  SW2_TRACE_RESET_TARGET();             // Disable trace output to make clean bench msg.
+
+  int arg = 1;
+  if (arg < argc && 0 == ::strcmp("-csv", argv[arg])) {
+    sCsv = true;
+    arg += 1;
+    printf("name,item,value,unit\n");
+  }
+
+  char const* filter = arg < argc ? argv[arg] : "";
+
+  for (sCurr = Bench::getFirst(); sCurr; sCurr = sCurr->mNext) {
+    if (std::string::npos != sCurr->getName().find(filter)) {
+      sCurr->run();
+    }
+  }
+
+  return 0;
+}
+
+// end of main.cpp